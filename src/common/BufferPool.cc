@@ -0,0 +1,183 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "common/BufferPool.h"
+#include "common/ceph_context.h"
+#include "common/perf_counters.h"
+
+enum {
+  l_bufpool_first = 86000,
+  l_bufpool_hit,          // buffers made from cached memory
+  l_bufpool_miss,         // buffers that needed new memory
+  l_bufpool_trim,         // released buffers freed, the cache being full
+  l_bufpool_cached,       // buffers' worth of memory cached
+  l_bufpool_cached_bytes,
+  l_bufpool_in_use_bytes, // memory of live pooled buffers
+  l_bufpool_last,
+};
+
+BufferPool::BufferPool(CephContext *cct, const std::string &name,
+		       unsigned max_buffer, uint64_t max_bytes)
+  : cct(cct), name(name), logger(NULL), nref(1),
+    lock("BufferPool::lock"),
+    max_buffer(max_buffer), max_bytes(max_bytes),
+    num_cached(0), cached_bytes(0), in_use_bytes(0)
+{
+  if (max_buffer < CEPH_PAGE_SIZE || max_bytes == 0)
+    this->max_buffer = 0;
+  else
+    free_bufs.resize(size_class(max_buffer) + 1);
+
+  PerfCountersBuilder b(cct, std::string("bufpool-") + name,
+			l_bufpool_first, l_bufpool_last);
+  b.add_u64_counter(l_bufpool_hit, "hit");
+  b.add_u64_counter(l_bufpool_miss, "miss");
+  b.add_u64_counter(l_bufpool_trim, "trim");
+  b.add_u64(l_bufpool_cached, "cached");
+  b.add_u64(l_bufpool_cached_bytes, "cached_bytes");
+  b.add_u64(l_bufpool_in_use_bytes, "in_use_bytes");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+}
+
+BufferPool::~BufferPool()
+{
+  assert(!logger);
+  assert(in_use_bytes == 0);
+}
+
+unsigned BufferPool::size_class(unsigned len) const
+{
+  unsigned c = 0;
+  uint64_t size = CEPH_PAGE_SIZE;
+  while (size < len) {
+    size <<= 1;
+    ++c;
+  }
+  return c;
+}
+
+void BufferPool::update_gauges()
+{
+  assert(lock.is_locked());
+  if (!logger)
+    return;
+  logger->set(l_bufpool_cached_bytes, cached_bytes);
+  logger->set(l_bufpool_in_use_bytes, in_use_bytes);
+  logger->set(l_bufpool_cached, num_cached);
+}
+
+bufferptr BufferPool::create(unsigned len)
+{
+  if (len < CEPH_PAGE_SIZE)
+    return buffer::create(len);
+  return buffer::create_pooled(this, len);
+}
+
+void BufferPool::shutdown()
+{
+  std::vector<char*> ls;
+  lock.Lock();
+  for (unsigned c = 0; c < free_bufs.size(); ++c) {
+    ls.insert(ls.end(), free_bufs[c].begin(), free_bufs[c].end());
+    free_bufs[c].clear();
+  }
+  num_cached = 0;
+  cached_bytes = 0;
+  max_bytes = 0;
+  max_buffer = 0;
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+    logger = NULL;
+  }
+  lock.Unlock();
+
+  for (std::vector<char*>::iterator p = ls.begin(); p != ls.end(); ++p)
+    ::free(*p);
+}
+
+char *BufferPool::alloc(unsigned len)
+{
+  unsigned c;
+  uint64_t size;
+  {
+    Mutex::Locker l(lock);
+    if (len == 0 || len > max_buffer)
+      return NULL;
+    c = size_class(len);
+    size = CEPH_PAGE_SIZE << c;
+    in_use_bytes += size;
+    if (!free_bufs[c].empty()) {
+      char *data = free_bufs[c].back();
+      free_bufs[c].pop_back();
+      --num_cached;
+      cached_bytes -= size;
+      logger->inc(l_bufpool_hit);
+      update_gauges();
+      return data;
+    }
+    logger->inc(l_bufpool_miss);
+    update_gauges();
+  }
+
+  char *data = NULL;
+#ifdef DARWIN
+  data = (char *)valloc(size);
+#else
+  if (::posix_memalign((void**)(void*)&data, CEPH_PAGE_SIZE, size))
+    data = NULL;
+#endif
+  if (!data) {
+    Mutex::Locker l(lock);
+    in_use_bytes -= size;
+    update_gauges();
+    throw buffer::bad_alloc();
+  }
+  return data;
+}
+
+void BufferPool::release(char *data, unsigned len)
+{
+  unsigned c = size_class(len);
+  uint64_t size = CEPH_PAGE_SIZE << c;
+  {
+    Mutex::Locker l(lock);
+    in_use_bytes -= size;
+    if (c < free_bufs.size() && cached_bytes + size <= max_bytes) {
+      free_bufs[c].push_back(data);
+      ++num_cached;
+      cached_bytes += size;
+      update_gauges();
+      return;
+    }
+    if (logger)
+      logger->inc(l_bufpool_trim);
+    update_gauges();
+  }
+  ::free(data);
+}
+
+void BufferPool::get()
+{
+  nref.inc();
+}
+
+void BufferPool::put()
+{
+  if (nref.dec() == 0)
+    delete this;
+}
@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_BUFFERPOOL_H
+#define CEPH_BUFFERPOOL_H
+
+#include <string>
+#include <vector>
+
+#include "include/atomic.h"
+#include "include/buffer.h"
+#include "common/Mutex.h"
+
+class CephContext;
+class PerfCounters;
+
+/**
+ * BufferPool - recycle the memory of page-aligned buffers
+ *
+ * Buffers of a page or more, up to max_buffer bytes, are rounded up to a
+ * power-of-two number of pages, and their memory goes back to the pool
+ * when their last ref goes away.  The pool keeps up to max_bytes of it
+ * for the next buffer of the same size class, instead of a
+ * posix_memalign() and free() per buffer.  Anything else is allocated
+ * as usual.
+ *
+ * Buffers may outlive their creator, so the pool is refcounted: its
+ * owner calls shutdown() and then put(), and the pool goes away once the
+ * last of its buffers does.
+ */
+class BufferPool : public buffer::raw_pool {
+  CephContext *cct;
+  std::string name;
+  PerfCounters *logger;  ///< NULL once shut down
+  atomic_t nref;
+
+  Mutex lock;
+  unsigned max_buffer;   ///< largest buffer we pool; 0 once shut down
+  uint64_t max_bytes;    ///< most memory we keep around for reuse
+  uint64_t num_cached, cached_bytes, in_use_bytes;
+  std::vector<std::vector<char*> > free_bufs;  ///< by size class
+
+  unsigned size_class(unsigned len) const;
+  void update_gauges();
+
+  ~BufferPool();
+
+public:
+  BufferPool(CephContext *cct, const std::string &name,
+	     unsigned max_buffer, uint64_t max_bytes);
+
+  /// a buffer of len bytes, page-aligned if it is a page or more
+  bufferptr create(unsigned len);
+
+  /// free the cached memory, and stop pooling and counting
+  void shutdown();
+
+  uint64_t get_cached_bytes() {
+    Mutex::Locker l(lock);
+    return cached_bytes;
+  }
+  uint64_t get_in_use_bytes() {
+    Mutex::Locker l(lock);
+    return in_use_bytes;
+  }
+
+  // buffer::raw_pool
+  char *alloc(unsigned len);
+  void release(char *data, unsigned len);
+  void get();
+  void put();
+};
+
+#endif
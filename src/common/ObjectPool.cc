@@ -0,0 +1,101 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <new>
+
+#include "common/ObjectPool.h"
+#include "include/assert.h"
+
+/// objects moved between a thread cache and the depot at once
+static const size_t BATCH = 32;
+/// most objects the depot holds
+static const size_t MAX_DEPOT = 64 * BATCH;
+
+ObjectPool::ObjectPool(size_t size)
+  : size(size), lock(SIMPLE_SPINLOCK_INITIALIZER)
+{
+  int r = pthread_key_create(&key, cache_exit);
+  assert(r == 0);
+  depot.reserve(MAX_DEPOT);
+}
+
+ObjectPool::Cache *ObjectPool::get_cache()
+{
+  Cache *c = (Cache *)pthread_getspecific(key);
+  if (!c) {
+    c = new Cache(this);
+    c->objs.reserve(2 * BATCH + 1);
+    pthread_setspecific(key, c);
+  }
+  return c;
+}
+
+void ObjectPool::cache_exit(void *arg)
+{
+  Cache *c = (Cache *)arg;
+  c->pool->give_back(c->objs, c->objs.size());
+  delete c;
+}
+
+void ObjectPool::give_back(std::vector<void*> &v, size_t n)
+{
+  assert(n <= v.size());
+  size_t keep = 0;
+  simple_spin_lock(&lock);
+  if (depot.size() < MAX_DEPOT) {
+    keep = MAX_DEPOT - depot.size();
+    if (keep > n)
+      keep = n;
+    depot.insert(depot.end(), v.end() - keep, v.end());
+  }
+  simple_spin_unlock(&lock);
+  v.resize(v.size() - keep);
+  for (n -= keep; n > 0; --n) {
+    ::operator delete(v.back());
+    v.pop_back();
+  }
+}
+
+void *ObjectPool::alloc(size_t s)
+{
+  if (s != size)
+    return ::operator new(s);
+
+  Cache *c = get_cache();
+  if (c->objs.empty()) {
+    simple_spin_lock(&lock);
+    size_t n = depot.size() < BATCH ? depot.size() : BATCH;
+    c->objs.insert(c->objs.end(), depot.end() - n, depot.end());
+    depot.resize(depot.size() - n);
+    simple_spin_unlock(&lock);
+    if (c->objs.empty())
+      return ::operator new(s);
+  }
+  void *p = c->objs.back();
+  c->objs.pop_back();
+  return p;
+}
+
+void ObjectPool::free(void *p, size_t s)
+{
+  if (s != size) {
+    ::operator delete(p);
+    return;
+  }
+
+  Cache *c = get_cache();
+  c->objs.push_back(p);
+  if (c->objs.size() > 2 * BATCH)
+    give_back(c->objs, BATCH);
+}
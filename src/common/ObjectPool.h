@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OBJECTPOOL_H
+#define CEPH_OBJECTPOOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+
+#include "common/simple_spin.h"
+
+/**
+ * ObjectPool - recycle the memory of objects of one size
+ *
+ * Each thread keeps the objects it frees in a cache of its own, and
+ * allocates from it without taking a lock.  A thread that frees more than
+ * it allocates (e.g. the one completing ops that another started) hands
+ * them back in batches to a shared depot, where a thread that runs out
+ * picks them up again.  Beyond what the caches and the depot hold,
+ * objects go back to the heap.
+ */
+class ObjectPool {
+  struct Cache {
+    ObjectPool *pool;
+    std::vector<void*> objs;
+    Cache(ObjectPool *p) : pool(p) {}
+  };
+
+  size_t size;
+  pthread_key_t key;
+  simple_spinlock_t lock;
+  std::vector<void*> depot;
+
+  Cache *get_cache();
+  static void cache_exit(void *c);
+  /// put n objects from v into the depot, or free them if it is full
+  void give_back(std::vector<void*> &v, size_t n);
+
+public:
+  explicit ObjectPool(size_t size);
+
+  void *alloc(size_t s);
+  void free(void *p, size_t s);
+};
+
+/**
+ * Derive T from PooledObject<T> to allocate its instances from an
+ * ObjectPool.  Instances of classes derived from T, being larger, come
+ * from the heap as usual.
+ */
+template <typename T>
+class PooledObject {
+  static ObjectPool *pool() {
+    // never destroyed: objects may be freed during exit
+    static ObjectPool *p = new ObjectPool(sizeof(T));
+    return p;
+  }
+
+public:
+  static void *operator new(size_t size) {
+    return pool()->alloc(size);
+  }
+  static void operator delete(void *p, size_t size) {
+    pool()->free(p, size);
+  }
+};
+
+#endif
@@ -0,0 +1,270 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_PRIORITIZEDQUEUE_H
+#define CEPH_PRIORITIZEDQUEUE_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <utility>
+#include "include/assert.h"
+
+/**
+ * PrioritizedQueue
+ *
+ * Items are queued with a priority, a cost and a class (e.g. the client
+ * that sent them).
+ *
+ * Items queued with enqueue_strict() are dequeued before any others,
+ * highest priority first.  The remaining items share the queue by
+ * priority: each priority has a token bucket, every dequeue hands the
+ * cost of the dequeued item out to the buckets in proportion to their
+ * priority, and an item is only dequeued ahead of a higher priority once
+ * its bucket holds its cost.  A low priority therefore gets a share of
+ * the queue instead of waiting until the higher ones are empty.
+ *
+ * Within a priority, the classes are served round robin, so one class
+ * with many items queued cannot starve the others.  Items of a class at
+ * a given priority are dequeued in the order they were queued.
+ */
+template <typename T, typename K>
+class PrioritizedQueue {
+  typedef std::list<std::pair<unsigned, T> > ListPairs;
+
+  class SubQueue {
+    typedef std::map<K, ListPairs> Classes;
+    Classes q;
+    typename Classes::iterator cur;  ///< next class to serve
+    unsigned tokens, max_tokens;
+    unsigned size;
+
+  public:
+    SubQueue() : cur(q.end()), tokens(0), max_tokens(0), size(0) {}
+    // only ever copied empty, when inserted into the map
+    SubQueue(const SubQueue &o)
+      : q(o.q), cur(q.begin()), tokens(o.tokens), max_tokens(o.max_tokens),
+	size(o.size) {}
+
+    void set_max_tokens(unsigned m) {
+      max_tokens = m;
+    }
+    unsigned num_tokens() const {
+      return tokens;
+    }
+    void put_tokens(unsigned t) {
+      tokens += t;
+      if (tokens > max_tokens)
+	tokens = max_tokens;
+    }
+    void take_tokens(unsigned t) {
+      tokens = tokens > t ? tokens - t : 0;
+    }
+
+    void enqueue(K cl, unsigned cost, T item) {
+      q[cl].push_back(std::make_pair(cost, item));
+      if (cur == q.end())
+	cur = q.begin();
+      ++size;
+    }
+    void enqueue_front(K cl, unsigned cost, T item) {
+      q[cl].push_front(std::make_pair(cost, item));
+      if (cur == q.end())
+	cur = q.begin();
+      ++size;
+    }
+    const std::pair<unsigned, T> &front() const {
+      assert(cur != q.end());
+      return cur->second.front();
+    }
+    void pop_front() {
+      assert(cur != q.end());
+      cur->second.pop_front();
+      if (cur->second.empty())
+	q.erase(cur++);
+      else
+	++cur;
+      if (cur == q.end())
+	cur = q.begin();
+      --size;
+    }
+    unsigned length() const {
+      return size;
+    }
+    bool empty() const {
+      return q.empty();
+    }
+
+    template <class F>
+    void remove_by_filter(F f, std::list<T> *removed) {
+      bool have_cur = cur != q.end();
+      K cur_key = have_cur ? cur->first : K();
+      for (typename Classes::iterator i = q.begin(); i != q.end(); ) {
+	for (typename ListPairs::iterator j = i->second.begin();
+	     j != i->second.end(); ) {
+	  if (f(j->second)) {
+	    if (removed)
+	      removed->push_back(j->second);
+	    i->second.erase(j++);
+	    --size;
+	  } else {
+	    ++j;
+	  }
+	}
+	if (i->second.empty())
+	  q.erase(i++);
+	else
+	  ++i;
+      }
+      // carry on with the same class, or the one after it if it is gone
+      cur = have_cur ? q.lower_bound(cur_key) : q.end();
+      if (cur == q.end())
+	cur = q.begin();
+    }
+  };
+
+  typedef std::map<unsigned, SubQueue> SubQueues;
+  SubQueues high_queue;  ///< strict priority
+  SubQueues queue;       ///< token buckets
+  unsigned max_tokens_per_subqueue;
+  uint64_t total_priority;  ///< sum of the priorities in queue
+
+  SubQueue *create_queue(unsigned priority) {
+    typename SubQueues::iterator p = queue.find(priority);
+    if (p != queue.end())
+      return &p->second;
+    total_priority += priority;
+    SubQueue *sq = &queue[priority];
+    sq->set_max_tokens(max_tokens_per_subqueue);
+    return sq;
+  }
+  void remove_queue(unsigned priority) {
+    assert(queue.count(priority));
+    queue.erase(priority);
+    total_priority -= priority;
+  }
+
+  /// hand out cost tokens to the buckets, weighted by priority
+  void distribute_tokens(unsigned cost) {
+    if (total_priority == 0)
+      return;
+    for (typename SubQueues::iterator p = queue.begin();
+	 p != queue.end();
+	 ++p)
+      p->second.put_tokens(((uint64_t)cost * p->first) / total_priority + 1);
+  }
+
+  unsigned clamp_cost(unsigned cost) const {
+    if (cost < 1)
+      return 1;
+    if (cost > max_tokens_per_subqueue)
+      return max_tokens_per_subqueue;
+    return cost;
+  }
+
+  template <class F>
+  static void filter_queues(SubQueues &qs, F f, std::list<T> *removed,
+			       std::list<unsigned> *emptied) {
+    for (typename SubQueues::iterator p = qs.begin(); p != qs.end(); ++p) {
+      p->second.remove_by_filter(f, removed);
+      if (p->second.empty())
+	emptied->push_back(p->first);
+    }
+  }
+
+public:
+  PrioritizedQueue(unsigned max_per)
+    : max_tokens_per_subqueue(max_per), total_priority(0) {}
+
+  unsigned length() const {
+    unsigned total = 0;
+    for (typename SubQueues::const_iterator p = high_queue.begin();
+	 p != high_queue.end();
+	 ++p)
+      total += p->second.length();
+    for (typename SubQueues::const_iterator p = queue.begin();
+	 p != queue.end();
+	 ++p)
+      total += p->second.length();
+    return total;
+  }
+  bool empty() const {
+    return high_queue.empty() && queue.empty();
+  }
+
+  void enqueue_strict(K cl, unsigned priority, T item) {
+    high_queue[priority].enqueue(cl, 0, item);
+  }
+  void enqueue_strict_front(K cl, unsigned priority, T item) {
+    high_queue[priority].enqueue_front(cl, 0, item);
+  }
+  void enqueue(K cl, unsigned priority, unsigned cost, T item) {
+    create_queue(priority)->enqueue(cl, clamp_cost(cost), item);
+  }
+  void enqueue_front(K cl, unsigned priority, unsigned cost, T item) {
+    create_queue(priority)->enqueue_front(cl, clamp_cost(cost), item);
+  }
+
+  T dequeue() {
+    assert(!empty());
+
+    if (!high_queue.empty()) {
+      typename SubQueues::iterator p = --high_queue.end();
+      T ret = p->second.front().second;
+      p->second.pop_front();
+      if (p->second.empty())
+	high_queue.erase(p);
+      return ret;
+    }
+
+    // the highest priority whose bucket can pay for its next item; if
+    // none can, the highest priority
+    typename SubQueues::iterator p = --queue.end();
+    for (typename SubQueues::reverse_iterator r = queue.rbegin();
+	 r != queue.rend();
+	 ++r) {
+      if (r->second.front().first <= r->second.num_tokens()) {
+	p = --r.base();
+	break;
+      }
+    }
+    unsigned cost = p->second.front().first;
+    T ret = p->second.front().second;
+    p->second.take_tokens(cost);
+    p->second.pop_front();
+    if (p->second.empty())
+      remove_queue(p->first);
+    distribute_tokens(cost);
+    return ret;
+  }
+
+  /// remove every item for which f returns true, in no particular order
+  template <class F>
+  void remove_by_filter(F f, std::list<T> *removed = 0) {
+    std::list<unsigned> emptied;
+    filter_queues(high_queue, f, removed, &emptied);
+    for (std::list<unsigned>::iterator i = emptied.begin();
+	 i != emptied.end();
+	 ++i)
+      high_queue.erase(*i);
+    emptied.clear();
+    filter_queues(queue, f, removed, &emptied);
+    for (std::list<unsigned>::iterator i = emptied.begin();
+	 i != emptied.end();
+	 ++i)
+      remove_queue(*i);
+  }
+};
+
+#endif
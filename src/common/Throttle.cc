@@ -180,3 +180,23 @@ int64_t Throttle::put(int64_t c)
   }
   return count;
 }
+
+void TokenBucket::take(utime_t now, uint64_t rate, uint64_t c)
+{
+  if (!rate || !c)
+    return;
+  Mutex::Locker l(lock);
+  utime_t earliest = now;
+  earliest -= burst;
+  if (paid_until < earliest)
+    paid_until = earliest;
+  paid_until += (double)c / (double)rate;
+}
+
+utime_t TokenBucket::get_wait(utime_t now)
+{
+  Mutex::Locker l(lock);
+  if (paid_until <= now)
+    return utime_t();
+  return paid_until - now;
+}
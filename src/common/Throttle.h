@@ -3,6 +3,7 @@
 
 #include "Mutex.h"
 #include "Cond.h"
+#include "include/utime.h"
 #include <list>
 
 class CephContext;
@@ -52,5 +53,30 @@ public:
   int64_t put(int64_t c = 1);
 };
 
+/**
+ * TokenBucket - limit the rate of something, e.g. bytes per second
+ *
+ * Callers take() what they use, even more than the bucket holds, which
+ * puts it in debt; get_wait() is the time until the debt is paid back
+ * at the rate.  An idle bucket saves up at most burst seconds of credit.
+ *
+ * The rate is given to take() so that it can follow a config option; a
+ * rate of 0 is no limit.
+ */
+class TokenBucket {
+  Mutex lock;
+  double burst;
+  utime_t paid_until;  ///< when everything taken so far is paid for
+
+public:
+  TokenBucket(const char *name, double b = 0) : lock(name), burst(b) {}
+
+  void take(utime_t now, uint64_t rate, uint64_t c);
+  utime_t get_wait(utime_t now);
+  bool ready(utime_t now) {
+    return get_wait(now) == utime_t();
+  }
+};
+
 
 #endif
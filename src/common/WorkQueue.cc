@@ -144,3 +144,140 @@ void ThreadPool::drain(WorkQueue_* wq)
   _lock.Unlock();
 }
 
+
+
+ShardedThreadPool::ShardedThreadPool(CephContext *cct_, string nm,
+				     uint32_t num_shards,
+				     uint32_t threads_per_shard,
+				     time_t ti, time_t sti)
+  : cct(cct_), name(nm), timeout_interval(ti), suicide_interval(sti)
+{
+  assert(num_shards > 0);
+  assert(threads_per_shard > 0);
+  for (uint32_t i = 0; i < num_shards; ++i) {
+    std::stringstream ss;
+    ss << name << "::shard " << i << "::lock";
+    shards.push_back(new Shard(ss.str()));
+    for (uint32_t j = 0; j < threads_per_shard; ++j)
+      threads.push_back(new WorkThread(this, i));
+  }
+}
+
+ShardedThreadPool::~ShardedThreadPool()
+{
+  for (unsigned i = 0; i < threads.size(); ++i)
+    delete threads[i];
+  for (unsigned i = 0; i < shards.size(); ++i)
+    delete shards[i];
+}
+
+void ShardedThreadPool::worker(uint32_t i)
+{
+  Shard *s = shards[i];
+  s->lock.Lock();
+  ldout(cct,10) << "worker start on shard " << i << dendl;
+
+  std::stringstream ss;
+  ss << name << " shard " << i << " thread " << (void*)pthread_self();
+  heartbeat_handle_d *hb = cct->get_heartbeat_map()->add_worker(ss.str());
+
+  while (!s->stop) {
+    if (!s->pause) {
+      void *item = _void_dequeue(i);
+      if (item) {
+	s->processing++;
+	ldout(cct,12) << "worker shard " << i << " start processing " << item << dendl;
+	s->lock.Unlock();
+	cct->get_heartbeat_map()->reset_timeout(hb, timeout_interval, suicide_interval);
+	_void_process(item);
+	s->lock.Lock();
+	ldout(cct,15) << "worker shard " << i << " done processing " << item << dendl;
+	s->processing--;
+	if (s->pause || s->draining)
+	  s->wait_cond.SignalAll();
+	continue;
+      }
+    }
+
+    ldout(cct,15) << "worker shard " << i << " waiting" << dendl;
+    cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
+    s->cond.WaitInterval(cct, s->lock, utime_t(2, 0));
+  }
+  ldout(cct,1) << "worker shard " << i << " finish" << dendl;
+
+  cct->get_heartbeat_map()->remove_worker(hb);
+
+  s->lock.Unlock();
+}
+
+void ShardedThreadPool::start()
+{
+  ldout(cct,10) << "start" << dendl;
+  for (unsigned i = 0; i < threads.size(); ++i)
+    threads[i]->create();
+  ldout(cct,15) << "started" << dendl;
+}
+
+void ShardedThreadPool::stop()
+{
+  ldout(cct,10) << "stop" << dendl;
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    Mutex::Locker l(shards[i]->lock);
+    shards[i]->stop = true;
+    shards[i]->cond.SignalAll();
+  }
+  for (unsigned i = 0; i < threads.size(); ++i)
+    threads[i]->join();
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    Mutex::Locker l(shards[i]->lock);
+    _clear(i);
+  }
+  ldout(cct,15) << "stopped" << dendl;
+}
+
+void ShardedThreadPool::pause()
+{
+  ldout(cct,10) << "pause" << dendl;
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    s->pause++;
+    while (s->processing)
+      s->wait_cond.Wait(s->lock);
+  }
+  ldout(cct,15) << "paused" << dendl;
+}
+
+void ShardedThreadPool::pause_new()
+{
+  ldout(cct,10) << "pause_new" << dendl;
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    Mutex::Locker l(shards[i]->lock);
+    shards[i]->pause++;
+  }
+}
+
+void ShardedThreadPool::unpause()
+{
+  ldout(cct,10) << "unpause" << dendl;
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    assert(s->pause > 0);
+    s->pause--;
+    s->cond.SignalAll();
+  }
+}
+
+void ShardedThreadPool::drain()
+{
+  ldout(cct,10) << "drain" << dendl;
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    s->draining++;
+    while (s->processing || !_empty(i))
+      s->wait_cond.Wait(s->lock);
+    s->draining--;
+  }
+}
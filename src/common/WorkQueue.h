@@ -284,6 +284,138 @@ public:
   void drain(WorkQueue_* wq = 0);
 };
 
+/**
+ * ShardedThreadPool
+ *
+ * A thread pool split into shards.  Each shard has its own lock, its
+ * own queue and its own threads, which only ever take work from that
+ * shard.  Queueing or processing an item takes only the lock of the
+ * shard it belongs to, so work for unrelated shards never contends on
+ * a pool-wide lock.  The queues themselves are kept by the subclass;
+ * see ShardedWorkQueue.
+ */
+class ShardedThreadPool {
+  CephContext *cct;
+  string name;
+  time_t timeout_interval, suicide_interval;
+
+  struct Shard {
+    string lockname;
+    Mutex lock;
+    Cond cond;       ///< wakes this shard's threads
+    Cond wait_cond;  ///< wakes pause()/drain() waiters
+    bool stop;
+    int pause;
+    int draining;
+    int processing;
+    Shard(const string &n)
+      : lockname(n), lock(lockname.c_str()),
+	stop(false), pause(0), draining(0), processing(0) {}
+  };
+  vector<Shard*> shards;
+
+  struct WorkThread : public Thread {
+    ShardedThreadPool *pool;
+    uint32_t shard;
+    WorkThread(ShardedThreadPool *p, uint32_t s) : pool(p), shard(s) {}
+    void *entry() {
+      pool->worker(shard);
+      return 0;
+    }
+  };
+  vector<WorkThread*> threads;
+
+  void worker(uint32_t shard);
+
+protected:
+  /// the following are called with the shard's lock held
+  virtual void *_void_dequeue(uint32_t shard) = 0;
+  virtual bool _empty(uint32_t shard) = 0;
+  virtual void _clear(uint32_t shard) = 0;
+  /// called without the shard's lock; worker() drops it around this
+  virtual void _void_process(void *item) = 0;
+
+  void lock_shard(uint32_t shard) {
+    shards[shard]->lock.Lock();
+  }
+  void unlock_shard(uint32_t shard) {
+    shards[shard]->lock.Unlock();
+  }
+  /// wake up one of the shard's threads (with the shard lock held)
+  void _wake_shard(uint32_t shard) {
+    shards[shard]->cond.SignalOne();
+  }
+
+public:
+  ShardedThreadPool(CephContext *cct_, string nm, uint32_t num_shards,
+		    uint32_t threads_per_shard, time_t ti, time_t sti);
+  virtual ~ShardedThreadPool();
+
+  uint32_t get_num_shards() const {
+    return shards.size();
+  }
+
+  /// start the threads of every shard
+  void start();
+  /// stop the threads and clear the queues
+  void stop();
+  /// pause every shard and wait for items in progress to finish
+  void pause();
+  /// pause initiation of new work
+  void pause_new();
+  /// resume work.  must match each pause() call 1:1 to resume.
+  void unpause();
+  /// wait until every shard is empty and idle
+  void drain();
+};
+
+/**
+ * ShardedWorkQueue
+ *
+ * A ShardedThreadPool holding items of type T.  Each item is mapped to
+ * a shard by _shard_of(), which must return the same value for as long
+ * as the item is queued, so that an item is only ever processed by the
+ * threads of one shard.
+ */
+template<class T>
+class ShardedWorkQueue : public ShardedThreadPool {
+  virtual uint32_t _shard_of(T *item) = 0;
+  virtual void _enqueue(uint32_t shard, T *item) = 0;
+  virtual void _dequeue(uint32_t shard, T *item) = 0;
+  virtual T *_dequeue(uint32_t shard) = 0;
+  virtual void _process(T *item) = 0;
+
+  void *_void_dequeue(uint32_t shard) {
+    return (void *)_dequeue(shard);
+  }
+  void _void_process(void *p) {
+    _process((T *)p);
+  }
+
+  uint32_t get_shard(T *item) {
+    return _shard_of(item) % get_num_shards();
+  }
+
+public:
+  ShardedWorkQueue(CephContext *cct_, string n, uint32_t num_shards,
+		   uint32_t threads_per_shard, time_t ti, time_t sti)
+    : ShardedThreadPool(cct_, n, num_shards, threads_per_shard, ti, sti) {}
+
+  void queue(T *item) {
+    uint32_t shard = get_shard(item);
+    lock_shard(shard);
+    _enqueue(shard, item);
+    _wake_shard(shard);
+    unlock_shard(shard);
+  }
+  void dequeue(T *item) {
+    uint32_t shard = get_shard(item);
+    lock_shard(shard);
+    _dequeue(shard, item);
+    unlock_shard(shard);
+  }
+};
+
 
 
 #endif
@@ -222,6 +222,25 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     }
   };
 
+  class buffer::raw_pooled : public buffer::raw {
+    raw_pool *pool;
+  public:
+    raw_pooled(raw_pool *p, char *d, unsigned l) : raw(d, l), pool(p) {
+      pool->get();
+      inc_total_alloc(len);
+      bdout << "raw_pooled " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
+    }
+    ~raw_pooled() {
+      pool->release(data, len);
+      pool->put();
+      dec_total_alloc(len);
+      bdout << "raw_pooled " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+    }
+    raw* clone_empty() {
+      return create_page_aligned(len);
+    }
+  };
+
   buffer::raw* buffer::copy(const char *c, unsigned len) {
     raw* r = new raw_char(len);
     memcpy(r->data, c, len);
@@ -251,6 +270,13 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 #endif
   }
 
+  buffer::raw* buffer::create_pooled(raw_pool *pool, unsigned len) {
+    char *d = pool->alloc(len);
+    if (!d)
+      return create_page_aligned(len);
+    return new raw_pooled(pool, d, len);
+  }
+
   buffer::ptr::ptr(raw *r) : _raw(r), _off(0), _len(r->len)   // no lock needed; this is an unref raw.
   {
     r->nref.inc();
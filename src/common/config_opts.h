@@ -24,6 +24,7 @@ OPTION(monmap, OPT_STR, "")
 OPTION(mon_host, OPT_STR, "")
 OPTION(lockdep, OPT_BOOL, false)
 OPTION(admin_socket, OPT_STR, "/var/run/ceph/$cluster-$name.asok")
+OPTION(perf_counters_shards, OPT_INT, 8)  // copies of each perf counter, to spread threads' updates over
 
 OPTION(daemonize, OPT_BOOL, false)
 OPTION(pid_file, OPT_STR, "")
@@ -99,6 +100,19 @@ OPTION(ms_bind_ipv6, OPT_BOOL, false)
 OPTION(ms_rwthread_stack_bytes, OPT_U64, 1024 << 10)
 OPTION(ms_tcp_read_timeout, OPT_U64, 900)
 OPTION(ms_inject_socket_failures, OPT_U64, 0)
+OPTION(ms_tcp_prefetch_max_size, OPT_INT, 4096) // bytes a small socket read takes ahead of need, to save syscalls; 0 to disable
+OPTION(ms_tcp_coalesce_bytes, OPT_INT, 512)   // copy message segments smaller than this together before sending them; 0 to disable
+OPTION(ms_tcp_zerocopy, OPT_BOOL, false)      // send large page-aligned segments with MSG_ZEROCOPY, where the kernel supports it
+OPTION(ms_tcp_zerocopy_bytes, OPT_INT, 65536) // smallest segment worth sending with MSG_ZEROCOPY
+OPTION(ms_rx_pool_bytes, OPT_U64, 16 << 20)     // memory of received message buffers each messenger keeps for reuse; 0 to disable
+OPTION(ms_rx_pool_max_buffer, OPT_U64, 4 << 20) // largest received buffer whose memory is reused
+OPTION(ms_type, OPT_STR, "simple")   // simple or event
+OPTION(ms_event_loops, OPT_INT, 1)      // epoll threads, for ms_type = event
+OPTION(ms_event_read_workers, OPT_INT, 4)       // reader worker threads, for ms_type = event
+OPTION(ms_event_write_workers, OPT_INT, 4)      // writer worker threads, for ms_type = event
+OPTION(ms_event_handshake_workers, OPT_INT, 2)  // accept threads, and as many connect threads, for ms_type = event
+OPTION(ms_event_throttle_workers, OPT_INT, 2)   // threads waiting on message throttles, for ms_type = event
+OPTION(ms_event_batch, OPT_INT, 16)     // messages a pipe reads or writes before yielding its worker
 OPTION(mon_data, OPT_STR, "/var/lib/ceph/mon/$cluster-$id")
 OPTION(mon_initial_members, OPT_STR, "")    // list of initial cluster mon ids; if specified, need majority to form initial quorum and create new cluster
 OPTION(mon_sync_fs_threshold, OPT_INT, 5)   // sync() when writing this many objects; 0 to disable.
@@ -283,13 +297,27 @@ OPTION(osd_pool_default_pg_num, OPT_INT, 8)
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_cache_size, OPT_INT, 500)
+OPTION(osd_map_cache_shards, OPT_INT, 8)   // number of independently locked osdmap cache stripes
 OPTION(osd_map_cache_bl_size, OPT_INT, 50)
 OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
+OPTION(osd_map_max_advance, OPT_INT, 200) // max epochs a pg advances before yielding its peering thread
+OPTION(osd_peering_wq_batch_size, OPT_U64, 20) // pgs taken by a peering thread at once
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_op_num_shards, OPT_INT, 5)  // client op queue shards, each with its own lock
+OPTION(osd_op_num_threads_per_shard, OPT_INT, 2)
+OPTION(osd_op_fast_dispatch, OPT_BOOL, true)  // queue client ops without osd_lock when possible
+OPTION(osd_op_pq_max_tokens_per_priority, OPT_U64, 4194304)
+OPTION(osd_op_pq_cost_overhead, OPT_U64, 65536)   // op queue cost of an op, on top of its bytes
+OPTION(osd_op_pq_strict_cutoff, OPT_INT, 196)     // ops at or above this priority (CEPH_MSG_PRIO_HIGH) skip the fair queue
+OPTION(osd_recovery_op_priority, OPT_INT, 10)     // message priority for recovery and backfill
+OPTION(osd_subop_batch_max, OPT_INT, 16)          // most replicated writes or replies sent to an osd in one message; <= 1 disables batching
+OPTION(osd_subop_batch_max_bytes, OPT_U64, 1<<20) // send a batch once it carries this much data
+OPTION(osd_subop_batch_window, OPT_DOUBLE, .001)  // longest a replicated write or reply waits for others to batch with
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
+OPTION(osd_recovery_delta, OPT_BOOL, true)   // push only the extents a replica's stale copy is missing
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
 OPTION(osd_op_thread_timeout, OPT_INT, 30)
@@ -316,7 +344,11 @@ OPTION(osd_preserve_trimmed_log, OPT_BOOL, false)
 OPTION(osd_auto_mark_unfound_lost, OPT_BOOL, false)
 OPTION(osd_recovery_delay_start, OPT_FLOAT, 15)
 OPTION(osd_recovery_max_active, OPT_INT, 5)
+OPTION(osd_recovery_read_nocache, OPT_BOOL, true) // keep recovery reads out of the page cache
 OPTION(osd_recovery_max_chunk, OPT_U64, 1<<20)  // max size of push chunk
+OPTION(osd_recovery_bytes_per_sec, OPT_U64, 0)  // limit on recovery push data per osd; 0 for none
+OPTION(osd_max_backfills, OPT_INT, 10)  // max pgs backfilling from, and to, an osd
+OPTION(osd_backfill_retry_interval, OPT_DOUBLE, 10.0)  // seconds before retrying a refused backfill reservation
 OPTION(osd_recovery_forget_lost_objects, OPT_BOOL, false)   // off for now
 OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
@@ -324,6 +356,10 @@ OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
 OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
 OPTION(osd_deep_scrub_stride, OPT_INT, 524288)
+OPTION(osd_scrub_chunk_min, OPT_INT, 5)     // min objects per chunky scrub chunk
+OPTION(osd_scrub_chunk_max, OPT_INT, 25)    // max objects per chunky scrub chunk
+OPTION(osd_scrub_prefetch, OPT_BOOL, true)  // build the next chunk's map while waiting for replicas
+OPTION(osd_scrub_bytes_per_sec, OPT_U64, 0) // limit on scrub reads per osd; 0 for none
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_dir, OPT_STR, CEPH_LIBDIR "/rados-classes") // where rados plugins are stored
 OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
@@ -332,6 +368,8 @@ OPTION(osd_rollback_to_cluster_snap, OPT_STR, "")
 OPTION(osd_default_notify_timeout, OPT_U32, 30) // default notify timeout in seconds
 OPTION(osd_kill_backfill_at, OPT_INT, 0)
 OPTION(osd_min_pg_log_entries, OPT_U32, 1000) // number of entries to keep in the pg log when trimming it
+OPTION(osd_pg_log_omap, OPT_BOOL, true) // store pg log entries as omap keys, not a byte log
+OPTION(osd_pg_log_max_extents, OPT_INT, 16) // most modified extents a pg log entry records
 OPTION(osd_op_complaint_time, OPT_FLOAT, 30) // how many seconds old makes an op complaint-worthy
 OPTION(osd_command_max_records, OPT_INT, 256)
 OPTION(osd_op_log_threshold, OPT_INT, 5) // how many op log messages to show in one go
@@ -343,6 +381,7 @@ OPTION(osd_debug_drop_pg_create_duration, OPT_INT, 1)
 OPTION(osd_op_history_size, OPT_U32, 20)    // Max number of completed ops to track
 OPTION(osd_op_history_duration, OPT_U32, 600) // Oldest completed op to track
 OPTION(osd_target_transaction_size, OPT_INT, 300)     // to adjust various transactions that batch smaller items
+OPTION(osd_compact_omap_on_pg_removal, OPT_BOOL, false) // compact the omap key range freed by a deleted pg
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
 // Use omap for xattrs for attrs over
@@ -351,6 +390,13 @@ OPTION(filestore_xattr_use_omap, OPT_BOOL, false)
 OPTION(filestore_max_inline_xattr_size, OPT_U32, 512)
 // for more than filestore_max_inline_xattrs attrs
 OPTION(filestore_max_inline_xattrs, OPT_U32, 2)
+// pack all of an object's attrs into a single xattr; values over
+// filestore_max_inline_xattr_size, or that do not fit in
+// filestore_max_packed_xattr_size, go to omap
+OPTION(filestore_xattr_pack, OPT_BOOL, false)
+OPTION(filestore_max_packed_xattr_size, OPT_U32, 1536)
+// on mount, rewrite every object's attrs in the layout selected above
+OPTION(filestore_xattr_pack_convert, OPT_BOOL, false)
 
 OPTION(filestore_max_sync_interval, OPT_DOUBLE, 5)    // seconds
 OPTION(filestore_min_sync_interval, OPT_DOUBLE, .01)  // seconds
@@ -376,13 +422,31 @@ OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_split_threads, OPT_INT, 1)  // threads finishing directory splits in the background; 0 = split inline
+OPTION(filestore_index_presplit_levels, OPT_INT, 0) // directory levels to create when a collection is created
+OPTION(filestore_debug_hold_splits, OPT_BOOL, false) // testing: leave a background split pending after each step
+OPTION(filestore_index_list_cache_size, OPT_INT, 128) // collection subdirectory listings to keep cached; 0 = off
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_dump_file, OPT_STR, "")         // file onto which store transaction dumps
 OPTION(filestore_kill_at, OPT_INT, 0)            // inject a failure at the n'th opportunity
 OPTION(filestore_fail_eio, OPT_BOOL, true)       // fail/crash on EIO
+OPTION(filestore_fd_cache_size, OPT_INT, 128)    // max open object fds to keep cached
+OPTION(filestore_fd_cache_shards, OPT_INT, 16)   // number of independently locked fd cache shards
+OPTION(filestore_omap_batch, OPT_BOOL, true)     // submit omap updates from one transaction batch together
+OPTION(filestore_omap_header_cache_size, OPT_INT, 1024) // object map headers to keep cached
+OPTION(filestore_readahead_size, OPT_INT, 1 << 20) // readahead window for sequential object reads; 0 = off
+OPTION(leveldb_write_buffer_size, OPT_U64, 0) // leveldb write buffer size; 0 = leveldb default
+OPTION(leveldb_cache_size, OPT_U64, 32 << 20) // leveldb shared block cache size; 0 = leveldb default
+OPTION(leveldb_block_size, OPT_U64, 0)        // leveldb block size; 0 = leveldb default
+OPTION(leveldb_bloom_size, OPT_INT, 10)       // leveldb bloom filter bits per key; 0 = no bloom filter
+OPTION(leveldb_max_open_files, OPT_INT, 0)    // leveldb max open files; 0 = leveldb default
+OPTION(leveldb_compression, OPT_BOOL, true)   // leveldb uses compression
+OPTION(leveldb_paranoid, OPT_BOOL, false)     // leveldb paranoid flag
+OPTION(leveldb_log, OPT_STR, "")              // enable leveldb's own log to this file
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, false)
+OPTION(journal_aio_max_in_flight, OPT_INT, 0)  // keep up to this many aios in flight; 0 = adaptive
 OPTION(journal_block_align, OPT_BOOL, true)
 OPTION(journal_max_write_bytes, OPT_INT, 10 << 20)
 OPTION(journal_max_write_entries, OPT_INT, 100)
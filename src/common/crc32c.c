@@ -0,0 +1,30 @@
+#include "include/crc32c.h"
+
+/*
+ * choose best implementation based on the CPU architecture.
+ */
+ceph_crc32c_func_t ceph_choose_crc32(void)
+{
+	if (ceph_crc32c_intel_fast_exists())
+		return ceph_crc32c_intel_fast;
+	return ceph_crc32c_sctp;
+}
+
+static uint32_t crc32c_init(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * The first call resolves the implementation and replaces the
+ * pointer.  Racing callers just do the same (idempotent) work.
+ */
+static ceph_crc32c_func_t ceph_crc32c_func = crc32c_init;
+
+static uint32_t crc32c_init(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	ceph_crc32c_func = ceph_choose_crc32();
+	return ceph_crc32c_func(crc, data, length);
+}
+
+uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	return ceph_crc32c_func(crc, data, length);
+}
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "include/crc32c.h"
+
+#if defined(__x86_64__)
+
+#define CPUID_ECX_SSE42 (1 << 20)
+
+int ceph_crc32c_intel_fast_exists(void)
+{
+	uint32_t eax = 1, ebx, ecx, edx;
+
+	__asm__("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	return (ecx & CPUID_ECX_SSE42) != 0;
+}
+
+/*
+ * Use the crc32 instruction directly (rather than the _mm_crc32_*
+ * intrinsics) so that we do not need to build with -msse4.2; the cpu
+ * is checked at runtime by ceph_choose_crc32().
+ */
+uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	uint64_t crc64 = crc;
+	uint32_t crc32;
+
+	/* align to 8 bytes */
+	while (length && ((uintptr_t)data & 7)) {
+		crc32 = (uint32_t)crc64;
+		__asm__("crc32b %1, %0" : "+r" (crc32) : "rm" (*data));
+		crc64 = crc32;
+		data++;
+		length--;
+	}
+
+	/* unrolled, 32 bytes per iteration */
+	while (length >= 32) {
+		const uint64_t *p = (const uint64_t *)data;
+		__asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (p[0]));
+		__asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (p[1]));
+		__asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (p[2]));
+		__asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (p[3]));
+		data += 32;
+		length -= 32;
+	}
+	while (length >= 8) {
+		__asm__("crc32q %1, %0" : "+r" (crc64) : "rm" (*(const uint64_t *)data));
+		data += 8;
+		length -= 8;
+	}
+
+	crc32 = (uint32_t)crc64;
+	while (length) {
+		__asm__("crc32b %1, %0" : "+r" (crc32) : "rm" (*data));
+		data++;
+		length--;
+	}
+	return crc32;
+}
+
+#else
+
+int ceph_crc32c_intel_fast_exists(void)
+{
+	return 0;
+}
+
+uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	return 0;
+}
+
+#endif
@@ -13,8 +13,11 @@
  */
 
 #include "common/perf_counters.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "include/atomic.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -91,18 +94,92 @@ void PerfCountersCollection::write_json_to_buf(bufferlist& bl, bool schema)
 
 // ---------------------------
 
+/// log2 buckets of a histogram: bucket 0 is under 1us, bucket b > 0 is
+/// [2^(b-1), 2^b) us, and the last one also takes everything longer
+static const unsigned PERF_HIST_BUCKETS = 32;
+
+static unsigned hist_bucket(double secs)
+{
+  uint64_t us = secs > 0 ? (uint64_t)(secs * 1000000.0) : 0;
+  unsigned b = 0;
+  while (us && b < PERF_HIST_BUCKETS - 1) {
+    us >>= 1;
+    ++b;
+  }
+  return b;
+}
+
+/// the upper bound, in seconds, of the bucket holding the q quantile
+static double hist_quantile(const std::vector<uint64_t> &hist,
+			    uint64_t count, double q)
+{
+  if (!count)
+    return 0;
+  uint64_t want = (uint64_t)(q * count);
+  if (want < 1)
+    want = 1;
+  uint64_t seen = 0;
+  unsigned b = 0;
+  for (; b < hist.size() - 1; ++b) {
+    seen += hist[b];
+    if (seen >= want)
+      break;
+  }
+  return (double)(1ull << b) / 1000000.0;
+}
+
+static bool is_sharded(int type)
+{
+  return type & (PERFCOUNTER_COUNTER | PERFCOUNTER_LONGRUNAVG);
+}
+
+static atomic_t next_thread_shard;
+static __thread int thread_shard = -1;
+
 PerfCounters::~PerfCounters()
 {
+  for (unsigned i = 0; i < m_shards.size(); ++i)
+    delete m_shards[i];
+}
+
+PerfCounters::perf_counter_shard_d *
+PerfCounters::get_shard(const perf_counter_data_any_d &data) const
+{
+  if (!is_sharded(data.type) || m_shards.size() == 1)
+    return m_shards[0];
+  if (thread_shard < 0)
+    thread_shard = next_thread_shard.inc();
+  return m_shards[thread_shard % m_shards.size()];
+}
+
+void PerfCounters::aggregate(perf_counter_data_vec_t &out) const
+{
+  out = m_data;
+  for (unsigned i = 0; i < m_shards.size(); ++i) {
+    Mutex::Locker lck(m_shards[i]->lock);
+    const perf_counter_data_vec_t &shard(m_shards[i]->data);
+    for (unsigned j = 0; j < out.size(); ++j) {
+      if (out[j].type & PERFCOUNTER_U64)
+	out[j].u.u64 += shard[j].u.u64;
+      else if (out[j].type & PERFCOUNTER_FLOAT)
+	out[j].u.dbl += shard[j].u.dbl;
+      out[j].avgcount += shard[j].avgcount;
+      for (unsigned b = 0; b < out[j].hist.size(); ++b)
+	out[j].hist[b] += shard[j].hist[b];
+    }
+  }
 }
 
 void PerfCounters::inc(int idx, uint64_t amt)
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_U64))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_U64))
     return;
+  perf_counter_shard_d *shard = get_shard(m_data[i]);
+  Mutex::Locker lck(shard->lock);
+  perf_counter_data_any_d& data(shard->data[i]);
   data.u.u64 += amt;
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     data.avgcount++;
@@ -110,75 +187,100 @@ void PerfCounters::inc(int idx, uint64_t amt)
 
 void PerfCounters::set(int idx, uint64_t amt)
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_U64))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_U64))
     return;
+  // move the whole value into the first shard
+  uint64_t avgcount = 0;
+  if (is_sharded(m_data[i].type)) {
+    for (unsigned s = 1; s < m_shards.size(); ++s) {
+      Mutex::Locker lck(m_shards[s]->lock);
+      perf_counter_data_any_d& data(m_shards[s]->data[i]);
+      data.u.u64 = 0;
+      avgcount += data.avgcount;
+      data.avgcount = 0;
+    }
+  }
+  Mutex::Locker lck(m_shards[0]->lock);
+  perf_counter_data_any_d& data(m_shards[0]->data[i]);
   data.u.u64 = amt;
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    data.avgcount += avgcount + 1;
 }
 
 uint64_t PerfCounters::get(int idx) const
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_U64))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_U64))
     return 0;
-  return data.u.u64;
+  uint64_t v = 0;
+  for (unsigned s = 0; s < m_shards.size(); ++s) {
+    Mutex::Locker lck(m_shards[s]->lock);
+    v += m_shards[s]->data[i].u.u64;
+  }
+  return v;
 }
 
 void PerfCounters::finc(int idx, double amt)
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_FLOAT))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_FLOAT))
     return;
+  perf_counter_shard_d *shard = get_shard(m_data[i]);
+  Mutex::Locker lck(shard->lock);
+  perf_counter_data_any_d& data(shard->data[i]);
   data.u.dbl += amt;
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     data.avgcount++;
+  if (data.type & PERFCOUNTER_HISTOGRAM)
+    data.hist[hist_bucket(amt)]++;
 }
 
 void PerfCounters::fset(int idx, double amt)
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_FLOAT))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_FLOAT))
     return;
-  data.u.dbl = amt;
-  if (data.type & PERFCOUNTER_LONGRUNAVG)
+  if (m_data[i].type & PERFCOUNTER_LONGRUNAVG)
     assert(0);
+  Mutex::Locker lck(m_shards[0]->lock);
+  m_shards[0]->data[i].u.dbl = amt;
 }
 
 double PerfCounters::fget(int idx) const
 {
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
-  const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
-  if (!(data.type & PERFCOUNTER_FLOAT))
+  int i = idx - m_lower_bound - 1;
+  if (!(m_data[i].type & PERFCOUNTER_FLOAT))
     return 0.0;
-  return data.u.dbl;
+  double v = 0;
+  for (unsigned s = 0; s < m_shards.size(); ++s) {
+    Mutex::Locker lck(m_shards[s]->lock);
+    v += m_shards[s]->data[i].u.dbl;
+  }
+  return v;
 }
 
 void PerfCounters::write_json_to_buf(bufferlist& bl, bool schema)
 {
-  char buf[512];
-  Mutex::Locker lck(m_lock);
+  char buf[1024];
+  perf_counter_data_vec_t data_vec;
+  aggregate(data_vec);
 
   snprintf(buf, sizeof(buf), "\"%s\":{", m_name.c_str());
   bl.append(buf);
 
-  perf_counter_data_vec_t::const_iterator d = m_data.begin();
-  perf_counter_data_vec_t::const_iterator d_end = m_data.end();
+  perf_counter_data_vec_t::const_iterator d = data_vec.begin();
+  perf_counter_data_vec_t::const_iterator d_end = data_vec.end();
   if (d == d_end) {
     bl.append('}');
     return;
@@ -210,12 +312,31 @@ PerfCounters::PerfCounters(CephContext *cct, const std::string &name,
     m_lower_bound(lower_bound),
     m_upper_bound(upper_bound),
     m_name(name.c_str()),
-    m_lock_name(std::string("PerfCounters::") + name.c_str()),
-    m_lock(m_lock_name.c_str())
+    m_lock_name(std::string("PerfCounters::") + name.c_str())
 {
   m_data.resize(upper_bound - lower_bound - 1);
 }
 
+void PerfCounters::create_shards()
+{
+  for (perf_counter_data_vec_t::iterator d = m_data.begin();
+       d != m_data.end(); ++d)
+    if (d->type & PERFCOUNTER_HISTOGRAM)
+      d->hist.resize(PERF_HIST_BUCKETS);
+
+  int n = m_cct ? m_cct->_conf->perf_counters_shards : 1;
+  if (n < 1)
+    n = 1;
+  for (int i = 0; i < n; ++i)
+    m_shards.push_back(new perf_counter_shard_d(m_lock_name, m_data));
+}
+
+PerfCounters::perf_counter_shard_d::perf_counter_shard_d(
+  const std::string &lock_name, const perf_counter_data_vec_t &data)
+  : lock(lock_name.c_str()), data(data)
+{
+}
+
 PerfCounters::perf_counter_data_any_d::perf_counter_data_any_d()
   : name(NULL),
     type(PERFCOUNTER_NONE),
@@ -231,7 +352,25 @@ void  PerfCounters::perf_counter_data_any_d::write_schema_json(char *buf, size_t
 
 void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz) const
 {
-  if (type & PERFCOUNTER_LONGRUNAVG) {
+  if (type & PERFCOUNTER_HISTOGRAM) {
+    size_t len = snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
+			  "\"sum\":%g,\"p50\":%g,\"p99\":%g,\"p999\":%g,"
+			  "\"buckets\":[",
+			  name, avgcount, u.dbl,
+			  hist_quantile(hist, avgcount, 0.5),
+			  hist_quantile(hist, avgcount, 0.99),
+			  hist_quantile(hist, avgcount, 0.999));
+    // leave off the empty buckets at the end
+    unsigned n = hist.size();
+    while (n > 0 && !hist[n - 1])
+      --n;
+    for (unsigned b = 0; b < n && len < buf_sz; ++b)
+      len += snprintf(buf + len, buf_sz - len, "%s%" PRId64,
+		      b ? "," : "", hist[b]);
+    if (len < buf_sz)
+      snprintf(buf + len, buf_sz - len, "]}");
+  }
+  else if (type & PERFCOUNTER_LONGRUNAVG) {
     if (type & PERFCOUNTER_U64) {
       snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
 	      "\"sum\":%" PRId64 "}", 
@@ -298,6 +437,12 @@ void PerfCountersBuilder::add_fl_avg(int idx, const char *name)
   add_impl(idx, name, PERFCOUNTER_FLOAT | PERFCOUNTER_LONGRUNAVG);
 }
 
+void PerfCountersBuilder::add_fl_hist(int idx, const char *name)
+{
+  add_impl(idx, name, PERFCOUNTER_FLOAT | PERFCOUNTER_LONGRUNAVG |
+	   PERFCOUNTER_HISTOGRAM);
+}
+
 void PerfCountersBuilder::add_impl(int idx, const char *name, int ty)
 {
   assert(idx > m_perf_counters->m_lower_bound);
@@ -319,6 +464,7 @@ PerfCounters *PerfCountersBuilder::create_perf_counters()
       assert(d->type != PERFCOUNTER_NONE);
     }
   }
+  m_perf_counters->create_shards();
   PerfCounters *ret = m_perf_counters;
   m_perf_counters = NULL;
   return ret;
@@ -35,6 +35,7 @@ enum perfcounter_type_d
   PERFCOUNTER_U64 = 0x2,
   PERFCOUNTER_LONGRUNAVG = 0x4,
   PERFCOUNTER_COUNTER = 0x8,
+  PERFCOUNTER_HISTOGRAM = 0x10,
 };
 
 /*
@@ -60,6 +61,14 @@ enum perfcounter_type_d
  * For the floating-point average, it returns the current value and
  * the "avgcount" member when read off. avgcount is incremented when you call
  * finc. Calling fset on an average is an error and will assert out.
+ * A floating-point histogram is an average of latencies in seconds that
+ * also counts them in log2 buckets of microseconds, so that it can report
+ * percentiles too.
+ *
+ * Counters and averages are kept in several shards, each with its own
+ * lock, and each thread updates the one it was assigned, so that threads
+ * updating the same counters don't contend.  Reads add the shards up.
+ * Values live in a single shard, since a set must replace the whole value.
  */
 class PerfCounters
 {
@@ -100,19 +109,33 @@ private:
       double dbl;
     } u;
     uint64_t avgcount;
+    std::vector<uint64_t> hist;  ///< log2 buckets, if a histogram
   };
   typedef std::vector<perf_counter_data_any_d> perf_counter_data_vec_t;
 
+  /** A copy of the counters, updated by some of the threads. */
+  struct perf_counter_shard_d {
+    perf_counter_shard_d(const std::string &lock_name,
+			 const perf_counter_data_vec_t &data);
+    /** Protects data */
+    Mutex lock;
+    perf_counter_data_vec_t data;
+  };
+
+  perf_counter_shard_d *get_shard(const perf_counter_data_any_d &data) const;
+  /// the counters summed over all shards
+  void aggregate(perf_counter_data_vec_t &out) const;
+  void create_shards();
+
   CephContext *m_cct;
   int m_lower_bound;
   int m_upper_bound;
   std::string m_name;
   const std::string m_lock_name;
 
-  /** Protects m_data */
-  mutable Mutex m_lock;
-
+  /** Names and types; the values are in m_shards */
   perf_counter_data_vec_t m_data;
+  std::vector<perf_counter_shard_d*> m_shards;
 
   friend class PerfCountersBuilder;
 };
@@ -172,6 +195,7 @@ public:
   void add_u64_avg(int key, const char *name);
   void add_fl(int key, const char *name);
   void add_fl_avg(int key, const char *name);
+  void add_fl_hist(int key, const char *name);
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
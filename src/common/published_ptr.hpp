@@ -0,0 +1,116 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_PUBLISHEDPTR_H
+#define CEPH_PUBLISHEDPTR_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <tr1/memory>
+#include "common/Mutex.h"
+#include "include/atomic.h"
+
+/**
+ * PublishedPtr
+ *
+ * A shared_ptr that is read far more often than it is replaced, e.g. the
+ * current OSDMap.  Readers never block: get() takes a reference without
+ * a lock, so they do not contend with each other or with the publisher.
+ *
+ * The value lives in one of two slots.  Readers announce themselves on
+ * the active slot's reader count before copying it; publish() fills the
+ * inactive slot once its last reader is gone and then flips the active
+ * index.  A slot is therefore never written while a reader may be
+ * copying it.  The reader counts are striped by thread so that readers
+ * on different cpus do not bounce the same cache line.
+ *
+ * publish() is serialized internally, and may wait briefly for readers
+ * of a map two publications old.
+ */
+template <class T>
+class PublishedPtr {
+public:
+  typedef std::tr1::shared_ptr<T> TPtr;
+
+private:
+  static const unsigned NUM_STRIPES = 8;
+
+  struct Stripe {
+    atomic_t readers;
+    char pad[64 - sizeof(atomic_t) % 64];
+  };
+
+  TPtr slots[2];
+  atomic_t active;
+  Stripe stripes[2][NUM_STRIPES];
+  Mutex publish_lock;
+
+  static unsigned stripe_of_thread() {
+    unsigned long t = (unsigned long)pthread_self();
+    return (t ^ (t >> 12)) % NUM_STRIPES;
+  }
+
+  bool has_readers(unsigned slot) {
+    for (unsigned i = 0; i < NUM_STRIPES; ++i)
+      if (stripes[slot][i].readers.read())
+	return true;
+    return false;
+  }
+
+public:
+  PublishedPtr() : active(0), publish_lock("PublishedPtr::publish_lock") {}
+
+  TPtr get() {
+    unsigned s = stripe_of_thread();
+    unsigned i;
+    while (true) {
+      i = (unsigned)active.read();
+      stripes[i][s].readers.inc();
+      // order our reader count before the re-check; pairs with the
+      // barrier in publish()
+      __sync_synchronize();
+      if ((unsigned)active.read() == i)
+	break;
+      stripes[i][s].readers.dec();
+    }
+    TPtr ret = slots[i];
+    stripes[i][s].readers.dec();
+    return ret;
+  }
+
+  void publish(const TPtr &val) {
+    TPtr old;
+    {
+      Mutex::Locker l(publish_lock);
+      unsigned next = 1 - active.read();
+      while (has_readers(next))
+	sched_yield();
+      old.swap(slots[next]);
+      slots[next] = val;
+      __sync_synchronize();
+      active.set(next);
+      __sync_synchronize();
+    }
+    // old (two publications back) is released outside of the lock
+  }
+
+  /// drop both slots; the caller must ensure there are no readers
+  void reset() {
+    Mutex::Locker l(publish_lock);
+    slots[0].reset();
+    slots[1].reset();
+  }
+};
+
+#endif
@@ -61,10 +61,28 @@ class SharedLRU {
 
   void remove(K key) {
     Mutex::Locker l(lock);
-    weak_refs.erase(key);
+    typename map<K, WeakVPtr>::iterator i = weak_refs.find(key);
+    // the key may have been cleared and re-added since this value was
+    // created; only drop the weak ref if it is ours (i.e., expired)
+    if (i != weak_refs.end() && i->second.expired())
+      weak_refs.erase(i);
     cond.Signal();
   }
 
+  void _clear(K key, list<VPtr> *to_release) {
+    typename map<K, WeakVPtr>::iterator i = weak_refs.find(key);
+    if (i != weak_refs.end()) {
+      VPtr val = i->second.lock();
+      if (val)
+	to_release->push_back(val);
+      weak_refs.erase(i);
+    }
+    if (contents.count(key)) {
+      to_release->push_back(contents[key]->second);
+      lru_remove(key);
+    }
+  }
+
   class Cleanup {
   public:
     SharedLRU<K, V> *cache;
@@ -79,12 +97,47 @@ class SharedLRU {
 public:
   SharedLRU(size_t max_size = 20) : lock("SharedLRU::lock"), max_size(max_size) {}
 
+  ~SharedLRU() {
+    // drop our refs while weak_refs is still around for Cleanup
+    contents.clear();
+    lru.clear();
+  }
+
   void set_size(size_t new_size) {
     list<VPtr> to_release;
     {
       Mutex::Locker l(lock);
       max_size = new_size;
-      trim_cache(to_release);
+      trim_cache(&to_release);
+    }
+  }
+
+  /// drop key from the cache; outstanding refs remain valid
+  void clear(K key) {
+    list<VPtr> to_release;
+    {
+      Mutex::Locker l(lock);
+      _clear(key, &to_release);
+    }
+  }
+
+  /// drop all keys for which pred(key) is true
+  template <class P>
+  void clear_if(P pred) {
+    list<VPtr> to_release;
+    {
+      Mutex::Locker l(lock);
+      list<K> to_clear;
+      for (typename map<K, WeakVPtr>::iterator i = weak_refs.begin();
+	   i != weak_refs.end();
+	   ++i) {
+	if (pred(i->first))
+	  to_clear.push_back(i->first);
+      }
+      for (typename list<K>::iterator i = to_clear.begin();
+	   i != to_clear.end();
+	   ++i)
+	_clear(*i, &to_release);
     }
   }
 
@@ -137,14 +190,29 @@ public:
     return val;
   }
 
+  /**
+   * add value for key
+   *
+   * If another value for key is still referenced (e.g. a concurrent
+   * caller added it first), value is deleted and the existing one is
+   * returned instead.
+   */
   VPtr add(K key, V *value) {
-    VPtr val(value, Cleanup(this, key));
+    VPtr val;
     list<VPtr> to_release;
     {
       Mutex::Locker l(lock);
-      weak_refs.insert(make_pair(key, val));
+      typename map<K, WeakVPtr>::iterator i = weak_refs.find(key);
+      if (i != weak_refs.end())
+	val = i->second.lock();
+      if (!val) {
+	val = VPtr(value, Cleanup(this, key));
+	weak_refs[key] = val;
+	value = NULL;
+      }
       lru_add(key, val, &to_release);
     }
+    delete value;
     return val;
   }
 };
@@ -37,6 +37,10 @@ class SimpleLRU {
   }
 
   void _add(K key, V value) {
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator i =
+      contents.find(key);
+    if (i != contents.end())
+      lru.erase(i->second);
     lru.push_front(make_pair(key, value));
     contents[key] = lru.begin();
     trim_cache();
@@ -50,17 +54,18 @@ public:
     pinned.insert(make_pair(key, val));
   }
 
-  void clear_pinned() {
+  /// move the pinned entries up to and including e back to the lru
+  void clear_pinned(K e) {
     Mutex::Locker l(lock);
     for (typename map<K, V>::iterator i = pinned.begin();
-	 i != pinned.end();
-	 ++i) {
+	 i != pinned.end() && i->first <= e;
+	 ) {
       if (!contents.count(i->first))
 	_add(i->first, i->second);
       else
 	lru.splice(lru.begin(), lru, contents[i->first]);
+      pinned.erase(i++);
     }
-    pinned.clear();
   }
 
   void set_size(size_t new_size) {
@@ -89,6 +94,16 @@ public:
     Mutex::Locker l(lock);
     _add(key, value);
   }
+
+  void clear(K key) {
+    Mutex::Locker l(lock);
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator i =
+      contents.find(key);
+    if (i == contents.end())
+      return;
+    lru.erase(i->second);
+    contents.erase(i);
+  }
 };
 
 #endif
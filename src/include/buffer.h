@@ -122,6 +122,7 @@ private:
   class raw_posix_aligned;
   class raw_hack_aligned;
   class raw_char;
+  class raw_pooled;
 
   friend std::ostream& operator<<(std::ostream& out, const raw &r);
 
@@ -137,6 +138,24 @@ public:
   static raw* claim_malloc(unsigned len, char *buf);
   static raw* create_static(unsigned len, char *buf);
   static raw* create_page_aligned(unsigned len);
+
+  /*
+   * a source of page-aligned memory that wants it back, to hand out
+   * again, when the last ref to a buffer made from it goes away.  it
+   * must stay around until then: each such buffer holds a ref to it.
+   */
+  class raw_pool {
+  public:
+    virtual ~raw_pool() {}
+    /// memory for len bytes, or NULL if it has none to offer
+    virtual char *alloc(unsigned len) = 0;
+    /// take back what alloc(len) returned
+    virtual void release(char *data, unsigned len) = 0;
+    virtual void get() = 0;
+    virtual void put() = 0;
+  };
+  /// page-aligned, from pool if it will, and returned to it when freed
+  static raw* create_pooled(raw_pool *pool, unsigned len);
   
   
   /*
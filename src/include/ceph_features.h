@@ -24,6 +24,8 @@
 #define CEPH_FEATURE_INDEP_PG_MAP   (1<<17)
 #define CEPH_FEATURE_CRUSH_TUNABLES (1<<18)
 #define CEPH_FEATURE_CHUNKY_SCRUB   (1<<19)
+#define CEPH_FEATURE_OSD_DELTA_RECOVERY (1<<20)
+#define CEPH_FEATURE_OSD_SUBOP_BATCH (1<<21)
 
 /*
  * Features supported.  Should be everything above.
@@ -48,7 +50,9 @@
 	 CEPH_FEATURE_MONENC |		 \
 	 CEPH_FEATURE_INDEP_PG_MAP |	 \
 	 CEPH_FEATURE_CRUSH_TUNABLES |	 \
-	 CEPH_FEATURE_CHUNKY_SCRUB)
+	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
+	 CEPH_FEATURE_OSD_DELTA_RECOVERY | \
+	 CEPH_FEATURE_OSD_SUBOP_BATCH)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
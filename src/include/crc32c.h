@@ -1,11 +1,35 @@
 #ifndef CEPH_CRC32C_H
 #define CEPH_CRC32C_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length);
+typedef uint32_t (*ceph_crc32c_func_t)(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * Portable table-driven (slice-by-8) implementation.
+ */
+extern uint32_t ceph_crc32c_sctp(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * SSE4.2 crc32 instruction; only valid if ceph_crc32c_intel_fast_exists().
+ */
+extern int ceph_crc32c_intel_fast_exists(void);
+extern uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * Choose the best implementation for the cpu we are running on.
+ */
+extern ceph_crc32c_func_t ceph_choose_crc32(void);
+
+/*
+ * Calculate crc32c, using the best implementation available.  Note
+ * that the crc is neither pre- nor post-inverted.
+ */
+extern uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length);
 
 #ifdef __cplusplus
 }
@@ -234,6 +234,8 @@ enum {
 	CEPH_OSD_OP_SCRUB_UNRESERVE = CEPH_OSD_OP_MODE_SUB | 7,
 	CEPH_OSD_OP_SCRUB_STOP      = CEPH_OSD_OP_MODE_SUB | 8,
 	CEPH_OSD_OP_SCRUB_MAP     = CEPH_OSD_OP_MODE_SUB | 9,
+	CEPH_OSD_OP_BACKFILL_RESERVE   = CEPH_OSD_OP_MODE_SUB | 10,
+	CEPH_OSD_OP_BACKFILL_UNRESERVE = CEPH_OSD_OP_MODE_SUB | 11,
 
 	/** lock **/
 	CEPH_OSD_OP_WRLOCK    = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_LOCK | 1,
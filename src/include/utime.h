@@ -36,7 +36,7 @@ public:
     return (tv.tv_sec == 0) && (tv.tv_nsec == 0);
   }
   void normalize() {
-    if (tv.tv_nsec > 1000000000ul) {
+    if (tv.tv_nsec >= 1000000000ul) {
       tv.tv_sec += tv.tv_nsec / (1000000000ul);
       tv.tv_nsec %= 1000000000ul;
     }
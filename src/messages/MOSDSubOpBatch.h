@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MOSDSUBOPBATCH_H
+#define CEPH_MOSDSUBOPBATCH_H
+
+#include "msg/Message.h"
+
+/*
+ * several MOSDSubOp and MOSDSubOpReply for the same osd, sent as one
+ * message.  The receiver dispatches them in order, as if each had been
+ * sent on its own over the same connection.
+ *
+ * The data of the sub ops is carried in the data section, so it is
+ * checksummed once, for the whole batch.
+ */
+class MOSDSubOpBatch : public Message {
+  static const int HEAD_VERSION = 1;
+
+public:
+  list<Message*> ops;
+
+  MOSDSubOpBatch() : Message(MSG_OSD_SUBOP_BATCH, HEAD_VERSION) {}
+
+  void add(Message *m) {
+    ops.push_back(m);
+    if (m->get_priority() > get_priority())
+      set_priority(m->get_priority());
+  }
+
+private:
+  ~MOSDSubOpBatch() {
+    for (list<Message*>::iterator p = ops.begin(); p != ops.end(); ++p)
+      (*p)->put();
+  }
+
+public:
+  void encode_payload(uint64_t features) {
+    __u32 n = ops.size();
+    ::encode(n, payload);
+    for (list<Message*>::iterator p = ops.begin(); p != ops.end(); ++p) {
+      Message *m = *p;
+      m->encode(features, false);
+      ::encode(m->get_header(), payload);
+      ::encode(m->get_footer(), payload);
+      ::encode(m->get_payload(), payload);
+      ::encode(m->get_middle(), payload);
+      __u32 data_len = m->get_data().length();
+      ::encode(data_len, payload);
+      data.claim_append(m->get_data());
+    }
+  }
+
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    bufferlist::iterator d = data.begin();
+    __u32 n;
+    ::decode(n, p);
+    while (n--) {
+      ceph_msg_header h;
+      ceph_msg_footer f;
+      bufferlist front, middle, mdata;
+      __u32 data_len;
+      ::decode(h, p);
+      ::decode(f, p);
+      ::decode(front, p);
+      ::decode(middle, p);
+      ::decode(data_len, p);
+      d.copy(data_len, mdata);
+      Message *m = decode_message(NULL, h, f, front, middle, mdata);
+      if (!m)
+	throw buffer::malformed_input("bad sub op in MOSDSubOpBatch");
+      ops.push_back(m);
+    }
+  }
+
+  const char *get_type_name() const { return "osd_sub_op_batch"; }
+  void print(ostream& out) const {
+    out << "osd_sub_op_batch(" << ops.size() << " ops)";
+  }
+};
+
+#endif
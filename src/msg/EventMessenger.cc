@@ -0,0 +1,527 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "EventMessenger.h"
+
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/errno.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix _prefix(_dout, msgr)
+static ostream& _prefix(std::ostream *_dout, EventMessenger *msgr) {
+  return *_dout << "-- " << msgr->get_myaddr() << " ";
+}
+
+/// events taken from epoll at once
+static const int EVENT_BATCH = 64;
+
+
+/*******************
+ * EventLoop
+ */
+
+EventMessenger::EventLoop::EventLoop(EventMessenger *m)
+  : msgr(m), epfd(-1),
+    lock("EventMessenger::EventLoop::lock"),
+    stopping(false)
+{
+  wake_fd[0] = wake_fd[1] = -1;
+}
+
+EventMessenger::EventLoop::~EventLoop()
+{
+  assert(released.empty());
+  assert(backoffs.empty());
+  if (epfd >= 0)
+    ::close(epfd);
+  if (wake_fd[0] >= 0)
+    ::close(wake_fd[0]);
+  if (wake_fd[1] >= 0)
+    ::close(wake_fd[1]);
+}
+
+int EventMessenger::EventLoop::init()
+{
+  epfd = ::epoll_create(1024);
+  if (epfd < 0) {
+    int r = -errno;
+    lderr(msgr->cct) << "EventLoop couldn't create epoll fd: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  if (::pipe(wake_fd) < 0) {
+    int r = -errno;
+    lderr(msgr->cct) << "EventLoop couldn't create wake pipe: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ::fcntl(wake_fd[0], F_SETFL, O_NONBLOCK);
+  ::fcntl(wake_fd[1], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd[0], &ev) < 0) {
+    int r = -errno;
+    lderr(msgr->cct) << "EventLoop couldn't add wake pipe: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+void EventMessenger::EventLoop::wake()
+{
+  char c = 0;
+  // if the pipe is full, the loop is due to wake up anyway
+  int r = ::write(wake_fd[1], &c, 1);
+  r++; r = 0; // placate gcc
+}
+
+void *EventMessenger::EventLoop::entry()
+{
+  struct epoll_event events[EVENT_BATCH];
+
+  ldout(msgr->cct,10) << "EventLoop start" << dendl;
+  lock.Lock();
+  while (!stopping) {
+    // nobody can be looking at these any more
+    list<Pipe*> ls;
+    ls.swap(released);
+
+    // due backoffs, and how long until the next one
+    utime_t now = ceph_clock_now(msgr->cct);
+    list<Pipe*> done;
+    while (!backoffs.empty() && backoffs.begin()->first <= now) {
+      done.push_back(backoffs.begin()->second);
+      backoffs.erase(backoffs.begin());
+    }
+    int timeout = -1;
+    if (!backoffs.empty()) {
+      utime_t left = backoffs.begin()->first - now;
+      timeout = left.sec() * 1000 + left.usec() / 1000 + 1;
+    }
+    lock.Unlock();
+
+    for (list<Pipe*>::iterator p = ls.begin(); p != ls.end(); ++p)
+      (*p)->put();
+    for (list<Pipe*>::iterator p = done.begin(); p != done.end(); ++p)
+      msgr->backoff_done(*p);
+
+    int n = ::epoll_wait(epfd, events, EVENT_BATCH, timeout);
+    if (n < 0 && errno != EINTR) {
+      int r = -errno;
+      lderr(msgr->cct) << "EventLoop epoll_wait failed: " << cpp_strerror(r) << dendl;
+      assert(0 == "epoll_wait failed");
+    }
+    for (int i = 0; i < n; ++i) {
+      Pipe *p = (Pipe *)events[i].data.ptr;
+      if (!p) {
+	char buf[64];
+	while (::read(wake_fd[0], buf, sizeof(buf)) > 0) ;
+	continue;
+      }
+      msgr->pipe_readable(p);
+    }
+
+    lock.Lock();
+  }
+
+  // drop what is left; the messenger is done with its Pipes by now
+  for (list<Pipe*>::iterator p = released.begin(); p != released.end(); ++p)
+    (*p)->put();
+  released.clear();
+  for (multimap<utime_t, Pipe*>::iterator p = backoffs.begin();
+       p != backoffs.end();
+       ++p)
+    p->second->put();
+  backoffs.clear();
+  lock.Unlock();
+  ldout(msgr->cct,10) << "EventLoop done" << dendl;
+  return 0;
+}
+
+void EventMessenger::EventLoop::stop()
+{
+  lock.Lock();
+  stopping = true;
+  wake();
+  lock.Unlock();
+  join();
+}
+
+int EventMessenger::EventLoop::arm(Pipe *p)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.ptr = p;
+  p->get();
+  // once it fires, sd stays in the set, disabled, until it is armed again
+  // or closed; only a new sd needs adding.
+  if (::epoll_ctl(epfd, EPOLL_CTL_MOD, p->sd, &ev) < 0 &&
+      (errno != ENOENT ||
+       ::epoll_ctl(epfd, EPOLL_CTL_ADD, p->sd, &ev) < 0)) {
+    int r = -errno;
+    p->put();
+    return r;
+  }
+  return 0;
+}
+
+void EventMessenger::EventLoop::disarm(Pipe *p, bool fired)
+{
+  if (fired) {
+    // called by the loop itself, which is done with p; the event
+    // disabled itself as it fired
+    p->put();
+    return;
+  }
+  ::epoll_ctl(epfd, EPOLL_CTL_DEL, p->sd, NULL);
+  // the loop may be holding an event for p that it has not handled yet;
+  // keep p around until it has.
+  Mutex::Locker l(lock);
+  released.push_back(p);
+  wake();
+}
+
+void EventMessenger::EventLoop::add_backoff(Pipe *p, utime_t t)
+{
+  Mutex::Locker l(lock);
+  p->get();
+  backoffs.insert(make_pair(t, p));
+  wake();
+}
+
+
+/*******************
+ * EventMessenger
+ */
+
+#undef dout_prefix
+#define dout_prefix _prefix(_dout, this)
+
+EventMessenger::EventMessenger(CephContext *cct, entity_name_t name,
+			       string mname, uint64_t _nonce)
+  : SimpleMessenger(cct, name, mname, _nonce),
+    read_pool(cct, "EventMessenger::read_pool",
+	      cct->_conf->ms_event_read_workers),
+    write_pool(cct, "EventMessenger::write_pool",
+	       cct->_conf->ms_event_write_workers),
+    accept_pool(cct, "EventMessenger::accept_pool",
+		cct->_conf->ms_event_handshake_workers),
+    connect_pool(cct, "EventMessenger::connect_pool",
+		 cct->_conf->ms_event_handshake_workers),
+    throttle_pool(cct, "EventMessenger::throttle_pool",
+		  cct->_conf->ms_event_throttle_workers),
+    read_wq(this, "EventMessenger::read_wq", false, false,
+	    cct->_conf->ms_tcp_read_timeout, &read_pool),
+    write_wq(this, "EventMessenger::write_wq", true, false,
+	     cct->_conf->ms_tcp_read_timeout, &write_pool),
+    accept_wq(this, "EventMessenger::accept_wq", false, true,
+	      cct->_conf->ms_tcp_read_timeout, &accept_pool),
+    connect_wq(this, "EventMessenger::connect_wq", true, true,
+	       cct->_conf->ms_tcp_read_timeout, &connect_pool),
+    throttle_wq(this, cct->_conf->ms_tcp_read_timeout, &throttle_pool),
+    event_started(false)
+{
+  int n = cct->_conf->ms_event_loops;
+  if (n < 1)
+    n = 1;
+  for (int i = 0; i < n; ++i)
+    loops.push_back(new EventLoop(this));
+}
+
+EventMessenger::~EventMessenger()
+{
+  assert(!event_started);
+  for (vector<EventLoop*>::iterator p = loops.begin(); p != loops.end(); ++p)
+    delete *p;
+}
+
+int EventMessenger::start()
+{
+  ldout(cct,1) << "EventMessenger.start " << loops.size() << " event loops, "
+	       << cct->_conf->ms_event_read_workers << " read workers, "
+	       << cct->_conf->ms_event_write_workers << " write workers" << dendl;
+  for (vector<EventLoop*>::iterator p = loops.begin(); p != loops.end(); ++p) {
+    int r = (*p)->init();
+    if (r < 0)
+      return r;
+  }
+  for (vector<EventLoop*>::iterator p = loops.begin(); p != loops.end(); ++p)
+    (*p)->create();
+  read_pool.start();
+  write_pool.start();
+  accept_pool.start();
+  connect_pool.start();
+  throttle_pool.start();
+  event_started = true;
+  return SimpleMessenger::start();
+}
+
+void EventMessenger::wait()
+{
+  SimpleMessenger::wait();
+
+  if (!event_started)
+    return;
+  ldout(cct,20) << "wait: stopping workers" << dendl;
+  read_pool.stop();
+  write_pool.stop();
+  accept_pool.stop();
+  connect_pool.stop();
+  throttle_pool.stop();
+  ldout(cct,20) << "wait: stopping event loops" << dendl;
+  for (vector<EventLoop*>::iterator p = loops.begin(); p != loops.end(); ++p)
+    (*p)->stop();
+  event_started = false;
+}
+
+void EventMessenger::queue_pipe(Pipe *p, bool writer)
+{
+  assert(p->pipe_lock.is_locked());
+  if (writer) {
+    p->writer_ev = Pipe::EV_QUEUED;
+    if (p->state == Pipe::STATE_CONNECTING && !p->backoff_pending)
+      connect_wq.queue(p);
+    else
+      write_wq.queue(p);
+  } else {
+    p->reader_ev = Pipe::EV_QUEUED;
+    if (p->state == Pipe::STATE_ACCEPTING)
+      accept_wq.queue(p);
+    else
+      read_wq.queue(p);
+  }
+}
+
+void EventMessenger::run_pipe(Pipe *p, bool writer, bool handshake)
+{
+  int &ev = writer ? p->writer_ev : p->reader_ev;
+
+  p->pipe_lock.Lock();
+  if (ev != Pipe::EV_QUEUED) {
+    // left over from before it was joined or queued again
+    p->pipe_lock.Unlock();
+    p->put();
+    return;
+  }
+  ev = Pipe::EV_RUNNING;
+  if (writer) {
+    p->writer_handshake = handshake;
+    p->writer_budget = cct->_conf->ms_event_batch;
+  } else {
+    p->reader_handshake = handshake;
+    p->reader_budget = cct->_conf->ms_event_batch;
+  }
+  p->pipe_lock.Unlock();
+
+  if (writer)
+    p->writer();
+  else
+    p->reader();
+
+  p->pipe_lock.Lock();
+  if (ev == Pipe::EV_RUNNING &&
+      !(writer ? p->writer_running : p->reader_running))
+    ev = Pipe::EV_IDLE;  // finished for good, and not started again
+  p->cond.Signal();      // for join_pipe_reader()
+  p->pipe_lock.Unlock();
+  p->put();
+}
+
+void EventMessenger::throttle_wait(Pipe *p)
+{
+  p->pipe_lock.Lock();
+  if (p->reader_ev != Pipe::EV_THROTTLE) {
+    // joined meanwhile
+    p->pipe_lock.Unlock();
+    p->put();
+    return;
+  }
+  Throttle *t = p->in_throttle_wait;
+  uint64_t c = p->in_pending_size();
+  uint64_t gen = p->in_pending_gen;
+  p->pipe_lock.Unlock();
+
+  ldout(cct,20) << "throttle_wait " << p << " waits for " << c << dendl;
+  t->get(c);
+
+  p->pipe_lock.Lock();
+  if (p->reader_ev == Pipe::EV_THROTTLE && p->in_pending_gen == gen) {
+    if (t == p->policy.throttler)
+      p->in_policy_throttled = true;
+    else
+      p->in_dispatch_throttled = true;
+    queue_pipe(p, false);
+  } else {
+    // the message was discarded while we waited
+    ldout(cct,20) << "throttle_wait " << p << " gives back " << c << dendl;
+    t->put(c);
+  }
+  p->pipe_lock.Unlock();
+  p->put();
+}
+
+void EventMessenger::pipe_readable(Pipe *p)
+{
+  p->pipe_lock.Lock();
+  if (p->reader_ev == Pipe::EV_ARMED) {
+    queue_pipe(p, false);
+    get_loop(p)->disarm(p, true);
+  }
+  // else it was disarmed, and its ref is on the released list
+  p->pipe_lock.Unlock();
+}
+
+void EventMessenger::backoff_done(Pipe *p)
+{
+  p->pipe_lock.Lock();
+  if (p->backoff_pending) {
+    ldout(cct,20) << "backoff done for " << p << dendl;
+    wake_pipe(p);
+  }
+  p->pipe_lock.Unlock();
+  p->put();
+}
+
+void EventMessenger::start_pipe_reader(Pipe *p)
+{
+  queue_pipe(p, false);
+}
+
+void EventMessenger::start_pipe_writer(Pipe *p)
+{
+  queue_pipe(p, true);
+}
+
+void EventMessenger::join_pipe_reader(Pipe *p)
+{
+  while (p->reader_running) {
+    if (p->reader_ev == Pipe::EV_RUNNING) {
+      p->cond.Wait(p->pipe_lock);
+      continue;
+    }
+    // it is not reading, and will find nothing to do if it is run again
+    if (p->reader_ev == Pipe::EV_ARMED)
+      get_loop(p)->disarm(p, false);
+    p->discard_in_pending();
+    p->reader_ev = Pipe::EV_IDLE;
+    p->reader_running = false;
+  }
+}
+
+void EventMessenger::wake_pipe(Pipe *p)
+{
+  // like a Signal() to a waiter in the SimpleMessenger, this cuts the
+  // reconnect backoff short.
+  p->backoff_pending = false;
+  if (p->writer_running && p->writer_ev == Pipe::EV_IDLE)
+    queue_pipe(p, true);
+  if (p->reader_running && p->reader_ev == Pipe::EV_IDLE)
+    queue_pipe(p, false);
+}
+
+bool EventMessenger::pipe_sleep(Pipe *p, bool writer)
+{
+  if (writer)
+    p->writer_ev = Pipe::EV_IDLE;
+  else
+    p->reader_ev = Pipe::EV_IDLE;
+  return false;
+}
+
+bool EventMessenger::pipe_continue(Pipe *p, bool writer)
+{
+  if (writer ? p->writer_handshake : p->reader_handshake) {
+    // done with the handshake; over to the read or write workers
+    queue_pipe(p, writer);
+    return false;
+  }
+
+  if (writer) {
+    if (--p->writer_budget > 0)
+      return true;
+    queue_pipe(p, true);
+    return false;
+  }
+
+  int r = 1;
+  if (p->sd >= 0 && !p->has_pending_data()) {
+    if (cct->_conf->ms_tcp_prefetch_max_size > 0) {
+      // take what is there; reading it then needs no more syscalls
+      r = p->tcp_prefetch();
+      if (r == 0)
+	p->zerocopy_reap();  // or its completions would wake the loop again
+    } else {
+      struct pollfd pfd;
+      pfd.fd = p->sd;
+      pfd.events = POLLIN | POLLRDHUP;
+      do {
+	pfd.revents = 0;
+	r = ::poll(&pfd, 1, 0);
+	// zerocopy completions alone don't make it readable
+      } while (r == 1 && pfd.revents == POLLERR && p->zerocopy_reap());
+    }
+  }
+  if (r == 0) {
+    // nothing to read yet
+    p->reader_ev = Pipe::EV_ARMED;
+    if (get_loop(p)->arm(p) == 0)
+      return false;
+    // carry on, and let the read find out what is wrong
+    p->reader_ev = Pipe::EV_RUNNING;
+    return true;
+  }
+  if (p->reader_budget-- > 0)
+    return true;
+  queue_pipe(p, false);
+  return false;
+}
+
+bool EventMessenger::pipe_handshake(Pipe *p, bool writer)
+{
+  if (writer ? p->writer_handshake : p->reader_handshake)
+    return true;
+  // it blocks on the peer for a while; over to the handshake workers
+  queue_pipe(p, writer);
+  return false;
+}
+
+bool EventMessenger::pipe_throttle(Pipe *p, Throttle *t, uint64_t c)
+{
+  if (t->get_or_fail(c))
+    return true;
+  // let a throttle worker do the waiting. the reader only returns after
+  // this, but all it does meanwhile is take the pipe_lock to yield.
+  p->pipe_lock.Lock();
+  p->in_throttle_wait = t;
+  p->reader_ev = Pipe::EV_THROTTLE;
+  throttle_wq.queue(p);
+  p->pipe_lock.Unlock();
+  return false;
+}
+
+void EventMessenger::pipe_backoff(Pipe *p, utime_t t)
+{
+  p->backoff_pending = true;
+  get_loop(p)->add_backoff(p, ceph_clock_now(cct) + t);
+}
@@ -0,0 +1,231 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_EVENTMESSENGER_H
+#define CEPH_EVENTMESSENGER_H
+
+#include <map>
+#include <list>
+#include <vector>
+using namespace std;
+
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "common/WorkQueue.h"
+
+#include "SimpleMessenger.h"
+
+/*
+ * The EventMessenger speaks the same protocol as the SimpleMessenger,
+ * using the same Pipes, but does not give each Pipe a reader and a
+ * writer thread of its own. Instead:
+ *
+ * - a few event loops wait (with epoll) for the sockets of idle readers
+ *   to become readable, and
+ * - fixed pools of workers run the readers and the writers that have
+ *   something to do, each on a pool of its own.
+ *
+ * Where its thread would block waiting for something to do, a reader or
+ * writer returns instead, and it is queued to its workers again once its
+ * socket becomes readable or it is woken by wake_pipe(). One that keeps
+ * finding work yields after ms_event_batch messages, so that the others
+ * get their turn.
+ *
+ * The waits that do not depend on the peer keeping up with the socket
+ * are kept off the read and write workers:
+ *
+ * - handshakes run on accept and connect workers. These are separate
+ *   pools, so that connects waiting on a peer's accepts never hold the
+ *   threads this messenger's accepts need, and the other way around.
+ * - a reader that cannot get the throttle bytes for a message it has
+ *   read the header of queues itself to the throttle workers, which wait
+ *   for them, and queue the reader again once they have them.
+ *
+ * Reading or writing the rest of a message once it has started still
+ * blocks the worker. A reader only waits on the writer at the other end
+ * of its own socket, and a writer on the reader, and these never wait
+ * for a worker while they are part way through a message, so this ties
+ * up a worker for as long as the message takes, but cannot deadlock.
+ *
+ * Lock ordering:
+ *
+ *   Pipe::pipe_lock
+ *       ThreadPool lock
+ *       EventLoop::lock
+ */
+class EventMessenger : public SimpleMessenger {
+  /**
+   * Waits for the sockets of idle readers to become readable, and
+   * queues their readers to the workers when they do. Also runs the
+   * reconnect backoff timers of writers.
+   */
+  class EventLoop : public Thread {
+    EventMessenger *msgr;
+    int epfd;
+    int wake_fd[2];
+    Mutex lock;
+    bool stopping;
+    /// refs of disarmed Pipes, dropped once the events in hand are handled
+    list<Pipe*> released;
+    /// writers waiting for their reconnect backoff
+    multimap<utime_t, Pipe*> backoffs;
+
+    void wake();
+
+  public:
+    EventLoop(EventMessenger *m);
+    ~EventLoop();
+
+    int init();
+    void *entry();
+    void stop();
+
+    /// wait for p->sd to become readable; pipe_lock held
+    int arm(Pipe *p);
+    /**
+     * Stop waiting for p->sd; pipe_lock held.
+     *
+     * @param fired true if called by the loop, as it handles the event
+     */
+    void disarm(Pipe *p, bool fired);
+    /// call backoff_done(p) at t
+    void add_backoff(Pipe *p, utime_t t);
+  };
+  vector<EventLoop*> loops;
+
+  EventLoop *get_loop(Pipe *p) {
+    return loops[((unsigned long)p >> 6) % loops.size()];
+  }
+
+  ThreadPool read_pool, write_pool, accept_pool, connect_pool, throttle_pool;
+
+  /// readers or writers waiting for a worker
+  class PipeWQ : public ThreadPool::WorkQueue<Pipe> {
+  protected:
+    EventMessenger *msgr;
+  private:
+    bool writer, handshake;
+    list<Pipe*> q;
+
+  public:
+    PipeWQ(EventMessenger *m, string n, bool w, bool h, time_t ti,
+	   ThreadPool *tp)
+      : ThreadPool::WorkQueue<Pipe>(n, ti, 0, tp),
+	msgr(m), writer(w), handshake(h) {}
+
+    bool _enqueue(Pipe *p) {
+      p->get();
+      q.push_back(p);
+      return true;
+    }
+    void _dequeue(Pipe *p) {
+      for (list<Pipe*>::iterator i = q.begin(); i != q.end(); ) {
+	if (*i == p) {
+	  q.erase(i++);
+	  p->put();
+	} else {
+	  ++i;
+	}
+      }
+    }
+    Pipe *_dequeue() {
+      if (q.empty())
+	return NULL;
+      Pipe *p = q.front();
+      q.pop_front();
+      return p;
+    }
+    bool _empty() {
+      return q.empty();
+    }
+    void _process(Pipe *p) {
+      msgr->run_pipe(p, writer, handshake);
+    }
+    void _clear() {
+      while (!q.empty()) {
+	q.front()->put();
+	q.pop_front();
+      }
+    }
+  } read_wq, write_wq, accept_wq, connect_wq;
+
+  /// readers waiting for a throttle worker to get their throttle bytes
+  class ThrottleWQ : public PipeWQ {
+  public:
+    ThrottleWQ(EventMessenger *m, time_t ti, ThreadPool *tp)
+      : PipeWQ(m, "EventMessenger::throttle_wq", false, false, ti, tp) {}
+
+    void _process(Pipe *p) {
+      msgr->throttle_wait(p);
+    }
+  } throttle_wq;
+
+  bool event_started;
+
+  /**
+   * Queue the reader or writer of p to its workers: the handshake ones
+   * if it is to accept or connect, or else the read or write ones.
+   * pipe_lock held.
+   */
+  void queue_pipe(Pipe *p, bool writer);
+  /**
+   * Run the reader or writer of p on this worker.
+   *
+   * @param handshake true if this is an accept or connect worker
+   */
+  void run_pipe(Pipe *p, bool writer, bool handshake);
+  /// get the throttle bytes the reader of p waits for, then queue it
+  void throttle_wait(Pipe *p);
+  /// p->sd became readable
+  void pipe_readable(Pipe *p);
+  /// the reconnect backoff of p is over
+  void backoff_done(Pipe *p);
+
+public:
+  EventMessenger(CephContext *cct, entity_name_t name,
+		 string mname, uint64_t _nonce);
+  virtual ~EventMessenger();
+
+  /**
+   * Start the event loops and the workers, and then the
+   * SimpleMessenger.
+   *
+   * @return 0, or -errno if an event loop could not be set up.
+   */
+  int start();
+  /**
+   * Wait for the SimpleMessenger to shut down, and then stop the event
+   * loops and the workers.
+   */
+  void wait();
+
+  /**
+   * @defgroup Running Pipes
+   * @{
+   */
+  void start_pipe_reader(Pipe *pipe);
+  void start_pipe_writer(Pipe *pipe);
+  void join_pipe_reader(Pipe *pipe);
+  void wake_pipe(Pipe *pipe);
+  bool pipe_sleep(Pipe *pipe, bool writer);
+  bool pipe_continue(Pipe *pipe, bool writer);
+  bool pipe_handshake(Pipe *pipe, bool writer);
+  bool pipe_throttle(Pipe *pipe, Throttle *t, uint64_t c);
+  void pipe_backoff(Pipe *pipe, utime_t t);
+  /**
+   * @} // Running Pipes
+   */
+};
+
+#endif
@@ -57,6 +57,7 @@ using namespace std;
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
+#include "messages/MOSDSubOpBatch.h"
 #include "messages/MOSDMap.h"
 
 #include "messages/MOSDPGNotify.h"
@@ -371,6 +372,9 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   case MSG_OSD_SUBOPREPLY:
     m = new MOSDSubOpReply();
     break;
+  case MSG_OSD_SUBOP_BATCH:
+    m = new MOSDSubOpBatch();
+    break;
 
   case CEPH_MSG_OSD_MAP:
     m = new MOSDMap;
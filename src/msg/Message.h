@@ -89,6 +89,7 @@
 
 #define MSG_OSD_PG_SCAN        94
 #define MSG_OSD_PG_BACKFILL    95
+#define MSG_OSD_SUBOP_BATCH    96
 
 #define MSG_COMMAND            97
 #define MSG_COMMAND_REPLY      98
@@ -3,11 +3,26 @@
 #include "Messenger.h"
 
 #include "SimpleMessenger.h"
+#if defined(__linux__)
+#include "EventMessenger.h"
+#endif
+
+#include "common/config.h"
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_ms
 
 Messenger *Messenger::create(CephContext *cct,
 			     entity_name_t name,
 			     string lname,
 			     uint64_t nonce)
 {
+#if defined(__linux__)
+  if (cct->_conf->ms_type == "event")
+    return new EventMessenger(cct, name, lname, nonce);
+#endif
+  if (cct->_conf->ms_type != "simple")
+    lderr(cct) << "ms_type '" << cct->_conf->ms_type
+	       << "' is not supported, using simple" << dendl;
   return new SimpleMessenger(cct, name, lname, nonce);
 }
@@ -18,12 +18,18 @@
 #include <limits.h>
 #include <poll.h>
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_MSG_ZEROCOPY
+#endif
+
 #include "Message.h"
 #include "Pipe.h"
 #include "SimpleMessenger.h"
 
 #include "common/debug.h"
 #include "common/errno.h"
+#include "include/page.h"
 
 #define dout_subsys ceph_subsys_ms
 
@@ -53,6 +59,17 @@ Pipe::Pipe(SimpleMessenger *r, int st, Connection *con)
     state(st),
     connection_state(NULL),
     reader_running(false), reader_joining(false), writer_running(false),
+    reader_ev(EV_IDLE), writer_ev(EV_IDLE),
+    reader_handshake(false), writer_handshake(false),
+    reader_budget(0), writer_budget(0),
+    backoff_pending(false),
+    in_pending(false),
+    in_policy_throttled(false), in_dispatch_throttled(false),
+    in_throttle_wait(NULL), in_pending_gen(0),
+    send_scratch(NULL),
+    recv_buf(NULL), recv_max_prefetch(0), recv_ofs(0), recv_len(0),
+    zc_lock("SimpleMessenger::Pipe::zc_lock"),
+    zc_enabled(false), zc_next(0),
     in_q(r->dispatch_queue.create_queue(this)),
     keepalive(false),
     close_on_empty(false),
@@ -77,6 +94,8 @@ Pipe::~Pipe()
   assert(sent.empty());
   if (connection_state)
     connection_state->put();
+  delete[] send_scratch;
+  delete[] recv_buf;
 }
 
 void Pipe::handle_ack(uint64_t seq)
@@ -103,7 +122,7 @@ void Pipe::start_reader()
   assert(pipe_lock.is_locked());
   assert(!reader_running);
   reader_running = true;
-  reader_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
+  msgr->start_pipe_reader(this);
 }
 
 void Pipe::start_writer()
@@ -111,7 +130,7 @@ void Pipe::start_writer()
   assert(pipe_lock.is_locked());
   assert(!writer_running);
   writer_running = true;
-  writer_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
+  msgr->start_pipe_writer(this);
 }
 
 void Pipe::join_reader()
@@ -121,13 +140,17 @@ void Pipe::join_reader()
   assert(!reader_joining);
   reader_joining = true;
   cond.Signal();
-  pipe_lock.Unlock();
-  reader_thread.join();
-  pipe_lock.Lock();
+  msgr->join_pipe_reader(this);
   assert(reader_joining);
   reader_joining = false;
 }
 
+void Pipe::_wake()
+{
+  assert(pipe_lock.is_locked());
+  msgr->wake_pipe(this);
+}
+
 
 void Pipe::queue_received(Message *m, int priority)
 {
@@ -143,6 +166,7 @@ int Pipe::accept()
 
   // my creater gave me sd via accept()
   assert(state == STATE_ACCEPTING);
+  zerocopy_init();
   
   // announce myself.
   int rc = tcp_write(CEPH_BANNER, strlen(CEPH_BANNER));
@@ -602,8 +626,11 @@ int Pipe::connect()
   const md_config_t *conf = msgr->cct->_conf;
 
   // close old socket.  this is safe because we stopped the reader thread above.
-  if (sd >= 0)
+  if (sd >= 0) {
+    zerocopy_reset();
     ::close(sd);
+  }
+  recv_ofs = recv_len = 0;  // whatever was prefetched came off the old one
 
   char buf[80];
 
@@ -630,6 +657,7 @@ int Pipe::connect()
     if (r < 0) 
       ldout(msgr->cct,0) << "connect couldn't set TCP_NODELAY: " << strerror_r(errno, buf, sizeof(buf)) << dendl;
   }
+  zerocopy_init();
 
   // verify banner
   // FIXME: this should be non-blocking, or in some other way verify the banner as we get it.
@@ -967,7 +995,7 @@ void Pipe::fault(bool onread)
 {
   const md_config_t *conf = msgr->cct->_conf;
   assert(pipe_lock.is_locked());
-  cond.Signal();
+  _wake();
 
   if (onread && state == STATE_CONNECTING) {
     ldout(msgr->cct,10) << "fault already connecting, reader shutting down" << dendl;
@@ -1034,7 +1062,7 @@ void Pipe::fault(bool onread)
     backoff.set_from_double(conf->ms_initial_backoff);
   } else {
     ldout(msgr->cct,10) << "fault waiting " << backoff << dendl;
-    cond.WaitInterval(msgr->cct, pipe_lock, backoff);
+    msgr->pipe_backoff(this, backoff);
     backoff += backoff;
     if (backoff > conf->ms_max_backoff)
       backoff.set_from_double(conf->ms_max_backoff);
@@ -1062,7 +1090,7 @@ void Pipe::stop()
   ldout(msgr->cct,10) << "stop" << dendl;
   assert(pipe_lock.is_locked());
   state = STATE_CLOSED;
-  cond.Signal();
+  _wake();
   shutdown_socket();
 }
 
@@ -1072,11 +1100,16 @@ void Pipe::stop()
  */
 void Pipe::reader()
 {
-  if (state == STATE_ACCEPTING) 
-    accept();
-
   pipe_lock.Lock();
 
+  if (state == STATE_ACCEPTING) {
+    if (!msgr->pipe_handshake(this, false))
+      goto yield;
+    pipe_lock.Unlock();
+    accept();
+    pipe_lock.Lock();
+  }
+
   // loop.
   while (state != STATE_CLOSED &&
 	 state != STATE_CONNECTING) {
@@ -1085,20 +1118,30 @@ void Pipe::reader()
     // sleep if (re)connecting
     if (state == STATE_STANDBY) {
       ldout(msgr->cct,20) << "reader sleeping during reconnect|standby" << dendl;
-      cond.Wait(pipe_lock);
+      discard_in_pending();  // it was read off the old socket
+      if (!msgr->pipe_sleep(this, false))
+	goto yield;
       continue;
     }
 
+    if (!msgr->pipe_continue(this, false))
+      goto yield;
+
     pipe_lock.Unlock();
 
     char buf[80];
     char tag = -1;
-    ldout(msgr->cct,20) << "reader reading tag..." << dendl;
-    if (tcp_read((char*)&tag, 1) < 0) {
-      pipe_lock.Lock();
-      ldout(msgr->cct,2) << "reader couldn't read tag, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
-      fault(true);
-      continue;
+    if (in_pending) {
+      // back for the message it got the throttle bytes for
+      tag = CEPH_MSGR_TAG_MSG;
+    } else {
+      ldout(msgr->cct,20) << "reader reading tag..." << dendl;
+      if (tcp_read((char*)&tag, 1) < 0) {
+	pipe_lock.Lock();
+	ldout(msgr->cct,2) << "reader couldn't read tag, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+	fault(true);
+	continue;
+      }
     }
 
     if (tag == CEPH_MSGR_TAG_KEEPALIVE) {
@@ -1130,6 +1173,8 @@ void Pipe::reader()
       pipe_lock.Lock();
       
       if (!m) {
+	if (r == -EAGAIN)
+	  goto yield;  // run again once it has the throttle bytes
 	if (r < 0)
 	  fault(true);
 	continue;
@@ -1161,7 +1206,7 @@ void Pipe::reader()
       // note last received message.
       in_seq = m->get_seq();
 
-      cond.Signal();  // wake up writer, to ack this
+      _wake();  // wake up writer, to ack this
       
       ldout(msgr->cct,10) << "reader got message "
 	       << m->get_seq() << " " << m << " " << *m
@@ -1176,7 +1221,7 @@ void Pipe::reader()
 	state = STATE_CLOSED;
       else
 	state = STATE_CLOSING;
-      cond.Signal();
+      _wake();
       break;
     }
     else {
@@ -1188,9 +1233,16 @@ void Pipe::reader()
 
  
   // reap?
+  discard_in_pending();
   reader_running = false;
   unlock_maybe_reap();
   ldout(msgr->cct,10) << "reader done" << dendl;
+  return;
+
+ yield:
+  // run again by the messenger when there is something to read
+  pipe_lock.Unlock();
+  ldout(msgr->cct,20) << "reader yields" << dendl;
 }
 
 /* write msgs to socket.
@@ -1214,6 +1266,13 @@ void Pipe::writer()
     // connect?
     if (state == STATE_CONNECTING) {
       assert(!policy.server);
+      if (backoff_pending) {
+	if (!msgr->pipe_sleep(this, true))
+	  goto yield;
+	continue;
+      }
+      if (!msgr->pipe_handshake(this, true))
+	goto yield;
       connect();
       continue;
     }
@@ -1292,6 +1351,8 @@ void Pipe::writer()
 	  fault();
         }
 	m->put();
+	if (!msgr->pipe_continue(this, true))
+	  goto yield;
       }
       continue;
     }
@@ -1304,7 +1365,8 @@ void Pipe::writer()
 
     // wait
     ldout(msgr->cct,20) << "writer sleeping" << dendl;
-    cond.Wait(pipe_lock);
+    if (!msgr->pipe_sleep(this, true))
+      goto yield;
   }
   
   ldout(msgr->cct,20) << "writer finishing" << dendl;
@@ -1313,6 +1375,28 @@ void Pipe::writer()
   writer_running = false;
   unlock_maybe_reap();
   ldout(msgr->cct,10) << "writer done" << dendl;
+  return;
+
+ yield:
+  // run again by the messenger once woken
+  pipe_lock.Unlock();
+  ldout(msgr->cct,20) << "writer yields" << dendl;
+}
+
+void Pipe::discard_in_pending()
+{
+  assert(pipe_lock.is_locked());
+  if (!in_pending)
+    return;
+  uint64_t message_size = in_pending_size();
+  ldout(msgr->cct,10) << "discarding the message waiting for throttle bytes, "
+		      << message_size << " bytes" << dendl;
+  if (in_policy_throttled)
+    policy.throttler->put(message_size);
+  if (in_dispatch_throttled)
+    msgr->dispatch_throttle_release(message_size);
+  in_pending = false;
+  ++in_pending_gen;
 }
 
 void Pipe::unlock_maybe_reap()
@@ -1326,7 +1410,8 @@ void Pipe::unlock_maybe_reap()
   }
 }
 
-static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
+static void alloc_aligned_buffer(BufferPool *pool, bufferlist& data,
+				 unsigned len, unsigned off)
 {
   // create a buffer to read into that matches the data alignment
   unsigned left = len;
@@ -1340,7 +1425,7 @@ static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
   }
   unsigned middle = left & CEPH_PAGE_MASK;
   if (middle > 0) {
-    bufferptr bp = buffer::create_page_aligned(middle);
+    bufferptr bp = pool->create(middle);
     data.push_back(bp);
     left -= middle;
   }
@@ -1359,34 +1444,46 @@ int Pipe::read_message(Message **pm)
   ceph_msg_header header; 
   ceph_msg_footer footer;
   __u32 header_crc;
-  
-  if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
-    if (tcp_read((char*)&header, sizeof(header)) < 0)
-      return -1;
-    header_crc = ceph_crc32c_le(0, (unsigned char *)&header, sizeof(header) - sizeof(header.crc));
+
+  if (in_pending) {
+    // we have the header already, and some of the throttle bytes
+    header = in_header;
+    ldout(msgr->cct,20) << "reader resumes envelope type=" << header.type
+			<< " src " << entity_name_t(header.src) << dendl;
   } else {
-    ceph_msg_header_old oldheader;
-    if (tcp_read((char*)&oldheader, sizeof(oldheader)) < 0)
+    if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
+      if (tcp_read((char*)&header, sizeof(header)) < 0)
+	return -1;
+      header_crc = ceph_crc32c_le(0, (unsigned char *)&header, sizeof(header) - sizeof(header.crc));
+    } else {
+      ceph_msg_header_old oldheader;
+      if (tcp_read((char*)&oldheader, sizeof(oldheader)) < 0)
+	return -1;
+      // this is fugly
+      memcpy(&header, &oldheader, sizeof(header));
+      header.src = oldheader.src.name;
+      header.reserved = oldheader.reserved;
+      header.crc = oldheader.crc;
+      header_crc = ceph_crc32c_le(0, (unsigned char *)&oldheader, sizeof(oldheader) - sizeof(oldheader.crc));
+    }
+
+    ldout(msgr->cct,20) << "reader got envelope type=" << header.type
+	     << " src " << entity_name_t(header.src)
+	     << " front=" << header.front_len
+	     << " data=" << header.data_len
+	     << " off " << header.data_off
+	     << dendl;
+
+    // verify header crc
+    if (header_crc != header.crc) {
+      ldout(msgr->cct,0) << "reader got bad header crc " << header_crc << " != " << header.crc << dendl;
       return -1;
-    // this is fugly
-    memcpy(&header, &oldheader, sizeof(header));
-    header.src = oldheader.src.name;
-    header.reserved = oldheader.reserved;
-    header.crc = oldheader.crc;
-    header_crc = ceph_crc32c_le(0, (unsigned char *)&oldheader, sizeof(oldheader) - sizeof(oldheader.crc));
-  }
-
-  ldout(msgr->cct,20) << "reader got envelope type=" << header.type
-           << " src " << entity_name_t(header.src)
-           << " front=" << header.front_len
-	   << " data=" << header.data_len
-	   << " off " << header.data_off
-           << dendl;
-
-  // verify header crc
-  if (header_crc != header.crc) {
-    ldout(msgr->cct,0) << "reader got bad header crc " << header_crc << " != " << header.crc << dendl;
-    return -1;
+    }
+
+    in_pending = true;
+    in_header = header;
+    in_recv_stamp = ceph_clock_now(msgr->cct);
+    in_policy_throttled = in_dispatch_throttled = false;
   }
 
   bufferlist front, middle, data;
@@ -1394,34 +1491,41 @@ int Pipe::read_message(Message **pm)
   unsigned data_len, data_off;
   int aborted;
   Message *message;
-  utime_t recv_stamp = ceph_clock_now(msgr->cct);
-  bool waited_on_throttle = false;
+  utime_t recv_stamp = in_recv_stamp;
 
-  uint64_t message_size = header.front_len + header.middle_len + header.data_len;
+  uint64_t message_size = in_pending_size();
   if (message_size) {
-    if (policy.throttler) {
+    if (policy.throttler && !in_policy_throttled) {
       ldout(msgr->cct,10) << "reader wants " << message_size << " from policy throttler "
 	       << policy.throttler->get_current() << "/"
 	       << policy.throttler->get_max() << dendl;
-      waited_on_throttle = policy.throttler->get(message_size);
+      if (!msgr->pipe_throttle(this, policy.throttler, message_size))
+	return -EAGAIN;
+      in_policy_throttled = true;
     }
 
     // throttle total bytes waiting for dispatch.  do this _after_ the
     // policy throttle, as this one does not deadlock (unless dispatch
     // blocks indefinitely, which it shouldn't).  in contrast, the
     // policy throttle carries for the lifetime of the message.
-    ldout(msgr->cct,10) << "reader wants " << message_size << " from dispatch throttler "
-	     << msgr->dispatch_throttler.get_current() << "/"
-	     << msgr->dispatch_throttler.get_max() << dendl;
-    waited_on_throttle |= msgr->dispatch_throttler.get(message_size);
+    if (!in_dispatch_throttled) {
+      ldout(msgr->cct,10) << "reader wants " << message_size << " from dispatch throttler "
+	       << msgr->dispatch_throttler.get_current() << "/"
+	       << msgr->dispatch_throttler.get_max() << dendl;
+      if (!msgr->pipe_throttle(this, &msgr->dispatch_throttler, message_size))
+	return -EAGAIN;
+      in_dispatch_throttled = true;
+    }
   }
+  // the bytes are ours now; out_dethrottle gives them back on failure
+  in_pending = false;
 
   utime_t throttle_stamp = ceph_clock_now(msgr->cct);
 
   // read front
   front_len = header.front_len;
   if (front_len) {
-    bufferptr bp = buffer::create(front_len);
+    bufferptr bp = msgr->rx_pool->create(front_len);
     if (tcp_read(bp.c_str(), front_len) < 0)
       goto out_dethrottle;
     front.push_back(bp);
@@ -1431,7 +1535,7 @@ int Pipe::read_message(Message **pm)
   // read middle
   middle_len = header.middle_len;
   if (middle_len) {
-    bufferptr bp = buffer::create(middle_len);
+    bufferptr bp = msgr->rx_pool->create(middle_len);
     if (tcp_read(bp.c_str(), middle_len) < 0)
       goto out_dethrottle;
     middle.push_back(bp);
@@ -1474,7 +1578,7 @@ int Pipe::read_message(Message **pm)
       } else {
 	if (!newbuf.length()) {
 	  ldout(msgr->cct,20) << "reader allocating new rx buffer at offset " << offset << dendl;
-	  alloc_aligned_buffer(newbuf, data_len, data_off);
+	  alloc_aligned_buffer(msgr->rx_pool, newbuf, data_len, data_off);
 	  blp = newbuf.begin();
 	  blp.advance(offset);
 	}
@@ -1545,7 +1649,7 @@ int Pipe::read_message(Message **pm)
   return ret;
 }
 
-int Pipe::do_sendmsg(struct msghdr *msg, int len, bool more)
+int Pipe::do_sendmsg(struct msghdr *msg, int len, bool more, bufferlist *zc)
 {
   char buf[80];
 
@@ -1557,7 +1661,24 @@ int Pipe::do_sendmsg(struct msghdr *msg, int len, bool more)
       assert(l == len);
     }
 
-    int r = ::sendmsg(sd, msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zc)
+      flags |= MSG_ZEROCOPY;
+#endif
+    int r = ::sendmsg(sd, msg, flags);
+#ifdef HAVE_MSG_ZEROCOPY
+    if (r < 0 && zc && errno == ENOBUFS) {
+      // no socket memory left to track the send; copy it instead
+      ldout(msgr->cct,10) << "do_sendmsg zerocopy got ENOBUFS, copying" << dendl;
+      zc = NULL;
+      continue;
+    }
+    if (r > 0 && zc) {
+      Mutex::Locker l(zc_lock);
+      zc_pending[zc_next++] = *zc;
+    }
+#endif
     if (r == 0) 
       ldout(msgr->cct,10) << "do_sendmsg hmm do_sendmsg got r==0!" << dendl;
     if (r < 0) { 
@@ -1638,10 +1759,88 @@ int Pipe::write_keepalive()
 }
 
 
+void Pipe::zerocopy_init()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  if (!msgr->cct->_conf->ms_tcp_zerocopy)
+    return;
+  int flag = 1;
+  if (::setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, (char*)&flag, sizeof(flag)) < 0) {
+    ldout(msgr->cct,10) << "zerocopy_init couldn't set SO_ZEROCOPY: "
+			<< cpp_strerror(errno) << ", copying" << dendl;
+    return;
+  }
+  Mutex::Locker l(zc_lock);
+  zc_enabled = true;
+  zc_next = 0;
+#endif
+}
+
+void Pipe::zerocopy_reset()
+{
+  Mutex::Locker l(zc_lock);
+  // the kernel holds its own refs to the pages it has yet to send
+  zc_enabled = false;
+  zc_next = 0;
+  zc_pending.clear();
+}
+
+bool Pipe::zerocopy_reap()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  Mutex::Locker l(zc_lock);
+  if (zc_pending.empty() || sd < 0)
+    return false;
+
+  int saved_errno = errno;  // callers report the errno of their own failures
+  bool found = false;
+  while (true) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+			    sizeof(struct sockaddr_storage))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;  // EAGAIN: nothing (more) on the error queue
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+	  !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+	continue;
+      struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	continue;
+      found = true;
+      // sends ee_info through ee_data are done
+      for (uint32_t id = ee->ee_info; ; ++id) {
+	zc_pending.erase(id);
+	if (id == ee->ee_data)
+	  break;
+      }
+      if ((ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && zc_enabled) {
+	// the device can't do it (e.g. loopback), and the kernel copied
+	// the pages after all; don't pay for the notifications too.
+	ldout(msgr->cct,10) << "zerocopy_reap kernel copied zerocopy send, copying from now on" << dendl;
+	zc_enabled = false;
+      }
+    }
+  }
+  errno = saved_errno;
+  return found;
+#else
+  return false;
+#endif
+}
+
+/// the scratch buffer tiny segments are copied into
+static const int SEND_SCRATCH_BYTES = 64 << 10;
+
 int Pipe::write_message(Message *m)
 {
   ceph_msg_header& header = m->get_header();
   ceph_msg_footer& footer = m->get_footer();
+  const md_config_t *conf = msgr->cct->_conf;
   int ret;
 
   // get envelope, buffers
@@ -1656,11 +1855,23 @@ int Pipe::write_message(Message *m)
   blist.append(m->get_data());
   
   ldout(msgr->cct,20)  << "write_message " << m << dendl;
+
+  // release what earlier zerocopy sends are done with
+  zerocopy_reap();
+  bool zc;
+  {
+    Mutex::Locker l(zc_lock);
+    zc = zc_enabled;
+  }
+  int coalesce = MIN(conf->ms_tcp_coalesce_bytes, SEND_SCRATCH_BYTES);
+  if (coalesce > 0 && !send_scratch)
+    send_scratch = new char[SEND_SCRATCH_BYTES];
   
   // set up msghdr and iovecs
   struct msghdr msg;
   memset(&msg, 0, sizeof(msg));
-  struct iovec *msgvec = new iovec[3 + blist.buffers().size()];  // conservative upper bound
+  int maxvec = MIN(3 + (int)blist.buffers().size(), IOV_MAX);  // conservative upper bound
+  struct iovec *msgvec = new iovec[maxvec];
   msg.msg_iov = msgvec;
   int msglen = 0;
   
@@ -1692,52 +1903,76 @@ int Pipe::write_message(Message *m)
     msg.msg_iovlen++;
   }
 
-  // payload (front+data)
-  list<bufferptr>::const_iterator pb = blist.buffers().begin();
-  int b_off = 0;  // carry-over buffer offset, if any
-  int bl_pos = 0; // blist pos
-  int left = blist.length();
-
-  while (left > 0) {
-    int donow = MIN(left, (int)pb->length()-b_off);
-    if (donow == 0) {
-      ldout(msgr->cct,0) << "donow = " << donow << " left " << left << " pb->length " << pb->length()
-	      << " b_off " << b_off << dendl;
+  // payload (front+middle+data)
+  //
+  // Segments shorter than ms_tcp_coalesce_bytes are copied into
+  // send_scratch and share an iovec, so that a message made of many tiny
+  // buffers doesn't take a sendmsg() per IOV_MAX of them.  Large
+  // page-aligned segments go out with MSG_ZEROCOPY, in sendmsg() calls of
+  // their own, since everything in such a call must stay put until the
+  // kernel says it is done with it.
+  {
+    bool vec_zc = false;   // msgvec holds zerocopy segments
+    int scratch_used = 0;
+    int scratch_vec = -1;  // the iovec pointing at the end of the scratch
+    for (list<bufferptr>::const_iterator pb = blist.buffers().begin();
+	 pb != blist.buffers().end();
+	 ++pb) {
+      const char *p = pb->c_str();
+      int len = pb->length();
+      if (len == 0)
+	continue;
+      bool seg_zc = zc && len >= conf->ms_tcp_zerocopy_bytes &&
+	((unsigned long)p & ~CEPH_PAGE_MASK) == 0;
+      bool seg_copy = !seg_zc && len < coalesce;
+      ldout(msgr->cct,30) << " segment " << (void*)p << "~" << len
+			  << (seg_zc ? " zerocopy" : (seg_copy ? " coalesced" : ""))
+			  << dendl;
+
+      if (msg.msg_iovlen > 0 &&
+	  (seg_zc != vec_zc ||
+	   (int)msg.msg_iovlen >= IOV_MAX-2 ||
+	   (seg_copy && scratch_used + len > SEND_SCRATCH_BYTES))) {
+	if (do_sendmsg(&msg, msglen, true, vec_zc ? &blist : NULL))
+	  goto fail;
+
+	// and restart the iov
+	msg.msg_iov = msgvec;
+	msg.msg_iovlen = 0;
+	msglen = 0;
+	scratch_used = 0;
+	scratch_vec = -1;
+      }
+      vec_zc = seg_zc;
+
+      if (seg_copy) {
+	char *dst = send_scratch + scratch_used;
+	memcpy(dst, p, len);
+	scratch_used += len;
+	if (scratch_vec >= 0 && scratch_vec == (int)msg.msg_iovlen - 1) {
+	  msgvec[scratch_vec].iov_len += len;
+	} else {
+	  scratch_vec = msg.msg_iovlen;
+	  msgvec[msg.msg_iovlen].iov_base = dst;
+	  msgvec[msg.msg_iovlen].iov_len = len;
+	  msg.msg_iovlen++;
+	}
+      } else {
+	msgvec[msg.msg_iovlen].iov_base = (void*)p;
+	msgvec[msg.msg_iovlen].iov_len = len;
+	msg.msg_iovlen++;
+      }
+      msglen += len;
     }
-    assert(donow > 0);
-    ldout(msgr->cct,30) << " bl_pos " << bl_pos << " b_off " << b_off
-	     << " leftinchunk " << left
-	     << " buffer len " << pb->length()
-	     << " writing " << donow 
-	     << dendl;
-    
-    if (msg.msg_iovlen >= IOV_MAX-2) {
-      if (do_sendmsg(&msg, msglen, true))
+
+    if (vec_zc) {
+      if (do_sendmsg(&msg, msglen, true, &blist))
 	goto fail;
-      
-      // and restart the iov
       msg.msg_iov = msgvec;
       msg.msg_iovlen = 0;
       msglen = 0;
     }
-    
-    msgvec[msg.msg_iovlen].iov_base = (void*)(pb->c_str()+b_off);
-    msgvec[msg.msg_iovlen].iov_len = donow;
-    msglen += donow;
-    msg.msg_iovlen++;
-    
-    left -= donow;
-    assert(left >= 0);
-    b_off += donow;
-    bl_pos += donow;
-    if (left == 0)
-      break;
-    while (b_off == (int)pb->length()) {
-      pb++;
-      b_off = 0;
-    }
   }
-  assert(left == 0);
 
   // send footer
   msgvec[msg.msg_iovlen].iov_base = (void*)&footer;
@@ -1794,6 +2029,8 @@ int Pipe::tcp_read_wait()
 {
   if (sd < 0)
     return -1;
+  if (has_pending_data())
+    return 0;
   struct pollfd pfd;
   short evmask;
   pfd.fd = sd;
@@ -1802,9 +2039,14 @@ int Pipe::tcp_read_wait()
   pfd.events |= POLLRDHUP;
 #endif
 
+ again:
   if (poll(&pfd, 1, msgr->timeout) <= 0)
     return -1;
 
+  // zerocopy completions show up as POLLERR; reap them and look again
+  if ((pfd.revents & POLLERR) && zerocopy_reap())
+    goto again;
+
   evmask = POLLERR | POLLHUP | POLLNVAL;
 #if defined(__linux__)
   evmask |= POLLRDHUP;
@@ -1820,6 +2062,16 @@ int Pipe::tcp_read_wait()
 
 int Pipe::tcp_read_nonblocking(char *buf, int len)
 {
+  if (!has_pending_data() && len < msgr->cct->_conf->ms_tcp_prefetch_max_size &&
+      tcp_prefetch() < 0)
+    return -1;
+  if (has_pending_data()) {
+    int got = MIN(recv_len - recv_ofs, len);
+    memcpy(buf, recv_buf + recv_ofs, got);
+    recv_ofs += got;
+    return got;
+  }
+
 again:
   int got = ::recv( sd, buf, len, MSG_DONTWAIT );
   if (got < 0) {
@@ -1840,6 +2092,31 @@ again:
   return got;
 }
 
+int Pipe::tcp_prefetch()
+{
+  assert(!has_pending_data());
+  if (!recv_buf) {
+    recv_max_prefetch = msgr->cct->_conf->ms_tcp_prefetch_max_size;
+    recv_buf = new char[recv_max_prefetch];
+  }
+  recv_ofs = recv_len = 0;
+  int got;
+  do {
+    got = ::recv(sd, recv_buf, recv_max_prefetch, MSG_DONTWAIT);
+  } while (got < 0 && errno == EINTR);
+  if (got < 0) {
+    if (errno == EAGAIN)
+      return 0;
+    ldout(msgr->cct, 10) << "tcp_prefetch socket " << sd << " returned "
+			 << got << " errno " << errno << " " << cpp_strerror(errno) << dendl;
+    return -1;
+  }
+  if (got == 0)
+    return -1;  // the peer sent a FIN
+  recv_len = got;
+  return got;
+}
+
 int Pipe::tcp_write(const char *buf, int len)
 {
   if (sd < 0)
@@ -19,6 +19,7 @@
 #include "Messenger.h"
 
 class SimpleMessenger;
+class EventMessenger;
 class IncomingQueue;
 class DispatchQueue;
 
@@ -30,6 +31,10 @@ class DispatchQueue;
    * propagating socket errors to the SimpleMessenger and then sticking
    * around in a state where it can provide enough data for the SimpleMessenger
    * to provide reliable Message delivery when it manages to reconnect.
+   *
+   * With an EventMessenger the reader and writer do not get threads of
+   * their own; they are run on the messenger's worker pools, and return
+   * wherever they would otherwise block waiting for something to do.
    */
   class Pipe : public RefCountedObject {
     /**
@@ -102,6 +107,7 @@ class DispatchQueue;
 
   protected:
     friend class SimpleMessenger;
+    friend class EventMessenger;
     Connection *connection_state;
 
     utime_t backoff;         // backoff time
@@ -109,6 +115,60 @@ class DispatchQueue;
     bool reader_running, reader_joining;
     bool writer_running;
 
+    /// where the reader or writer is, for an EventMessenger
+    enum {
+      EV_IDLE,     // waiting for wake_pipe()
+      EV_ARMED,    // reader waiting for the socket to become readable
+      EV_QUEUED,   // waiting for a worker
+      EV_RUNNING,  // on a worker
+      EV_THROTTLE  // reader waiting for a throttle worker to get its bytes
+    };
+    int reader_ev, writer_ev;
+    bool reader_handshake, writer_handshake;  // run by the handshake workers
+    int reader_budget, writer_budget;  // messages left before yielding
+    bool backoff_pending;  // writer waits for the reconnect backoff
+
+    /**
+     * The message the reader has read the header of, until it has the
+     * throttle bytes for it. An EventMessenger reader returns rather than
+     * wait for them, and carries on from here when it is run again.
+     */
+    bool in_pending;
+    ceph_msg_header in_header;
+    utime_t in_recv_stamp;
+    bool in_policy_throttled, in_dispatch_throttled;  // bytes taken so far
+    Throttle *in_throttle_wait;  // the throttle it waits for
+    uint64_t in_pending_gen;     // bumped each time in_pending is discarded
+
+    uint64_t in_pending_size() {
+      return in_header.front_len + in_header.middle_len + in_header.data_len;
+    }
+    /// drop in_pending, releasing its throttle bytes; pipe_lock held
+    void discard_in_pending();
+
+    /// write_message() copies tiny segments here, to send them as one
+    char *send_scratch;
+
+    /**
+     * Bytes received ahead of the reads that will want them. A small
+     * read takes what else is waiting on the socket too, so that the rest
+     * of the message, and the next ones, need no syscalls.
+     */
+    char *recv_buf;
+    int recv_max_prefetch;  // size of recv_buf
+    int recv_ofs, recv_len;
+
+    /**
+     * MSG_ZEROCOPY sends the kernel may still be reading from, by the id
+     * it gave them, with the buffers to keep until it is done. The reader
+     * reaps completions too (they make the socket poll with POLLERR), so
+     * these have a lock of their own.
+     */
+    Mutex zc_lock;
+    bool zc_enabled;    // send large segments with MSG_ZEROCOPY
+    uint32_t zc_next;   // id of the next zerocopy send on sd
+    map<uint32_t, bufferlist> zc_pending;
+
     map<int, list<Message*> > out_q;  // priority queue for outbound msgs
     IncomingQueue *in_q;
     list<Message*> sent;
@@ -138,14 +198,31 @@ class DispatchQueue;
      * @param msg The msghdr to write out
      * @param len The length of the data in msg
      * @param more Should be set true if this is one part of a larger message
+     * @param zc If set, send with MSG_ZEROCOPY, and keep zc until the
+     * kernel is done with it
      * @return 0, or -1 on failure (unrecoverable -- close the socket).
      */
-    int do_sendmsg(struct msghdr *msg, int len, bool more=false);
+    int do_sendmsg(struct msghdr *msg, int len, bool more=false,
+		   bufferlist *zc=NULL);
     int write_ack(uint64_t s);
     int write_keepalive();
 
+    /// turn on MSG_ZEROCOPY for a new sd, if configured and supported
+    void zerocopy_init();
+    /// forget the zerocopy sends on sd, which is about to be closed
+    void zerocopy_reset();
+    /**
+     * Release the buffers of the zerocopy sends the kernel is done with.
+     *
+     * @return true if there were any completions on the error queue
+     */
+    bool zerocopy_reap();
+
     void fault(bool reader=false);
 
+    /// wake the reader and writer: their state or queues changed
+    void _wake();
+
     void was_session_reset();
 
     /* Clean up sent list */
@@ -209,11 +286,11 @@ class DispatchQueue;
     }
     void _send(Message *m) {
       out_q[m->get_priority()].push_back(m);
-      cond.Signal();
+      _wake();
     }
     void _send_keepalive() {
       keepalive = true;
-      cond.Signal();
+      _wake();
     }
     Message *_get_next_outgoing() {
       Message *m = 0;
@@ -267,6 +344,19 @@ class DispatchQueue;
      */
     int tcp_read_nonblocking(char *buf, int len);
 
+    /// true if there are prefetched bytes left to read
+    bool has_pending_data() {
+      return recv_len > recv_ofs;
+    }
+
+    /**
+     * non-blocking read of what is available on the socket into the
+     * (empty) prefetch buffer
+     *
+     * @return bytes read, 0 if there are none yet, or -1 on error
+     */
+    int tcp_prefetch();
+
     /**
      * blocking write of bytes to socket
      *
@@ -48,6 +48,9 @@ SimpleMessenger::SimpleMessenger(CephContext *cct, entity_name_t name,
     cluster_protocol(0),
     policy_lock("SimpleMessenger::policy_lock"),
     dispatch_throttler(cct, string("msgr_dispatch_throttler-") + mname, cct->_conf->ms_dispatch_throttle_bytes),
+    rx_pool(new BufferPool(cct, string("msgr_rx-") + mname,
+			   cct->_conf->ms_rx_pool_max_buffer,
+			   cct->_conf->ms_rx_pool_bytes)),
     reaper_started(false), reaper_stop(false),
     timeout(0),
     local_connection(new Connection)
@@ -66,6 +69,9 @@ SimpleMessenger::~SimpleMessenger()
   assert(rank_pipe.empty()); // we don't have any running Pipes.
   assert(reaper_stop && !reaper_started); // the reaper thread is stopped
   delete local_connection;
+  // messages we received may still hold its buffers
+  rx_pool->shutdown();
+  rx_pool->put();
 }
 
 void SimpleMessenger::ready()
@@ -294,6 +300,45 @@ int SimpleMessenger::start()
   return 0;
 }
 
+void SimpleMessenger::start_pipe_reader(Pipe *pipe)
+{
+  pipe->reader_thread.create(cct->_conf->ms_rwthread_stack_bytes);
+}
+
+void SimpleMessenger::start_pipe_writer(Pipe *pipe)
+{
+  pipe->writer_thread.create(cct->_conf->ms_rwthread_stack_bytes);
+}
+
+void SimpleMessenger::join_pipe_reader(Pipe *pipe)
+{
+  pipe->pipe_lock.Unlock();
+  pipe->reader_thread.join();
+  pipe->pipe_lock.Lock();
+}
+
+void SimpleMessenger::wake_pipe(Pipe *pipe)
+{
+  pipe->cond.Signal();
+}
+
+bool SimpleMessenger::pipe_sleep(Pipe *pipe, bool writer)
+{
+  pipe->cond.Wait(pipe->pipe_lock);
+  return true;
+}
+
+bool SimpleMessenger::pipe_throttle(Pipe *pipe, Throttle *t, uint64_t c)
+{
+  t->get(c);
+  return true;
+}
+
+void SimpleMessenger::pipe_backoff(Pipe *pipe, utime_t t)
+{
+  pipe->cond.WaitInterval(cct, pipe->pipe_lock, t);
+}
+
 Pipe *SimpleMessenger::add_accept_pipe(int sd)
 {
   lock.Lock();
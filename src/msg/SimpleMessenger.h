@@ -30,6 +30,7 @@ using namespace __gnu_cxx;
 #include "common/Cond.h"
 #include "common/Thread.h"
 #include "common/Throttle.h"
+#include "common/BufferPool.h"
 
 #include "Messenger.h"
 #include "Message.h"
@@ -515,6 +516,9 @@ private:
   /// Throttle preventing us from building up a big backlog waiting for dispatch
   Throttle dispatch_throttler;
 
+  /// recycles the memory of the buffers Pipes read messages into
+  BufferPool *rx_pool;
+
   bool reaper_started, reaper_stop;
   Cond reaper_cond;
 
@@ -628,6 +632,63 @@ public:
    * ready to be torn down.
    */
   void queue_reap(Pipe *pipe);
+
+  /**
+   * @defgroup Running Pipes
+   *
+   * The SimpleMessenger runs the reader and the writer of each Pipe in
+   * threads of their own, which block on the socket and on Pipe::cond
+   * whenever they have nothing to do. A subclass may run them some other
+   * way, by overriding these. All of them are called with the Pipe's
+   * pipe_lock held.
+   * @{
+   */
+  /// start running pipe->reader()
+  virtual void start_pipe_reader(Pipe *pipe);
+  /// start running pipe->writer()
+  virtual void start_pipe_writer(Pipe *pipe);
+  /**
+   * Wait for pipe->reader() to finish. It has been told to (its state is
+   * no longer one it reads in). This drops the pipe_lock while it waits.
+   */
+  virtual void join_pipe_reader(Pipe *pipe);
+  /// something changed that the reader or writer of pipe may wait for
+  virtual void wake_pipe(Pipe *pipe);
+  /**
+   * Wait for wake_pipe(), dropping the pipe_lock meanwhile.
+   *
+   * @param writer true for the writer, false for the reader
+   * @return true when woken, or false if the caller should instead
+   * return; it is run again when woken.
+   */
+  virtual bool pipe_sleep(Pipe *pipe, bool writer);
+  /**
+   * Called before reading, or after writing, each message.
+   *
+   * @return true to carry on, or false if the caller should return; it
+   * is run again when it has something to do.
+   */
+  virtual bool pipe_continue(Pipe *pipe, bool writer) { return true; }
+  /**
+   * Called before the reader accepts, or the writer connects.
+   *
+   * @return true to go ahead, or false if the caller should return; it
+   * is run again to do the handshake.
+   */
+  virtual bool pipe_handshake(Pipe *pipe, bool writer) { return true; }
+  /**
+   * Take c bytes from t for the message the reader of pipe has read the
+   * header of. Called without the pipe_lock.
+   *
+   * @return true once they are taken, or false if the reader should
+   * return; it is run again once they are.
+   */
+  virtual bool pipe_throttle(Pipe *pipe, Throttle *t, uint64_t c);
+  /// the writer waits for t before trying to reconnect
+  virtual void pipe_backoff(Pipe *pipe, utime_t t);
+  /**
+   * @} // Running Pipes
+   */
   /**
    * @} // SimpleMessenger Internals
    */
@@ -121,6 +121,47 @@ protected:
    */
   virtual int cleanup() = 0;
 
+  /**
+   * True if created() left a reorganization for split_step() to do
+   *
+   * Indexes which defer splitting their directories report so here
+   * rather than doing the work inline in created().
+   */
+  virtual bool split_pending() { return false; }
+
+  /**
+   * Advance a deferred reorganization of the collection
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int split_step(
+    bool *done ///< [out] True if nothing is left to do
+    ) {
+    *done = true;
+    return 0;
+  }
+
+  /**
+   * Prepare the collection directory to be removed
+   *
+   * Removes any directories the index keeps below an otherwise empty
+   * collection.
+   *
+   * @return Error Code, -ENOTEMPTY if the collection holds objects
+   */
+  virtual int prep_delete() { return 0; }
+
+  /**
+   * Remove any stale link to hoid the index keeps besides its own
+   *
+   * A directory split in progress may leave a second link to an object
+   * behind in the directory being split.  Call before removing hoid, so
+   * that the link count of the object's file only counts real links.
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int remove_stale_copy(const hobject_t &hoid) { return 0; }
+
   /**
    * Call when a file is created using a path returned from lookup.
    *
@@ -19,6 +19,7 @@
 
 #include "common/debug.h"
 #include "common/config.h"
+#include "common/perf_counters.h"
 #include "include/assert.h"
 
 #define dout_subsys ceph_subsys_filestore
@@ -77,8 +78,39 @@ static bool append_unescaped(string::const_iterator begin,
   return true;
 }
 
+DBObjectMap::DBObjectMap(KeyValueDB *db)
+  : db(db),
+    header_lock("DBOBjectMap"),
+    removed_seq_min(0), removed_seq_max(0),
+    batch_lock("DBObjectMap::batch_lock"),
+    pending_lock("DBObjectMap::pending_lock")
+{
+  const size_t shards = 16;
+  size_t size = g_conf->filestore_omap_header_cache_size;
+  for (size_t i = 0; i < shards; ++i)
+    header_cache.push_back(new HeaderCacheShard(
+			     size ? MAX(size / shards, 1) : 0));
+
+  PerfCountersBuilder b(g_ceph_context, "dbobjectmap",
+			l_dbom_first, l_dbom_last);
+  b.add_u64_counter(l_dbom_header_cache_hit, "header_cache_hit");
+  b.add_u64_counter(l_dbom_header_cache_miss, "header_cache_miss");
+  logger = b.create_perf_counters();
+  g_ceph_context->get_perfcounters_collection()->add(logger);
+}
+
+DBObjectMap::~DBObjectMap()
+{
+  g_ceph_context->get_perfcounters_collection()->remove(logger);
+  delete logger;
+  for (size_t i = 0; i < header_cache.size(); ++i)
+    delete header_cache[i];
+}
+
 bool DBObjectMap::check(std::ostream &out)
 {
+  if (flush_batch() < 0)
+    return false;
   bool retval = true;
   map<uint64_t, uint64_t> parent_to_num_children;
   map<uint64_t, uint64_t> parent_to_actual_num_children;
@@ -316,6 +348,8 @@ int DBObjectMap::DBObjectMapIteratorImpl::init()
 ObjectMap::ObjectMapIterator DBObjectMap::get_iterator(
   const hobject_t &hoid)
 {
+  if (flush_batch() < 0)
+    return ObjectMapIterator(new EmptyIteratorImpl());
   Header header = lookup_map_header(hoid);
   if (!header)
     return ObjectMapIterator(new EmptyIteratorImpl());
@@ -503,8 +537,9 @@ int DBObjectMap::set_keys(const hobject_t &hoid,
 			  const map<string, bufferlist> &set,
 			  const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  Batch *b = get_batch();
+  KeyValueDB::Transaction t = get_transaction(b);
+  Header header = lookup_create_map_header(hoid, t, b);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
@@ -512,21 +547,22 @@ int DBObjectMap::set_keys(const hobject_t &hoid,
 
   t->set(user_prefix(header), set);
 
-  return db->submit_transaction(t);
+  return submit_transaction(t, b);
 }
 
 int DBObjectMap::set_header(const hobject_t &hoid,
 			    const bufferlist &bl,
 			    const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  Batch *b = get_batch();
+  KeyValueDB::Transaction t = get_transaction(b);
+  Header header = lookup_create_map_header(hoid, t, b);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
   _set_header(header, bl, t);
-  return db->submit_transaction(t);
+  return submit_transaction(t, b);
 }
 
 void DBObjectMap::_set_header(Header header, const bufferlist &bl,
@@ -540,6 +576,9 @@ void DBObjectMap::_set_header(Header header, const bufferlist &bl,
 int DBObjectMap::get_header(const hobject_t &hoid,
 			    bufferlist *bl)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header) {
     return 0;
@@ -575,6 +614,9 @@ int DBObjectMap::_get_header(Header header,
 int DBObjectMap::clear(const hobject_t &hoid,
 		       const SequencerPosition *spos)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   KeyValueDB::Transaction t = db->get_transaction();
   Header header = lookup_map_header(hoid);
   if (!header)
@@ -584,10 +626,12 @@ int DBObjectMap::clear(const hobject_t &hoid,
   remove_map_header(hoid, header, t);
   assert(header->num_children > 0);
   header->num_children--;
-  int r = _clear(header, t);
-  if (r < 0)
+  r = _clear(header, t);
+  if (r < 0) {
+    finish_map_headers(t, r);
     return r;
-  return db->submit_transaction(t);
+  }
+  return submit(t);
 }
 
 int DBObjectMap::_clear(Header header,
@@ -697,15 +741,24 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
 			 const set<string> &to_clear,
 			 const SequencerPosition *spos)
 {
-  Header header = lookup_map_header(hoid);
+  Batch *b = get_batch();
+  Header header = lookup_map_header(hoid, b);
   if (!header)
     return -ENOENT;
-  KeyValueDB::Transaction t = db->get_transaction();
+  if (b && header->parent) {
+    // copying up from the parent reads our own keys, which may be
+    // sitting in the batch
+    int r = flush_batch(b);
+    if (r < 0)
+      return r;
+    b = 0;
+  }
+  KeyValueDB::Transaction t = get_transaction(b);
   if (check_spos(hoid, header, spos))
     return 0;
   t->rmkeys(user_prefix(header), to_clear);
   if (!header->parent) {
-    return db->submit_transaction(t);
+    return submit_transaction(t, b);
   }
 
   // Copy up keys from parent around to_clear
@@ -765,13 +818,16 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
     set_map_header(hoid, *header, t);
     t->rmkeys_by_prefix(complete_prefix(header));
   }
-  return db->submit_transaction(t);
+  return submit(t);
 }
 
 int DBObjectMap::get(const hobject_t &hoid,
 		     bufferlist *_header,
 		     map<string, bufferlist> *out)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -788,6 +844,9 @@ int DBObjectMap::get(const hobject_t &hoid,
 int DBObjectMap::get_keys(const hobject_t &hoid,
 			  set<string> *keys)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -826,6 +885,9 @@ int DBObjectMap::get_values(const hobject_t &hoid,
 			    const set<string> &keys,
 			    map<string, bufferlist> *out)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -836,6 +898,9 @@ int DBObjectMap::check_keys(const hobject_t &hoid,
 			    const set<string> &keys,
 			    set<string> *out)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -846,6 +911,9 @@ int DBObjectMap::get_xattrs(const hobject_t &hoid,
 			    const set<string> &to_get,
 			    map<string, bufferlist> *out)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -855,6 +923,9 @@ int DBObjectMap::get_xattrs(const hobject_t &hoid,
 int DBObjectMap::get_all_xattrs(const hobject_t &hoid,
 				set<string> *out)
 {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -870,28 +941,30 @@ int DBObjectMap::set_xattrs(const hobject_t &hoid,
 			    const map<string, bufferlist> &to_set,
 			    const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  Batch *b = get_batch();
+  KeyValueDB::Transaction t = get_transaction(b);
+  Header header = lookup_create_map_header(hoid, t, b);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
   t->set(xattr_prefix(header), to_set);
-  return db->submit_transaction(t);
+  return submit_transaction(t, b);
 }
 
 int DBObjectMap::remove_xattrs(const hobject_t &hoid,
 			       const set<string> &to_remove,
 			       const SequencerPosition *spos)
 {
-  KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_map_header(hoid);
+  Batch *b = get_batch();
+  Header header = lookup_map_header(hoid, b);
   if (!header)
     return -ENOENT;
+  KeyValueDB::Transaction t = get_transaction(b);
   if (check_spos(hoid, header, spos))
     return 0;
   t->rmkeys(xattr_prefix(header), to_remove);
-  return db->submit_transaction(t);
+  return submit_transaction(t, b);
 }
 
 int DBObjectMap::clone(const hobject_t &hoid,
@@ -901,13 +974,16 @@ int DBObjectMap::clone(const hobject_t &hoid,
   if (hoid == target)
     return 0;
 
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   KeyValueDB::Transaction t = db->get_transaction();
   {
     Header destination = lookup_map_header(target);
     if (destination) {
-      remove_map_header(target, destination, t);
       if (check_spos(target, destination, spos))
 	return 0;
+      remove_map_header(target, destination, t);
       destination->num_children--;
       _clear(destination, t);
     }
@@ -915,7 +991,7 @@ int DBObjectMap::clone(const hobject_t &hoid,
 
   Header parent = lookup_map_header(hoid);
   if (!parent)
-    return db->submit_transaction(t);
+    return submit(t);
 
   Header source = generate_new_header(hoid, parent);
   Header destination = generate_new_header(target, parent);
@@ -936,7 +1012,7 @@ int DBObjectMap::clone(const hobject_t &hoid,
   t->set(xattr_prefix(source), to_set);
   t->set(xattr_prefix(destination), to_set);
   t->rmkeys_by_prefix(xattr_prefix(parent));
-  return db->submit_transaction(t);
+  return submit(t);
 }
 
 int DBObjectMap::upgrade()
@@ -1044,8 +1120,28 @@ int DBObjectMap::init(bool do_upgrade)
   return 0;
 }
 
+void DBObjectMap::compact()
+{
+  uint64_t min, max;
+  {
+    Mutex::Locker l(header_lock);
+    min = removed_seq_min;
+    max = removed_seq_max;
+    removed_seq_min = removed_seq_max = 0;
+  }
+  if (!max)
+    return;
+  dout(10) << "compact: seq " << min << " to " << max << dendl;
+  // header_key() is fixed width, so each header's prefixes sort by seq
+  db->compact_range(USER_PREFIX + header_key(min),
+		    USER_PREFIX + header_key(max + 1));
+}
+
 int DBObjectMap::sync(const hobject_t *hoid,
 		      const SequencerPosition *spos) {
+  int r = flush_batch();
+  if (r < 0)
+    return r;
   KeyValueDB::Transaction t = db->get_transaction();
   write_state(t);
   if (hoid) {
@@ -1058,7 +1154,65 @@ int DBObjectMap::sync(const hobject_t *hoid,
       set_map_header(*hoid, *header, t);
     }
   }
-  return db->submit_transaction_sync(t);
+  return submit(t, true);
+}
+
+void DBObjectMap::start_batch()
+{
+  Mutex::Locker l(batch_lock);
+  Batch *&b = batches[pthread_self()];
+  assert(!b);
+  b = new Batch(db->get_transaction());
+}
+
+int DBObjectMap::end_batch()
+{
+  Batch *b;
+  {
+    Mutex::Locker l(batch_lock);
+    map<pthread_t, Batch*>::iterator p = batches.find(pthread_self());
+    assert(p != batches.end());
+    b = p->second;
+    batches.erase(p);
+  }
+  int r = flush_batch(b);
+  delete b;
+  return r;
+}
+
+DBObjectMap::Batch *DBObjectMap::get_batch()
+{
+  Mutex::Locker l(batch_lock);
+  map<pthread_t, Batch*>::iterator p = batches.find(pthread_self());
+  return p == batches.end() ? 0 : p->second;
+}
+
+KeyValueDB::Transaction DBObjectMap::get_transaction(Batch *b)
+{
+  if (!b)
+    return db->get_transaction();
+  b->ops++;
+  return b->t;
+}
+
+int DBObjectMap::submit_transaction(KeyValueDB::Transaction t, Batch *b)
+{
+  if (b)
+    return 0;
+  return submit(t);
+}
+
+int DBObjectMap::flush_batch(Batch *b)
+{
+  if (!b->ops)
+    return 0;
+  dout(20) << "flush_batch submitting " << b->ops << " ops on "
+	   << b->headers.size() << " objects" << dendl;
+  int r = submit(b->t);
+  b->t = db->get_transaction();
+  b->headers.clear();
+  b->ops = 0;
+  return r;
 }
 
 int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
@@ -1073,10 +1227,22 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 }
 
 
-DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
+DBObjectMap::Header DBObjectMap::read_map_header(const hobject_t &hoid)
 {
-  while (map_header_in_use.count(hoid))
-    header_cond.Wait(header_lock);
+  HeaderCacheShard *shard = get_header_cache(hoid);
+  uint64_t gen;
+  {
+    Mutex::Locker l(shard->lock);
+    _Header cached;
+    if (shard->lru.lookup(hoid, &cached)) {
+      logger->inc(l_dbom_header_cache_hit);
+      if (!cached.seq)
+	return Header();
+      return Header(new _Header(cached));
+    }
+    gen = shard->gen;
+  }
+  logger->inc(l_dbom_header_cache_miss);
 
   map<string, bufferlist> out;
   set<string> to_get;
@@ -1084,13 +1250,22 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
   int r = db->get(HOBJECT_TO_SEQ, to_get, &out);
   if (r < 0)
     return Header();
-  if (!out.size())
+  _Header found;
+  if (out.size()) {
+    bufferlist::iterator iter = out.begin()->second.begin();
+    found.decode(iter);
+  }
+
+  {
+    // an update noted since we looked may already be committed, or may
+    // commit after the read above; either way what we read may be stale
+    Mutex::Locker l(shard->lock);
+    if (shard->gen == gen && !shard->pending.count(hoid))
+      shard->lru.add(hoid, found);
+  }
+  if (!found.seq)
     return Header();
-  
-  Header ret(new _Header(), RemoveMapHeaderOnDelete(this, hoid));
-  bufferlist::iterator iter = out.begin()->second.begin();
-  ret->decode(iter);
-  return ret;
+  return Header(new _Header(found));
 }
 
 DBObjectMap::Header DBObjectMap::_generate_new_header(const hobject_t &hoid,
@@ -1142,22 +1317,54 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
   return header;
 }
 
+DBObjectMap::Header DBObjectMap::lookup_map_header(const hobject_t &hoid,
+						   Batch *b)
+{
+  if (b) {
+    map<hobject_t, Header>::iterator p = b->headers.find(hoid);
+    if (p != b->headers.end())
+      return p->second;
+  }
+  Header header = read_map_header(hoid);
+  if (b && header)
+    b->headers[hoid] = header;
+  return header;
+}
+
 DBObjectMap::Header DBObjectMap::lookup_create_map_header(
   const hobject_t &hoid,
-  KeyValueDB::Transaction t)
+  KeyValueDB::Transaction t,
+  Batch *b)
 {
-  Mutex::Locker l(header_lock);
-  Header header = _lookup_map_header(hoid);
-  if (!header) {
-    header = _generate_new_header(hoid, Header());
-    set_map_header(hoid, *header, t);
+  if (b) {
+    map<hobject_t, Header>::iterator p = b->headers.find(hoid);
+    if (p != b->headers.end())
+      return p->second;
   }
+  Header header;
+  {
+    Mutex::Locker l(header_lock);
+    header = read_map_header(hoid);
+    if (!header) {
+      header = _generate_new_header(hoid, Header());
+      set_map_header(hoid, *header, t);
+    }
+  }
+  if (b)
+    b->headers[hoid] = header;
   return header;
 }
 
 void DBObjectMap::clear_header(Header header, KeyValueDB::Transaction t)
 {
   dout(20) << "clear_header: clearing seq " << header->seq << dendl;
+  {
+    Mutex::Locker l(header_lock);
+    if (!removed_seq_max || header->seq < removed_seq_min)
+      removed_seq_min = header->seq;
+    if (header->seq > removed_seq_max)
+      removed_seq_max = header->seq;
+  }
   t->rmkeys_by_prefix(user_prefix(header));
   t->rmkeys_by_prefix(sys_prefix(header));
   t->rmkeys_by_prefix(complete_prefix(header));
@@ -1184,6 +1391,7 @@ void DBObjectMap::remove_map_header(const hobject_t &hoid,
   set<string> to_remove;
   to_remove.insert(map_header_key(hoid));
   t->rmkeys(HOBJECT_TO_SEQ, to_remove);
+  note_map_header(hoid, _Header(), t);
 }
 
 void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
@@ -1195,6 +1403,61 @@ void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(hoid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
+  note_map_header(hoid, header, t);
+}
+
+void DBObjectMap::note_map_header(const hobject_t &hoid,
+				  const _Header &header,
+				  KeyValueDB::Transaction t)
+{
+  bool first;
+  {
+    Mutex::Locker l(pending_lock);
+    map<hobject_t, _Header> &headers = pending_headers[t];
+    first = !headers.count(hoid);
+    headers[hoid] = header;
+  }
+  HeaderCacheShard *shard = get_header_cache(hoid);
+  Mutex::Locker l(shard->lock);
+  shard->lru.clear(hoid);
+  shard->gen++;
+  if (first)
+    shard->pending[hoid]++;
+}
+
+void DBObjectMap::finish_map_headers(KeyValueDB::Transaction t, int r)
+{
+  map<hobject_t, _Header> headers;
+  {
+    Mutex::Locker l(pending_lock);
+    map<KeyValueDB::Transaction, map<hobject_t, _Header> >::iterator p =
+      pending_headers.find(t);
+    if (p == pending_headers.end())
+      return;
+    headers.swap(p->second);
+    pending_headers.erase(p);
+  }
+  for (map<hobject_t, _Header>::iterator i = headers.begin();
+       i != headers.end();
+       ++i) {
+    HeaderCacheShard *shard = get_header_cache(i->first);
+    Mutex::Locker l(shard->lock);
+    shard->gen++;
+    map<hobject_t, int>::iterator p = shard->pending.find(i->first);
+    assert(p != shard->pending.end());
+    if (--p->second > 0)
+      continue;  // a later update is still in flight
+    shard->pending.erase(p);
+    if (r >= 0)
+      shard->lru.add(i->first, i->second);
+  }
+}
+
+int DBObjectMap::submit(KeyValueDB::Transaction t, bool sync)
+{
+  int r = sync ? db->submit_transaction_sync(t) : db->submit_transaction(t);
+  finish_map_headers(t, r);
+  return r;
 }
 
 bool DBObjectMap::check_spos(const hobject_t &hoid,
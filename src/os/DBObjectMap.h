@@ -17,6 +17,16 @@
 #include "osd/osd_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/simple_cache.hpp"
+
+class PerfCounters;
+
+enum {
+  l_dbom_first = 85000,
+  l_dbom_header_cache_hit,
+  l_dbom_header_cache_miss,
+  l_dbom_last,
+};
 
 /**
  * DBObjectMap: Implements ObjectMap in terms of KeyValueDB
@@ -61,17 +71,20 @@ public:
    */
   Mutex header_lock;
   Cond header_cond;
-  Cond map_header_cond;
 
   /**
    * Set of headers currently in use
    */
   set<uint64_t> in_use;
-  set<hobject_t> map_header_in_use;
 
-  DBObjectMap(KeyValueDB *db) : db(db),
-				header_lock("DBOBjectMap")
-    {}
+  /**
+   * Span of header seqs cleared since the last compact(), protected by
+   * header_lock.  removed_seq_max == 0 iff nothing has been cleared.
+   */
+  uint64_t removed_seq_min, removed_seq_max;
+
+  DBObjectMap(KeyValueDB *db);
+  ~DBObjectMap();
 
   int set_keys(
     const hobject_t &hoid,
@@ -165,6 +178,12 @@ public:
   /// Ensure that all previous operations are durable
   int sync(const hobject_t *hoid=0, const SequencerPosition *spos=0);
 
+  void start_batch();
+  int end_batch();
+
+  /// Compact the key range freed by headers cleared since the last call
+  void compact();
+
   ObjectMapIterator get_iterator(const hobject_t &hoid);
 
   static const string USER_PREFIX;
@@ -274,6 +293,87 @@ private:
   /// Implicit lock on Header->seq
   typedef std::tr1::shared_ptr<_Header> Header;
 
+  /**
+   * Mutations accumulated by one thread between start_batch() and
+   * end_batch()
+   *
+   * Only mutations confined to the object's own prefixes (set_keys,
+   * set_header, rm_keys without a parent, set_xattrs, remove_xattrs)
+   * are batched; they do not read anything the batch might have
+   * changed other than the object's header, which is kept in headers.
+   * Everything else flushes the batch first.
+   */
+  struct Batch {
+    KeyValueDB::Transaction t;
+    map<hobject_t, Header> headers; ///< headers of objects mutated in t
+    unsigned ops;                   ///< mutations in t
+    Batch(KeyValueDB::Transaction t) : t(t), ops(0) {}
+  };
+
+  /// Protects batches
+  Mutex batch_lock;
+  map<pthread_t, Batch*> batches;
+
+  /**
+   * Cache of committed HOBJECT_TO_SEQ entries, sharded by hoid
+   *
+   * Each shard is protected by its own lock; header_lock is not needed
+   * to use the cache.  set_map_header/remove_map_header drop the entry
+   * and count the update as pending until the transaction carrying it
+   * has been submitted (@see finish_map_headers), which caches the new
+   * value.  A lookup that misses fills the entry in only if no update
+   * to hoid was noted while it read the db.  An entry with seq 0
+   * records that hoid has no header.
+   */
+  struct HeaderCacheShard {
+    Mutex lock;
+    SimpleLRU<hobject_t, _Header> lru;
+    map<hobject_t, int> pending; ///< uncommitted updates, by hoid
+    uint64_t gen;                ///< bumped by every update
+    HeaderCacheShard(size_t size)
+      : lock("DBObjectMap::HeaderCacheShard::lock"), lru(size), gen(0) {}
+  };
+  vector<HeaderCacheShard*> header_cache;
+  HeaderCacheShard *get_header_cache(const hobject_t &hoid) {
+    return header_cache[__gnu_cxx::hash<hobject_t>()(hoid) %
+			header_cache.size()];
+  }
+
+  /// Protects pending_headers
+  Mutex pending_lock;
+  /// Map header updates carried by each transaction not yet submitted
+  map<KeyValueDB::Transaction, map<hobject_t, _Header> > pending_headers;
+
+  /// Record that t sets hoid's map header (seq 0 if it removes it)
+  void note_map_header(const hobject_t &hoid, const _Header &header,
+		       KeyValueDB::Transaction t);
+
+  /// t was submitted with result r (< 0 if dropped); cache its headers
+  void finish_map_headers(KeyValueDB::Transaction t, int r);
+
+  /// Submit t, then cache the map headers it set
+  int submit(KeyValueDB::Transaction t, bool sync = false);
+
+  PerfCounters *logger;
+
+  /// Batch opened by the calling thread, NULL if none
+  Batch *get_batch();
+
+  /// Transaction to add a mutation to, b's if batching
+  KeyValueDB::Transaction get_transaction(Batch *b);
+
+  /// Submit t unless it belongs to b
+  int submit_transaction(KeyValueDB::Transaction t, Batch *b);
+
+  /// Submit b's mutations and start over with an empty transaction
+  int flush_batch(Batch *b);
+
+  /// Flush the calling thread's batch, if any
+  int flush_batch() {
+    Batch *b = get_batch();
+    return b ? flush_batch(b) : 0;
+  }
+
   string map_header_key(const hobject_t &hoid);
   string header_key(uint64_t seq);
   string complete_prefix(Header header);
@@ -379,9 +479,10 @@ private:
 		  Header header,
 		  const SequencerPosition *spos);
 
-  /// Lookup or create header for c hoid
+  /// Lookup or create header for c hoid, reusing b's copy if present
   Header lookup_create_map_header(const hobject_t &hoid,
-				  KeyValueDB::Transaction t);
+				  KeyValueDB::Transaction t,
+				  Batch *b = 0);
 
   /**
    * Generate new header for c hoid with new seq number
@@ -394,12 +495,9 @@ private:
     return _generate_new_header(hoid, parent);
   }
 
-  /// Lookup leaf header for c hoid
-  Header _lookup_map_header(const hobject_t &hoid);
-  Header lookup_map_header(const hobject_t &hoid) {
-    Mutex::Locker l(header_lock);
-    return _lookup_map_header(hoid);
-  }
+  /// Lookup leaf header for c hoid, through the header cache
+  Header read_map_header(const hobject_t &hoid);
+  Header lookup_map_header(const hobject_t &hoid, Batch *b = 0);
 
   /// Lookup header node for input
   Header lookup_parent(Header input);
@@ -438,24 +536,6 @@ private:
   void _set_header(Header header, const bufferlist &bl,
 		   KeyValueDB::Transaction t);
 
-  /** 
-   * Removes map header lock once Header is out of scope
-   * @see lookup_map_header
-   */
-  class RemoveMapHeaderOnDelete {
-  public:
-    DBObjectMap *db;
-    hobject_t obj;
-    RemoveMapHeaderOnDelete(DBObjectMap *db, const hobject_t &obj) :
-      db(db), obj(obj) {}
-    void operator() (_Header *header) {
-      Mutex::Locker l(db->header_lock);
-      db->map_header_in_use.erase(obj);
-      db->map_header_cond.Signal();
-      delete header;
-    }
-  };
-
   /** 
    * Removes header seq lock once Header is out of scope
    * @see lookup_parent
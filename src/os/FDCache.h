@@ -0,0 +1,130 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_FDCACHE_H
+#define CEPH_FDCACHE_H
+
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "common/shared_cache.hpp"
+#include "common/Mutex.h"
+#include "include/compat.h"
+#include "include/assert.h"
+#include "os/hobject.h"
+#include "osd/osd_types.h"
+
+/**
+ * FD Cache
+ *
+ * Caches open fds for FileStore objects, keyed by collection and
+ * object.  The cache is split into shards, each a SharedLRU with its
+ * own lock, so that lookups for unrelated objects do not contend.
+ * Users hold an FDRef for the duration of the operation; the fd is
+ * closed once it has been evicted and the last ref goes away.
+ */
+class FDCache {
+public:
+  /**
+   * FD
+   *
+   * Wrapper for an fd.  Destructor closes the fd.  Also carries the
+   * read pattern seen on the object while the fd stays cached.
+   */
+  class FD {
+  public:
+    const int fd;
+
+    Mutex ra_lock;    ///< protects ra_last, ra_end
+    uint64_t ra_last; ///< end of the last read
+    uint64_t ra_end;  ///< end of the range already handed to readahead
+
+    FD(int _fd) : fd(_fd), ra_lock("FDCache::FD::ra_lock"),
+		  ra_last(0), ra_end(0) {
+      assert(_fd >= 0);
+    }
+    int operator*() const {
+      return fd;
+    }
+    ~FD() {
+      TEMP_FAILURE_RETRY(::close(fd));
+    }
+  };
+  typedef std::tr1::shared_ptr<FD> FDRef;
+  typedef pair<coll_t, hobject_t> key_t;
+
+private:
+  typedef SharedLRU<key_t, FD> shard_t;
+  vector<shard_t*> registry;
+
+  shard_t *get_shard(const hobject_t &hoid) {
+    return registry[__gnu_cxx::hash<hobject_t>()(hoid) % registry.size()];
+  }
+
+  struct MatchAll {
+    bool operator()(const key_t &k) const {
+      return true;
+    }
+  };
+  struct MatchColl {
+    coll_t cid;
+    MatchColl(const coll_t &c) : cid(c) {}
+    bool operator()(const key_t &k) const {
+      return k.first == cid;
+    }
+  };
+
+public:
+  FDCache(size_t size, size_t shards) {
+    assert(shards > 0);
+    registry.resize(shards);
+    for (size_t i = 0; i < shards; ++i) {
+      registry[i] = new shard_t;
+      registry[i]->set_size(size > shards ? size / shards : 1);
+    }
+  }
+  ~FDCache() {
+    for (size_t i = 0; i < registry.size(); ++i)
+      delete registry[i];
+  }
+
+  FDRef lookup(const coll_t &cid, const hobject_t &hoid) {
+    return get_shard(hoid)->lookup(make_pair(cid, hoid));
+  }
+
+  FDRef add(const coll_t &cid, const hobject_t &hoid, int fd) {
+    return get_shard(hoid)->add(make_pair(cid, hoid), new FD(fd));
+  }
+
+  /// drop cid/hoid from the cache; call when the name goes away
+  void clear(const coll_t &cid, const hobject_t &hoid) {
+    get_shard(hoid)->clear(make_pair(cid, hoid));
+  }
+
+  /// drop every object in cid; call when the collection is renamed/removed
+  void clear(const coll_t &cid) {
+    for (size_t i = 0; i < registry.size(); ++i)
+      registry[i]->clear_if(MatchColl(cid));
+  }
+
+  /// drop everything
+  void clear() {
+    for (size_t i = 0; i < registry.size(); ++i)
+      registry[i]->clear_if(MatchAll());
+  }
+};
+
+#endif
@@ -96,7 +96,8 @@ int FileJournal::_open(bool forwrite, bool create)
 
 #ifdef HAVE_LIBAIO
   aio_ctx = 0;
-  ret = io_setup(128, &aio_ctx);
+  // each journal write may be split into up to 3 aios (wrap + header)
+  ret = io_setup(MAX(128, 3 * aio_max_in_flight), &aio_ctx);
   if (ret < 0) {
     ret = errno;
     derr << "FileJournal::_open: unable to setup io_context " << cpp_strerror(ret) << dendl;
@@ -1118,22 +1119,35 @@ void FileJournal::write_thread_entry()
 #ifdef HAVE_LIBAIO
     if (aio) {
       Mutex::Locker locker(aio_lock);
-      // should we back off to limit aios in flight?  try to do this
-      // adaptively so that we submit larger aios once we have lots of
-      // them in flight.
-      int exp = MIN(aio_num * 2, 24);
-      long unsigned min_new = 1ull << exp;
-      long unsigned cur = throttle_bytes.get_current();
-      dout(20) << "write_thread_entry aio throttle: aio num " << aio_num << " bytes " << aio_bytes
-	      << " ... exp " << exp << " min_new " << min_new
-	       << " ... pending " << cur << dendl;
-      if (cur < min_new) {
-	dout(20) << "write_thread_entry deferring until more aios complete: "
-		 << aio_num << " aios with " << aio_bytes << " bytes needs " << min_new
-		 << " bytes to start a new aio (currently " << cur << " pending)" << dendl;
-	aio_cond.Wait(aio_lock);
-	dout(20) << "write_thread_entry woke up" << dendl;
-	continue;
+      if (aio_max_in_flight > 0) {
+	// fixed queue depth: each write covers a disjoint region of the
+	// journal, so let up to aio_max_in_flight of them proceed at
+	// once.  check_aio_completion still retires them in seq order.
+	if (aio_num >= aio_max_in_flight) {
+	  dout(20) << "write_thread_entry deferring until more aios complete: "
+		   << aio_num << " aios in flight (max " << aio_max_in_flight << ")" << dendl;
+	  aio_cond.Wait(aio_lock);
+	  dout(20) << "write_thread_entry woke up" << dendl;
+	  continue;
+	}
+      } else {
+	// should we back off to limit aios in flight?  try to do this
+	// adaptively so that we submit larger aios once we have lots of
+	// them in flight.
+	int exp = MIN(aio_num * 2, 24);
+	long unsigned min_new = 1ull << exp;
+	long unsigned cur = throttle_bytes.get_current();
+	dout(20) << "write_thread_entry aio throttle: aio num " << aio_num << " bytes " << aio_bytes
+		 << " ... exp " << exp << " min_new " << min_new
+		 << " ... pending " << cur << dendl;
+	if (cur < min_new) {
+	  dout(20) << "write_thread_entry deferring until more aios complete: "
+		   << aio_num << " aios with " << aio_bytes << " bytes needs " << min_new
+		   << " bytes to start a new aio (currently " << cur << " pending)" << dendl;
+	  aio_cond.Wait(aio_lock);
+	  dout(20) << "write_thread_entry woke up" << dendl;
+	  continue;
+	}
       }
     }
 #endif
@@ -1275,7 +1289,7 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 
   iocb *piocb = &aio.iocb;
   int attempts = 10;
-  do {
+  while (true) {
     int r = io_submit(aio_ctx, 1, &piocb);
     if (r < 0) {
       derr << "io_submit to " << aio.off << "~" << aio.len
@@ -1286,7 +1300,8 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
       }
       assert(0 == "io_submit got unexpected error");
     }
-  } while (false);
+    break;
+  }
   pos += aio.len;
   write_finish_cond.Signal();
   return 0;
@@ -1350,7 +1365,7 @@ void FileJournal::check_aio_completion()
   assert(aio_lock.is_locked());
   dout(20) << "check_aio_completion" << dendl;
 
-  bool completed_something = false;
+  bool completed_something = false, retired_something = false;
   uint64_t new_journaled_seq = 0;
 
   list<aio_info>::iterator p = aio_queue.begin();
@@ -1361,6 +1376,7 @@ void FileJournal::check_aio_completion()
       new_journaled_seq = p->seq;
       completed_something = true;
     }
+    retired_something = true;
     aio_num--;
     aio_bytes -= p->len;
     aio_queue.erase(p++);
@@ -1383,7 +1399,9 @@ void FileJournal::check_aio_completion()
 	queue_completions_thru(journaled_seq);
       }
     }
+  }
 
+  if (retired_something) {
     // maybe write queue was waiting for aio count to drop?
     aio_cond.Signal();
   }
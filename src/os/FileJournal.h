@@ -199,6 +199,9 @@ private:
   list<aio_info> aio_queue;
   int aio_num, aio_bytes;
   /// End protected by aio_lock
+
+  /// fixed aio queue depth; 0 means adaptive (see write_thread_entry)
+  int aio_max_in_flight;
 #endif
 
   uint64_t last_committed_seq;
@@ -303,6 +306,7 @@ private:
 #ifdef HAVE_LIBAIO
     aio_lock("FileJournal::aio_lock"),
     aio_num(0), aio_bytes(0),
+    aio_max_in_flight(g_conf->journal_aio_max_in_flight),
 #endif
     last_committed_seq(0), 
     full_state(FULL_NOTFULL),
@@ -97,6 +97,9 @@ static const __SWORD_TYPE BTRFS_SUPER_MAGIC(0x9123683E);
 #define CLUSTER_SNAP_ITEM "clustersnap_%s"
 
 #define REPLAY_GUARD_XATTR "user.cephos.seq"
+// all of an object's attrs, when filestore_xattr_pack is set; on the
+// current dir it marks a store holding packed objects
+#define PACKED_ATTRS_XATTR "user.cephos.attrs"
 
 /*
  * long file names will have the following format:
@@ -206,22 +209,24 @@ int FileStore::lfn_find(coll_t cid, const hobject_t& oid, IndexedPath *path)
 
 int FileStore::lfn_getxattr(coll_t cid, const hobject_t& oid, const char *name, void *val, size_t size)
 {
-  IndexedPath path;
-  int r = lfn_find(cid, oid, &path);
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
   if (r < 0)
     return r;
-  r = do_getxattr(path->path(), name, val, size);
+  r = do_fgetxattr(**fd, name, val, size);
+  lfn_close(fd);
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
 }
 
 int FileStore::lfn_setxattr(coll_t cid, const hobject_t& oid, const char *name, const void *val, size_t size)
 {
-  IndexedPath path;
-  int r = lfn_find(cid, oid, &path);
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
   if (r < 0)
     return r;
-  r = do_setxattr(path->path(), name, val, size);
+  r = do_fsetxattr(**fd, name, val, size);
+  lfn_close(fd);
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
 }
@@ -250,39 +255,54 @@ int FileStore::lfn_listxattr(coll_t cid, const hobject_t& oid, char *names, size
 
 int FileStore::lfn_truncate(coll_t cid, const hobject_t& oid, off_t length)
 {
-  IndexedPath path;
-  int r = lfn_find(cid, oid, &path);
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
   if (r < 0)
     return r;
-  r = ::truncate(path->path(), length);
+  r = ::ftruncate(**fd, length);
   if (r < 0)
     r = -errno;
+  lfn_close(fd);
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
 }
 
 int FileStore::lfn_stat(coll_t cid, const hobject_t& oid, struct stat *buf)
 {
-  IndexedPath path;
-  int r = lfn_find(cid, oid, &path);
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
   if (r < 0)
     return r;
-  r = ::stat(path->path(), buf);
+  r = ::fstat(**fd, buf);
   if (r < 0)
     r = -errno;
+  lfn_close(fd);
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
 }
 
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode,
-			IndexedPath *path,
-			Index *index) {
+int FileStore::lfn_open(coll_t cid, const hobject_t& oid, bool create,
+			FDRef *outfd, IndexedPath *path, Index *index)
+{
+  assert(outfd);
+  if (!path) {
+    *outfd = fdcache.lookup(cid, oid);
+    if (*outfd) {
+      logger->inc(l_os_fd_cache_hit);
+      return 0;
+    }
+    logger->inc(l_os_fd_cache_miss);
+  }
+
   Index index2;
   IndexedPath path2;
   if (!path)
     path = &path2;
   int fd, exist;
   int r = 0;
+  int flags = O_RDWR;
+  if (create)
+    flags |= O_CREAT;
   if (!index) {
     index = &index2;
   }
@@ -301,16 +321,16 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode
     goto fail;
   }
 
-  r = ::open((*path)->path(), flags, mode);
+  r = ::open((*path)->path(), flags, 0644);
   if (r < 0) {
     r = -errno;
     dout(10) << "error opening file " << (*path)->path() << " with flags="
-	     << flags << " and mode=" << mode << ": " << cpp_strerror(-r) << dendl;
+	     << flags << ": " << cpp_strerror(-r) << dendl;
     goto fail;
   }
   fd = r;
 
-  if ((flags & O_CREAT) && (!exist)) {
+  if (create && (!exist)) {
     r = (*index)->created(oid, (*path)->path());
     if (r < 0) {
       TEMP_FAILURE_RETRY(::close(fd));
@@ -318,27 +338,19 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode
 	   << ") in index: " << cpp_strerror(-r) << dendl;
       goto fail;
     }
+    if ((*index)->split_pending())
+      queue_split(cid);
   }
-  return fd;
+  *outfd = fdcache.add(cid, oid, fd);
+  return 0;
 
  fail:
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
 }
 
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode, IndexedPath *path)
-{
-  return lfn_open(cid, oid, flags, mode, path, 0);
-}
-
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode)
+void FileStore::lfn_close(FDRef fd)
 {
-  return lfn_open(cid, oid, flags, mode, 0, 0);
-}
-
-int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags)
-{
-  return lfn_open(cid, oid, flags, 0);
 }
 
 int FileStore::lfn_link(coll_t c, coll_t cid, const hobject_t& o) 
@@ -390,9 +402,40 @@ int FileStore::lfn_link(coll_t c, coll_t cid, const hobject_t& o)
     assert(!m_filestore_fail_eio || r != -EIO);
     return r;
   }
+  if (index_new->split_pending())
+    queue_split(cid);
   return 0;
 }
 
+void FileStore::queue_split(coll_t cid)
+{
+  dout(15) << "queue_split " << cid << dendl;
+  split_wq.queue(new coll_t(cid));
+}
+
+void FileStore::_split_collection(coll_t cid)
+{
+  Index index;
+  int r = get_index(cid, &index);
+  if (r < 0) {
+    dout(10) << "_split_collection " << cid << " index: "
+	     << cpp_strerror(-r) << dendl;
+    return;
+  }
+  bool done = false;
+  r = index->split_step(&done);
+  index.reset();
+  if (r < 0) {
+    derr << "_split_collection " << cid << " split step: "
+	 << cpp_strerror(-r) << dendl;
+    assert(!m_filestore_fail_eio || r != -EIO);
+    return;
+  }
+  dout(15) << "_split_collection " << cid << (done ? " done" : " more") << dendl;
+  if (!done && !g_conf->filestore_debug_hold_splits)
+    queue_split(cid);
+}
+
 int FileStore::lfn_unlink(coll_t cid, const hobject_t& o,
 			  const SequencerPosition &spos)
 {
@@ -409,6 +452,14 @@ int FileStore::lfn_unlink(coll_t cid, const hobject_t& o,
       return r;
     }
 
+    // a pending split may still hold a second link to o; drop it, so
+    // that st_nlink only counts links from other collections
+    r = index->remove_stale_copy(o);
+    if (r < 0) {
+      assert(!m_filestore_fail_eio || r != -EIO);
+      return r;
+    }
+
     struct stat st;
     r = ::stat(path->path(), &st);
     if (r < 0) {
@@ -430,6 +481,7 @@ int FileStore::lfn_unlink(coll_t cid, const hobject_t& o,
 	object_map->sync(&o, &spos);
     }
   }
+  fdcache.clear(cid, o);
   return index->unlink(o);
 }
 
@@ -722,6 +774,7 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   fsid_fd(-1), op_fd(-1),
   basedir_fd(-1), current_fd(-1),
   index_manager(do_update),
+  fdcache(g_conf->filestore_fd_cache_size, g_conf->filestore_fd_cache_shards),
   ondisk_finisher(g_ceph_context),
   lock("FileStore::lock"),
   force_sync(false), sync_epoch(0),
@@ -733,6 +786,9 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   op_tp(g_ceph_context, "FileStore::op_tp", g_conf->filestore_op_threads),
   op_wq(this, g_conf->filestore_op_thread_timeout,
 	g_conf->filestore_op_thread_suicide_timeout, &op_tp),
+  split_tp(g_ceph_context, "FileStore::split_tp", g_conf->filestore_split_threads),
+  split_wq(this, g_conf->filestore_op_thread_timeout,
+	   g_conf->filestore_op_thread_suicide_timeout, &split_tp),
   flusher_queue_len(0), flusher_thread(this),
   logger(NULL),
   m_filestore_btrfs_clone_range(g_conf->filestore_btrfs_clone_range),
@@ -751,6 +807,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   m_filestore_max_sync_interval(g_conf->filestore_max_sync_interval),
   m_filestore_min_sync_interval(g_conf->filestore_min_sync_interval),
   m_filestore_fail_eio(g_conf->filestore_fail_eio),
+  m_filestore_readahead_size(g_conf->filestore_readahead_size),
+  m_filestore_xattr_pack(false),
   do_update(do_update),
   m_journal_dio(g_conf->journal_dio),
   m_journal_aio(g_conf->journal_aio),
@@ -786,7 +844,7 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_u64(l_os_jq_max_bytes, "journal_queue_max_bytes");
   plb.add_u64(l_os_jq_bytes, "journal_queue_bytes");
   plb.add_u64_counter(l_os_j_bytes, "journal_bytes");
-  plb.add_fl_avg(l_os_j_lat, "journal_latency");
+  plb.add_fl_hist(l_os_j_lat, "journal_latency");
   plb.add_u64_counter(l_os_j_wr, "journal_wr");
   plb.add_u64_avg(l_os_j_wr_bytes, "journal_wr_bytes");
   plb.add_u64(l_os_oq_max_ops, "op_queue_max_ops");
@@ -795,13 +853,16 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_u64(l_os_oq_max_bytes, "op_queue_max_bytes");
   plb.add_u64(l_os_oq_bytes, "op_queue_bytes");
   plb.add_u64_counter(l_os_bytes, "bytes");
-  plb.add_fl_avg(l_os_apply_lat, "apply_latency");
+  plb.add_fl_hist(l_os_apply_lat, "apply_latency");
   plb.add_u64(l_os_committing, "committing");
 
   plb.add_u64_counter(l_os_commit, "commitcycle");
   plb.add_fl_avg(l_os_commit_len, "commitcycle_interval");
   plb.add_fl_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
+  plb.add_u64_counter(l_os_fd_cache_hit, "fd_cache_hit");
+  plb.add_u64_counter(l_os_fd_cache_miss, "fd_cache_miss");
+  plb.add_u64_counter(l_os_readahead, "readahead");
 
   logger = plb.create_perf_counters();
 }
@@ -1336,11 +1397,14 @@ int FileStore::_detect_fs()
   do_setxattr(fn, "user.test4", &buf, sizeof(buf));
   ret = do_setxattr(fn, "user.test5", &buf, sizeof(buf));
   if (ret == -ENOSPC) {
-    if (!g_conf->filestore_xattr_use_omap) {
+    if (g_conf->filestore_xattr_use_omap) {
+      derr << "limited size xattrs -- filestore_xattr_use_omap enabled" << dendl;
+    } else if (g_conf->filestore_xattr_pack) {
+      // the packed blob is bounded, and overflows to omap
+      derr << "limited size xattrs -- filestore_xattr_pack enabled" << dendl;
+    } else {
       derr << "limited size xattrs -- enable filestore_xattr_use_omap" << dendl;
       return -ENOTSUP;
-    } else {
-      derr << "limited size xattrs -- filestore_xattr_use_omap enabled" << dendl;
     }
   }
   do_removexattr(fn, "user.test");
@@ -1922,6 +1986,28 @@ int FileStore::mount()
     goto close_current_fd;
   }
 
+  // object attr layout.  the current dir is marked once packed objects
+  // may exist; the journal is replayed in the layout it was written in.
+  {
+    char v;
+    bool marked = do_fgetxattr(current_fd, PACKED_ATTRS_XATTR, &v, sizeof(v)) >= 0;
+    if (marked && !g_conf->filestore_xattr_pack &&
+	!g_conf->filestore_xattr_pack_convert) {
+      derr << "mount: objects have packed attrs; enable 'filestore xattr pack',"
+	   << " or 'filestore xattr pack convert' to unpack them" << dendl;
+      ret = -EINVAL;
+      goto close_current_fd;
+    }
+    if (!marked && g_conf->filestore_xattr_pack) {
+      ret = do_fsetxattr(current_fd, PACKED_ATTRS_XATTR, "1", 1);
+      if (ret < 0) {
+	derr << "mount: unable to mark packed attrs: " << cpp_strerror(ret) << dendl;
+	goto close_current_fd;
+      }
+    }
+    m_filestore_xattr_pack = marked || g_conf->filestore_xattr_pack;
+  }
+
   if (!btrfs_stable_commits) {
     // mark current/ as non-snapshotted so that we don't rollback away
     // from it.
@@ -1936,7 +2022,15 @@ int FileStore::mount()
   }
 
   {
-    LevelDBStore *omap_store = new LevelDBStore(omap_dir);
+    LevelDBStore *omap_store = new LevelDBStore(omap_dir, g_ceph_context);
+    omap_store->options.write_buffer_size = g_conf->leveldb_write_buffer_size;
+    omap_store->options.cache_size = g_conf->leveldb_cache_size;
+    omap_store->options.block_size = g_conf->leveldb_block_size;
+    omap_store->options.bloom_size = g_conf->leveldb_bloom_size;
+    omap_store->options.max_open_files = g_conf->leveldb_max_open_files;
+    omap_store->options.compression_enabled = g_conf->leveldb_compression;
+    omap_store->options.paranoid_checks = g_conf->leveldb_paranoid;
+    omap_store->options.log_file = g_conf->leveldb_log;
     stringstream err;
     if (omap_store->init(err)) {
       derr << "Error initializing leveldb: " << err.str() << dendl;
@@ -2030,15 +2124,16 @@ int FileStore::mount()
       derr << "maybe journal is not pointing to a block device and its size "
 	   << "wasn't configured?" << dendl;
     }
+    goto stop_sync;
+  }
 
-    // stop sync thread
-    lock.Lock();
-    stop = true;
-    sync_cond.Signal();
-    lock.Unlock();
-    sync_thread.join();
-
-    goto close_current_fd;
+  if (g_conf->filestore_xattr_pack_convert) {
+    ret = convert_attrs(g_conf->filestore_xattr_pack);
+    if (ret < 0) {
+      derr << "mount: failed to convert object attrs: " << cpp_strerror(ret) << dendl;
+      goto stop_sync;
+    }
+    m_filestore_xattr_pack = g_conf->filestore_xattr_pack;
   }
 
   {
@@ -2052,7 +2147,11 @@ int FileStore::mount()
 
   journal_start();
 
+  // replay is done, splits triggered from here on can run in the background
+  index_manager.set_async_split(g_conf->filestore_split_threads > 0);
+
   op_tp.start();
+  split_tp.start();
   flusher_thread.create();
   op_finisher.start();
   ondisk_finisher.start();
@@ -2066,6 +2165,13 @@ int FileStore::mount()
   // all okay.
   return 0;
 
+stop_sync:
+  // stop sync thread
+  lock.Lock();
+  stop = true;
+  sync_cond.Signal();
+  lock.Unlock();
+  sync_thread.join();
 close_current_fd:
   TEMP_FAILURE_RETRY(::close(current_fd));
   current_fd = -1;
@@ -2095,6 +2201,8 @@ int FileStore::umount()
   lock.Unlock();
   sync_thread.join();
   op_tp.stop();
+  split_tp.stop();
+  index_manager.set_async_split(false);
   flusher_thread.join();
 
   journal_stop();
@@ -2120,6 +2228,8 @@ int FileStore::umount()
     TEMP_FAILURE_RETRY(::close(basedir_fd));
     basedir_fd = -1;
   }
+  fdcache.clear();
+  index_manager.clear_list_cache();
   object_map.reset();
 
   {
@@ -2427,6 +2537,12 @@ int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
     ops += (*p)->get_num_ops();
   }
 
+  // coalesce the omap updates from these transactions into one
+  // backing store write
+  bool batch = g_conf->filestore_omap_batch;
+  if (batch)
+    object_map->start_batch();
+
   int trans_num = 0;
   for (list<Transaction*>::iterator p = tls.begin();
        p != tls.end();
@@ -2435,6 +2551,15 @@ int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
     if (r < 0)
       break;
   }
+
+  if (batch) {
+    int r2 = object_map->end_batch();
+    if (r2 < 0) {
+      assert(!m_filestore_fail_eio || r2 != -EIO);
+      if (r >= 0)
+	r = r2;
+    }
+  }
   
   return r;
 }
@@ -2545,13 +2670,14 @@ int FileStore::_check_replay_guard(coll_t cid, hobject_t oid, const SequencerPos
   if (!replaying || btrfs_stable_commits)
     return 1;
 
-  int fd = lfn_open(cid, oid, 0);
-  if (fd < 0) {
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
+  if (r < 0) {
     dout(10) << "_check_replay_guard " << cid << " " << oid << " dne" << dendl;
     return 1;  // if file does not exist, there is no guard, and we can replay.
   }
-  int ret = _check_replay_guard(fd, spos);
-  TEMP_FAILURE_RETRY(::close(fd));
+  int ret = _check_replay_guard(**fd, spos);
+  lfn_close(fd);
   return ret;
 }
 
@@ -2994,38 +3120,79 @@ int FileStore::stat(coll_t cid, const hobject_t& oid, struct stat *st)
   return r;
 }
 
+void FileStore::_readahead(FDRef fd, uint64_t offset, uint64_t len)
+{
+#ifdef HAVE_POSIX_FADVISE
+  uint64_t window = m_filestore_readahead_size;
+  if (!window)
+    return;
+  uint64_t end = offset + len;
+  uint64_t start = 0, ra_len = 0;
+  {
+    Mutex::Locker l(fd->ra_lock);
+    if (offset && offset == fd->ra_last) {
+      // sequential; keep at least half a window queued ahead of the reader
+      if (end + window / 2 > fd->ra_end) {
+	start = MAX(fd->ra_end, end);
+	fd->ra_end = end + window;
+	ra_len = fd->ra_end - start;
+      }
+    } else {
+      fd->ra_end = end;
+    }
+    fd->ra_last = end;
+  }
+  if (!ra_len)
+    return;
+  dout(20) << "_readahead " << **fd << " " << start << "~" << ra_len << dendl;
+  ::posix_fadvise(**fd, start, ra_len, POSIX_FADV_WILLNEED);
+  logger->inc(l_os_readahead);
+#endif
+}
+
 int FileStore::read(coll_t cid, const hobject_t& oid, 
-                    uint64_t offset, size_t len, bufferlist& bl)
+                    uint64_t offset, size_t len, bufferlist& bl, int flags)
 {
   int got;
 
   dout(15) << "read " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
-  int fd = lfn_open(cid, oid, O_RDONLY);
-  if (fd < 0) {
-    dout(10) << "FileStore::read(" << cid << "/" << oid << ") open error: " << cpp_strerror(fd) << dendl;
-    return fd;
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
+  if (r < 0) {
+    dout(10) << "FileStore::read(" << cid << "/" << oid << ") open error: " << cpp_strerror(r) << dendl;
+    return r;
   }
 
   if (len == 0) {
     struct stat st;
     memset(&st, 0, sizeof(struct stat));
-    int r = ::fstat(fd, &st);
+    int r = ::fstat(**fd, &st);
     assert(r == 0);
     len = st.st_size;
   }
 
   bufferptr bptr(len);  // prealloc space for entire read
-  got = safe_pread(fd, bptr.c_str(), len, offset);
+  got = safe_pread(**fd, bptr.c_str(), len, offset);
   if (got < 0) {
     dout(10) << "FileStore::read(" << cid << "/" << oid << ") pread error: " << cpp_strerror(got) << dendl;
-    TEMP_FAILURE_RETRY(::close(fd));
+    lfn_close(fd);
     assert(!m_filestore_fail_eio || got != -EIO);
     return got;
   }
   bptr.set_length(got);   // properly size the buffer
   bl.push_back(bptr);   // put it in the target bufferlist
-  TEMP_FAILURE_RETRY(::close(fd));
+
+#ifdef HAVE_POSIX_FADVISE
+  if (flags & READ_NOCACHE) {
+    // don't let this read displace pages somebody else is using
+    if (got)
+      ::posix_fadvise(**fd, offset, got, POSIX_FADV_DONTNEED);
+  } else if (got) {
+    _readahead(fd, offset, got);
+  }
+#endif
+  lfn_close(fd);
 
   dout(10) << "FileStore::read " << cid << "/" << oid << " " << offset << "~"
 	   << got << "/" << len << dendl;
@@ -3049,15 +3216,14 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
 
   dout(15) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
-  int r;
-  int fd = lfn_open(cid, oid, O_RDONLY);
-  if (fd < 0) {
-    r = fd;
+  FDRef fd;
+  int r = lfn_open(cid, oid, false, &fd);
+  if (r < 0) {
     dout(10) << "read couldn't open " << cid << "/" << oid << ": " << cpp_strerror(r) << dendl;
   } else {
     uint64_t i;
 
-    r = do_fiemap(fd, offset, len, &fiemap);
+    r = do_fiemap(**fd, offset, len, &fiemap);
     if (r < 0)
       goto done;
 
@@ -3099,8 +3265,8 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
   }
 
 done:
-  if (fd >= 0)
-    TEMP_FAILURE_RETRY(::close(fd));
+  if (fd)
+    lfn_close(fd);
   if (r >= 0)
     ::encode(exomap, bl);
 
@@ -3133,14 +3299,10 @@ int FileStore::_touch(coll_t cid, const hobject_t& oid)
 {
   dout(15) << "touch " << cid << "/" << oid << dendl;
 
-  int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
-  int r;
-  if (fd >= 0) {
-    TEMP_FAILURE_RETRY(::close(fd));
-    r = 0;
-  } else
-    r = fd;
+  FDRef fd;
+  int r = lfn_open(cid, oid, true, &fd);
+  if (r >= 0)
+    lfn_close(fd);
   dout(10) << "touch " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -3154,45 +3316,55 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
 
   int64_t actual;
 
-  int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
-  if (fd < 0) {
-    r = fd;
-    dout(0) << "write couldn't open " << cid << "/" << oid << " flags " << flags << ": "
+  FDRef fd;
+  r = lfn_open(cid, oid, true, &fd);
+  if (r < 0) {
+    dout(0) << "write couldn't open " << cid << "/" << oid << ": "
 	    << cpp_strerror(r) << dendl;
     goto out;
   }
     
   // seek
-  actual = ::lseek64(fd, offset, SEEK_SET);
+  actual = ::lseek64(**fd, offset, SEEK_SET);
   if (actual < 0) {
     r = -errno;
     dout(0) << "write lseek64 to " << offset << " failed: " << cpp_strerror(r) << dendl;
+    lfn_close(fd);
     goto out;
   }
   if (actual != (int64_t)offset) {
     dout(0) << "write lseek64 to " << offset << " gave bad offset " << actual << dendl;
     r = -EIO;
+    lfn_close(fd);
     goto out;
   }
 
   // write
-  r = bl.write_fd(fd);
+  r = bl.write_fd(**fd);
   if (r == 0)
     r = bl.length();
 
-  // flush?
-  if ((ssize_t)len < m_filestore_flush_min ||
+  // flush?  the flusher closes the fd it is given, so hand it a dup of
+  // the (shared) cached fd; if we can't dup or queue it, flush here.
+  {
+    bool queued = false;
 #ifdef HAVE_SYNC_FILE_RANGE
-      !m_filestore_flusher || !queue_flusher(fd, offset, len)
-#else
-      true
+    if ((ssize_t)len >= m_filestore_flush_min && m_filestore_flusher) {
+      int flush_fd = ::dup(**fd);
+      if (flush_fd < 0) {
+	dout(10) << "write dup of fd " << **fd << " failed: "
+		 << cpp_strerror(errno) << ", flushing synchronously" << dendl;
+      } else if (queue_flusher(flush_fd, offset, len)) {
+	queued = true;
+      } else {
+	TEMP_FAILURE_RETRY(::close(flush_fd));
+      }
+    }
 #endif
-      ) {
-    if (m_filestore_sync_flush)
-      ::sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
-    TEMP_FAILURE_RETRY(::close(fd));
+    if (!queued && m_filestore_sync_flush)
+      ::sync_file_range(**fd, offset, len, SYNC_FILE_RANGE_WRITE);
   }
+  lfn_close(fd);
 
  out:
   dout(10) << "write " << cid << "/" << oid << " " << offset << "~" << len << " = " << r << dendl;
@@ -3207,17 +3379,17 @@ int FileStore::_zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t l
 #ifdef CEPH_HAVE_FALLOCATE
 # if !defined(DARWIN) && !defined(__FreeBSD__)
   // first try to punch a hole.
-  int fd = lfn_open(cid, oid, O_RDONLY);
-  if (fd < 0) {
-    ret = -errno;
+  FDRef fd;
+  ret = lfn_open(cid, oid, false, &fd);
+  if (ret < 0) {
     goto out;
   }
 
   // first try fallocate
-  ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE, offset, len);
+  ret = fallocate(**fd, FALLOC_FL_PUNCH_HOLE, offset, len);
   if (ret < 0)
     ret = -errno;
-  TEMP_FAILURE_RETRY(::close(fd));
+  lfn_close(fd);
 
   if (ret == 0)
     goto out;  // yay!
@@ -3250,23 +3422,26 @@ int FileStore::_clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newo
   if (_check_replay_guard(cid, newoid, spos) < 0)
     return 0;
 
-  int o, n, r;
+  int r;
+  FDRef o, n;
   {
     Index index;
-    IndexedPath from, to;
-    o = lfn_open(cid, oldoid, O_RDONLY, 0, &from, &index);
-    if (o < 0) {
-      r = o;
+    r = lfn_open(cid, oldoid, false, &o, 0, &index);
+    if (r < 0) {
       goto out2;
     }
-    n = lfn_open(cid, newoid, O_CREAT|O_TRUNC|O_WRONLY, 0644, &to, &index);
-    if (n < 0) {
-      r = n;
+    r = lfn_open(cid, newoid, true, &n, 0, &index);
+    if (r < 0) {
       goto out;
     }
+    r = ::ftruncate(**n, 0);
+    if (r < 0) {
+      r = -errno;
+      goto out3;
+    }
     struct stat st;
-    ::fstat(o, &st);
-    r = _do_clone_range(o, n, 0, st.st_size, 0);
+    ::fstat(**o, &st);
+    r = _do_clone_range(**o, **n, 0, st.st_size, 0);
     if (r < 0) {
       r = -errno;
       goto out3;
@@ -3279,22 +3454,32 @@ int FileStore::_clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newo
 
   {
     map<string, bufferptr> aset;
-    r = _getattrs(cid, oldoid, aset);
-    if (r < 0)
-      goto out3;
+    set<string> spilled;
+    r = -ENODATA;
+    if (m_filestore_xattr_pack) {
+      // spilled values came along with the object map clone
+      r = _get_packed_attrs(cid, oldoid, &aset, &spilled);
+      if (r == 0)
+	r = _set_packed_attrs(cid, newoid, aset, spilled);
+    }
+    if (r == -ENODATA) {
+      r = _getattrs(cid, oldoid, aset);
+      if (r < 0)
+	goto out3;
 
-    r = _setattrs(cid, newoid, aset, spos);
+      r = _setattrs(cid, newoid, aset, spos);
+    }
     if (r < 0)
       goto out3;
   }
 
   // clone is non-idempotent; record our work.
-  _set_replay_guard(n, spos, &newoid);
+  _set_replay_guard(**n, spos, &newoid);
 
  out3:
-  TEMP_FAILURE_RETRY(::close(n));
+  lfn_close(n);
  out:
-  TEMP_FAILURE_RETRY(::close(o));
+  lfn_close(o);
  out2:
   dout(10) << "clone " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " = " << r << dendl;
   assert(!m_filestore_fail_eio || r != -EIO);
@@ -3443,25 +3628,23 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
     return 0;
 
   int r;
-  int o, n;
-  o = lfn_open(cid, oldoid, O_RDONLY);
-  if (o < 0) {
-    r = o;
+  FDRef o, n;
+  r = lfn_open(cid, oldoid, false, &o);
+  if (r < 0) {
     goto out2;
   }
-  n = lfn_open(cid, newoid, O_CREAT|O_WRONLY, 0644);
-  if (n < 0) {
-    r = n;
+  r = lfn_open(cid, newoid, true, &n);
+  if (r < 0) {
     goto out;
   }
-  r = _do_clone_range(o, n, srcoff, len, dstoff);
+  r = _do_clone_range(**o, **n, srcoff, len, dstoff);
 
   // clone is non-idempotent; record our work.
-  _set_replay_guard(n, spos, &newoid);
+  _set_replay_guard(**n, spos, &newoid);
 
-  TEMP_FAILURE_RETRY(::close(n));
+  lfn_close(n);
  out:
-  TEMP_FAILURE_RETRY(::close(o));
+  lfn_close(o);
  out2:
   dout(10) << "clone_range " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " "
 	   << srcoff << "~" << len << " to " << dstoff << " = " << r << dendl;
@@ -3868,6 +4051,14 @@ void FileStore::sync_and_flush()
   dout(10) << "sync_and_flush done" << dendl;
 }
 
+void FileStore::compact_omap()
+{
+  dout(10) << "compact_omap" << dendl;
+  if (object_map)
+    object_map->compact();
+  dout(10) << "compact_omap done" << dendl;
+}
+
 int FileStore::snapshot(const string& name)
 {
   dout(10) << "snapshot " << name << dendl;
@@ -4049,10 +4240,31 @@ int FileStore::_getattrs(const char *fn, map<string,bufferptr>& aset, bool user_
 int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr &bp)
 {
   dout(15) << "getattr " << cid << "/" << oid << " '" << name << "'" << dendl;
-  char n[ATTR_MAX_NAME_LEN];
-  get_attrname(name, n, ATTR_MAX_NAME_LEN);
-  int r = _getattr(cid, oid, n, bp);
-  if (r == -ENODATA && g_conf->filestore_xattr_use_omap) {
+  int r = -ENODATA;
+  bool packed = false;
+  bool in_omap = g_conf->filestore_xattr_use_omap;
+  if (m_filestore_xattr_pack) {
+    map<string,bufferptr> attrs;
+    set<string> spilled;
+    r = _get_packed_attrs(cid, oid, &attrs, &spilled);
+    if (r == 0) {
+      packed = true;
+      map<string,bufferptr>::iterator p = attrs.find(name);
+      if (p != attrs.end()) {
+	bp = p->second;
+	r = bp.length();
+      } else {
+	r = -ENODATA;
+      }
+      in_omap = spilled.count(name);
+    }
+  }
+  if (!packed && r == -ENODATA) {
+    char n[ATTR_MAX_NAME_LEN];
+    get_attrname(name, n, ATTR_MAX_NAME_LEN);
+    r = _getattr(cid, oid, n, bp);
+  }
+  if (r == -ENODATA && in_omap) {
     map<string, bufferlist> got;
     set<string> to_get;
     to_get.insert(string(name));
@@ -4084,8 +4296,29 @@ int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, buffe
 int FileStore::getattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& aset, bool user_only) 
 {
   dout(15) << "getattrs " << cid << "/" << oid << dendl;
-  int r = _getattrs(cid, oid, aset, user_only);
-  if (g_conf->filestore_xattr_use_omap) {
+  int r = -ENODATA;
+  bool packed = false;
+  set<string> spilled;
+  if (m_filestore_xattr_pack) {
+    map<string,bufferptr> attrs;
+    r = _get_packed_attrs(cid, oid, &attrs, &spilled);
+    if (r == 0) {
+      packed = true;
+      for (map<string,bufferptr>::iterator i = attrs.begin();
+	   i != attrs.end();
+	   ++i) {
+	if (!user_only)
+	  aset[i->first] = i->second;
+	else if (i->first[0] == '_' && i->first != "_")
+	  aset[i->first.substr(1, i->first.size())] = i->second;
+      }
+    } else if (r != -ENODATA) {
+      goto out;
+    }
+  }
+  if (!packed)
+    r = _getattrs(cid, oid, aset, user_only);
+  if (packed ? !spilled.empty() : g_conf->filestore_xattr_use_omap) {
     set<string> omap_attrs;
     map<string, bufferlist> omap_aset;
     Index index;
@@ -4094,10 +4327,14 @@ int FileStore::getattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>&
       dout(10) << __func__ << " could not get index r = " << r << dendl;
       goto out;
     }
-    r = object_map->get_all_xattrs(oid, &omap_attrs);
-    if (r < 0 && r != -ENOENT) {
-      dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
-      goto out;
+    if (packed) {
+      omap_attrs.swap(spilled);
+    } else {
+      r = object_map->get_all_xattrs(oid, &omap_attrs);
+      if (r < 0 && r != -ENOENT) {
+	dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+	goto out;
+      }
     }
     r = object_map->get_xattrs(oid, omap_attrs, &omap_aset);
     if (r < 0 && r != -ENOENT) {
@@ -4131,6 +4368,9 @@ int FileStore::getattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>&
 int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& aset,
 			 const SequencerPosition &spos)
 {
+  if (m_filestore_xattr_pack)
+    return _setattrs_packed(cid, oid, aset, &spos);
+
   map<string, bufferlist> omap_set;
   set<string> omap_remove;
   map<string, bufferptr> inline_set;
@@ -4214,10 +4454,32 @@ int FileStore::_rmattr(coll_t cid, const hobject_t& oid, const char *name,
 		       const SequencerPosition &spos)
 {
   dout(15) << "rmattr " << cid << "/" << oid << " '" << name << "'" << dendl;
-  char n[ATTR_MAX_NAME_LEN];
-  get_attrname(name, n, ATTR_MAX_NAME_LEN);
-  int r = lfn_removexattr(cid, oid, n);
-  if (r == -ENODATA && g_conf->filestore_xattr_use_omap) {
+  int r = -ENODATA;
+  bool packed = false;
+  bool in_omap = g_conf->filestore_xattr_use_omap;
+  if (m_filestore_xattr_pack) {
+    map<string,bufferptr> attrs;
+    set<string> spilled;
+    r = _get_packed_attrs(cid, oid, &attrs, &spilled);
+    if (r == 0) {
+      packed = true;
+      in_omap = spilled.erase(name);
+      if (attrs.erase(name) || in_omap)
+	r = _set_packed_attrs(cid, oid, attrs, spilled);
+      else
+	r = -ENODATA;
+      if (r == 0 && in_omap)
+	r = -ENODATA;  // drop it from the object map below
+    } else if (r != -ENODATA) {
+      return r;
+    }
+  }
+  if (!packed) {
+    char n[ATTR_MAX_NAME_LEN];
+    get_attrname(name, n, ATTR_MAX_NAME_LEN);
+    r = lfn_removexattr(cid, oid, n);
+  }
+  if (r == -ENODATA && in_omap) {
     Index index;
     r = get_index(cid, &index);
     if (r < 0) {
@@ -4242,6 +4504,12 @@ int FileStore::_rmattrs(coll_t cid, const hobject_t& oid,
 {
   dout(15) << "rmattrs " << cid << "/" << oid << dendl;
 
+  if (m_filestore_xattr_pack) {
+    int r = lfn_removexattr(cid, oid, PACKED_ATTRS_XATTR);
+    if (r < 0 && r != -ENODATA)
+      return r;
+  }
+
   map<string,bufferptr> aset;
   int r = _getattrs(cid, oid, aset);
   if (r >= 0) {
@@ -4253,7 +4521,7 @@ int FileStore::_rmattrs(coll_t cid, const hobject_t& oid,
 	break;
     }
   }
-  if (g_conf->filestore_xattr_use_omap) {
+  if (g_conf->filestore_xattr_use_omap || m_filestore_xattr_pack) {
     set<string> omap_attrs;
     Index index;
     r = get_index(cid, &index);
@@ -4277,6 +4545,280 @@ int FileStore::_rmattrs(coll_t cid, const hobject_t& oid,
   return r;
 }
 
+// packed attrs
+//
+// With filestore_xattr_pack, an object's attrs live in a single
+// PACKED_ATTRS_XATTR blob: the inline values, plus the names of the
+// values that were too big and went to the object map instead.  An
+// object without the blob still has its attrs in the old layout; the
+// first packed write moves them over.
+
+int FileStore::_get_packed_attrs(coll_t cid, const hobject_t& oid,
+				 map<string,bufferptr> *attrs,
+				 set<string> *spilled)
+{
+  // one chunk short of ATTR_MAX_BLOCK_LEN, so that a blob that fits
+  // is read with a single fgetxattr
+  bufferptr bp(ATTR_MAX_BLOCK_LEN - 1);
+  int r = lfn_getxattr(cid, oid, PACKED_ATTRS_XATTR, bp.c_str(), bp.length());
+  if (r == -ERANGE)
+    r = _getattr(cid, oid, PACKED_ATTRS_XATTR, bp);
+  if (r < 0)
+    return r;
+  bp.set_length(r);
+
+  bufferlist bl;
+  bl.push_back(bp);
+  bufferlist::iterator p = bl.begin();
+  DECODE_START(1, p);
+  ::decode(*attrs, p);
+  ::decode(*spilled, p);
+  DECODE_FINISH(p);
+  return 0;
+}
+
+int FileStore::_set_packed_attrs(coll_t cid, const hobject_t& oid,
+				 const map<string,bufferptr>& attrs,
+				 const set<string>& spilled)
+{
+  int r;
+  if (attrs.empty() && spilled.empty()) {
+    r = lfn_removexattr(cid, oid, PACKED_ATTRS_XATTR);
+    return r == -ENODATA ? 0 : r;
+  }
+  bufferlist bl;
+  ENCODE_START(1, 1, bl);
+  ::encode(attrs, bl);
+  ::encode(spilled, bl);
+  ENCODE_FINISH(bl);
+  r = lfn_setxattr(cid, oid, PACKED_ATTRS_XATTR, bl.c_str(), bl.length());
+  return r < 0 ? r : 0;
+}
+
+int FileStore::_setattrs_packed(coll_t cid, const hobject_t& oid,
+				map<string,bufferptr>& aset,
+				const SequencerPosition *spos)
+{
+  dout(15) << "setattrs_packed " << cid << "/" << oid << dendl;
+  map<string,bufferptr> attrs, legacy;
+  set<string> spilled;
+  map<string,bufferlist> omap_set;
+  set<string> omap_remove;
+  int r = _get_packed_attrs(cid, oid, &attrs, &spilled);
+  if (r == -ENODATA) {
+    // not packed yet; take over the attrs stored the old way
+    r = _getattrs(cid, oid, legacy);
+    if (r < 0)
+      return r;
+    attrs = legacy;
+    if (g_conf->filestore_xattr_use_omap) {
+      Index index;
+      r = get_index(cid, &index);
+      if (r < 0) {
+	dout(10) << __func__ << " could not get index r = " << r << dendl;
+	return r;
+      }
+      r = object_map->get_all_xattrs(oid, &spilled);
+      if (r < 0 && r != -ENOENT) {
+	dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+	assert(!m_filestore_fail_eio || r != -EIO);
+	return r;
+      }
+    }
+  } else if (r < 0) {
+    return r;
+  }
+
+  for (map<string,bufferptr>::iterator p = aset.begin(); p != aset.end(); ++p)
+    attrs[p->first] = p->second;
+  for (map<string,bufferptr>::iterator p = attrs.begin(); p != attrs.end(); ++p)
+    if (spilled.erase(p->first))
+      omap_remove.insert(p->first);
+
+  // overflow big values, and whatever does not fit in the blob, to omap
+  uint64_t total = 0;
+  for (map<string,bufferptr>::iterator p = attrs.begin(); p != attrs.end(); ) {
+    uint64_t len = p->first.length() + p->second.length() + 2 * sizeof(__u32);
+    if (p->second.length() > g_conf->filestore_max_inline_xattr_size ||
+	total + len > g_conf->filestore_max_packed_xattr_size) {
+      omap_set[p->first].push_back(p->second);
+      omap_remove.erase(p->first);
+      spilled.insert(p->first);
+      attrs.erase(p++);
+    } else {
+      total += len;
+      ++p;
+    }
+  }
+
+  // write the spilled values before the blob that names them
+  if (!omap_set.empty()) {
+    Index index;
+    r = get_index(cid, &index);
+    if (r < 0) {
+      dout(10) << __func__ << " could not get index r = " << r << dendl;
+      return r;
+    }
+    r = object_map->set_xattrs(oid, omap_set, spos);
+    if (r < 0) {
+      dout(10) << __func__ << " could not set_xattrs r = " << r << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+      return r;
+    }
+  }
+
+  r = _set_packed_attrs(cid, oid, attrs, spilled);
+  if (r < 0) {
+    derr << "FileStore::_setattrs_packed: _set_packed_attrs returned " << r << dendl;
+    return r;
+  }
+
+  for (map<string,bufferptr>::iterator p = legacy.begin(); p != legacy.end(); ++p) {
+    char n[ATTR_MAX_NAME_LEN];
+    get_attrname(p->first.c_str(), n, ATTR_MAX_NAME_LEN);
+    r = lfn_removexattr(cid, oid, n);
+    if (r < 0 && r != -ENODATA)
+      return r;
+  }
+
+  if (!omap_remove.empty()) {
+    Index index;
+    r = get_index(cid, &index);
+    if (r < 0) {
+      dout(10) << __func__ << " could not get index r = " << r << dendl;
+      return r;
+    }
+    r = object_map->remove_xattrs(oid, omap_remove, spos);
+    if (r < 0 && r != -ENOENT) {
+      dout(10) << __func__ << " could not remove_xattrs r = " << r << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+      return r;
+    }
+  }
+  dout(10) << "setattrs_packed " << cid << "/" << oid << " = 0, "
+	   << attrs.size() << " packed, " << spilled.size() << " spilled" << dendl;
+  return 0;
+}
+
+int FileStore::_convert_attrs(coll_t cid, const hobject_t& oid, bool pack)
+{
+  map<string,bufferptr> attrs;
+  set<string> spilled;
+  int r = _get_packed_attrs(cid, oid, &attrs, &spilled);
+  if (pack) {
+    if (r != -ENODATA)
+      return r;  // already packed
+    map<string,bufferptr> none;
+    return _setattrs_packed(cid, oid, none, 0);
+  }
+
+  if (r == -ENODATA)
+    return 0;  // not packed
+  if (r < 0)
+    return r;
+
+  // drop anything left over from before the object was packed
+  map<string,bufferptr> legacy;
+  r = _getattrs(cid, oid, legacy);
+  if (r < 0)
+    return r;
+  for (map<string,bufferptr>::iterator p = legacy.begin(); p != legacy.end(); ++p) {
+    char n[ATTR_MAX_NAME_LEN];
+    get_attrname(p->first.c_str(), n, ATTR_MAX_NAME_LEN);
+    r = lfn_removexattr(cid, oid, n);
+    if (r < 0 && r != -ENODATA)
+      return r;
+  }
+
+  // without filestore_xattr_use_omap the old layout keeps everything inline
+  map<string,bufferlist> got;
+  if (!g_conf->filestore_xattr_use_omap && !spilled.empty()) {
+    Index index;
+    r = get_index(cid, &index);
+    if (r < 0) {
+      dout(10) << __func__ << " could not get index r = " << r << dendl;
+      return r;
+    }
+    r = object_map->get_xattrs(oid, spilled, &got);
+    if (r < 0 && r != -ENOENT) {
+      dout(10) << __func__ << " could not get_xattrs r = " << r << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+      return r;
+    }
+    for (map<string,bufferlist>::iterator p = got.begin(); p != got.end(); ++p)
+      attrs[p->first] = bufferptr(p->second.c_str(), p->second.length());
+  }
+
+  for (map<string,bufferptr>::iterator p = attrs.begin(); p != attrs.end(); ++p) {
+    char n[ATTR_MAX_NAME_LEN];
+    get_attrname(p->first.c_str(), n, ATTR_MAX_NAME_LEN);
+    r = lfn_setxattr(cid, oid, n, p->second.length() ? p->second.c_str() : "",
+		     p->second.length());
+    if (r < 0)
+      return r;
+  }
+  r = lfn_removexattr(cid, oid, PACKED_ATTRS_XATTR);
+  if (r < 0)
+    return r;
+
+  if (!got.empty()) {
+    Index index;
+    r = get_index(cid, &index);
+    if (r < 0) {
+      dout(10) << __func__ << " could not get index r = " << r << dendl;
+      return r;
+    }
+    r = object_map->remove_xattrs(oid, spilled);
+    if (r < 0 && r != -ENOENT) {
+      dout(10) << __func__ << " could not remove_xattrs r = " << r << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+      return r;
+    }
+  }
+  return 0;
+}
+
+int FileStore::convert_attrs(bool pack)
+{
+  dout(0) << "convert_attrs " << (pack ? "packing" : "unpacking")
+	  << " object attrs" << dendl;
+  vector<coll_t> collections;
+  int r = list_collections(collections);
+  if (r < 0)
+    return r;
+  uint64_t objects = 0;
+  for (vector<coll_t>::iterator c = collections.begin();
+       c != collections.end();
+       ++c) {
+    vector<hobject_t> ls;
+    r = collection_list(*c, ls);
+    if (r < 0)
+      return r;
+    for (vector<hobject_t>::iterator o = ls.begin(); o != ls.end(); ++o) {
+      r = _convert_attrs(*c, *o, pack);
+      if (r < 0) {
+	derr << "convert_attrs " << *c << "/" << *o << " failed: "
+	     << cpp_strerror(r) << dendl;
+	return r;
+      }
+    }
+    objects += ls.size();
+  }
+
+  r = object_map->sync();
+  if (r < 0)
+    return r;
+  sync_filesystem(current_fd);
+  if (!pack) {
+    r = do_removexattr(current_fn.c_str(), PACKED_ATTRS_XATTR);
+    if (r < 0 && r != -ENODATA)
+      return r;
+  }
+  dout(0) << "convert_attrs converted " << objects << " objects in "
+	  << collections.size() << " collections" << dendl;
+  return 0;
+}
+
 
 
 // collections
@@ -4409,12 +4951,34 @@ int FileStore::_collection_rename(const coll_t &cid, const coll_t &ncid,
   }
 
   int ret = 0;
-  if (::rename(old_coll, new_coll)) {
+  {
+    // hold both indexes (in lfn_link order) so that a concurrent lfn_open
+    // can't put an fd for either collection back into the fdcache between
+    // the clear and the rename.  ncid may not exist yet, in which case
+    // there is nothing to open in it either.
+    Index index_old, index_new;
+    if (cid < ncid) {
+      get_index(ncid, &index_new);
+      ret = get_index(cid, &index_old);
+    } else {
+      ret = get_index(cid, &index_old);
+      get_index(ncid, &index_new);
+    }
+    if (ret < 0)
+      return ret;
+
+    fdcache.clear(cid);
+    fdcache.clear(ncid);
+    index_manager.clear_list_cache(old_coll);
+    index_manager.clear_list_cache(new_coll);
+
+    if (::rename(old_coll, new_coll))
+      ret = -errno;
+  }
+  if (ret < 0) {
     if (replaying && !btrfs_stable_commits &&
-	(errno == EEXIST || errno == ENOTEMPTY))
+	(ret == -EEXIST || ret == -ENOTEMPTY))
       ret = _collection_remove_recursive(cid, spos);
-    else
-      ret = -errno;
 
     dout(10) << "collection_rename '" << cid << "' to '" << ncid << "'"
 	     << ": ret = " << ret << dendl;
@@ -4719,7 +5283,19 @@ int FileStore::_destroy_collection(coll_t c)
   char fn[PATH_MAX];
   get_cdir(c, fn, sizeof(fn));
   dout(15) << "_destroy_collection " << fn << dendl;
-  int r = ::rmdir(fn);
+  fdcache.clear(c);
+  index_manager.clear_list_cache(fn);
+  int r;
+  {
+    Index index;
+    r = get_index(c, &index);
+    if (r < 0)
+      return r;
+    r = index->prep_delete();
+    if (r < 0)
+      return r;
+  }
+  r = ::rmdir(fn);
   if (r < 0)
     r = -errno;
   dout(10) << "_destroy_collection " << fn << " = " << r << dendl;
@@ -4744,8 +5320,9 @@ int FileStore::_collection_add(coll_t c, coll_t oldcid, const hobject_t& o,
 
   // open guard on object so we don't any previous operations on the
   // new name that will modify the source inode.
-  int fd = lfn_open(oldcid, o, 0);
-  if (fd < 0) {
+  FDRef fd;
+  int r = lfn_open(oldcid, o, false, &fd);
+  if (r < 0) {
     // the source collection/object does not exist. If we are replaying, we
     // should be safe, so just return 0 and move on.
     assert(replaying);
@@ -4753,12 +5330,12 @@ int FileStore::_collection_add(coll_t c, coll_t oldcid, const hobject_t& o,
         << oldcid << "/" << o << " (dne, continue replay) " << dendl;
     return 0;
   }
-  assert(fd >= 0);
   if (dstcmp > 0) {      // if dstcmp == 0 the guard already says "in-progress"
-    _set_replay_guard(fd, spos, &o, true);
+    _set_replay_guard(**fd, spos, &o, true);
   }
 
-  int r = lfn_link(oldcid, c, o);
+  fdcache.clear(c, o);
+  r = lfn_link(oldcid, c, o);
   if (replaying && !btrfs_stable_commits &&
       r == -EEXIST)    // crashed between link() and set_replay_guard()
     r = 0;
@@ -4767,9 +5344,9 @@ int FileStore::_collection_add(coll_t c, coll_t oldcid, const hobject_t& o,
 
   // close guard on object so we don't do this again
   if (r == 0) {
-    _close_replay_guard(fd, spos);
+    _close_replay_guard(**fd, spos);
   }
-  TEMP_FAILURE_RETRY(::close(fd));
+  lfn_close(fd);
 
   dout(10) << "collection_add " << c << "/" << o << " from " << oldcid << "/" << o << " = " << r << dendl;
   return r;
@@ -4851,6 +5428,7 @@ const char** FileStore::get_tracked_conf_keys() const
     "filestore_dump_file",
     "filestore_kill_at",
     "filestore_fail_eio",
+    "filestore_readahead_size",
     NULL
   };
   return KEYS;
@@ -4864,7 +5442,8 @@ void FileStore::handle_conf_change(const struct md_config_t *conf,
       changed.count("filestore_flusher_max_fds") ||
       changed.count("filestore_flush_min") ||
       changed.count("filestore_kill_at") ||
-      changed.count("filestore_fail_eio")) {
+      changed.count("filestore_fail_eio") ||
+      changed.count("filestore_readahead_size")) {
     Mutex::Locker l(lock);
     m_filestore_min_sync_interval = conf->filestore_min_sync_interval;
     m_filestore_max_sync_interval = conf->filestore_max_sync_interval;
@@ -4874,6 +5453,7 @@ void FileStore::handle_conf_change(const struct md_config_t *conf,
     m_filestore_sync_flush = conf->filestore_sync_flush;
     m_filestore_kill_at.set(conf->filestore_kill_at);
     m_filestore_fail_eio = conf->filestore_fail_eio;
+    m_filestore_readahead_size = conf->filestore_readahead_size;
   }
   if (changed.count("filestore_commit_timeout")) {
     Mutex::Locker l(sync_entry_timeo_lock);
@@ -40,6 +40,7 @@ using namespace __gnu_cxx;
 #include "IndexManager.h"
 #include "ObjectMap.h"
 #include "SequencerPosition.h"
+#include "FDCache.h"
 
 #include "include/uuid.h"
 
@@ -84,6 +85,9 @@ private:
 
   // ObjectMap
   boost::scoped_ptr<ObjectMap> object_map;
+
+  // fd cache
+  FDCache fdcache;
   
   Finisher ondisk_finisher;
 
@@ -240,6 +244,61 @@ private:
     }
   } op_wq;
 
+  /**
+   * Collections with a HashIndex directory split to finish
+   *
+   * With filestore_split_threads > 0, a split is only started when an
+   * object is created, and is finished here one subdirectory at a time
+   * so that operations on the collection only wait for a single step.
+   */
+  deque<coll_t*> split_queue;
+  set<coll_t> split_queued; ///< collections in split_queue
+  ThreadPool split_tp;
+  struct SplitWQ : public ThreadPool::WorkQueue<coll_t> {
+    FileStore *store;
+    SplitWQ(FileStore *fs, time_t timeout, time_t suicide_timeout, ThreadPool *tp)
+      : ThreadPool::WorkQueue<coll_t>("FileStore::SplitWQ", timeout, suicide_timeout, tp), store(fs) {}
+
+    bool _enqueue(coll_t *cid) {
+      if (!store->split_queued.insert(*cid).second) {
+	delete cid;
+	return false;
+      }
+      store->split_queue.push_back(cid);
+      return true;
+    }
+    void _dequeue(coll_t *cid) {
+      assert(0);
+    }
+    bool _empty() {
+      return store->split_queue.empty();
+    }
+    coll_t *_dequeue() {
+      if (store->split_queue.empty())
+	return NULL;
+      coll_t *cid = store->split_queue.front();
+      store->split_queue.pop_front();
+      store->split_queued.erase(*cid);
+      return cid;
+    }
+    void _process(coll_t *cid) {
+      store->_split_collection(*cid);
+    }
+    void _process_finish(coll_t *cid) {
+      delete cid;
+    }
+    void _clear() {
+      while (!store->split_queue.empty()) {
+	delete store->split_queue.front();
+	store->split_queue.pop_front();
+      }
+      store->split_queued.clear();
+    }
+  } split_wq;
+
+  void queue_split(coll_t cid);
+  void _split_collection(coll_t cid);
+
   void _do_op(OpSequencer *o);
   void _finish_op(OpSequencer *o);
   Op *build_op(list<Transaction*>& tls,
@@ -273,6 +332,8 @@ private:
   PerfCounters *logger;
 
 public:
+  typedef FDCache::FDRef FDRef;
+
   int lfn_find(coll_t cid, const hobject_t& oid, IndexedPath *path);
   int lfn_getxattr(coll_t cid, const hobject_t& oid, const char *name, void *val, size_t size);
   int lfn_setxattr(coll_t cid, const hobject_t& oid, const char *name, const void *val, size_t size);
@@ -280,12 +341,21 @@ public:
   int lfn_listxattr(coll_t cid, const hobject_t& oid, char *names, size_t len);
   int lfn_truncate(coll_t cid, const hobject_t& oid, off_t length);
   int lfn_stat(coll_t cid, const hobject_t& oid, struct stat *buf);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode,
-	       IndexedPath *path);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode,
-	       IndexedPath *path, Index *index);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode);
-  int lfn_open(coll_t cid, const hobject_t& oid, int flags);
+  /**
+   * open an object, consulting the fd cache first
+   *
+   * The returned fd is opened O_RDWR and may be shared with other
+   * users; it must not be closed directly.  Drop it with lfn_close().
+   *
+   * @param create create the object if it does not exist
+   * @param outfd [out] ref to the open fd
+   * @param path [out] optional, resolved path; forces an index lookup
+   * @param index [in,out] optional, index to use/fill in for the lookup
+   * @return 0 on success, negative error code otherwise
+   */
+  int lfn_open(coll_t cid, const hobject_t& oid, bool create, FDRef *outfd,
+	       IndexedPath *path = 0, Index *index = 0);
+  void lfn_close(FDRef fd);
   int lfn_link(coll_t c, coll_t cid, const hobject_t& o) ;
   int lfn_unlink(coll_t cid, const hobject_t& o, const SequencerPosition &spos);
 
@@ -366,7 +436,8 @@ public:
   }
   bool exists(coll_t cid, const hobject_t& oid);
   int stat(coll_t cid, const hobject_t& oid, struct stat *st);
-  int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl, int flags = 0);
+  void _readahead(FDRef fd, uint64_t offset, uint64_t len);
   int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
 
   int _touch(coll_t cid, const hobject_t& oid);
@@ -390,6 +461,7 @@ public:
   void _flush_op_queue();
   void flush();
   void sync_and_flush();
+  void compact_omap();
 
   int dump_journal(ostream& out);
 
@@ -416,6 +488,18 @@ public:
   int _rmattrs(coll_t cid, const hobject_t& oid,
 	       const SequencerPosition &spos);
 
+  // packed attrs (filestore_xattr_pack)
+  int _get_packed_attrs(coll_t cid, const hobject_t& oid,
+			map<string,bufferptr> *attrs, set<string> *spilled);
+  int _set_packed_attrs(coll_t cid, const hobject_t& oid,
+			const map<string,bufferptr>& attrs,
+			const set<string>& spilled);
+  int _setattrs_packed(coll_t cid, const hobject_t& oid,
+		       map<string,bufferptr>& aset,
+		       const SequencerPosition *spos);
+  int _convert_attrs(coll_t cid, const hobject_t& oid, bool pack);
+  int convert_attrs(bool pack);
+
   int collection_getattr(coll_t c, const char *name, void *value, size_t size);
   int collection_getattr(coll_t c, const char *name, bufferlist& bl);
   int collection_getattrs(coll_t cid, map<string,bufferptr> &aset);
@@ -493,6 +577,8 @@ private:
   double m_filestore_max_sync_interval;
   double m_filestore_min_sync_interval;
   bool m_filestore_fail_eio;
+  int m_filestore_readahead_size;
+  bool m_filestore_xattr_pack;   ///< set at mount; the layout must not change under us
   int do_update;
   bool m_journal_dio, m_journal_aio;
   std::string m_osd_rollback_to_cluster_snap;
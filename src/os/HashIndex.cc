@@ -20,10 +20,12 @@
 #include "HashIndex.h"
 
 #include "common/debug.h"
+#include "common/errno.h"
 #define dout_subsys ceph_subsys_filestore
 
 const string HashIndex::SUBDIR_ATTR = "contents";
 const string HashIndex::IN_PROGRESS_OP_TAG = "in_progress_op";
+const string HashIndex::PRESPLIT_ATTR = "presplit_levels";
 
 int HashIndex::cleanup() {
   bufferlist bl;
@@ -46,12 +48,143 @@ int HashIndex::cleanup() {
     return -EINVAL;
 }
 
+int HashIndex::split_step(bool *done) {
+  *done = true;
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  if (r == -ENODATA || r == -ENOENT) {
+    // nothing in progress, or the collection went away
+    return 0;
+  }
+  if (r < 0)
+    return r;
+  bufferlist::iterator i = bl.begin();
+  InProgressOp in_progress(i);
+  if (in_progress.is_merge()) {
+    subdir_info_s info;
+    r = get_info(in_progress.path, &info);
+    if (r < 0)
+      return r;
+    return complete_merge(in_progress.path, info);
+  }
+  if (!in_progress.is_split())
+    return -EINVAL;
+  return do_split_step(in_progress.path, 1, done);
+}
+
+int HashIndex::remove_stale_copy(const hobject_t &hoid) {
+  if (!async_split)
+    return 0;  // splits complete before created() returns
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  if (r == -ENODATA || r == -ENOENT)
+    return 0;
+  if (r < 0)
+    return r;
+  bufferlist::iterator i = bl.begin();
+  InProgressOp in_progress(i);
+  if (!in_progress.is_split())
+    return 0;
+
+  // only objects of a subdir the split has completed have a copy left
+  // in the directory being split
+  vector<string> path_comp;
+  get_path_components(hoid, &path_comp);
+  const vector<string> &path = in_progress.path;
+  if (path_comp.size() <= path.size() ||
+      !equal(path.begin(), path.end(), path_comp.begin()))
+    return 0;
+  vector<string> subdir = path;
+  subdir.push_back(path_comp[path.size()]);
+  subdir_info_s info;
+  if (get_info(subdir, &info) < 0)
+    return 0;
+
+  string mangled_name;
+  int exists;
+  r = get_mangled_name(path, hoid, &mangled_name, &exists);
+  if (r < 0)
+    return r;
+  if (!exists)
+    return 0;
+  return remove_object(path, hoid);
+}
+
+int HashIndex::prep_delete() {
+  // an unfinished split leaves stale copies behind
+  int r = cleanup();
+  if (r < 0)
+    return r;
+  vector<string> path;
+  return remove_empty_subdirs(&path);
+}
+
+int HashIndex::remove_empty_subdirs(vector<string> *path) {
+  map<string, hobject_t> objects;
+  int r = list_objects(*path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  if (!objects.empty())
+    return -ENOTEMPTY;
+  set<string> subdirs;
+  r = list_subdirs(*path, &subdirs);
+  if (r < 0)
+    return r;
+  for (set<string>::iterator i = subdirs.begin(); i != subdirs.end(); ++i) {
+    path->push_back(*i);
+    r = remove_empty_subdirs(path);
+    if (r == 0)
+      r = remove_path(*path);
+    path->pop_back();
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
 int HashIndex::_init() {
   subdir_info_s info;
   vector<string> path;
+  __s32 levels = MAX(MIN(init_presplit_levels, MAX_HASH_LEVEL), 0);
+  bufferlist bl;
+  ::encode(levels, bl);
+  int r = add_attr_path(path, PRESPLIT_ATTR, bl);
+  if (r < 0)
+    return r;
+  presplit_levels = levels;
+  r = pre_split(&path, levels);
+  if (r < 0)
+    return r;
+  if (levels > 0)
+    info.subdirs = 16;
   return set_info(path, info);
 }
 
+int HashIndex::pre_split(vector<string> *path, int levels) {
+  if (levels <= 0)
+    return 0;
+  for (int i = 0; i < 16; ++i) {
+    char c[2];
+    snprintf(c, sizeof(c), "%X", i);
+    path->push_back(c);
+    int r = create_path(*path);
+    if (r < 0 && r != -EEXIST)
+      return r;
+    r = pre_split(path, levels - 1);
+    if (r < 0)
+      return r;
+    // as in a split, the info goes on last
+    subdir_info_s info;
+    info.hash_level = path->size();
+    info.subdirs = levels > 1 ? 16 : 0;
+    r = set_info(*path, info);
+    if (r < 0)
+      return r;
+    path->pop_back();
+  }
+  return 0;
+}
+
 /* LFNIndex virtual method implementations */
 int HashIndex::_created(const vector<string> &path,
 			const hobject_t &hoid,
@@ -67,6 +200,21 @@ int HashIndex::_created(const vector<string> &path,
     return r;
 
   if (must_split(info)) {
+    if (async_split) {
+      // only one split or merge may be in progress at a time; this
+      // directory will trigger again on a later create
+      bool in_progress;
+      r = op_in_progress(&in_progress);
+      if (r < 0)
+	return r;
+      if (!in_progress) {
+	r = initiate_split(path, info);
+	if (r < 0)
+	  return r;
+      }
+      split_queued = true;
+      return 0;
+    }
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -92,6 +240,16 @@ int HashIndex::_remove(const vector<string> &path,
   if (r < 0)
     return r;
   if (must_merge(info)) {
+    if (async_split) {
+      // don't clobber the tag of a split in progress; the merge will
+      // trigger again on a later remove
+      bool in_progress;
+      r = op_in_progress(&in_progress);
+      if (r < 0)
+	return r;
+      if (in_progress)
+	return 0;
+    }
     r = initiate_merge(path, info);
     if (r < 0)
       return r;
@@ -161,6 +319,19 @@ int HashIndex::end_split_or_merge(const vector<string> &path) {
   return remove_attr_path(vector<string>(), IN_PROGRESS_OP_TAG);
 }
 
+int HashIndex::op_in_progress(bool *in_progress) {
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  if (r == -ENODATA || r == -ENOENT) {
+    *in_progress = false;
+    return 0;
+  }
+  if (r < 0)
+    return r;
+  *in_progress = true;
+  return 0;
+}
+
 int HashIndex::get_info(const vector<string> &path, subdir_info_s *info) {
   bufferlist buf;
   int r = get_attr_path(path, SUBDIR_ATTR, buf);
@@ -179,10 +350,32 @@ int HashIndex::set_info(const vector<string> &path, const subdir_info_s &info) {
   return add_attr_path(path, SUBDIR_ATTR, buf);
 }
 
+int HashIndex::get_presplit_levels() {
+  if (presplit_levels >= 0)
+    return presplit_levels;
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), PRESPLIT_ATTR, bl);
+  if (r == -ENODATA) {
+    // created before collections could be presplit
+    presplit_levels = 0;
+  } else if (r < 0) {
+    // not merging is always safe
+    dout(0) << "get_presplit_levels: error reading " << PRESPLIT_ATTR
+	    << ": " << cpp_strerror(r) << dendl;
+    return MAX_HASH_LEVEL;
+  } else {
+    __s32 levels;
+    bufferlist::iterator p = bl.begin();
+    ::decode(levels, p);
+    presplit_levels = levels;
+  }
+  return presplit_levels;
+}
+
 bool HashIndex::must_merge(const subdir_info_s &info) {
-  return (info.hash_level > 0 &&
-	  info.objs < (unsigned)merge_threshold &&
-	  info.subdirs == 0);
+  return (info.objs < (unsigned)merge_threshold &&
+	  info.subdirs == 0 &&
+	  info.hash_level > (unsigned)get_presplit_levels());
 }
 
 bool HashIndex::must_split(const subdir_info_s &info) {
@@ -248,10 +441,26 @@ int HashIndex::initiate_split(const vector<string> &path, subdir_info_s info) {
 }
 
 int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
+  bool done = false;
+  while (!done) {
+    int r = do_split_step(path, 0, &done);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int HashIndex::do_split_step(const vector<string> &path,
+			     int max_subdirs,
+			     bool *done) {
+  *done = false;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
   int level = info.hash_level;
   map<string, hobject_t> objects;
   vector<string> dst = path;
-  int r;
   dst.push_back("");
   r = list_objects(path, 0, 0, &objects);
   if (r < 0)
@@ -261,8 +470,6 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
   if (r < 0)
     return r;
   map<string, map<string, hobject_t> > mapped;
-  map<string, hobject_t> moved;
-  int num_moved = 0;
   for (map<string, hobject_t>::iterator i = objects.begin();
        i != objects.end();
        ++i) {
@@ -270,49 +477,40 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
     get_path_components(i->second, &new_path);
     mapped[new_path[level]][i->first] = i->second;
   }
+
+  int filled = 0;
   for (map<string, map<string, hobject_t> >::iterator i = mapped.begin();
        i != mapped.end();
-       ) {
+       ++i) {
     dst[level] = i->first;
     /* If the info already exists, it must be correct,
      * we may be picking up a partially finished split */
     subdir_info_s temp;
     // subdir has already been fully copied
-    if (subdirs.count(i->first) && !get_info(dst, &temp)) {
-      for (map<string, hobject_t>::iterator j = i->second.begin();
-	   j != i->second.end();
-	   ++j) {
-	moved[j->first] = j->second;
-	num_moved++;
-	objects.erase(j->first);
-      }
-      ++i;
+    if (subdirs.count(i->first) && !get_info(dst, &temp))
       continue;
-    }
 
     subdir_info_s info_new;
     info_new.objs = i->second.size();
     info_new.subdirs = 0;
     info_new.hash_level = level + 1;
-    if (must_merge(info_new) && !subdirs.count(i->first)) {
-      mapped.erase(i++);
+    if (must_merge(info_new) && !subdirs.count(i->first))
       continue;
-    }
+
+    if (max_subdirs > 0 && filled == max_subdirs)
+      return 0;
 
     // Subdir doesn't yet exist
     if (!subdirs.count(i->first)) {
-      info.subdirs += 1;
       r = create_path(dst);
       if (r < 0)
 	return r;
+      subdirs.insert(i->first);
     } // else subdir has been created but only partially copied
 
     for (map<string, hobject_t>::iterator j = i->second.begin();
 	 j != i->second.end();
 	 ++j) {
-      moved[j->first] = j->second;
-      num_moved++;
-      objects.erase(j->first);
       r = link_object(path, dst, j->second, j->first);
       // May be a partially finished split
       if (r < 0 && r != -EEXIST) {
@@ -333,18 +531,50 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
     if (r < 0)
       return r;
 
-    ++i;
+    ++filled;
+  }
+
+  // A subdir without info and without objects left to copy was
+  // created just before a crash; nothing can have been put in it.
+  for (set<string>::iterator i = subdirs.begin(); i != subdirs.end(); ) {
+    dst[level] = *i;
+    subdir_info_s temp;
+    if (!mapped.count(*i) && get_info(dst, &temp) < 0) {
+      r = remove_path(dst);
+      if (r < 0)
+	return r;
+      subdirs.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+
+  // Every subdir is complete, drop the copies left in path
+  map<string, hobject_t> moved;
+  for (map<string, map<string, hobject_t> >::iterator i = mapped.begin();
+       i != mapped.end();
+       ++i) {
+    if (!subdirs.count(i->first))
+      continue;
+    for (map<string, hobject_t>::iterator j = i->second.begin();
+	 j != i->second.end();
+	 ++j) {
+      moved[j->first] = j->second;
+      objects.erase(j->first);
+    }
   }
   r = remove_objects(path, moved, &objects);
   if (r < 0)
     return r;
   info.objs = objects.size();
+  info.subdirs = subdirs.size();
   r = set_info(path, info);
   if (r < 0)
     return r;
   r = fsync_dir(path);
   if (r < 0)
     return r;
+  *done = true;
   return end_split_or_merge(path);
 }
 
@@ -393,8 +623,7 @@ int HashIndex::get_path_contents_by_hash(const vector<string> &path,
 					 const snapid_t *seq,
 					 set<string> *hash_prefixes,
 					 set<pair<string, hobject_t> > *objects) {
-  set<string> subdirs;
-  map<string, hobject_t> rev_objects;
+  std::tr1::shared_ptr<DirListing> listing;
   int r;
   string cur_prefix;
   for (vector<string>::const_iterator i = path.begin();
@@ -402,25 +631,29 @@ int HashIndex::get_path_contents_by_hash(const vector<string> &path,
        ++i) {
     cur_prefix.append(*i);
   }
-  r = list_objects(path, 0, 0, &rev_objects);
+  // successive partial listings revisit the same directories, read
+  // them through the list cache rather than copying them out
+  r = get_listing(path, &listing);
   if (r < 0)
     return r;
-  for (map<string, hobject_t>::iterator i = rev_objects.begin();
-       i != rev_objects.end();
+  const set<string> &subdirs = listing->subdirs;
+  for (map<string, hobject_t>::const_iterator i = listing->objects.begin();
+       i != listing->objects.end();
        ++i) {
-    string hash_prefix = get_path_str(i->second);
-    if (lower_bound && hash_prefix < *lower_bound)
-      continue;
     if (next_object && i->second < *next_object)
       continue;
     if (seq && i->second.snap < *seq)
       continue;
+    string hash_prefix = get_path_str(i->second);
+    // a copy left behind by an unfinished split; the subdir has it
+    if (hash_prefix.size() > path.size() &&
+	subdirs.count(hash_prefix.substr(path.size(), 1)))
+      continue;
+    if (lower_bound && hash_prefix < *lower_bound)
+      continue;
     hash_prefixes->insert(hash_prefix);
     objects->insert(pair<string, hobject_t>(hash_prefix, i->second));
   }
-  r = list_subdirs(path, &subdirs);
-  if (r < 0)
-    return r;
   for (set<string>::iterator i = subdirs.begin();
        i != subdirs.end();
        ++i) {
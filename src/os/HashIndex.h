@@ -45,6 +45,16 @@
  * Subdirectories are created when the number of objects in a directory
  * exceed 32*merge_threshhold.  The number of objects in a directory 
  * is encoded as subdir_info_s in an xattr on the directory.
+ *
+ * A split links the objects of a directory into its new subdirectories
+ * one subdirectory at a time, and only then removes them from the
+ * directory being split.  A subdirectory is only visible to lookups
+ * once all of its objects have been linked and its subdir_info_s has
+ * been written, so a split may be spread over several calls to
+ * split_step() with other operations on the collection in between:
+ * until the split completes, objects of a directory which map to an
+ * existing subdirectory are stale copies and are ignored.  The
+ * in progress op tag on the root records the split across restarts.
  */
 class HashIndex : public LFNIndex {
 private:
@@ -52,6 +62,8 @@ private:
   static const string SUBDIR_ATTR;
   /// Attribute name for storing in progress op tag
   static const string IN_PROGRESS_OP_TAG;
+  /// Attribute name for storing the levels the collection was presplit to
+  static const string PRESPLIT_ATTR;
   /// Size (bits) in object hash
   static const int PATH_HASH_LEN = 32;
   /// Max length of hashed path
@@ -65,6 +77,22 @@ private:
   int merge_threshold;
   int split_multiplier;
 
+  /// Levels of directories to create up front if init() creates the index
+  int init_presplit_levels;
+
+  /**
+   * Directories at or above this level were created up front and are
+   * never merged.  Read from PRESPLIT_ATTR on first use, -1 until then,
+   * so a later change to the setting does not affect the collection.
+   */
+  int presplit_levels;
+
+  /// Leave splits to split_step() rather than completing them in created()
+  bool async_split;
+
+  /// created() started, or ran into, a split for split_step() to finish
+  bool split_queued;
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
@@ -134,15 +162,31 @@ public:
     const char *base_path, ///< [in] Path to the index root.
     int merge_at,          ///< [in] Merge threshhold.
     int split_multiple,	   ///< [in] Split threshhold.
-    uint32_t index_version)///< [in] Index version
+    uint32_t index_version,///< [in] Index version
+    int presplit = 0,      ///< [in] Levels to create at init.
+    bool async = false)    ///< [in] Defer splits to split_step.
     : LFNIndex(collection, base_path, index_version), merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple), init_presplit_levels(presplit),
+      presplit_levels(-1),
+      async_split(async), split_queued(false) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
 
   /// @see CollectionIndex
   int cleanup();
+
+  /// @see CollectionIndex
+  bool split_pending() { return split_queued; }
+
+  /// @see CollectionIndex
+  int split_step(bool *done);
+
+  /// @see CollectionIndex
+  int prep_delete();
+
+  /// @see CollectionIndex
+  int remove_stale_copy(const hobject_t &hoid);
 	
 protected:
   int _init();
@@ -187,6 +231,19 @@ private:
   int end_split_or_merge(
     const vector<string> &path ///< [in] path to split or merged
     ); ///< @return Error Code, 0 on success
+  /// Check for a split or merge tag on the root
+  int op_in_progress(
+    bool *in_progress ///< [out] true if a split or merge is unfinished
+    ); ///< @return Error Code, 0 on success
+  /// Remove the empty subdirectories below path
+  int remove_empty_subdirs(
+    vector<string> *path ///< [in,out] Directory to clear out
+    ); ///< @return Error Code, -ENOTEMPTY if objects remain
+  /// Create levels levels of subdirectories below path
+  int pre_split(
+    vector<string> *path, ///< [in,out] Directory to populate
+    int levels		  ///< [in] Levels left to create
+    ); ///< @return Error Code, 0 on success
   /// Gets info from the xattr on the subdir represented by path
   int get_info(
     const vector<string> &path, ///< [in] Path from which to read attribute.
@@ -199,6 +256,9 @@ private:
     const subdir_info_s &info  	///< [in] Value to set
     ); /// @return Error Code, 0 on success
 
+  /// Levels the collection was presplit to when it was created
+  int get_presplit_levels(); ///< @return levels, MAX_HASH_LEVEL if unknown
+
   /// Encapsulates logic for when to split.
   bool must_merge(
     const subdir_info_s &info ///< [in] Info to check
@@ -233,6 +293,19 @@ private:
     subdir_info_s info	       ///< [in] Info attached to path
     ); /// @return Error Code, 0 on success
 
+  /**
+   * Advance the split of path
+   *
+   * Fills in up to max_subdirs new subdirectories (0 for no limit).
+   * Once every subdirectory is complete, removes the moved objects
+   * from path and clears the in progress tag.
+   */
+  int do_split_step(
+    const vector<string> &path, ///< [in] Subdir being split
+    int max_subdirs,            ///< [in] Subdirs to fill in this step
+    bool *done                  ///< [out] True if the split is complete
+    ); /// @return Error Code, 0 on success
+
   /// Determine path components from hoid hash
   void get_path_components(
     const hobject_t &hoid, ///< [in] Object for which to get path components
@@ -63,6 +63,30 @@ static int get_version(const char *path, uint32_t *version) {
   return 0;
 }
 
+namespace {
+  /// Matches path and everything below it
+  struct MatchPrefix {
+    string path, prefix;
+    MatchPrefix(const char *p) : path(p), prefix(path + "/") {}
+    bool operator()(const string &key) const {
+      return key == path || key.compare(0, prefix.size(), prefix) == 0;
+    }
+  };
+  struct MatchAll {
+    bool operator()(const string &key) const {
+      return true;
+    }
+  };
+}
+
+void IndexManager::clear_list_cache(const char *path) {
+  list_cache.clear_if(MatchPrefix(path));
+}
+
+void IndexManager::clear_list_cache() {
+  list_cache.clear_if(MatchAll());
+}
+
 void IndexManager::put_index(coll_t c) {
   Mutex::Locker l(lock);
   assert(col_indices.count(c));
@@ -72,12 +96,14 @@ void IndexManager::put_index(coll_t c) {
 
 int IndexManager::init_index(coll_t c, const char *path, uint32_t version) {
   Mutex::Locker l(lock);
+  clear_list_cache(path);
   int r = set_version(path, version);
   if (r < 0)
     return r;
   HashIndex index(c, path, g_conf->filestore_merge_threshold,
 		  g_conf->filestore_split_multiple,
-		  CollectionIndex::HASH_INDEX_TAG_2);
+		  CollectionIndex::HASH_INDEX_TAG_2,
+		  g_conf->filestore_index_presplit_levels);
   return index.init();
 }
 
@@ -100,9 +126,13 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     case CollectionIndex::HASH_INDEX_TAG_2: // fall through
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
-      *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version), 
-		     RemoveOnDelete(c, this));
+      HashIndex *hindex = new HashIndex(c, path, g_conf->filestore_merge_threshold,
+					g_conf->filestore_split_multiple, version,
+					g_conf->filestore_index_presplit_levels,
+					async_split);
+      if (g_conf->filestore_index_list_cache_size > 0)
+	hindex->set_list_cache(&list_cache);
+      *index = Index(hindex, RemoveOnDelete(c, this));
       return 0;
     }
     default: assert(0);
@@ -110,10 +140,14 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
 
   } else {
     // No need to check
-    *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HOBJECT_WITH_POOL), 
-		   RemoveOnDelete(c, this));
+    HashIndex *hindex = new HashIndex(c, path, g_conf->filestore_merge_threshold,
+				      g_conf->filestore_split_multiple,
+				      CollectionIndex::HOBJECT_WITH_POOL,
+				      g_conf->filestore_index_presplit_levels,
+				      async_split);
+    if (g_conf->filestore_index_list_cache_size > 0)
+      hindex->set_list_cache(&list_cache);
+    *index = Index(hindex, RemoveOnDelete(c, this));
     return 0;
   }
 }
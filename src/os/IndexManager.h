@@ -48,6 +48,10 @@ class IndexManager {
   Mutex lock; ///< Lock for Index Manager
   Cond cond;  ///< Cond for waiters on col_indices
   bool upgrade;
+  bool async_split; ///< HashIndexes leave splits to split_step()
+
+  /// Subdirectory listings shared by the HashIndexes, @see LFNIndex
+  LFNIndex::ListCache list_cache;
 
   /// Currently in use CollectionIndices
   map<coll_t,std::tr1::weak_ptr<CollectionIndex> > col_indices;
@@ -86,7 +90,20 @@ class IndexManager {
 public:
   /// Constructor
   IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+			       upgrade(upgrade), async_split(false),
+			       list_cache(g_conf->filestore_index_list_cache_size) {}
+
+  /// Drop cached listings of the collection at path
+  void clear_list_cache(const char *path);
+
+  /// Drop all cached listings; call when the store changed underneath
+  void clear_list_cache();
+
+  /// Have indexes built from now on defer directory splits
+  void set_async_split(bool async) {
+    Mutex::Locker l(lock);
+    async_split = async;
+  }
 
   /**
    * Reserve and return index for c
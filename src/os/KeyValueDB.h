@@ -77,6 +77,23 @@ public:
     std::map<string, bufferlist> *out ///< [out] Key value retrieved
     ) = 0;
 
+  /// Compact the whole store, dropping deleted and overwritten entries
+  virtual void compact() {}
+
+  /// Compact the keys under prefix
+  virtual void compact_range(
+    const string &prefix ///< [in] Prefix to compact
+    ) {}
+
+  /// Compact the keys of every prefix p with start <= p < end
+  virtual void compact_range(
+    const string &start, ///< [in] First prefix to compact
+    const string &end    ///< [in] Prefix bound, exclusive
+    ) {}
+
+  /// Dump implementation specific statistics
+  virtual void get_statistics(ostream &out) {}
+
   class WholeSpaceIteratorImpl {
   public:
     virtual int seek_to_first() = 0;
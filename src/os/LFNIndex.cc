@@ -69,6 +69,7 @@ int LFNIndex::created(const hobject_t &hoid, const char *path) {
   r = decompose_full_path(path, &path_comp, 0, &short_name);
   if (r < 0)
     return r;
+  dir_changed(path_comp);
   r = lfn_created(path_comp, hoid, short_name);
   if (r < 0)
     return r;
@@ -151,6 +152,7 @@ int LFNIndex::link_object(const vector<string> &from,
   r = lfn_get_name(to, hoid, 0, &to_path, 0);
   if (r < 0)
     return r;
+  dir_changed(to);
   r = ::link(from_path.c_str(), to_path.c_str());
   if (r < 0)
     return -errno;
@@ -161,6 +163,7 @@ int LFNIndex::link_object(const vector<string> &from,
 int LFNIndex::remove_objects(const vector<string> &dir,
 			     const map<string, hobject_t> &to_remove,
 			     map<string, hobject_t> *remaining) {
+  dir_changed(dir);
   set<string> clean_chains;
   for (map<string, hobject_t>::const_iterator to_clean = to_remove.begin();
        to_clean != to_remove.end();
@@ -222,6 +225,8 @@ int LFNIndex::move_objects(const vector<string> &from,
   r = list_objects(from, 0, NULL, &to_move);
   if (r < 0)
     return r;
+  dir_changed(from);
+  dir_changed(to);
   for (map<string,hobject_t>::iterator i = to_move.begin();
        i != to_move.end();
        ++i) {
@@ -285,6 +290,58 @@ static int get_hobject_from_oinfo(const char *dir, const char *file,
 
 int LFNIndex::list_objects(const vector<string> &to_list, int max_objs,
 			   long *handle, map<string, hobject_t> *out) {
+  if (!list_cache || max_objs > 0 || handle)
+    return read_objects(to_list, max_objs, handle, out);
+  std::tr1::shared_ptr<DirListing> listing;
+  int r = get_listing(to_list, &listing);
+  if (r < 0)
+    return r;
+  out->insert(listing->objects.begin(), listing->objects.end());
+  return 0;
+}
+
+int LFNIndex::list_subdirs(const vector<string> &to_list,
+			   set<string> *out) {
+  if (!list_cache)
+    return read_subdirs(to_list, out);
+  std::tr1::shared_ptr<DirListing> listing;
+  int r = get_listing(to_list, &listing);
+  if (r < 0)
+    return r;
+  out->insert(listing->subdirs.begin(), listing->subdirs.end());
+  return 0;
+}
+
+int LFNIndex::get_listing(const vector<string> &to_list,
+			  std::tr1::shared_ptr<DirListing> *listing) {
+  string key = get_full_path_subdir(to_list);
+  if (list_cache) {
+    *listing = list_cache->lookup(key);
+    if (*listing)
+      return 0;
+  }
+  DirListing *l = new DirListing;
+  int r = read_objects(to_list, 0, 0, &l->objects);
+  if (r == 0)
+    r = read_subdirs(to_list, &l->subdirs);
+  if (r < 0) {
+    delete l;
+    return r;
+  }
+  if (list_cache)
+    *listing = list_cache->add(key, l);
+  else
+    listing->reset(l);
+  return 0;
+}
+
+void LFNIndex::dir_changed(const vector<string> &path) {
+  if (list_cache)
+    list_cache->clear(get_full_path_subdir(path));
+}
+
+int LFNIndex::read_objects(const vector<string> &to_list, int max_objs,
+			   long *handle, map<string, hobject_t> *out) {
   string to_list_path = get_full_path_subdir(to_list);
   DIR *dir = ::opendir(to_list_path.c_str());
   char buf[PATH_MAX];
@@ -343,8 +400,8 @@ int LFNIndex::list_objects(const vector<string> &to_list, int max_objs,
   return r;
 }
 
-int LFNIndex::list_subdirs(const vector<string> &to_list,
-				  set<string> *out) {
+int LFNIndex::read_subdirs(const vector<string> &to_list,
+			   set<string> *out) {
   string to_list_path = get_full_path_subdir(to_list);
   DIR *dir = ::opendir(to_list_path.c_str());
   char buf[PATH_MAX];
@@ -369,6 +426,8 @@ int LFNIndex::list_subdirs(const vector<string> &to_list,
 }
 
 int LFNIndex::create_path(const vector<string> &to_create) {
+  assert(!to_create.empty());
+  dir_changed(vector<string>(to_create.begin(), to_create.end() - 1));
   int r = ::mkdir(get_full_path_subdir(to_create).c_str(), 0777);
   if (r < 0)
     return -errno;
@@ -377,6 +436,9 @@ int LFNIndex::create_path(const vector<string> &to_create) {
 }
 
 int LFNIndex::remove_path(const vector<string> &to_remove) {
+  assert(!to_remove.empty());
+  dir_changed(to_remove);
+  dir_changed(vector<string>(to_remove.begin(), to_remove.end() - 1));
   int r = ::rmdir(get_full_path_subdir(to_remove).c_str());
   if (r < 0)
     return -errno;
@@ -620,6 +682,7 @@ int LFNIndex::lfn_get_name(const vector<string> &path,
 	return -errno;
       if (errno == ENODATA) {
 	// Left over from incomplete transaction, it'll be replayed
+	dir_changed(path);
 	r = ::unlink(candidate_path.c_str());
 	if (r < 0)
 	  return -errno;
@@ -662,6 +725,7 @@ int LFNIndex::lfn_created(const vector<string> &path,
 int LFNIndex::lfn_unlink(const vector<string> &path,
 			 const hobject_t &hoid,
 			 const string &mangled_name) {
+  dir_changed(path);
   if (!lfn_is_hashed_filename(mangled_name)) {
     string full_path = get_full_path(path, mangled_name);
     int r = ::unlink(full_path.c_str());
@@ -25,6 +25,7 @@
 #include "osd/osd_types.h"
 #include "include/object.h"
 #include "common/ceph_crypto.h"
+#include "common/shared_cache.hpp"
 
 #include "CollectionIndex.h"
 
@@ -49,6 +50,23 @@
  * and a negative error code on failure.
  */
 class LFNIndex : public CollectionIndex {
+public:
+  /// Parsed contents of a subdirectory
+  struct DirListing {
+    map<string, hobject_t> objects; ///< mangled filename -> object
+    set<string> subdirs;            ///< demangled subdirectory names
+  };
+  /**
+   * Listings of recently read subdirectories, keyed by full path
+   *
+   * Outlives the LFNIndex instances, which only exist for the duration
+   * of one operation, so that a series of partial listings of a
+   * collection reads and parses each subdirectory once.  Any change to
+   * a subdirectory made through the index drops its entry.
+   */
+  typedef SharedLRU<string, DirListing> ListCache;
+
+private:
   /// Hash digest output size.
   static const int FILENAME_LFN_DIGEST_SIZE = CEPH_CRYPTO_SHA1_DIGESTSIZE;
   /// Length of filename hash.
@@ -81,6 +99,7 @@ protected:
 private:
   string lfn_attribute;
   coll_t collection;
+  ListCache *list_cache;
 
 public:
   /// Constructor
@@ -89,7 +108,7 @@ public:
     const char *base_path, ///< [in] path to Index root
     uint32_t index_version)
     : base_path(base_path), index_version(index_version),
-      collection(collection) {
+      collection(collection), list_cache(0) {
     if (index_version == HASH_INDEX_TAG) {
       lfn_attribute = LFN_ATTR;
     } else {
@@ -101,6 +120,9 @@ public:
 
   coll_t coll() const { return collection; }
 
+  /// Use cache for full listings of subdirectories; NULL to disable
+  void set_list_cache(ListCache *cache) { list_cache = cache; }
+
   /// Virtual destructor
   virtual ~LFNIndex() {}
 
@@ -293,6 +315,22 @@ protected:
     set<string> *out		   ///< [out] Subdirectories listed. 
     );
 
+  /**
+   * Gets the contents of to_list, from the list cache if possible
+   *
+   * The listing must not be modified.
+   * @return Error code on failure, 0 on success
+   */
+  int get_listing(
+    const vector<string> &to_list,		  ///< [in] Directory to list.
+    std::tr1::shared_ptr<DirListing> *listing ///< [out] Contents.
+    );
+
+  /// Drop the cached listing of path; call before changing its entries
+  void dir_changed(
+    const vector<string> &path ///< [in] Subdirectory being changed.
+    );
+
   /// Create subdirectory.
   int create_path(
     const vector<string> &to_create ///< [in] Subdirectory to create.
@@ -330,6 +368,20 @@ protected:
     ); ///< @return Error code, 0 on success
 
 private:
+  /// Reads objects in to_list from disk, @see list_objects
+  int read_objects(
+    const vector<string> &to_list,
+    int max_objects,
+    long *handle,
+    map<string, hobject_t> *out
+    );
+
+  /// Reads subdirectories of to_list from disk, @see list_subdirs
+  int read_subdirs(
+    const vector<string> &to_list,
+    set<string> *out
+    );
+
   /* lfn translation functions */
 
   /**
@@ -10,20 +10,206 @@
 #include "leveldb/write_batch.h"
 #include "leveldb/slice.h"
 #include <errno.h>
+#include <sstream>
+#include "common/admin_socket.h"
+#include "common/ceph_context.h"
+#include "common/perf_counters.h"
 using std::string;
 
+class LevelDBStoreHook : public AdminSocketHook {
+  LevelDBStore *store;
+public:
+  LevelDBStoreHook(LevelDBStore *s) : store(s) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    if (command == "leveldb stats") {
+      store->get_statistics(ss);
+    } else if (command == "leveldb compact") {
+      store->compact();
+      ss << "compacted" << std::endl;
+    } else {
+      return false;
+    }
+    out.append(ss);
+    return true;
+  }
+};
+
 int LevelDBStore::init(ostream &out)
 {
-  leveldb::Options options;
-  options.create_if_missing = true;
+  leveldb::Options ldoptions;
+  if (options.write_buffer_size)
+    ldoptions.write_buffer_size = options.write_buffer_size;
+  if (options.max_open_files)
+    ldoptions.max_open_files = options.max_open_files;
+  if (options.cache_size) {
+    db_cache.reset(leveldb::NewLRUCache(options.cache_size));
+    ldoptions.block_cache = db_cache.get();
+  }
+  if (options.block_size)
+    ldoptions.block_size = options.block_size;
+  if (options.bloom_size) {
+    filterpolicy.reset(leveldb::NewBloomFilterPolicy(options.bloom_size));
+    ldoptions.filter_policy = filterpolicy.get();
+  }
+  if (!options.compression_enabled)
+    ldoptions.compression = leveldb::kNoCompression;
+  ldoptions.paranoid_checks = options.paranoid_checks;
+  if (options.log_file.length()) {
+    leveldb::Logger *_logger;
+    leveldb::Status status =
+      leveldb::Env::Default()->NewLogger(options.log_file, &_logger);
+    if (!status.ok()) {
+      out << "unable to open leveldb log " << options.log_file << ": "
+	  << status.ToString() << std::endl;
+      return -EINVAL;
+    }
+    dblogger.reset(_logger);
+    ldoptions.info_log = dblogger.get();
+  }
+  ldoptions.create_if_missing = true;
+
   leveldb::DB *_db;
-  leveldb::Status status = leveldb::DB::Open(options, path, &_db);
+  leveldb::Status status = leveldb::DB::Open(ldoptions, path, &_db);
   db.reset(_db);
   if (!status.ok()) {
     out << status.ToString() << std::endl;
     return -EINVAL;
-  } else
-    return 0;
+  }
+
+  if (cct) {
+    PerfCountersBuilder plb(cct, "leveldb", l_leveldb_first, l_leveldb_last);
+    plb.add_u64_counter(l_leveldb_gets, "leveldb_get");
+    plb.add_u64_counter(l_leveldb_txns, "leveldb_transaction");
+    plb.add_u64_counter(l_leveldb_compact, "leveldb_compact");
+    plb.add_u64_counter(l_leveldb_compact_range, "leveldb_compact_range");
+    plb.add_u64(l_leveldb_size, "leveldb_size");
+    logger = plb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(logger);
+    update_size();
+
+    // only the first store in the process gets the commands
+    asok_hook = new LevelDBStoreHook(this);
+    AdminSocket *admin_socket = cct->get_admin_socket();
+    if (admin_socket->register_command("leveldb stats", asok_hook,
+				       "dump leveldb statistics") == 0) {
+      admin_socket->register_command("leveldb compact", asok_hook,
+				     "compact leveldb");
+    } else {
+      delete asok_hook;
+      asok_hook = 0;
+    }
+  }
+  return 0;
+}
+
+LevelDBStore::~LevelDBStore()
+{
+  if (asok_hook) {
+    cct->get_admin_socket()->unregister_command("leveldb stats");
+    cct->get_admin_socket()->unregister_command("leveldb compact");
+    delete asok_hook;
+  }
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
+  // the cache, filter policy and log must outlive the db
+  db.reset();
+}
+
+int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
+{
+  LevelDBTransactionImpl * _t =
+    static_cast<LevelDBTransactionImpl *>(t.get());
+  leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
+  if (logger)
+    logger->inc(l_leveldb_txns);
+  return s.ok() ? 0 : -1;
+}
+
+int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
+{
+  LevelDBTransactionImpl * _t =
+    static_cast<LevelDBTransactionImpl *>(t.get());
+  leveldb::WriteOptions options;
+  options.sync = true;
+  leveldb::Status s = db->Write(options, &(_t->bat));
+  if (logger) {
+    logger->inc(l_leveldb_txns);
+    // sync writes come once per FileStore commit, which is a cheap
+    // enough cadence to keep the size estimate current
+    update_size();
+  }
+  return s.ok() ? 0 : -1;
+}
+
+void LevelDBStore::compact()
+{
+  if (logger)
+    logger->inc(l_leveldb_compact);
+  db->CompactRange(NULL, NULL);
+  update_size();
+}
+
+void LevelDBStore::compact_range(const string &prefix)
+{
+  string start = combine_strings(prefix, "");
+  string end = past_prefix(prefix);
+  leveldb::Slice cstart(start);
+  leveldb::Slice cend(end);
+  if (logger)
+    logger->inc(l_leveldb_compact_range);
+  db->CompactRange(&cstart, &cend);
+  update_size();
+}
+
+void LevelDBStore::compact_range(const string &start, const string &end)
+{
+  // a key is prefix + '\0' + key, so the raw [start, end) covers
+  // exactly the keys whose prefix falls in [start, end)
+  leveldb::Slice cstart(start);
+  leveldb::Slice cend(end);
+  if (logger)
+    logger->inc(l_leveldb_compact_range);
+  db->CompactRange(&cstart, &cend);
+  update_size();
+}
+
+uint64_t LevelDBStore::get_estimated_size(const string &start,
+					  const string &end)
+{
+  leveldb::Range range(start, end);
+  uint64_t size = 0;
+  db->GetApproximateSizes(&range, 1, &size);
+  return size;
+}
+
+void LevelDBStore::update_size()
+{
+  if (!logger)
+    return;
+  // every key sorts below "\xff"
+  logger->set(l_leveldb_size, get_estimated_size("", string(1, '\xff')));
+}
+
+void LevelDBStore::get_statistics(ostream &out)
+{
+  string stats;
+  if (db->GetProperty("leveldb.stats", &stats))
+    out << stats;
+  uint64_t total = get_estimated_size("", string(1, '\xff'));
+  out << "approximate size " << total << std::endl;
+  for (int level = 0; ; ++level) {
+    stringstream prop;
+    prop << "leveldb.num-files-at-level" << level;
+    string files;
+    if (!db->GetProperty(prop.str(), &files))
+      break;
+    out << "level " << level << " files " << files << std::endl;
+  }
+  if (logger)
+    logger->set(l_leveldb_size, total);
 }
 
 void LevelDBStore::LevelDBTransactionImpl::set(
@@ -66,6 +252,8 @@ int LevelDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  if (logger)
+    logger->inc(l_leveldb_gets);
   KeyValueDB::Iterator it = get_iterator(prefix);
   for (std::set<string>::const_iterator i = keys.begin();
        i != keys.end();
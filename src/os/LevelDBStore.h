@@ -14,19 +14,93 @@
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "leveldb/slice.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/env.h"
+
+class CephContext;
+class PerfCounters;
+class LevelDBStoreHook;
+
+enum {
+  l_leveldb_first = 34300,
+  l_leveldb_gets,
+  l_leveldb_txns,
+  l_leveldb_compact,
+  l_leveldb_compact_range,
+  l_leveldb_size,
+  l_leveldb_last,
+};
 
 /**
  * Uses LevelDB to implement the KeyValueDB interface
  */
 class LevelDBStore : public KeyValueDB {
+  CephContext *cct;
+  PerfCounters *logger;
+  LevelDBStoreHook *asok_hook;
   string path;
   boost::scoped_ptr<leveldb::DB> db;
+  boost::scoped_ptr<leveldb::Cache> db_cache;
+  boost::scoped_ptr<const leveldb::FilterPolicy> filterpolicy;
+  boost::scoped_ptr<leveldb::Logger> dblogger;
+
+  /// refresh the size estimate reported through l_leveldb_size
+  void update_size();
+
 public:
-  LevelDBStore(const string &path) : path(path) {}
+  /**
+   * Tunables, applied at init().  A zero/empty value keeps the leveldb
+   * default.  FileStore fills these in from the leveldb_* config
+   * options.
+   */
+  struct options_t {
+    uint64_t write_buffer_size; ///< memtable size before it is flushed
+    uint64_t cache_size;        ///< shared LRU block cache size
+    uint64_t block_size;        ///< uncompressed size of a table block
+    int bloom_size;             ///< bloom filter bits per key
+    int max_open_files;         ///< table files kept open
+    bool compression_enabled;   ///< snappy compress blocks
+    bool paranoid_checks;       ///< verify checksums aggressively
+    string log_file;            ///< leveldb info log
+
+    options_t() :
+      write_buffer_size(0),
+      cache_size(0),
+      block_size(0),
+      bloom_size(0),
+      max_open_files(0),
+      compression_enabled(true),
+      paranoid_checks(false)
+    {}
+  } options;
+
+  /**
+   * If cct is set, perf counters and the "leveldb stats"/"leveldb
+   * compact" admin socket commands are registered at init().
+   */
+  LevelDBStore(const string &path, CephContext *cct = 0)
+    : cct(cct), logger(0), asok_hook(0), path(path) {}
+  ~LevelDBStore();
 
   /// Opens underlying db
   int init(ostream &out);
 
+  /// Compact the whole store
+  void compact();
+
+  /// Compact the keys under prefix
+  void compact_range(const string &prefix);
+
+  /// Compact the keys of every prefix in [start, end)
+  void compact_range(const string &start, const string &end);
+
+  /// Dump leveldb's level/compaction stats and size estimates
+  void get_statistics(ostream &out);
+
+  /// Estimated on-disk bytes used by keys of prefixes in [start, end)
+  uint64_t get_estimated_size(const string &start, const string &end);
+
   class LevelDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     leveldb::WriteBatch bat;
@@ -52,21 +126,8 @@ public:
       new LevelDBTransactionImpl(this));
   }
 
-  int submit_transaction(KeyValueDB::Transaction t) {
-    LevelDBTransactionImpl * _t =
-      static_cast<LevelDBTransactionImpl *>(t.get());
-    leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
-    return s.ok() ? 0 : -1;
-  }
-
-  int submit_transaction_sync(KeyValueDB::Transaction t) {
-    LevelDBTransactionImpl * _t =
-      static_cast<LevelDBTransactionImpl *>(t.get());
-    leveldb::WriteOptions options;
-    options.sync = true;
-    leveldb::Status s = db->Write(options, &(_t->bat));
-    return s.ok() ? 0 : -1;
-  }
+  int submit_transaction(KeyValueDB::Transaction t);
+  int submit_transaction_sync(KeyValueDB::Transaction t);
 
   int get(
     const string &prefix,
@@ -131,6 +131,22 @@ public:
 
   virtual bool check(std::ostream &out) { return true; }
 
+  /**
+   * Batch mutations made by the calling thread
+   *
+   * Until end_batch(), mutations from this thread may be accumulated
+   * into a single backing store transaction rather than each being
+   * submitted on its own.  Reads from the calling thread still see
+   * its own earlier writes.
+   */
+  virtual void start_batch() {}
+
+  /// Submit anything accumulated since start_batch()
+  virtual int end_batch() { return 0; }
+
+  /// Reclaim space left behind by removed objects; may be slow
+  virtual void compact() {}
+
   class ObjectMapIteratorImpl {
   public:
     virtual int seek_to_first() = 0;
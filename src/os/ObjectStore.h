@@ -19,6 +19,7 @@
 #include "include/types.h"
 #include "osd/osd_types.h"
 #include "common/TrackedOp.h"
+#include "common/ObjectPool.h"
 #include "ObjectMap.h"
 
 #include <errno.h>
@@ -67,6 +68,9 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_fd_cache_hit,
+  l_os_fd_cache_miss,
+  l_os_readahead,
   l_os_last,
 };
 
@@ -116,7 +120,7 @@ public:
   /*********************************
    * transaction
    */
-  class Transaction {
+  class Transaction : public PooledObject<Transaction> {
   public:
     enum {
       OP_NOP =          0,
@@ -660,7 +664,12 @@ public:
   // objects
   virtual bool exists(coll_t cid, const hobject_t& oid) = 0;                   // useful?
   virtual int stat(coll_t cid, const hobject_t& oid, struct stat *st) = 0;     // struct stat?
-  virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
+  /// read flags
+  enum {
+    /// the data will not be read again soon; keep it out of the page cache
+    READ_NOCACHE = 1,
+  };
+  virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl, int flags = 0) = 0;
   virtual int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
 
   virtual int getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr& value) = 0;
@@ -775,6 +784,9 @@ public:
   virtual void flush() {}
   virtual void sync_and_flush() {}
 
+  /// reclaim omap space left behind by removed objects; may be slow
+  virtual void compact_omap() {}
+
   virtual int dump_journal(ostream& out) { return -EOPNOTSUPP; }
 
   virtual int snapshot(const string& name) { return -EOPNOTSUPP; }
@@ -0,0 +1,6 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "AllocCounter.h"
+
+__thread uint64_t thread_allocs = 0;
@@ -0,0 +1,31 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_OSD_ALLOCCOUNTER_H
+#define CEPH_OSD_ALLOCCOUNTER_H
+
+#include <stdint.h>
+
+/*
+ * Per-thread count of heap allocations, which OpRequest uses to tell how
+ * many an op costs.  The counting is done by the operator new in
+ * osd/AllocCounterNew.cc, which only ceph-osd links in; in any other
+ * binary the count stays at zero.
+ */
+extern __thread uint64_t thread_allocs;
+
+/// number of times this thread has called operator new
+inline uint64_t get_thread_allocs()
+{
+  return thread_allocs;
+}
+
+#endif
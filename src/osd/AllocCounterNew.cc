@@ -0,0 +1,43 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+/*
+ * Replaces the global operator new with one that counts the allocations
+ * of each thread in thread_allocs (see AllocCounter.h).  This changes
+ * the allocator of the whole program, so it is only linked into ceph-osd
+ * and the tests of the counting, never into a library.
+ *
+ * Everything else (operator new[], the nothrow versions, and operator
+ * delete) is left to the defaults, which go through this or malloc()
+ * and free().
+ */
+
+#include <new>
+#include <stdlib.h>
+
+#include "AllocCounter.h"
+
+void *operator new(size_t size) throw (std::bad_alloc)
+{
+  ++thread_allocs;
+  if (size == 0)
+    size = 1;
+  for (;;) {
+    void *p = malloc(size);
+    if (p)
+      return p;
+    std::new_handler handler = std::set_new_handler(0);
+    std::set_new_handler(handler);
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
@@ -0,0 +1,77 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef CEPH_OSD_BACKFILLSLOTS_H
+#define CEPH_OSD_BACKFILLSLOTS_H
+
+#include <map>
+using std::map;
+
+#include "osd_types.h"
+
+/*
+ * The backfill reservations one osd holds on one side of a backfill:
+ * each pg that has a slot maps to the peer osd at the other end.  The
+ * caller does the locking.
+ */
+class BackfillSlots {
+  map<pg_t,int> slots;   ///< pg -> peer osd
+
+public:
+  /**
+   * take pgid's slot for peer, unless max pgs already hold one
+   *
+   * A pg that already has a slot keeps it, and the slot passes to peer:
+   * once the pg's peer changes, only the new peer will release it.
+   *
+   * @param prev [out] the peer that held the slot before, or -1
+   * @return true if peer now holds the slot
+   */
+  bool reserve(pg_t pgid, int peer, int max, int *prev = 0) {
+    map<pg_t,int>::iterator p = slots.find(pgid);
+    if (prev)
+      *prev = p == slots.end() ? -1 : p->second;
+    if (p != slots.end()) {
+      p->second = peer;
+      return true;
+    }
+    if ((int)slots.size() >= max)
+      return false;
+    slots[pgid] = peer;
+    return true;
+  }
+
+  /**
+   * drop pgid's slot; if peer >= 0, only if peer holds it
+   *
+   * @param prev [out] the peer that held the slot, if it was dropped
+   * @return true if the slot was dropped
+   */
+  bool release(pg_t pgid, int peer = -1, int *prev = 0) {
+    map<pg_t,int>::iterator p = slots.find(pgid);
+    if (p == slots.end() ||
+	(peer >= 0 && p->second != peer))
+      return false;
+    if (prev)
+      *prev = p->second;
+    slots.erase(p);
+    return true;
+  }
+
+  size_t size() const {
+    return slots.size();
+  }
+  const map<pg_t,int>& get_slots() const {
+    return slots;
+  }
+};
+
+#endif
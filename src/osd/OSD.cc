@@ -57,6 +57,7 @@
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
+#include "messages/MOSDSubOpBatch.h"
 #include "messages/MOSDBoot.h"
 #include "messages/MOSDPGTemp.h"
 
@@ -122,6 +123,12 @@ static ostream& _prefix(std::ostream* _dout, int whoami, OSDMapRef osdmap) {
 		<< " ";
 }
 
+// OSDService methods below share OSD's dout_prefix
+static ostream& _prefix(std::ostream* _dout, int whoami,
+			PublishedPtr<const OSDMap> &osdmap) {
+  return _prefix(_dout, whoami, osdmap.get());
+}
+
 const coll_t coll_t::META_COLL("meta");
 
 static CompatSet get_osd_compat_set() {
@@ -147,7 +154,6 @@ OSDService::OSDService(OSD *osd) :
   client_messenger(osd->client_messenger),
   logger(osd->logger),
   monc(osd->monc),
-  op_wq(osd->op_wq),
   peering_wq(osd->peering_wq),
   recovery_wq(osd->recovery_wq),
   snap_trim_wq(osd->snap_trim_wq),
@@ -158,6 +164,12 @@ OSDService::OSDService(OSD *osd) :
   publish_lock("OSDService::publish_lock"),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
+  scrub_read_bucket("OSDService::scrub_read_bucket"),
+  recovery_push_bucket("OSDService::recovery_push_bucket", 1.0),
+  backfill_reserve_lock("OSDService::backfill_reserve_lock"),
+  subop_batch_lock("OSDService::subop_batch_lock"),
+  subop_batch_timer_lock("OSDService::subop_batch_timer_lock"),
+  subop_batch_timer(osd->client_messenger->cct, subop_batch_timer_lock),
   watch_lock("OSD::watch_lock"),
   watch_timer(osd->client_messenger->cct, watch_lock),
   watch(NULL),
@@ -165,10 +177,32 @@ OSDService::OSDService(OSD *osd) :
   tid_lock("OSDService::tid_lock"),
   pg_temp_lock("OSDService::pg_temp_lock"),
   map_cache_lock("OSDService::map_lock"),
-  map_cache(g_conf->osd_map_cache_size),
   map_bl_cache(g_conf->osd_map_cache_size),
   map_bl_inc_cache(g_conf->osd_map_cache_size)
-{}
+{
+  size_t stripes = MAX(1, g_conf->osd_map_cache_shards);
+  size_t size = g_conf->osd_map_cache_size;
+  map_cache.resize(stripes);
+  for (size_t i = 0; i < stripes; ++i) {
+    map_cache[i] = new SharedLRU<epoch_t, const OSDMap>;
+    map_cache[i]->set_size(size > stripes ? size / stripes : 1);
+  }
+}
+
+OSDService::~OSDService()
+{
+  // the published map refers back to its stripe when released
+  osdmap.reset();
+  for (size_t i = 0; i < map_cache.size(); ++i)
+    delete map_cache[i];
+  for (map<int, SubOpBatch*>::iterator p = subop_batches.begin();
+       p != subop_batches.end();
+       ++p) {
+    if (p->second->m)
+      p->second->m->put();
+    delete p->second;
+  }
+}
 
 void OSDService::need_heartbeat_peer_update()
 {
@@ -701,11 +735,16 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_queue_len(0),
-  op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
-  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
+  reservations_hook(NULL),
+  fast_dispatch_lock("OSD::fast_dispatch_lock"),
+  op_wq(this, external_messenger->cct, g_conf->osd_op_num_shards,
+	g_conf->osd_op_num_threads_per_shard, g_conf->osd_op_thread_timeout),
+  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp,
+	     g_conf->osd_peering_wq_batch_size),
   map_lock("OSD::map_lock"),
+  map_prep_lock("OSD::map_prep_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
+  pg_map_lock("OSD::pg_map_lock"),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
   debug_drop_pg_create_duration(g_conf->osd_debug_drop_pg_create_duration),
   debug_drop_pg_create_left(-1),
@@ -781,6 +820,20 @@ public:
 };
 
 
+class ReservationsSocketHook : public AdminSocketHook {
+  OSDService *service;
+public:
+  ReservationsSocketHook(OSDService *s) : service(s) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    JSONFormatter jf(true);
+    service->dump_reservations(&jf);
+    stringstream ss;
+    jf.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 class OpsFlightSocketHook : public AdminSocketHook {
   OSD *osd;
 public:
@@ -799,6 +852,7 @@ int OSD::init()
 
   timer.init();
   service.watch_timer.init();
+  service.subop_batch_timer.init();
   service.watch = new Watch();
 
   // mount.
@@ -894,6 +948,7 @@ int OSD::init()
   osd_lock.Lock();
 
   op_tp.start();
+  op_wq.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
@@ -921,6 +976,10 @@ int OSD::init()
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  reservations_hook = new ReservationsSocketHook(&service);
+  r = admin_socket->register_command("dump_reservations", reservations_hook,
+				     "show the backfill reservations held and awaited");
+  assert(r == 0);
 
   return 0;
 }
@@ -933,24 +992,33 @@ void OSD::create_logger()
 
   osd_plb.add_u64(l_osd_opq, "opq");       // op queue length (waiting to be processed yet)
   osd_plb.add_u64(l_osd_op_wip, "op_wip");   // rep ops currently being processed (primary)
+  osd_plb.add_u64_counter(l_osd_op_fast, "op_fast_dispatch");   // client ops queued without osd_lock
+  osd_plb.add_u64(l_osd_opq_strict, "opq_strict");       // op queue length, strict priority ops
+  osd_plb.add_u64(l_osd_opq_client, "opq_client");       // op queue length, client ops
+  osd_plb.add_u64(l_osd_opq_subop, "opq_subop");         // op queue length, replication/peer ops
+  osd_plb.add_u64(l_osd_opq_recovery, "opq_recovery");   // op queue length, recovery ops
+  osd_plb.add_fl_avg(l_osd_opq_wait_strict, "opq_wait_strict");      // time in op queue
+  osd_plb.add_fl_avg(l_osd_opq_wait_client, "opq_wait_client");
+  osd_plb.add_fl_avg(l_osd_opq_wait_subop, "opq_wait_subop");
+  osd_plb.add_fl_avg(l_osd_opq_wait_recovery, "opq_wait_recovery");
 
   osd_plb.add_u64_counter(l_osd_op,       "op");           // client ops
   osd_plb.add_u64_counter(l_osd_op_inb,   "op_in_bytes");       // client op in bytes (writes)
   osd_plb.add_u64_counter(l_osd_op_outb,  "op_out_bytes");      // client op out bytes (reads)
-  osd_plb.add_fl_avg(l_osd_op_lat,   "op_latency");       // client op latency
+  osd_plb.add_fl_hist(l_osd_op_lat,   "op_latency");       // client op latency
 
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes");   // client read out bytes
-  osd_plb.add_fl_avg(l_osd_op_r_lat,  "op_r_latency");    // client read latency
+  osd_plb.add_fl_hist(l_osd_op_r_lat,  "op_r_latency");    // client read latency
   osd_plb.add_u64_counter(l_osd_op_w,      "op_w");        // client writes
   osd_plb.add_u64_counter(l_osd_op_w_inb,  "op_w_in_bytes");    // client write in bytes
   osd_plb.add_fl_avg(l_osd_op_w_rlat, "op_w_rlat");   // client write readable/applied latency
-  osd_plb.add_fl_avg(l_osd_op_w_lat,  "op_w_latency");    // client write latency
+  osd_plb.add_fl_hist(l_osd_op_w_lat,  "op_w_latency");    // client write latency
   osd_plb.add_u64_counter(l_osd_op_rw,     "op_rw");       // client rmw
   osd_plb.add_u64_counter(l_osd_op_rw_inb, "op_rw_in_bytes");   // client rmw in bytes
   osd_plb.add_u64_counter(l_osd_op_rw_outb,"op_rw_out_bytes");  // client rmw out bytes
   osd_plb.add_fl_avg(l_osd_op_rw_rlat,"op_rw_rlat");  // client rmw readable/applied latency
-  osd_plb.add_fl_avg(l_osd_op_rw_lat, "op_rw_latency");   // client rmw latency
+  osd_plb.add_fl_hist(l_osd_op_rw_lat, "op_rw_latency");   // client rmw latency
 
   osd_plb.add_u64_counter(l_osd_sop,       "subop");         // subops
   osd_plb.add_u64_counter(l_osd_sop_inb,   "subop_in_bytes");     // subop in bytes
@@ -958,16 +1026,19 @@ void OSD::create_logger()
 
   osd_plb.add_u64_counter(l_osd_sop_w,     "subop_w");          // replicated (client) writes
   osd_plb.add_u64_counter(l_osd_sop_w_inb, "subop_w_in_bytes");      // replicated write in bytes
-  osd_plb.add_fl_avg(l_osd_sop_w_lat, "subop_w_latency");      // replicated write latency
+  osd_plb.add_fl_hist(l_osd_sop_w_lat, "subop_w_latency");      // replicated write latency
   osd_plb.add_u64_counter(l_osd_sop_pull,     "subop_pull");       // pull request
   osd_plb.add_fl_avg(l_osd_sop_pull_lat, "subop_pull_latency");
   osd_plb.add_u64_counter(l_osd_sop_push,     "subop_push");       // push (write)
   osd_plb.add_u64_counter(l_osd_sop_push_inb, "subop_push_in_bytes");
   osd_plb.add_fl_avg(l_osd_sop_push_lat, "subop_push_latency");
+  osd_plb.add_u64_counter(l_osd_sop_batch, "subop_batch");     // batches sent
+  osd_plb.add_u64_counter(l_osd_sop_batched, "subop_batched"); // sub ops and replies sent in them
 
   osd_plb.add_u64_counter(l_osd_pull,      "pull");       // pull requests sent
   osd_plb.add_u64_counter(l_osd_push,      "push");       // push messages
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
+  osd_plb.add_u64_counter(l_osd_push_delta, "push_delta");  // objects pushed as deltas
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
@@ -983,6 +1054,11 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
+  osd_plb.add_u64_counter(l_osd_map_cache_hit, "osd_map_cache_hit");  // osdmap cache hits
+  osd_plb.add_u64_counter(l_osd_map_cache_miss, "osd_map_cache_miss"); // osdmap decoded from the store
+  osd_plb.add_u64_counter(l_osd_map_prepared, "map_epochs_prepared");  // epochs decoded before taking osd_lock
+  osd_plb.add_u64_counter(l_osd_pg_map_advance, "pg_map_epochs_handled"); // map epochs handed to pgs
+  osd_plb.add_u64_counter(l_osd_pg_map_skip, "pg_map_epochs_skipped");    // map epochs pgs skipped as unaffecting
 
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
@@ -1000,6 +1076,7 @@ void OSD::suicide(int exitcode)
 
   derr << " pausing thread pools" << dendl;
   op_tp.pause();
+  op_wq.pause();
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
@@ -1026,12 +1103,19 @@ int OSD::shutdown()
 
   state = STATE_STOPPING;
 
+  // wait for ops already past the fast dispatch check
+  fast_dispatch_lock.get_write();
+  fast_dispatch_ok.set(0);
+  fast_dispatch_lock.put_write();
+
   timer.shutdown();
 
   service.watch_lock.Lock();
   service.watch_timer.shutdown();
   service.watch_lock.Unlock();
 
+  service.shutdown_subop_batches();
+
   heartbeat_lock.Lock();
   heartbeat_stop = true;
   heartbeat_cond.Signal();
@@ -1045,13 +1129,17 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_reservations");
   delete admin_ops_hook;
   delete historic_ops_hook;
+  delete reservations_hook;
   admin_ops_hook = NULL;
   historic_ops_hook = NULL;
+  reservations_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
+  op_wq.stop();
   op_tp.stop();
   dout(10) << "op tp stopped" << dendl;
 
@@ -1083,6 +1171,13 @@ int OSD::shutdown()
     p->second->unlock();
   }
 
+  {
+    // wait out any prepare_osd_map() queueing maps; later ones see
+    // we are stopping
+    Mutex::Locker l(map_prep_lock);
+    prepared_maps.clear();
+  }
+
   osd_lock.Unlock();
   store->sync();
   store->flush();
@@ -1124,7 +1219,9 @@ int OSD::shutdown()
     PG *pg = p->second;
     pg->put();
   }
+  pg_map_lock.get_write();
   pg_map.clear();
+  pg_map_lock.put_write();
 
   client_messenger->shutdown();
   cluster_messenger->shutdown();
@@ -1259,14 +1356,18 @@ PG *OSD::_open_lock_pg(
   else 
     assert(0);
 
-  assert(pg_map.count(pgid) == 0);
-  pg_map[pgid] = pg;
-
+  // lock before publishing in pg_map; _get_pg_fast() callers must
+  // not see the pg until it is initialized
   if (hold_map_lock)
     pg->lock_with_map_lock_held(no_lockdep_check);
   else
     pg->lock(no_lockdep_check);
   pg->get();  // because it's in pg_map
+
+  pg_map_lock.get_write();
+  assert(pg_map.count(pgid) == 0);
+  pg_map[pgid] = pg;
+  pg_map_lock.put_write();
   return pg;
 }
 
@@ -1316,6 +1417,19 @@ PG *OSD::_lookup_lock_pg(pg_t pgid)
   return pg;
 }
 
+PG *OSD::_get_pg_fast(pg_t pgid)
+{
+  PG *pg = NULL;
+  pg_map_lock.get_read();
+  hash_map<pg_t, PG*>::iterator p = pg_map.find(pgid);
+  if (p != pg_map.end()) {
+    pg = p->second;
+    pg->get();
+  }
+  pg_map_lock.put_read();
+  return pg;
+}
+
 PG *OSD::_lookup_lock_pg_with_map_lock_held(pg_t pgid)
 {
   assert(osd_lock.is_locked());
@@ -2065,6 +2179,16 @@ void OSD::tick()
   if (is_active()) {
     // periodically kick recovery work queue
     recovery_tp.wake();
+
+    // pgs that could not reserve a backfill try again
+    list<pg_t> retry;
+    service.get_backfill_retries(ceph_clock_now(g_ceph_context), &retry);
+    for (list<pg_t>::iterator p = retry.begin(); p != retry.end(); ++p) {
+      if (_have_pg(*p)) {
+	dout(10) << "tick retrying backfill reservation for " << *p << dendl;
+	service.queue_for_recovery(pg_map[*p]);
+      }
+    }
   
     if (service.scrub_should_schedule()) {
       sched_scrub();
@@ -2163,6 +2287,12 @@ void OSD::RemoveWQ::_process(boost::tuple<coll_t, SequencerRef, DeletingStateRef
     osr, t,
     new ObjectStore::C_DeleteTransactionHolder<SequencerRef>(t, item->get<1>()),
     new ContainerContext<SequencerRef>(item->get<1>()));
+  if (g_conf->osd_compact_omap_on_pg_removal) {
+    // the removals must be applied before their keys can be compacted away
+    if (osr)
+      osr->flush();
+    store->compact_omap();
+  }
   delete item;
 }
 // =========================================
@@ -2447,7 +2577,7 @@ void OSDService::send_pg_temp()
   if (pg_temp_wanted.empty())
     return;
   dout(10) << "send_pg_temp " << pg_temp_wanted << dendl;
-  MOSDPGTemp *m = new MOSDPGTemp(osdmap->get_epoch());
+  MOSDPGTemp *m = new MOSDPGTemp(get_osdmap()->get_epoch());
   m->pg_temp = pg_temp_wanted;
   monc->send_mon_message(m);
 }
@@ -2975,6 +3105,11 @@ bool OSD::heartbeat_dispatch(Message *m)
 
 bool OSD::ms_dispatch(Message *m)
 {
+  if (m->get_type() == CEPH_MSG_OSD_OP && fast_dispatch_op(m))
+    return true;
+  if (m->get_type() == CEPH_MSG_OSD_MAP)
+    prepare_osd_map((MOSDMap*)m);
+
   // lock!
   osd_lock.Lock();
   while (dispatch_running) {
@@ -3100,6 +3235,72 @@ void OSD::do_waiters()
       dispatch_op(*it);
     dout(2) << "do_waiters -- finish" << dendl;
   }
+  _update_fast_dispatch();
+}
+
+void OSD::_update_fast_dispatch()
+{
+  assert(osd_lock.is_locked());
+  bool ok = g_conf->osd_op_fast_dispatch && is_active() &&
+    waiting_for_osdmap.empty() && waiting_for_pg.empty();
+  if (ok) {
+    Mutex::Locker l(finished_lock);
+    ok = finished.empty();
+  }
+  fast_dispatch_ok.set(ok);
+}
+
+/*
+ * Queue a client op without osd_lock.  This only handles the common
+ * case, an op for a pg we have, from a client with our current map;
+ * anything else returns false and goes through handle_op.
+ */
+bool OSD::fast_dispatch_op(Message *m)
+{
+  fast_dispatch_lock.get_read();
+  bool r = _fast_dispatch_op((MOSDOp*)m);
+  fast_dispatch_lock.put_read();
+  return r;
+}
+
+bool OSD::_fast_dispatch_op(MOSDOp *op)
+{
+  if (!fast_dispatch_ok.read())
+    return false;
+
+  OSDMapRef curmap = service.get_osdmap();
+  if (!curmap ||
+      op->get_map_epoch() != curmap->get_epoch() ||
+      !is_active())
+    return false;
+
+  pg_t pgid = op->get_pg();
+  if ((op->get_flags() & CEPH_OSD_FLAG_PGOP) == 0 &&
+      curmap->have_pg_pool(pgid.pool()))
+    pgid = curmap->raw_pg_to_pg(pgid);
+  PG *pg = _get_pg_fast(pgid);
+  if (!pg)
+    return false;
+  pg->lock();
+  if (pg->deleting) {
+    pg->unlock();
+    pg->put();
+    return false;
+  }
+
+  dout(15) << "fast_dispatch_op " << *op << dendl;
+  OpRequestRef req = op_tracker.create_request(op);
+  logger->inc(l_osd_op_fast);
+  if (!op_is_discardable(op)) {
+    // we don't need encoded payload anymore
+    op->clear_payload();
+    if (check_op(req, curmap) &&
+	op_has_sufficient_caps(pg, op))
+      enqueue_op(pg, req);
+  }
+  pg->unlock();
+  pg->put();
+  return true;
 }
 
 void OSD::dispatch_op(OpRequestRef op)
@@ -3209,6 +3410,10 @@ void OSD::_dispatch(Message *m)
     handle_rep_scrub((MOSDRepScrub*)m);
     break;    
 
+  case MSG_OSD_SUBOP_BATCH:
+    handle_sub_op_batch((MOSDSubOpBatch*)m);
+    break;
+
     // -- need OSDMap --
 
   default:
@@ -3218,6 +3423,7 @@ void OSD::_dispatch(Message *m)
       // no map?  starting up?
       if (!osdmap) {
         dout(7) << "no OSDMap, not booted" << dendl;
+        fast_dispatch_ok.set(0);
         waiting_for_osdmap.push_back(op);
         break;
       }
@@ -3397,6 +3603,156 @@ void OSDService::dec_scrubs_active()
   sched_scrub_lock.Unlock();
 }
 
+/// charge bytes read by scrub against osd_scrub_bytes_per_sec
+void OSDService::scrub_read_account(uint64_t bytes)
+{
+  scrub_read_bucket.take(ceph_clock_now(g_ceph_context),
+			 g_conf->osd_scrub_bytes_per_sec, bytes);
+}
+
+/**
+ * wait, without any pg locked, until past scrub reads are paid for.  we
+ * wait at most half the scrub thread timeout at a time; any debt left is
+ * paid before the next chunk.
+ */
+void OSDService::scrub_read_wait()
+{
+  if (!g_conf->osd_scrub_bytes_per_sec)
+    return;
+  utime_t delay = scrub_read_bucket.get_wait(ceph_clock_now(g_ceph_context));
+  if (delay == utime_t())
+    return;
+  utime_t max_delay(g_conf->osd_scrub_thread_timeout / 2, 0);
+  if (delay > max_delay)
+    delay = max_delay;
+  dout(20) << "scrub_read_wait " << delay << dendl;
+  struct timespec ts;
+  delay.to_timespec(&ts);
+  nanosleep(&ts, NULL);
+}
+
+/// charge bytes pushed by recovery against osd_recovery_bytes_per_sec
+void OSDService::recovery_push_account(uint64_t bytes)
+{
+  recovery_push_bucket.take(ceph_clock_now(g_ceph_context),
+			    g_conf->osd_recovery_bytes_per_sec, bytes);
+}
+
+bool OSDService::recovery_push_ready()
+{
+  if (!g_conf->osd_recovery_bytes_per_sec)
+    return true;
+  return recovery_push_bucket.ready(ceph_clock_now(g_ceph_context));
+}
+
+bool OSDService::reserve_local_backfill(pg_t pgid, int target)
+{
+  Mutex::Locker l(backfill_reserve_lock);
+  if (!local_backfills.reserve(pgid, target, g_conf->osd_max_backfills)) {
+    dout(10) << "reserve_local_backfill " << pgid << " to osd." << target
+	     << " rejected, " << local_backfills.size() << " in progress" << dendl;
+    return false;
+  }
+  dout(10) << "reserve_local_backfill " << pgid << " to osd." << target << dendl;
+  backfill_retry.erase(pgid);
+  return true;
+}
+
+void OSDService::release_local_backfill(pg_t pgid)
+{
+  Mutex::Locker l(backfill_reserve_lock);
+  if (local_backfills.release(pgid))
+    dout(10) << "release_local_backfill " << pgid << dendl;
+  backfill_retry.erase(pgid);
+}
+
+bool OSDService::reserve_remote_backfill(pg_t pgid, int primary)
+{
+  Mutex::Locker l(backfill_reserve_lock);
+  int prev;
+  if (!remote_backfills.reserve(pgid, primary, g_conf->osd_max_backfills, &prev)) {
+    dout(10) << "reserve_remote_backfill " << pgid << " from osd." << primary
+	     << " rejected, " << remote_backfills.size() << " in progress" << dendl;
+    return false;
+  }
+  if (prev >= 0 && prev != primary)
+    dout(10) << "reserve_remote_backfill " << pgid << " from osd." << primary
+	     << ", taking the slot over from osd." << prev << dendl;
+  else
+    dout(10) << "reserve_remote_backfill " << pgid << " from osd." << primary << dendl;
+  return true;
+}
+
+/// release pgid's remote slot; if primary >= 0, only if it holds the slot
+void OSDService::release_remote_backfill(pg_t pgid, int primary)
+{
+  Mutex::Locker l(backfill_reserve_lock);
+  int prev;
+  if (remote_backfills.release(pgid, primary, &prev))
+    dout(10) << "release_remote_backfill " << pgid << " from osd." << prev << dendl;
+}
+
+/// queue pgid for recovery again after osd_backfill_retry_interval
+void OSDService::retry_backfill_reserve(pg_t pgid)
+{
+  utime_t when = ceph_clock_now(g_ceph_context);
+  when += g_conf->osd_backfill_retry_interval;
+  Mutex::Locker l(backfill_reserve_lock);
+  backfill_retry[pgid] = when;
+}
+
+void OSDService::get_backfill_retries(utime_t now, list<pg_t> *ls)
+{
+  Mutex::Locker l(backfill_reserve_lock);
+  for (map<pg_t,utime_t>::iterator p = backfill_retry.begin();
+       p != backfill_retry.end(); ) {
+    if (p->second <= now) {
+      ls->push_back(p->first);
+      backfill_retry.erase(p++);
+    } else {
+      ++p;
+    }
+  }
+}
+
+void OSDService::dump_reservations(Formatter *f)
+{
+  Mutex::Locker l(backfill_reserve_lock);
+  f->open_object_section("reservations");
+  f->dump_int("max_backfills", g_conf->osd_max_backfills);
+  f->open_array_section("local");
+  for (map<pg_t,int>::const_iterator p = local_backfills.get_slots().begin();
+       p != local_backfills.get_slots().end();
+       ++p) {
+    f->open_object_section("backfill");
+    f->dump_stream("pgid") << p->first;
+    f->dump_int("target", p->second);
+    f->close_section();
+  }
+  f->close_section();
+  f->open_array_section("remote");
+  for (map<pg_t,int>::const_iterator p = remote_backfills.get_slots().begin();
+       p != remote_backfills.get_slots().end();
+       ++p) {
+    f->open_object_section("backfill");
+    f->dump_stream("pgid") << p->first;
+    f->dump_int("primary", p->second);
+    f->close_section();
+  }
+  f->close_section();
+  f->open_array_section("waiting");
+  for (map<pg_t,utime_t>::iterator p = backfill_retry.begin();
+       p != backfill_retry.end();
+       ++p) {
+    f->open_object_section("backfill");
+    f->dump_stream("pgid") << p->first;
+    f->dump_stream("retry_at") << p->second;
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
+
 // =====================================================
 // MAP
 
@@ -3408,6 +3764,7 @@ void OSD::wait_for_new_map(OpRequestRef op)
     monc->renew_subs();
   }
   
+  fast_dispatch_ok.set(0);
   waiting_for_osdmap.push_back(op);
   op->mark_delayed();
 }
@@ -3438,6 +3795,129 @@ void OSD::note_up_osd(int peer)
   forget_peer_epoch(peer, osdmap->get_epoch() - 1);
 }
 
+/*
+ * Decode the maps in m, and build full maps from its incrementals,
+ * before handle_osd_map() takes osd_lock.  On a flood of new epochs this
+ * is most of the work, and doing it here keeps osd_lock (and with it
+ * heartbeats and peering) free meanwhile.  Anything not prepared here is
+ * decoded by handle_osd_map() as before.
+ *
+ * NOTE: called in a dispatch thread, without osd_lock
+ */
+void OSD::prepare_osd_map(MOSDMap *m)
+{
+  if (m->fsid != monc->get_fsid())
+    return;
+  Session *session = (Session *)m->get_connection()->get_priv();
+  if (session) {
+    bool allowed = session->entity_name.is_mon() ||
+      session->entity_name.is_osd();
+    session->put();
+    if (!allowed)
+      return;
+  }
+
+  // build on the newest map we have stored
+  OSDSuperblock sb = service.get_superblock();
+  epoch_t first = m->get_first();
+  epoch_t last = m->get_last();
+  if (last <= sb.newest_map || first > sb.newest_map + 1)
+    return;
+
+  map<epoch_t, pair<OSDMapRef, bufferlist> > prepared;
+  OSDMapRef prev;
+  for (epoch_t e = MAX(sb.newest_map + 1, first); e <= last; ++e) {
+    {
+      Mutex::Locker l(map_prep_lock);
+      map<epoch_t, pair<OSDMapRef, bufferlist> >::iterator q =
+	prepared_maps.find(e);
+      if (q != prepared_maps.end()) {
+	// another dispatch thread got here first
+	prev = q->second.first;
+	continue;
+      }
+    }
+
+    map<epoch_t,bufferlist>::iterator p = m->maps.find(e);
+    if (p != m->maps.end()) {
+      OSDMap *o = new OSDMap;
+      o->decode(p->second);
+      prev = add_map(o);
+      prepared[e] = make_pair(prev, p->second);
+      continue;
+    }
+
+    p = m->incremental_maps.find(e);
+    if (p == m->incremental_maps.end())
+      break;
+    OSDMap *o = new OSDMap;
+    if (e > 1) {
+      if (!prev)
+	prev = get_map(e - 1);
+      bufferlist obl;
+      prev->encode(obl);
+      o->decode(obl);
+    }
+    OSDMap::Incremental inc;
+    bufferlist::iterator bp = p->second.begin();
+    inc.decode(bp);
+    if (o->apply_incremental(inc) < 0) {
+      // handle_osd_map() will complain
+      delete o;
+      break;
+    }
+    // add_map() may hand back another thread's copy, and free o
+    prev = add_map(o);
+    bufferlist fbl;
+    prev->encode(fbl);
+    prepared[e] = make_pair(prev, fbl);
+  }
+
+  if (prepared.empty())
+    return;
+  dout(10) << "prepare_osd_map prepared " << prepared.size() << " epochs ["
+	   << prepared.begin()->first << "," << prepared.rbegin()->first
+	   << "]" << dendl;
+  if (logger)
+    logger->inc(l_osd_map_prepared, prepared.size());
+
+  // queue the maps for disk too.  handle_osd_map() commits the superblock
+  // through the same (default) sequencer, after this, so they are
+  // readable before it says we have them.  should it never get that far,
+  // all we leave behind are maps for epochs we have not recorded yet.
+  Mutex::Locker l(map_prep_lock);
+  if (is_stopping())
+    return;  // shutdown() is done with the store
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  for (map<epoch_t, pair<OSDMapRef, bufferlist> >::iterator p =
+	 prepared.begin();
+       p != prepared.end();
+       ++p) {
+    map<epoch_t,bufferlist>::iterator i = m->incremental_maps.find(p->first);
+    if (!m->maps.count(p->first) && i != m->incremental_maps.end()) {
+      hobject_t oid = get_inc_osdmap_pobject_name(p->first);
+      t->write(coll_t::META_COLL, oid, 0, i->second.length(), i->second);
+    }
+    bufferlist& fbl = p->second.second;
+    hobject_t fulloid = get_osdmap_pobject_name(p->first);
+    t->write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
+  }
+  store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
+
+  prepared_maps.insert(prepared.begin(), prepared.end());
+
+  // handle_osd_map() may have stored some of these meanwhile
+  trim_prepared_maps(service.get_superblock().newest_map);
+}
+
+/// drop prepared maps for epochs we have already stored
+void OSD::trim_prepared_maps(epoch_t e)
+{
+  assert(map_prep_lock.is_locked());
+  while (!prepared_maps.empty() && prepared_maps.begin()->first <= e)
+    prepared_maps.erase(prepared_maps.begin());
+}
+
 void OSD::handle_osd_map(MOSDMap *m)
 {
   assert(osd_lock.is_locked());
@@ -3460,6 +3940,19 @@ void OSD::handle_osd_map(MOSDMap *m)
 
   epoch_t first = m->get_first();
   epoch_t last = m->get_last();
+
+  // take what prepare_osd_map() decoded for us
+  map<epoch_t, pair<OSDMapRef, bufferlist> > prepared;
+  {
+    Mutex::Locker l(map_prep_lock);
+    map<epoch_t, pair<OSDMapRef, bufferlist> >::iterator p =
+      prepared_maps.begin();
+    while (p != prepared_maps.end() && p->first <= last) {
+      prepared.insert(*p);
+      prepared_maps.erase(p++);
+    }
+  }
+
   dout(3) << "handle_osd_map epochs [" << first << "," << last << "], i have "
 	  << osdmap->get_epoch()
 	  << ", src has [" << m->oldest_map << "," << m->newest_map << "]"
@@ -3500,6 +3993,20 @@ void OSD::handle_osd_map(MOSDMap *m)
   epoch_t start = MAX(osdmap->get_epoch() + 1, first);
   for (epoch_t e = start; e <= last; e++) {
     map<epoch_t,bufferlist>::iterator p;
+    map<epoch_t, pair<OSDMapRef, bufferlist> >::iterator q = prepared.find(e);
+    if (q != prepared.end()) {
+      dout(10) << "handle_osd_map  prepared map for epoch " << e << dendl;
+      pinned_maps.push_back(q->second.first);
+      // prepare_osd_map() already queued these for disk
+      if (!m->maps.count(e)) {
+	p = m->incremental_maps.find(e);
+	if (p != m->incremental_maps.end())
+	  pin_map_inc_bl(e, p->second);
+      }
+      pin_map_bl(e, q->second.second);
+      continue;
+    }
+
     p = m->maps.find(e);
     if (p != m->maps.end()) {
       dout(10) << "handle_osd_map  got full map for epoch " << e << dendl;
@@ -3539,10 +4046,12 @@ void OSD::handle_osd_map(MOSDMap *m)
 	assert(0 == "bad fsid");
       }
 
-      pinned_maps.push_back(add_map(o));
+      // add_map() may hand back another thread's copy, and free o
+      OSDMapRef added = add_map(o);
+      pinned_maps.push_back(added);
 
       bufferlist fbl;
-      o->encode(fbl);
+      added->encode(fbl);
 
       hobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
@@ -3665,7 +4174,8 @@ void OSD::handle_osd_map(MOSDMap *m)
     superblock.clean_thru = osdmap->get_epoch();
   }
 
-  // superblock and commit
+  // superblock and commit.  the maps must be readable from the store
+  // before any pg advances to them, so wait for the apply.
   write_superblock(t);
   int r = store->apply_transaction(t, fin);
   if (r) {
@@ -3676,8 +4186,12 @@ void OSD::handle_osd_map(MOSDMap *m)
     return;
   }
   service.publish_superblock(superblock);
+  {
+    Mutex::Locker l(map_prep_lock);
+    trim_prepared_maps(last);
+  }
 
-  clear_map_bl_cache_pins();
+  clear_map_bl_cache_pins(last);
   map_lock.put_write();
 
   check_osdmap_features();
@@ -3744,26 +4258,49 @@ void OSD::check_osdmap_features()
   }
 }
 
-void OSD::advance_pg(epoch_t osd_epoch, PG *pg, PG::RecoveryCtx *rctx)
+bool OSD::advance_pg(epoch_t osd_epoch, PG *pg, PG::RecoveryCtx *rctx)
 {
   assert(pg->is_locked());
   epoch_t next_epoch = pg->get_osdmap()->get_epoch() + 1;
   OSDMapRef lastmap = pg->get_osdmap();
 
   if (lastmap->get_epoch() == osd_epoch)
-    return;
+    return true;
   assert(lastmap->get_epoch() < osd_epoch);
 
+  // bound the work done for one pg at a time, so that a long run of new
+  // maps is spread over the peering threads instead of stalling them
+  epoch_t max = lastmap->get_epoch() + MAX(1, g_conf->osd_map_max_advance);
+  int advanced = 0, skipped = 0;
   for (;
-       next_epoch <= osd_epoch;
+       next_epoch <= osd_epoch && next_epoch <= max;
        ++next_epoch) {
     OSDMapRef nextmap = get_map(next_epoch);
     vector<int> newup, newacting;
     nextmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
-    pg->handle_advance_map(nextmap, lastmap, newup, newacting, rctx);
+    if (pg->affected_by_map(nextmap, newup, newacting)) {
+      pg->handle_advance_map(nextmap, lastmap, newup, newacting, rctx);
+      ++advanced;
+    } else {
+      pg->skip_map(nextmap);
+      ++skipped;
+    }
     lastmap = nextmap;
   }
+  dout(10) << "advance_pg " << *pg << " to " << lastmap->get_epoch()
+	   << ", " << advanced << " handled, " << skipped << " skipped" << dendl;
+  if (logger) {
+    logger->inc(l_osd_pg_map_advance, advanced);
+    logger->inc(l_osd_pg_map_skip, skipped);
+  }
+
+  if (next_epoch <= osd_epoch) {
+    dout(10) << "advance_pg " << *pg << " " << (osd_epoch - lastmap->get_epoch())
+	     << " epochs behind, requeueing" << dendl;
+    return false;
+  }
   pg->handle_activate_map(rctx);
+  return true;
 }
 
 /** 
@@ -3956,13 +4493,18 @@ MOSDMap *OSD::build_incremental_map_msg(epoch_t since, epoch_t to)
 
 void OSD::send_map(MOSDMap *m, const entity_inst_t& inst, bool lazy)
 {
-  Messenger *msgr = client_messenger;
-  if (entity_name_t::TYPE_OSD == inst.name._type)
-    msgr = cluster_messenger;
-  if (lazy)
-    msgr->lazy_send_message(m, inst);  // only if we already have an open connection
-  else
-    msgr->send_message(m, inst);
+  if (entity_name_t::TYPE_OSD == inst.name._type) {
+    if (!lazy) {
+      service.send_message_osd_cluster(m, inst);
+      return;
+    }
+    service.flush_subop_batch(inst.name.num());
+    cluster_messenger->lazy_send_message(m, inst);  // only if we already have an open connection
+  } else if (lazy) {
+    client_messenger->lazy_send_message(m, inst);
+  } else {
+    client_messenger->send_message(m, inst);
+  }
 }
 
 void OSD::send_incremental_map(epoch_t since, const entity_inst_t& inst, bool lazy)
@@ -4040,47 +4582,56 @@ void OSDService::pin_map_bl(epoch_t e, bufferlist &bl)
   map_bl_cache.pin(e, bl);
 }
 
-void OSDService::clear_map_bl_cache_pins()
+void OSDService::clear_map_bl_cache_pins(epoch_t e)
 {
   Mutex::Locker l(map_cache_lock);
-  map_bl_inc_cache.clear_pinned();
-  map_bl_cache.clear_pinned();
+  map_bl_inc_cache.clear_pinned(e);
+  map_bl_cache.clear_pinned(e);
 }
 
-OSDMapRef OSDService::_add_map(OSDMap *o)
+OSDMapRef OSDService::add_map(OSDMap *o)
 {
   epoch_t e = o->get_epoch();
 
   if (g_conf->osd_map_dedup) {
-    // Dedup against an existing map at a nearby epoch
-    OSDMapRef for_dedup = map_cache.lower_bound(e);
+    // Dedup against an existing map at a nearby epoch; usually the
+    // previous one, otherwise whatever this stripe holds
+    OSDMapRef for_dedup;
+    if (e > 0)
+      for_dedup = map_cache_stripe(e - 1)->lookup(e - 1);
+    if (!for_dedup)
+      for_dedup = map_cache_stripe(e)->lower_bound(e);
     if (for_dedup) {
       OSDMap::dedup(for_dedup.get(), o);
     }
   }
-  OSDMapRef l = map_cache.add(e, o);
+  // if another thread decoded the same epoch first, this returns its map
+  OSDMapRef l = map_cache_stripe(e)->add(e, o);
   return l;
 }
 
 OSDMapRef OSDService::get_map(epoch_t epoch)
 {
-  Mutex::Locker l(map_cache_lock);
-  OSDMapRef retval = map_cache.lookup(epoch);
+  OSDMapRef retval = map_cache_stripe(epoch)->lookup(epoch);
   if (retval) {
     dout(30) << "get_map " << epoch << " -cached" << dendl;
+    if (logger)
+      logger->inc(l_osd_map_cache_hit);
     return retval;
   }
+  if (logger)
+    logger->inc(l_osd_map_cache_miss);
 
   OSDMap *map = new OSDMap;
   if (epoch > 0) {
     dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
     bufferlist bl;
-    assert(_get_map_bl(epoch, bl));
+    assert(get_map_bl(epoch, bl));
     map->decode(bl);
   } else {
     dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
   }
-  return _add_map(map);
+  return add_map(map);
 }
 
 bool OSD::require_mon_peer(Message *m)
@@ -4551,7 +5102,7 @@ void OSD::do_notifies(
 	      << " on " << it->second.size() << " PGs" << dendl;
       MOSDPGNotify *m = new MOSDPGNotify(curmap->get_epoch(),
 					 it->second);
-      cluster_messenger->send_message(m, curmap->get_cluster_inst(it->first));
+      service.send_message_osd_cluster(m, curmap->get_cluster_inst(it->first));
     } else {
       dout(7) << "do_notify osd." << it->first
 	      << " sending seperate messages" << dendl;
@@ -4563,7 +5114,7 @@ void OSD::do_notifies(
 	list[0] = *i;
 	MOSDPGNotify *m = new MOSDPGNotify(i->first.epoch_sent,
 					   list);
-	cluster_messenger->send_message(m, curmap->get_cluster_inst(it->first));
+	service.send_message_osd_cluster(m, curmap->get_cluster_inst(it->first));
       }
     }
   }
@@ -4589,7 +5140,7 @@ void OSD::do_queries(map< int, map<pg_t,pg_query_t> >& query_map,
       dout(7) << "do_queries querying osd." << who
 	      << " on " << pit->second.size() << " PGs" << dendl;
       MOSDPGQuery *m = new MOSDPGQuery(curmap->get_epoch(), pit->second);
-      cluster_messenger->send_message(m, curmap->get_cluster_inst(who));
+      service.send_message_osd_cluster(m, curmap->get_cluster_inst(who));
     } else {
       dout(7) << "do_queries querying osd." << who
 	      << " sending seperate messages "
@@ -4600,7 +5151,7 @@ void OSD::do_queries(map< int, map<pg_t,pg_query_t> >& query_map,
 	map<pg_t, pg_query_t> to_send;
 	to_send.insert(*i);
 	MOSDPGQuery *m = new MOSDPGQuery(i->second.epoch_sent, to_send);
-	cluster_messenger->send_message(m, curmap->get_cluster_inst(who));
+	service.send_message_osd_cluster(m, curmap->get_cluster_inst(who));
       }
     }
   }
@@ -4626,7 +5177,7 @@ void OSD::do_infos(map<int,vector<pair<pg_notify_t, pg_interval_map_t> > >& info
     if ((con->features & CEPH_FEATURE_INDEP_PG_MAP)) {
       MOSDPGInfo *m = new MOSDPGInfo(curmap->get_epoch());
       m->pg_list = p->second;
-      cluster_messenger->send_message(m, curmap->get_cluster_inst(p->first));
+      service.send_message_osd_cluster(m, curmap->get_cluster_inst(p->first));
     } else {
       for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator i =
 	     p->second.begin();
@@ -4636,7 +5187,7 @@ void OSD::do_infos(map<int,vector<pair<pg_notify_t, pg_interval_map_t> > >& info
 	to_send[0] = *i;
 	MOSDPGInfo *m = new MOSDPGInfo(i->first.epoch_sent);
 	m->pg_list = to_send;
-	cluster_messenger->send_message(m, curmap->get_cluster_inst(p->first));
+	service.send_message_osd_cluster(m, curmap->get_cluster_inst(p->first));
       }
     }
   }
@@ -4923,7 +5474,7 @@ void OSD::handle_pg_query(OpRequestRef op)
       MOSDPGLog *mlog = new MOSDPGLog(osdmap->get_epoch(), empty,
 				      it->second.epoch_sent);
       _share_map_outgoing(osdmap->get_cluster_inst(from));
-      cluster_messenger->send_message(mlog,
+      service.send_message_osd_cluster(mlog,
 				      osdmap->get_cluster_inst(from));
     } else {
       notify_list[from].push_back(make_pair(pg_notify_t(it->second.epoch_sent,
@@ -5045,7 +5596,9 @@ void OSD::_remove_pg(PG *pg)
   pg->deleting = true;
 
   // remove from map
+  pg_map_lock.get_write();
   pg_map.erase(pg->info.pgid);
+  pg_map_lock.put_write();
   pg->put(); // since we've taken it out of map
 
   service.unreg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
@@ -5115,6 +5668,11 @@ bool OSD::_recover_now()
     dout(15) << "_recover_now defer until " << defer_recovery_until << dendl;
     return false;
   }
+  if (!service.recovery_push_ready()) {
+    // tick() wakes the recovery threads again
+    dout(15) << "_recover_now over osd_recovery_bytes_per_sec" << dendl;
+    return false;
+  }
 
   return true;
 }
@@ -5241,12 +5799,12 @@ void OSDService::reply_op_error(OpRequestRef op, int err, eversion_t v)
   int flags;
   flags = m->get_flags() & (CEPH_OSD_FLAG_ACK|CEPH_OSD_FLAG_ONDISK);
 
-  MOSDOpReply *reply = new MOSDOpReply(m, err, osdmap->get_epoch(), flags);
-  Messenger *msgr = client_messenger;
+  MOSDOpReply *reply = new MOSDOpReply(m, err, get_osdmap()->get_epoch(), flags);
   reply->set_version(v);
   if (m->get_source().is_osd())
-    msgr = cluster_messenger;
-  msgr->send_message(reply, m->get_connection());
+    send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
+  else
+    client_messenger->send_message(reply, m->get_connection());
 }
 
 void OSDService::handle_misdirected_op(PG *pg, OpRequestRef op)
@@ -5264,10 +5822,191 @@ void OSDService::handle_misdirected_op(PG *pg, OpRequestRef op)
 	      << " pg " << m->get_pg()
 	      << " to osd." << whoami
 	      << " not " << pg->acting
-	      << " in e" << m->get_map_epoch() << "/" << osdmap->get_epoch() << "\n";
+	      << " in e" << m->get_map_epoch() << "/" << get_osdmap()->get_epoch() << "\n";
   reply_op_error(op, -ENXIO);
 }
 
+class C_FlushSubOpBatch : public Context {
+  OSDService *service;
+  OSDService::SubOpBatch *b;
+  uint64_t seq;
+public:
+  C_FlushSubOpBatch(OSDService *s, OSDService::SubOpBatch *b, uint64_t seq)
+    : service(s), b(b), seq(seq) {}
+  void finish(int r) {
+    service->flush_subop_batch(b, seq);
+  }
+};
+
+OSDService::SubOpBatch *OSDService::get_subop_batch(int peer)
+{
+  Mutex::Locker l(subop_batch_lock);
+  SubOpBatch *&b = subop_batches[peer];
+  if (!b)
+    b = new SubOpBatch;
+  return b;
+}
+
+/**
+ * send a sub op or sub op reply to an osd, possibly batched with others
+ *
+ * @param inst the osd, as of the map of the pg sending m
+ * @param more true if the caller expects to send more shortly; if
+ *             false, everything collected so far is sent now
+ */
+void OSDService::send_subop(Message *m, const entity_inst_t& inst, bool more)
+{
+  SubOpBatch *b = get_subop_batch(inst.name.num());
+  bool queue_flush = false;
+  uint64_t seq;
+  b->lock.Lock();
+  if (b->m && b->inst != inst) {
+    // peer restarted, or the pg has a different map than the last sender
+    _send_subop_batch(b);
+  }
+  if (!b->m) {
+    bool batch = g_conf->osd_subop_batch_max > 1;
+    if (batch) {
+      Connection *con = cluster_messenger->get_connection(inst);
+      batch = con->features & CEPH_FEATURE_OSD_SUBOP_BATCH;
+      con->put();
+    }
+    if (!batch) {
+      cluster_messenger->send_message(m, inst);
+      b->lock.Unlock();
+      if (!more)
+	flush_subop_batches();
+      return;
+    }
+    b->inst = inst;
+    b->m = new MOSDSubOpBatch;
+    b->bytes = 0;
+  }
+
+  b->m->add(m);
+  b->bytes += m->get_data().length();
+  if ((int)b->m->ops.size() >= g_conf->osd_subop_batch_max ||
+      b->bytes >= g_conf->osd_subop_batch_max_bytes || !more) {
+    _send_subop_batch(b);
+  } else if (!b->flush_queued) {
+    b->flush_queued = true;
+    queue_flush = true;
+  }
+  seq = b->seq;
+  b->lock.Unlock();
+
+  if (!more) {
+    flush_subop_batches();
+  } else if (queue_flush) {
+    Mutex::Locker l(subop_batch_timer_lock);
+    subop_batch_timer.add_event_after(g_conf->osd_subop_batch_window,
+				      new C_FlushSubOpBatch(this, b, seq));
+  }
+}
+
+/// send every osd's batch
+void OSDService::flush_subop_batches()
+{
+  vector<SubOpBatch*> ls;
+  {
+    Mutex::Locker l(subop_batch_lock);
+    for (map<int, SubOpBatch*>::iterator p = subop_batches.begin();
+	 p != subop_batches.end();
+	 ++p)
+      ls.push_back(p->second);
+  }
+  for (vector<SubOpBatch*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    Mutex::Locker l((*p)->lock);
+    if ((*p)->m)
+      _send_subop_batch(*p);
+  }
+}
+
+/// send peer's batch, if any
+void OSDService::flush_subop_batch(int peer)
+{
+  SubOpBatch *b = get_subop_batch(peer);
+  Mutex::Locker l(b->lock);
+  if (b->m)
+    _send_subop_batch(b);
+}
+
+/// send b if it is still the batch numbered seq
+void OSDService::flush_subop_batch(SubOpBatch *b, uint64_t seq)
+{
+  Mutex::Locker l(b->lock);
+  if (b->m && b->seq == seq)
+    _send_subop_batch(b);
+}
+
+void OSDService::_send_subop_batch(SubOpBatch *b)
+{
+  assert(b->lock.is_locked());
+  assert(b->m);
+  if (b->m->ops.size() == 1) {
+    // not worth the wrapper
+    cluster_messenger->send_message(b->m->ops.front(), b->inst);
+    b->m->ops.clear();
+    b->m->put();
+  } else {
+    osd->logger->inc(l_osd_sop_batch);
+    osd->logger->inc(l_osd_sop_batched, b->m->ops.size());
+    cluster_messenger->send_message(b->m, b->inst);
+  }
+  b->m = NULL;
+  b->bytes = 0;
+  b->seq++;
+  b->flush_queued = false;
+}
+
+void OSDService::shutdown_subop_batches()
+{
+  flush_subop_batches();
+  subop_batch_timer_lock.Lock();
+  subop_batch_timer.shutdown();
+  subop_batch_timer_lock.Unlock();
+}
+
+// both hold the batch lock over the send, so that a batch flushed by
+// another thread cannot overtake m either
+void OSDService::send_message_osd_cluster(Message *m, const entity_inst_t& inst)
+{
+  SubOpBatch *b = get_subop_batch(inst.name.num());
+  Mutex::Locker l(b->lock);
+  if (b->m)
+    _send_subop_batch(b);
+  cluster_messenger->send_message(m, inst);
+}
+
+void OSDService::send_message_osd_cluster(int peer, Message *m, Connection *con)
+{
+  SubOpBatch *b = get_subop_batch(peer);
+  Mutex::Locker l(b->lock);
+  if (b->m)
+    _send_subop_batch(b);
+  cluster_messenger->send_message(m, con);
+}
+
+bool OSDService::op_queue_empty()
+{
+  return osd->op_wq.op_queue_len.read() == 0;
+}
+
+void OSD::handle_sub_op_batch(MOSDSubOpBatch *m)
+{
+  dout(10) << "handle_sub_op_batch " << *m << " from " << m->get_source_inst() << dendl;
+  while (!m->ops.empty()) {
+    Message *op = m->ops.front();
+    m->ops.pop_front();
+    op->get_header().src = m->get_header().src;
+    op->set_connection(m->get_connection()->get());
+    op->set_recv_stamp(m->get_recv_stamp());
+    op->set_dispatch_stamp(m->get_dispatch_stamp());
+    _dispatch(op);
+  }
+  m->put();
+}
+
 void OSD::handle_op(OpRequestRef op)
 {
   MOSDOp *m = (MOSDOp*)op->request;
@@ -5283,53 +6022,12 @@ void OSD::handle_op(OpRequestRef op)
   if (!require_same_or_newer_map(op, m->get_map_epoch()))
     return;
 
-  // object name too long?
-  if (m->get_oid().name.size() > MAX_CEPH_OBJECT_NAME_LEN) {
-    dout(4) << "handle_op '" << m->get_oid().name << "' is longer than "
-	    << MAX_CEPH_OBJECT_NAME_LEN << " bytes!" << dendl;
-    service.reply_op_error(op, -ENAMETOOLONG);
-    return;
-  }
-
-  // blacklisted?
-  if (osdmap->is_blacklisted(m->get_source_addr())) {
-    dout(4) << "handle_op " << m->get_source_addr() << " is blacklisted" << dendl;
-    service.reply_op_error(op, -EBLACKLISTED);
-    return;
-  }
-
   // share our map with sender, if they're old
   _share_map_incoming(m->get_source_inst(), m->get_map_epoch(),
 		      (Session *)m->get_connection()->get_priv());
 
-  int r = init_op_flags(m);
-  if (r) {
-    service.reply_op_error(op, r);
+  if (!check_op(op, osdmap))
     return;
-  }
-
-  if (m->may_write()) {
-    // full?
-    if (osdmap->test_flag(CEPH_OSDMAP_FULL) &&
-	!m->get_source().is_mds()) {  // FIXME: we'll exclude mds writes for now.
-      service.reply_op_error(op, -ENOSPC);
-      return;
-    }
-
-    // invalid?
-    if (m->get_snapid() != CEPH_NOSNAP) {
-      service.reply_op_error(op, -EINVAL);
-      return;
-    }
-
-    // too big?
-    if (g_conf->osd_max_write_size &&
-	m->get_data_len() > g_conf->osd_max_write_size << 20) {
-      // journal can't hold commit!
-      service.reply_op_error(op, -OSD_WRITETOOBIG);
-      return;
-    }
-  }
 
   // calc actual pgid
   pg_t pgid = m->get_pg();
@@ -5345,6 +6043,7 @@ void OSD::handle_op(OpRequestRef op)
 
     if (osdmap->get_pg_acting_role(pgid, whoami) >= 0) {
       dout(7) << "we are valid target for op, waiting" << dendl;
+      fast_dispatch_ok.set(0);
       waiting_for_pg[pgid].push_back(op);
       op->mark_delayed();
       return;
@@ -5388,6 +6087,56 @@ void OSD::handle_op(OpRequestRef op)
   pg->unlock();
 }
 
+bool OSD::check_op(OpRequestRef op, OSDMapRef curmap)
+{
+  MOSDOp *m = (MOSDOp*)op->request;
+
+  // object name too long?
+  if (m->get_oid().name.size() > MAX_CEPH_OBJECT_NAME_LEN) {
+    dout(4) << "handle_op '" << m->get_oid().name << "' is longer than "
+	    << MAX_CEPH_OBJECT_NAME_LEN << " bytes!" << dendl;
+    service.reply_op_error(op, -ENAMETOOLONG);
+    return false;
+  }
+
+  // blacklisted?
+  if (curmap->is_blacklisted(m->get_source_addr())) {
+    dout(4) << "handle_op " << m->get_source_addr() << " is blacklisted" << dendl;
+    service.reply_op_error(op, -EBLACKLISTED);
+    return false;
+  }
+
+  int r = init_op_flags(m);
+  if (r) {
+    service.reply_op_error(op, r);
+    return false;
+  }
+
+  if (m->may_write()) {
+    // full?
+    if (curmap->test_flag(CEPH_OSDMAP_FULL) &&
+	!m->get_source().is_mds()) {  // FIXME: we'll exclude mds writes for now.
+      service.reply_op_error(op, -ENOSPC);
+      return false;
+    }
+
+    // invalid?
+    if (m->get_snapid() != CEPH_NOSNAP) {
+      service.reply_op_error(op, -EINVAL);
+      return false;
+    }
+
+    // too big?
+    if (g_conf->osd_max_write_size &&
+	m->get_data_len() > g_conf->osd_max_write_size << 20) {
+      // journal can't hold commit!
+      service.reply_op_error(op, -OSD_WRITETOOBIG);
+      return false;
+    }
+  }
+  return true;
+}
+
 bool OSD::op_has_sufficient_caps(PG *pg, MOSDOp *op)
 {
   Session *session = (Session *)op->get_connection()->get_priv();
@@ -5507,24 +6256,148 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
   pg->queue_op(op);
 }
 
-bool OSD::OpWQ::_enqueue(PG *pg)
+OSD::OpWQ::OpWQ(OSD *o, CephContext *cct, uint32_t num_shards,
+		uint32_t threads_per_shard, time_t ti)
+  : ShardedThreadPool(cct, "OSD::OpWQ", num_shards, threads_per_shard,
+		      ti, ti*10),
+    osd(o)
+{
+  for (uint32_t i = 0; i < get_num_shards(); ++i)
+    shard_data.push_back(
+      new ShardData(g_conf->osd_op_pq_max_tokens_per_priority));
+}
+
+OSD::OpWQ::~OpWQ()
+{
+  for (unsigned i = 0; i < shard_data.size(); ++i)
+    delete shard_data[i];
+}
+
+int OSD::OpWQ::op_class(OpRequestRef op)
 {
+  int priority = op->request->get_priority();
+  if (priority >= g_conf->osd_op_pq_strict_cutoff)
+    return OPQ_STRICT;
+  if (op->request->get_type() == CEPH_MSG_OSD_OP)
+    return OPQ_CLIENT;
+  if (priority <= g_conf->osd_recovery_op_priority)
+    return OPQ_RECOVERY;
+  return OPQ_SUBOP;
+}
+
+/*
+ * bytes moved by the op, plus a fixed overhead for the op itself
+ */
+unsigned OSD::OpWQ::op_cost(OpRequestRef op)
+{
+  uint64_t bytes = op->request->get_header().data_len;
+  if (op->request->get_type() == CEPH_MSG_OSD_OP) {
+    MOSDOp *m = (MOSDOp*)op->request;
+    for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p)
+      if (p->op.op == CEPH_OSD_OP_READ ||
+	  p->op.op == CEPH_OSD_OP_SPARSE_READ)
+	bytes += p->op.extent.length;
+  }
+  bytes += g_conf->osd_op_pq_cost_overhead;
+  return MIN(bytes, (uint64_t)UINT_MAX);
+}
+
+void OSD::OpWQ::_queue(PG *pg, OpRequestRef op, bool front)
+{
+  Item item;
+  item.pg = pg;
+  item.op = op;
+  item.klass = op_class(op);
+  item.stamp = ceph_clock_now(g_ceph_context);
+  unsigned priority = op->request->get_priority();
+  entity_inst_t source = op->request->get_source_inst();
+
   pg->get();
-  osd->op_queue.push_back(pg);
-  osd->op_queue_len++;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
-  return true;
+  uint32_t shard = shard_of(pg);
+  lock_shard(shard);
+  PrioritizedQueue<Item, entity_inst_t> &pqueue = shard_data[shard]->pqueue;
+  if (item.klass == OPQ_STRICT) {
+    if (front)
+      pqueue.enqueue_strict_front(source, priority, item);
+    else
+      pqueue.enqueue_strict(source, priority, item);
+  } else {
+    unsigned cost = op_cost(op);
+    if (front)
+      pqueue.enqueue_front(source, priority, cost, item);
+    else
+      pqueue.enqueue(source, priority, cost, item);
+  }
+  _wake_shard(shard);
+  unlock_shard(shard);
+
+  osd->logger->set(l_osd_opq, op_queue_len.inc());
+  osd->logger->set(l_osd_opq_strict + item.klass,
+		   class_len[item.klass].inc());
 }
 
-PG *OSD::OpWQ::_dequeue()
+void OSD::OpWQ::note_taken(const Item &item, bool processed)
 {
-  if (osd->op_queue.empty())
+  osd->logger->set(l_osd_opq, op_queue_len.dec());
+  osd->logger->set(l_osd_opq_strict + item.klass,
+		   class_len[item.klass].dec());
+  if (processed)
+    osd->logger->finc(l_osd_opq_wait_strict + item.klass,
+		      ceph_clock_now(g_ceph_context) - item.stamp);
+}
+
+void OSD::OpWQ::dequeue(PG *pg)
+{
+  uint32_t shard = shard_of(pg);
+  ShardData *sd = shard_data[shard];
+  list<Item> removed, taken;
+  lock_shard(shard);
+  sd->pqueue.remove_by_filter(ItemIsFor(pg), &removed);
+  map<PG*, list<Item> >::iterator p = sd->pg_for_processing.find(pg);
+  if (p != sd->pg_for_processing.end()) {
+    taken.swap(p->second);
+    sd->pg_for_processing.erase(p);
+  }
+  unlock_shard(shard);
+
+  for (list<Item>::iterator i = removed.begin(); i != removed.end(); ++i) {
+    note_taken(*i, false);
+    pg->put();
+  }
+  // the workers that dequeued these hold their pg refs
+  for (list<Item>::iterator i = taken.begin(); i != taken.end(); ++i)
+    note_taken(*i, false);
+}
+
+void *OSD::OpWQ::_void_dequeue(uint32_t shard)
+{
+  ShardData *sd = shard_data[shard];
+  if (sd->pqueue.empty())
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
-  osd->op_queue_len--;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
-  return pg;
+  Item item = sd->pqueue.dequeue();
+  sd->pg_for_processing[item.pg].push_back(item);
+  return item.pg;
+}
+
+OpRequestRef OSD::OpWQ::take_op(PG *pg)
+{
+  assert(pg->is_locked());
+  uint32_t shard = shard_of(pg);
+  ShardData *sd = shard_data[shard];
+  lock_shard(shard);
+  map<PG*, list<Item> >::iterator p = sd->pg_for_processing.find(pg);
+  if (p == sd->pg_for_processing.end()) {
+    unlock_shard(shard);
+    return OpRequestRef();
+  }
+  Item item = p->second.front();
+  p->second.pop_front();
+  if (p->second.empty())
+    sd->pg_for_processing.erase(p);
+  unlock_shard(shard);
+
+  note_taken(item, true);
+  return item.op;
 }
 
 void OSDService::queue_for_peering(PG *pg)
@@ -5532,9 +6405,14 @@ void OSDService::queue_for_peering(PG *pg)
   peering_wq.queue(pg);
 }
 
-void OSDService::queue_for_op(PG *pg)
+void OSDService::queue_for_op(PG *pg, OpRequestRef op)
+{
+  osd->op_wq.queue(pg, op);
+}
+
+void OSDService::requeue_op(PG *pg, OpRequestRef op)
 {
-  op_wq.queue(pg);
+  osd->op_wq.queue_front(pg, op);
 }
 
 void OSD::process_peering_events(const list<PG*> &pgs)
@@ -5553,8 +6431,10 @@ void OSD::process_peering_events(const list<PG*> &pgs)
       pg->unlock();
       continue;
     }
-    advance_pg(curmap->get_epoch(), pg, &rctx);
-    if (!pg->peering_queue.empty()) {
+    if (!advance_pg(curmap->get_epoch(), pg, &rctx)) {
+      // not caught up with curmap yet; handle events once we are
+      service.queue_for_peering(pg);
+    } else if (!pg->peering_queue.empty()) {
       PG::CephPeeringEvtRef evt = pg->peering_queue.front();
       pg->peering_queue.pop_front();
       pg->handle_peering_event(evt, &rctx);
@@ -5578,23 +6458,22 @@ void OSD::process_peering_events(const list<PG*> &pgs)
  */
 void OSD::dequeue_op(PG *pg)
 {
-  OpRequestRef op;
-
   pg->lock();
-  if (pg->deleting) {
+  OpRequestRef op = op_wq.take_op(pg);
+  if (!op || pg->deleting) {
     pg->unlock();
     pg->put();
     return;
   }
-  assert(!pg->op_queue.empty());
-  op = pg->op_queue.front();
-  pg->op_queue.pop_front();
-    
+
   dout(10) << "dequeue_op " << op << " " << *op->request << " pg " << *pg << dendl;
 
   op->mark_reached_pg();
 
-  pg->do_request(op);
+  {
+    OpRequest::AllocCharge charge(op.get());
+    pg->do_request(op);
+  }
 
   // unlock and put pg
   pg->unlock();
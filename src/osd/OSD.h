@@ -25,10 +25,13 @@
 #include "common/RWLock.h"
 #include "common/Timer.h"
 #include "common/WorkQueue.h"
+#include "common/PrioritizedQueue.h"
+#include "common/Throttle.h"
 #include "common/LogClient.h"
 
 #include "os/ObjectStore.h"
 #include "OSDCap.h"
+#include "BackfillSlots.h"
 
 #include "common/DecayCounter.h"
 #include "osd/ClassHandler.h"
@@ -50,16 +53,35 @@ using namespace __gnu_cxx;
 
 #include "OpRequest.h"
 #include "common/shared_cache.hpp"
+#include "common/published_ptr.hpp"
 #include "common/simple_cache.hpp"
 #include "common/sharedptr_registry.hpp"
 
 #define CEPH_OSD_PROTOCOL    10 /* cluster internal */
 
 
+/// op queue classes, for the per-class perf counters
+enum {
+  OPQ_STRICT,    ///< at or above osd_op_pq_strict_cutoff
+  OPQ_CLIENT,    ///< client ops
+  OPQ_SUBOP,     ///< replication and other peer ops
+  OPQ_RECOVERY,  ///< at or below osd_recovery_op_priority
+  OPQ_NUM_CLASSES
+};
+
 enum {
   l_osd_first = 10000,
   l_osd_opq,
   l_osd_op_wip,
+  l_osd_op_fast,
+  l_osd_opq_strict,   // queue length per OPQ_* class
+  l_osd_opq_client,
+  l_osd_opq_subop,
+  l_osd_opq_recovery,
+  l_osd_opq_wait_strict,   // time queued per OPQ_* class
+  l_osd_opq_wait_client,
+  l_osd_opq_wait_subop,
+  l_osd_opq_wait_recovery,
   l_osd_op,
   l_osd_op_inb,
   l_osd_op_outb,
@@ -88,10 +110,13 @@ enum {
   l_osd_sop_push,
   l_osd_sop_push_inb,
   l_osd_sop_push_lat,
+  l_osd_sop_batch,
+  l_osd_sop_batched,
 
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_delta,
 
   l_osd_rop,
 
@@ -107,6 +132,11 @@ enum {
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
+  l_osd_map_cache_hit,
+  l_osd_map_cache_miss,
+  l_osd_map_prepared,
+  l_osd_pg_map_advance,
+  l_osd_pg_map_skip,
 
   l_osd_last,
 };
@@ -129,6 +159,8 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
 class HistoricOpsSocketHook;
+class MOSDSubOpBatch;
+class ReservationsSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -168,7 +200,6 @@ public:
   Messenger *&client_messenger;
   PerfCounters *&logger;
   MonClient   *&monc;
-  ThreadPool::WorkQueue<PG> &op_wq;
   ThreadPool::BatchWorkQueue<PG> &peering_wq;
   ThreadPool::WorkQueue<PG> &recovery_wq;
   ThreadPool::WorkQueue<PG> &snap_trim_wq;
@@ -188,14 +219,13 @@ public:
     Mutex::Locker l(publish_lock);
     superblock = block;
   }
-  OSDMapRef osdmap;
+  /// current map; read without a lock on the op path
+  PublishedPtr<const OSDMap> osdmap;
   OSDMapRef get_osdmap() {
-    Mutex::Locker l(publish_lock);
-    return osdmap;
+    return osdmap.get();
   }
   void publish_map(OSDMapRef map) {
-    Mutex::Locker l(publish_lock);
-    osdmap = map;
+    osdmap.publish(map);
   }
 
   int get_nodeid() const { return whoami; }
@@ -234,10 +264,71 @@ public:
   void dec_scrubs_pending();
   void dec_scrubs_active();
 
+  // -- scrub read throttle --
+  TokenBucket scrub_read_bucket;
+  void scrub_read_account(uint64_t bytes);
+  void scrub_read_wait();
+
+  // -- recovery push throttle --
+  TokenBucket recovery_push_bucket;
+  void recovery_push_account(uint64_t bytes);
+  bool recovery_push_ready();
+
+  // -- backfill reservations --
+  // a primary holds a local slot while it backfills a pg, and the
+  // backfill target a remote slot; neither admits more than
+  // osd_max_backfills pgs.
+  Mutex backfill_reserve_lock;
+  BackfillSlots local_backfills;     ///< pg -> backfill target
+  BackfillSlots remote_backfills;    ///< pg -> primary backfilling it to us
+  map<pg_t,utime_t> backfill_retry;  ///< pg -> when to try to reserve again
+  bool reserve_local_backfill(pg_t pgid, int target);
+  void release_local_backfill(pg_t pgid);
+  bool reserve_remote_backfill(pg_t pgid, int primary);
+  void release_remote_backfill(pg_t pgid, int primary = -1);
+  void retry_backfill_reserve(pg_t pgid);
+  void get_backfill_retries(utime_t now, list<pg_t> *ls);
+  void dump_reservations(Formatter *f);
+
   void reply_op_error(OpRequestRef op, int err);
   void reply_op_error(OpRequestRef op, int err, eversion_t v);
   void handle_misdirected_op(PG *pg, OpRequestRef op);
 
+  // -- sub op batching --
+  // Replicated writes and their replies for the same osd are collected
+  // and sent as one MOSDSubOpBatch.  A batch goes out when it is full,
+  // when the sender has nothing more coming, or osd_subop_batch_window
+  // after it was started.  Every other message to the osd goes through
+  // send_message_osd_cluster(), which sends the osd's batch first, so
+  // nothing overtakes a batched message.
+  struct SubOpBatch {
+    Mutex lock;
+    entity_inst_t inst;   ///< where m goes
+    MOSDSubOpBatch *m;    ///< NULL if nothing is being collected
+    uint64_t bytes;
+    uint64_t seq;         ///< bumped each time a batch is sent
+    bool flush_queued;    ///< a timed flush is scheduled for this batch
+    SubOpBatch()
+      : lock("OSDService::SubOpBatch::lock"),
+	m(NULL), bytes(0), seq(0), flush_queued(false) {}
+  };
+  Mutex subop_batch_lock;  ///< protects subop_batches, not the batches
+  map<int, SubOpBatch*> subop_batches;  ///< osd -> batch; kept until shutdown
+  Mutex subop_batch_timer_lock;  ///< taken before any SubOpBatch::lock
+  SafeTimer subop_batch_timer;   // subop_batch_timer_lock
+  atomic_t rep_replies_pending;  ///< replica write acks/commits not yet sent
+  SubOpBatch *get_subop_batch(int peer);
+  void send_subop(Message *m, const entity_inst_t& inst, bool more);
+  void flush_subop_batches();
+  void flush_subop_batch(int peer);
+  void flush_subop_batch(SubOpBatch *b, uint64_t seq);
+  void _send_subop_batch(SubOpBatch *b);
+  void shutdown_subop_batches();
+  /// send to an osd over the cluster messenger, after its batched sub ops
+  void send_message_osd_cluster(Message *m, const entity_inst_t& inst);
+  void send_message_osd_cluster(int peer, Message *m, Connection *con);
+  bool op_queue_empty();
+
   // -- Watch --
   Mutex watch_lock;
   SafeTimer watch_timer;
@@ -266,7 +357,8 @@ public:
   void send_pg_temp();
 
   void queue_for_peering(PG *pg);
-  void queue_for_op(PG *pg);
+  void queue_for_op(PG *pg, OpRequestRef op);
+  void requeue_op(PG *pg, OpRequestRef op);
   bool queue_for_recovery(PG *pg);
   bool queue_for_snap_trim(PG *pg) {
     return snap_trim_wq.queue(pg);
@@ -275,18 +367,19 @@ public:
     return scrub_wq.queue(pg);
   }
 
-  // osd map cache (past osd maps)
+  // osd map cache (past osd maps), striped by epoch so that lookups of
+  // different epochs do not contend; each stripe has its own lock
+  vector<SharedLRU<epoch_t, const OSDMap>*> map_cache;
+  SharedLRU<epoch_t, const OSDMap> *map_cache_stripe(epoch_t e) {
+    return map_cache[e % map_cache.size()];
+  }
+  // map_cache_lock protects the encoded map caches
   Mutex map_cache_lock;
-  SharedLRU<epoch_t, const OSDMap> map_cache;
   SimpleLRU<epoch_t, bufferlist> map_bl_cache;
   SimpleLRU<epoch_t, bufferlist> map_bl_inc_cache;
 
   OSDMapRef get_map(epoch_t e);
-  OSDMapRef add_map(OSDMap *o) {
-    Mutex::Locker l(map_cache_lock);
-    return _add_map(o);
-  }
-  OSDMapRef _add_map(OSDMap *o);
+  OSDMapRef add_map(OSDMap *o);
 
   void add_map_bl(epoch_t e, bufferlist& bl) {
     Mutex::Locker l(map_cache_lock);
@@ -308,7 +401,7 @@ public:
   void _add_map_inc_bl(epoch_t e, bufferlist& bl);
   bool get_inc_map_bl(epoch_t e, bufferlist& bl);
 
-  void clear_map_bl_cache_pins();
+  void clear_map_bl_cache_pins(epoch_t e);
 
   void need_heartbeat_peer_update();
 
@@ -316,6 +409,7 @@ public:
   void pg_stat_queue_dequeue(PG *pg);
 
   OSDService(OSD *osd);
+  ~OSDService();
 };
 class OSD : public Dispatcher {
   /** OSD **/
@@ -545,38 +639,87 @@ private:
   friend class HistoricOpsSocketHook;
   OpsFlightSocketHook *admin_ops_hook;
   HistoricOpsSocketHook *historic_ops_hook;
+  ReservationsSocketHook *reservations_hook;
+
+  // -- fast dispatch --
+  /**
+   * Client ops are queued without osd_lock while fast_dispatch_ok is
+   * set.  It is cleared whenever an op is parked on the OSD (waiting
+   * for a map or a pg), so that later ops from the same client cannot
+   * overtake it, and set again by do_waiters() once nothing is parked.
+   */
+  RWLock fast_dispatch_lock;  ///< held for read while an op is fast dispatched
+  atomic_t fast_dispatch_ok;
+  bool fast_dispatch_op(Message *m);
+  bool _fast_dispatch_op(class MOSDOp *op);
+  void _update_fast_dispatch();
 
   // -- op queue --
-  list<PG*> op_queue;
-  int op_queue_len;
-
-  struct OpWQ : public ThreadPool::WorkQueue<PG> {
+  /**
+   * Ops to process.  PGs hash to a shard, each with its own lock,
+   * queue and threads.  Within a shard ops are scheduled by priority
+   * and cost (see PrioritizedQueue), round robin between the entities
+   * that sent them.  A worker takes a PG off the queue and then, with
+   * the PG locked, the oldest op dequeued for that PG, so that a PG's
+   * ops are processed in the order they were dequeued.
+   */
+  struct OpWQ : public ShardedThreadPool {
+    struct Item {
+      PG *pg;
+      OpRequestRef op;
+      int klass;      ///< OPQ_*
+      utime_t stamp;  ///< when queued
+    };
+    struct ItemIsFor {
+      PG *pg;
+      ItemIsFor(PG *p) : pg(p) {}
+      bool operator()(const Item &item) const {
+	return item.pg == pg;
+      }
+    };
+    struct ShardData {
+      PrioritizedQueue<Item, entity_inst_t> pqueue;
+      map<PG*, list<Item> > pg_for_processing;  ///< dequeued, not yet taken
+      ShardData(unsigned max_tokens) : pqueue(max_tokens) {}
+    };
     OSD *osd;
-    OpWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
+    vector<ShardData*> shard_data;
+    atomic_t op_queue_len;
+    atomic_t class_len[OPQ_NUM_CLASSES];
 
-    bool _enqueue(PG *pg);
-    void _dequeue(PG *pg) {
-      for (list<PG*>::iterator i = osd->op_queue.begin();
-	   i != osd->op_queue.end();
-	   ) {
-	if (*i == pg) {
-	  osd->op_queue.erase(i++);
-	  pg->put();
-	} else {
-	  ++i;
-	}
-      }
+    OpWQ(OSD *o, CephContext *cct, uint32_t num_shards,
+	 uint32_t threads_per_shard, time_t ti);
+    ~OpWQ();
+
+    uint32_t shard_of(PG *pg) {
+      return __gnu_cxx::hash<pg_t>()(pg->info.pgid) % get_num_shards();
     }
-    bool _empty() {
-      return osd->op_queue.empty();
+    static int op_class(OpRequestRef op);
+    static unsigned op_cost(OpRequestRef op);
+    void _queue(PG *pg, OpRequestRef op, bool front);
+    void note_taken(const Item &item, bool processed);
+
+    void queue(PG *pg, OpRequestRef op) {
+      _queue(pg, op, false);
     }
-    PG *_dequeue();
-    void _process(PG *pg) {
-      osd->dequeue_op(pg);
+    /// queue ahead of the sender's other ops at the same priority
+    void queue_front(PG *pg, OpRequestRef op) {
+      _queue(pg, op, true);
     }
-    void _clear() {
-      assert(osd->op_queue.empty());
+    /// drop every queued op for pg
+    void dequeue(PG *pg);
+    /// the next op dequeued for pg, or NULL; call with pg locked
+    OpRequestRef take_op(PG *pg);
+
+    void *_void_dequeue(uint32_t shard);
+    void _void_process(void *p) {
+      osd->dequeue_op((PG*)p);
+    }
+    bool _empty(uint32_t shard) {
+      return shard_data[shard]->pqueue.empty();
+    }
+    void _clear(uint32_t shard) {
+      assert(shard_data[shard]->pqueue.empty());
     }
   } op_wq;
 
@@ -668,6 +811,12 @@ private:
   RWLock          map_lock;
   list<OpRequestRef>  waiting_for_osdmap;
 
+  /// maps decoded by prepare_osd_map(), with their full encoding
+  Mutex map_prep_lock;
+  map<epoch_t, pair<OSDMapRef, bufferlist> > prepared_maps;
+  void prepare_osd_map(class MOSDMap *m);
+  void trim_prepared_maps(epoch_t e);
+
   Mutex peer_map_epoch_lock;
   map<int, epoch_t> peer_map_epoch;
   
@@ -685,7 +834,7 @@ private:
   void note_down_osd(int osd);
   void note_up_osd(int osd);
   
-  void advance_pg(epoch_t advance_to, PG *pg, PG::RecoveryCtx *rctx);
+  bool advance_pg(epoch_t advance_to, PG *pg, PG::RecoveryCtx *rctx);
   void advance_map(ObjectStore::Transaction& t, C_Contexts *tfin);
   void activate_map();
 
@@ -714,8 +863,8 @@ private:
   bool get_inc_map_bl(epoch_t e, bufferlist& bl) {
     return service.get_inc_map_bl(e, bl);
   }
-  void clear_map_bl_cache_pins() {
-    service.clear_map_bl_cache_pins();
+  void clear_map_bl_cache_pins(epoch_t e) {
+    service.clear_map_bl_cache_pins(e);
   }
 
   MOSDMap *build_incremental_map_msg(epoch_t from, epoch_t to);
@@ -724,6 +873,7 @@ private:
 
 protected:
   // -- placement groups --
+  RWLock pg_map_lock;  ///< taken for write when pg_map changes; see _get_pg_fast()
   hash_map<pg_t, PG*> pg_map;
   map<pg_t, list<OpRequestRef> > waiting_for_pg;
   PGRecoveryStats pg_recovery_stats;
@@ -732,6 +882,8 @@ protected:
 
   bool  _have_pg(pg_t pgid);
   PG   *_lookup_lock_pg(pg_t pgid);
+  /// get a ref to the pg without osd_lock, or NULL; the caller must check deleting
+  PG   *_get_pg_fast(pg_t pgid);
   PG   *_lookup_lock_pg_with_map_lock_held(pg_t pgid);
   PG   *_open_lock_pg(OSDMapRef createmap,
 		      pg_t pg, bool no_lockdep_check=false,
@@ -1113,6 +1265,7 @@ protected:
       return pg;
     }
     void _process(PG *pg) {
+      osd->service.scrub_read_wait();
       pg->scrub();
       pg->put();
     }
@@ -1198,6 +1351,7 @@ protected:
       return msg;
     }
     void _process(MOSDRepScrub *msg) {
+      osd->service.scrub_read_wait();
       osd->osd_lock.Lock();
       if (osd->_have_pg(msg->pgid)) {
 	PG *pg = osd->_lookup_lock_pg(msg->pgid);
@@ -1319,6 +1473,7 @@ public:
   void handle_signal(int signum);
 
   void handle_rep_scrub(MOSDRepScrub *m);
+  void handle_sub_op_batch(MOSDSubOpBatch *m);
   void handle_scrub(class MOSDScrub *m);
   void handle_osd_ping(class MOSDPing *m);
   void handle_op(OpRequestRef op);
@@ -1327,6 +1482,8 @@ public:
 
   /// check if we can throw out op from a disconnected client
   static bool op_is_discardable(class MOSDOp *m);
+  /// check op against the map; replies with an error and returns false if it should not be queued
+  bool check_op(OpRequestRef op, OSDMapRef curmap);
   /// check if op has sufficient caps
   bool op_has_sufficient_caps(PG *pg, class MOSDOp *m);
   /// check if op should be (re)queued for processing
@@ -83,6 +83,9 @@ void OpTracker::dump_ops_in_flight(ostream &ss)
   Mutex::Locker locker(ops_in_flight_lock);
   jf.open_object_section("ops_in_flight"); // overall dump
   jf.dump_int("num_ops", ops_in_flight.size());
+  jf.dump_unsigned("num_ops_done", ops_done);
+  jf.dump_float("allocs_per_op_done",
+		ops_done ? (double)ops_done_allocs / ops_done : 0.0);
   jf.open_array_section("ops"); // list of OpRequests
   utime_t now = ceph_clock_now(g_ceph_context);
   for (xlist<OpRequest*>::iterator p = ops_in_flight.begin(); !p.end(); ++p) {
@@ -109,6 +112,8 @@ void OpTracker::unregister_inflight_op(OpRequest *i)
   utime_t now = ceph_clock_now(g_ceph_context);
   i->xitem.remove_myself();
   i->request->clear_data();
+  ++ops_done;
+  ops_done_allocs += i->allocs;
   history.insert(now, i);
 }
 
@@ -184,6 +189,7 @@ void OpRequest::dump(utime_t now, Formatter *f) const
   f->dump_float("age", now - received_time);
   f->dump_float("duration", get_duration());
   f->dump_string("flag_point", state_string());
+  f->dump_unsigned("allocs", allocs);
   if (m->get_orig_source().is_client()) {
     f->open_object_section("client_info");
     stringstream client_name;
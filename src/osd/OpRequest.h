@@ -23,7 +23,9 @@
 #include "msg/Message.h"
 #include <tr1/memory>
 #include "common/TrackedOp.h"
+#include "common/ObjectPool.h"
 #include "osd/osd_types.h"
+#include "osd/AllocCounter.h"
 
 class OpRequest;
 class OpHistory {
@@ -50,9 +52,11 @@ class OpTracker {
   Mutex ops_in_flight_lock;
   xlist<OpRequest *> ops_in_flight;
   OpHistory history;
+  uint64_t ops_done, ops_done_allocs;  ///< ops unregistered, and their allocs
 
 public:
-  OpTracker() : seq(0), ops_in_flight_lock("OpTracker mutex") {}
+  OpTracker() : seq(0), ops_in_flight_lock("OpTracker mutex"),
+		ops_done(0), ops_done_allocs(0) {}
   void dump_ops_in_flight(std::ostream& ss);
   void dump_historic_ops(std::ostream& ss);
   void register_inflight_op(xlist<OpRequest*>::item *i);
@@ -79,7 +83,7 @@ public:
  * you want to track, create an OpRequest with it, and then pass around that OpRequest
  * the way you used to pass around the Message.
  */
-struct OpRequest : public TrackedOp {
+struct OpRequest : public TrackedOp, public PooledObject<OpRequest> {
   friend class OpTracker;
   friend class OpHistory;
   Message *request;
@@ -103,6 +107,7 @@ private:
   uint8_t hit_flag_points;
   uint8_t latest_flag_point;
   uint64_t seq;
+  uint64_t allocs;  ///< heap allocations made while processing us
   static const uint8_t flag_queued_for_pg=1 << 0;
   static const uint8_t flag_reached_pg =  1 << 1;
   static const uint8_t flag_delayed =     1 << 2;
@@ -115,7 +120,7 @@ private:
     lock("OpRequest::lock"),
     tracker(tracker),
     hit_flag_points(0), latest_flag_point(0),
-    seq(0) {
+    seq(0), allocs(0) {
     received_time = request->get_recv_stamp();
     tracker->register_inflight_op(&xitem);
   }
@@ -174,6 +179,26 @@ public:
   }
 
   void mark_event(const string &event);
+  /// account for n heap allocations made on our behalf
+  void add_allocs(uint64_t n) {
+    Mutex::Locker l(lock);
+    allocs += n;
+  }
+  uint64_t get_allocs() {
+    Mutex::Locker l(lock);
+    return allocs;
+  }
+
+  /// charges the allocations this thread makes during its life to op
+  class AllocCharge {
+    OpRequest *op;
+    uint64_t start;
+  public:
+    AllocCharge(OpRequest *op) : op(op), start(get_thread_allocs()) {}
+    ~AllocCharge() {
+      op->add_allocs(get_thread_allocs() - start);
+    }
+  };
   osd_reqid_t get_reqid() const {
     return reqid;
   }
@@ -14,6 +14,7 @@
 
 #include "PG.h"
 #include "common/config.h"
+#include "common/errno.h"
 #include "OSD.h"
 #include "OpRequest.h"
 
@@ -74,6 +75,8 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   last_peering_reset(0),
   heartbeat_peer_lock("PG::heartbeat_peer_lock"),
   backfill_target(-1),
+  backfill_reserve_state(BACKFILL_UNRESERVED),
+  backfill_reserve_peer(-1),
   pg_stats_lock("PG::pg_stats_lock"),
   pg_stats_valid(false),
   osr(osd->osr_registry.lookup_or_create(p, (stringify(p)))),
@@ -110,7 +113,7 @@ void PG::lock_with_map_lock_held(bool no_lockdep)
 void PG::reassert_lock_with_map_lock_held()
 {
   assert(_lock.is_locked());
-  osdmap_ref = osd->osdmap;
+  osdmap_ref = osd->get_osdmap();
 
   dout(30) << "reassert_lock_with_map_lock_held" << dendl;
 }
@@ -413,6 +416,7 @@ void PG::rewind_divergent_log(ObjectStore::Transaction& t, eversion_t newhead)
     if (p == log.log.begin()) {
       // yikes, the whole thing is divergent!
       divergent.swap(log.log);
+      log.unindex();
       break;
     }
     --p;
@@ -431,11 +435,14 @@ void PG::rewind_divergent_log(ObjectStore::Transaction& t, eversion_t newhead)
   if (info.last_complete > newhead)
     info.last_complete = newhead;
 
-  for (list<pg_log_entry_t>::iterator d = divergent.begin(); d != divergent.end(); d++)
+  for (list<pg_log_entry_t>::iterator d = divergent.begin(); d != divergent.end(); d++) {
+    dirty_log_entries.insert(d->version);
     merge_old_entry(t, *d);
+  }
 
   dirty_info = true;
-  dirty_log = true;
+  if (!ondisklog.omap)
+    dirty_log = true;
 }
 
 void PG::merge_log(ObjectStore::Transaction& t,
@@ -472,7 +479,8 @@ void PG::merge_log(ObjectStore::Transaction& t,
 	 to++) {
       if (to->version > log.tail)
 	break;
-      log.index(*to);
+      log.index(to);
+      dirty_log_entries.insert(to->version);
       dout(15) << *to << dendl;
     }
     assert(to != olog.log.end() ||
@@ -518,19 +526,9 @@ void PG::merge_log(ObjectStore::Transaction& t,
       }
     }
 
-    // index, update missing, delete deleted
-    for (list<pg_log_entry_t>::iterator p = from; p != to; p++) {
-      pg_log_entry_t &ne = *p;
-      dout(20) << "merge_log " << ne << dendl;
-      log.index(ne);
-      if (ne.soid <= info.last_backfill) {
-	missing.add_next_event(ne);
-	if (ne.is_delete())
-	  t.remove(coll, ne.soid);
-      }
-    }
-      
-    // move aside divergent items
+    // move aside divergent items.  unindex them first, so that the
+    // index falls back to our older entries for their objects and the
+    // new entries below only have to be added to it.
     list<pg_log_entry_t> divergent;
     while (!log.empty()) {
       pg_log_entry_t &oe = *log.log.rbegin();
@@ -545,15 +543,27 @@ void PG::merge_log(ObjectStore::Transaction& t,
       if (oe.version.version <= lower_bound.version)
 	break;
       dout(10) << "merge_log divergent " << oe << dendl;
-      divergent.push_front(oe);
-      log.unindex(oe);
-      log.log.pop_back();
+      log.unindex_head(oe);
+      dirty_log_entries.insert(oe.version);
+      divergent.splice(divergent.begin(), log.log, --log.log.end());
+    }
+
+    // index, update missing, delete deleted
+    for (list<pg_log_entry_t>::iterator p = from; p != to; p++) {
+      pg_log_entry_t &ne = *p;
+      dout(20) << "merge_log " << ne << dendl;
+      log.index(p);
+      dirty_log_entries.insert(ne.version);
+      if (ne.soid <= info.last_backfill) {
+	missing.add_next_event(ne);
+	if (ne.is_delete())
+	  t.remove(coll, ne.soid);
+      }
     }
 
     // splice
     log.log.splice(log.log.end(), 
 		   olog.log, from, to);
-    log.index();   
 
     info.last_update = log.head = olog.head;
 
@@ -570,7 +580,8 @@ void PG::merge_log(ObjectStore::Transaction& t,
 
   if (changed) {
     dirty_info = true;
-    dirty_log = true;
+    if (!ondisklog.omap)
+      dirty_log = true;
   }
 }
 
@@ -1349,9 +1360,12 @@ void PG::activate(ObjectStore::Transaction& t,
 
   need_up_thru = false;
 
-  // write pg info, log
+  // write pg info, log.  an omap log is already up to date with
+  // whatever peering merged into it; a byte log is rewritten, which also
+  // converts it to omap if osd_pg_log_omap is set.
   dirty_info = true;
-  dirty_log = true;
+  if (!ondisklog.omap || !g_conf->osd_pg_log_omap)
+    dirty_log = true;
 
   // clean up stray objects
   clean_up_local(t); 
@@ -1491,7 +1505,7 @@ void PG::activate(ObjectStore::Transaction& t,
       if (m) {
 	dout(10) << "activate peer osd." << peer << " sending " << m->log << dendl;
 	//m->log.print(cout);
-	osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(peer));
+	osd->send_message_osd_cluster(m, get_osdmap()->get_cluster_inst(peer));
       }
 
       // peer now has 
@@ -1638,7 +1652,7 @@ void PG::_activate_committed(epoch_t e, entity_inst_t& primary)
 				info);
     i.info.history.last_epoch_started = e;
     m->pg_list.push_back(make_pair(i, pg_interval_map_t()));
-    osd->cluster_messenger->send_message(m, primary);
+    osd->send_message_osd_cluster(m, primary);
   }
 
   if (dirty_info) {
@@ -1854,7 +1868,7 @@ void PG::purge_strays()
       MOSDPGRemove *m = new MOSDPGRemove(
 	get_osdmap()->get_epoch(),
 	to_remove);
-      osd->cluster_messenger->send_message(
+      osd->send_message_osd_cluster(
 	m, get_osdmap()->get_cluster_inst(*p));
       stray_purged.insert(*p);
     } else {
@@ -1944,8 +1958,9 @@ void PG::update_stats()
       info.stats.last_active = now;
     info.stats.last_unstale = now;
 
-    info.stats.log_size = ondisklog.length();
-    info.stats.ondisk_log_size = ondisklog.length();
+    // an omap log has no byte bounds; report its length in entries
+    info.stats.log_size = ondisklog.omap ? log.log.size() : ondisklog.length();
+    info.stats.ondisk_log_size = info.stats.log_size;
     info.stats.log_start = log.tail;
     info.stats.ondisk_log_start = log.tail;
 
@@ -2068,6 +2083,31 @@ void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
 
+  if (g_conf->osd_pg_log_omap) {
+    ondisklog.has_checksums = true;
+    map<string,bufferlist> keys;
+    for (list<pg_log_entry_t>::iterator p = log.log.begin();
+	 p != log.log.end();
+	 p++) {
+      p->offset = 0;
+      add_log_entry_bl(*p, keys[p->version.get_key_name()]);
+    }
+    t.remove(coll_t::META_COLL, log_oid);
+    t.touch(coll_t::META_COLL, log_oid);
+    t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
+
+    ondisklog.zero();
+    ondisklog.omap = true;
+    bufferlist blb(sizeof(ondisklog));
+    ::encode(ondisklog, blb);
+    t.collection_setattr(coll, "ondisklog", blb);
+
+    dout(10) << "write_log " << keys.size() << " entries to omap" << dendl;
+    dirty_log_entries.clear();
+    dirty_log = false;
+    return;
+  }
+
   // assemble buffer
   bufferlist bl;
 
@@ -2087,7 +2127,9 @@ void PG::write_log(ObjectStore::Transaction& t)
     p->offset = startoff;
   }
   ondisklog.head = bl.length();
+  ondisklog.zero_to = 0;
   ondisklog.has_checksums = true;
+  ondisklog.omap = false;
 
   // write it
   t.remove(coll_t::META_COLL, log_oid );
@@ -2098,15 +2140,52 @@ void PG::write_log(ObjectStore::Transaction& t)
   t.collection_setattr(coll, "ondisklog", blb);
   
   dout(10) << "write_log to " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  dirty_log_entries.clear();
   dirty_log = false;
 }
 
+/**
+ * write_log_entries - bring the keys of an omap log up to date with the
+ * entries in dirty_log_entries: those still in the log are (re)written,
+ * the rest are removed.
+ */
+void PG::write_log_entries(ObjectStore::Transaction& t)
+{
+  assert(ondisklog.omap);
+  if (dirty_log_entries.empty())
+    return;
+
+  map<string,bufferlist> keys;
+  set<string> rm;
+  for (set<eversion_t>::iterator p = dirty_log_entries.begin();
+       p != dirty_log_entries.end();
+       ++p) {
+    hash_map<eversion_t,list<pg_log_entry_t>::iterator>::iterator q =
+      log.versions.find(*p);
+    if (q == log.versions.end()) {
+      rm.insert(p->get_key_name());
+    } else {
+      q->second->offset = 0;
+      add_log_entry_bl(*q->second, keys[p->get_key_name()]);
+    }
+  }
+  dout(10) << "write_log_entries " << keys.size() << " set, "
+	   << rm.size() << " removed" << dendl;
+  if (!rm.empty())
+    t.omap_rmkeys(coll_t::META_COLL, log_oid, rm);
+  if (!keys.empty())
+    t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
+  dirty_log_entries.clear();
+}
+
 void PG::write_if_dirty(ObjectStore::Transaction& t)
 {
   if (dirty_info)
     write_info(t);
   if (dirty_log)
     write_log(t);
+  else if (!dirty_log_entries.empty())
+    write_log_entries(t);
 }
 
 void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
@@ -2117,9 +2196,19 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     assert(trim_to <= info.last_complete);
 
     dout(10) << "trim " << log << " to " << trim_to << dendl;
+    if (ondisklog.omap) {
+      set<string> keys;
+      for (list<pg_log_entry_t>::iterator p = log.log.begin();
+	   p != log.log.end() && p->version <= trim_to;
+	   ++p)
+	keys.insert(p->version.get_key_name());
+      if (!keys.empty())
+	t.omap_rmkeys(coll_t::META_COLL, log_oid, keys);
+    }
     log.trim(t, trim_to);
     info.log_tail = log.tail;
-    trim_ondisklog(t);
+    if (!ondisklog.omap)
+      trim_ondisklog(t);
   }
 }
 
@@ -2164,7 +2253,7 @@ void PG::trim_peers()
   dout(10) << "trim_peers " << pg_trim_to << dendl;
   if (pg_trim_to != eversion_t()) {
     for (unsigned i=1; i<acting.size(); i++)
-      osd->cluster_messenger->send_message(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
+      osd->send_message_osd_cluster(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
 						  pg_trim_to),
 				   get_osdmap()->get_cluster_inst(acting[i]));
   }
@@ -2182,6 +2271,13 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
 
   // log mutation
   log.add(e);
+  add_log_entry_bl(e, log_bl);
+  dout(10) << "add_log_entry " << e << dendl;
+}
+
+/// encode e as it is stored on disk, a byte log record or an omap value
+void PG::add_log_entry_bl(const pg_log_entry_t& e, bufferlist& log_bl)
+{
   if (ondisklog.has_checksums) {
     bufferlist ebl(sizeof(e)*2);
     ::encode(e, ebl);
@@ -2191,7 +2287,6 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
   } else {
     ::encode(e, log_bl);
   }
-  dout(10) << "add_log_entry " << e << dendl;
 }
 
 
@@ -2199,6 +2294,25 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
 {
   dout(10) << "append_log " << log << " " << logv << dendl;
 
+  if (ondisklog.omap) {
+    // anything peering left behind goes first
+    write_log_entries(t);
+
+    map<string,bufferlist> keys;
+    for (vector<pg_log_entry_t>::iterator p = logv.begin();
+	 p != logv.end();
+	 p++) {
+      p->offset = 0;
+      add_log_entry(*p, keys[p->version.get_key_name()]);
+    }
+    dout(10) << "append_log adding " << keys.size() << " keys" << dendl;
+    t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
+
+    trim(t, trim_to);
+    write_info(t);
+    return;
+  }
+
   bufferlist bl;
   for (vector<pg_log_entry_t>::iterator p = logv.begin();
        p != logv.end();
@@ -2243,7 +2357,58 @@ void PG::read_log(ObjectStore *store)
   bool listed_collection = false;
   vector<hobject_t> ls;
   
-  if (ondisklog.head > 0) {
+  if (ondisklog.omap) {
+    map<string,bufferlist> keys;
+    bufferlist header;
+    int r = store->omap_get(coll_t::META_COLL, log_oid, &header, &keys);
+    if (r < 0) {
+      std::ostringstream oss;
+      oss << "read_log omap_get got " << cpp_strerror(r);
+      throw read_log_error(oss.str().c_str());
+    }
+
+    // keys sort in version order.  stray keys (below the tail, past
+    // last_update, or an older dup of a version) are dropped and removed
+    // with the next log write.
+    assert(log.empty());
+    eversion_t last;
+    pg_log_entry_t e;
+    for (map<string,bufferlist>::iterator k = keys.begin();
+	 k != keys.end();
+	 ++k) {
+      bufferlist::iterator p = k->second.begin();
+      bufferlist ebl;
+      ::decode(ebl, p);
+      __u32 crc;
+      ::decode(crc, p);
+      __u32 got = ebl.crc32c(0);
+      if (crc != got) {
+	std::ostringstream oss;
+	oss << "read_log " << k->first << " bad crc got " << got << " expected" << crc;
+	throw read_log_error(oss.str().c_str());
+      }
+      bufferlist::iterator q = ebl.begin();
+      ::decode(e, q);
+      dout(20) << "read_log " << k->first << " " << e << dendl;
+
+      if (e.version <= log.tail || e.version > info.last_update) {
+	dout(0) << "read_log  ignoring entry " << e.version << " outside of ("
+		<< log.tail << "," << info.last_update << "]" << dendl;
+	dirty_log_entries.insert(e.version);
+	continue;
+      }
+      if (last.version == e.version.version) {
+	dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
+	dirty_log_entries.insert(last);
+	log.log.pop_back();
+	osd->clog.error() << info.pgid << " read_log got dup "
+	      << e.version << " after " << last << "\n";
+      }
+      e.offset = 0;
+      log.log.push_back(e);
+      last = e.version;
+    }
+  } else if (ondisklog.head > 0) {
     // read
     bufferlist bl;
     store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
@@ -2401,14 +2566,54 @@ bool PG::check_log_for_corruption(ObjectStore *store)
   bufferlist::iterator p = blb.begin();
   ::decode(bounds, p);
 
-  dout(10) << "check_log_for_corruption: tail " << bounds.tail << " head " << bounds.head << dendl;
+  dout(10) << "check_log_for_corruption: tail " << bounds.tail << " head " << bounds.head
+	   << (bounds.omap ? " omap" : "") << dendl;
 
   stringstream ss;
   ss << "CORRUPT pg " << info.pgid << " log: ";
 
   bool ok = true;
   uint64_t pos = 0;
-  if (bounds.head > 0) {
+  if (bounds.omap) {
+    map<string,bufferlist> keys;
+    bufferlist header;
+    int r = store->omap_get(coll_t::META_COLL, log_oid, &header, &keys);
+    if (r < 0) {
+      ss << "omap_get got " << cpp_strerror(r);
+      ok = false;
+    }
+    for (map<string,bufferlist>::iterator k = keys.begin();
+	 ok && k != keys.end();
+	 ++k) {
+      pg_log_entry_t e;
+      try {
+	bufferlist::iterator p = k->second.begin();
+	bufferlist ebl;
+	::decode(ebl, p);
+	__u32 crc;
+	::decode(crc, p);
+	if (ebl.crc32c(0) != crc) {
+	  ss << "bad crc for entry " << k->first;
+	  ok = false;
+	  break;
+	}
+	bufferlist::iterator q = ebl.begin();
+	::decode(e, q);
+      }
+      catch (const buffer::error &err) {
+	dout(0) << "corrupt entry " << k->first << dendl;
+	ss << "corrupt entry " << k->first;
+	ok = false;
+	break;
+      }
+      if (e.version.get_key_name() != k->first) {
+	ss << "entry " << e.version << " stored as " << k->first;
+	ok = false;
+	break;
+      }
+      dout(30) << " " << k->first << " " << e << dendl;
+    }
+  } else if (bounds.head > 0) {
     // read
     struct stat st;
     store->stat(coll_t::META_COLL, log_oid, &st);
@@ -2671,10 +2876,11 @@ void PG::requeue_object_waiters(map<hobject_t, list<OpRequestRef> >& m)
 void PG::requeue_ops(list<OpRequestRef> &ls)
 {
   dout(15) << " requeue_ops " << ls << dendl;
-  assert(&ls != &op_queue);
-  size_t requeue_size = ls.size();
-  op_queue.splice(op_queue.begin(), ls, ls.begin(), ls.end());
-  for (size_t i = 0; i < requeue_size; ++i) osd->queue_for_op(this);
+  for (list<OpRequestRef>::reverse_iterator i = ls.rbegin();
+       i != ls.rend();
+       ++i)
+    osd->requeue_op(this, *i);
+  ls.clear();
 }
 
 
@@ -2841,6 +3047,7 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
                                       g_conf->osd_deep_scrub_stride, bl)) > 0) {
           h << bl;
           pos += bl.length();
+          osd->scrub_read_account(bl.length());
           bl.clear();
         }
         o.digest = h.digest();
@@ -2862,7 +3069,7 @@ void PG::_request_scrub_map_classic(int replica, eversion_t version)
   MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
 					      last_update_applied,
                                               get_osdmap()->get_epoch());
-  osd->cluster_messenger->send_message(repscrubop,
+  osd->send_message_osd_cluster(repscrubop,
                                        get_osdmap()->get_cluster_inst(replica));
 }
 
@@ -2876,7 +3083,7 @@ void PG::_request_scrub_map(int replica, eversion_t version,
   MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
                                               get_osdmap()->get_epoch(),
                                               start, end, deep);
-  osd->cluster_messenger->send_message(repscrubop,
+  osd->send_message_osd_cluster(repscrubop,
                                        get_osdmap()->get_cluster_inst(replica));
 }
 
@@ -2897,7 +3104,7 @@ void PG::sub_op_scrub_reserve(OpRequestRef op)
 
   MOSDSubOpReply *reply = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
   ::encode(scrubber.reserved, reply->get_data());
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  osd->send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
 }
 
 void PG::sub_op_scrub_reserve_reply(OpRequestRef op)
@@ -2933,6 +3140,144 @@ void PG::sub_op_scrub_reserve_reply(OpRequestRef op)
   }
 }
 
+/*
+ * Backfill reservations
+ *
+ * Before the primary backfills a pg it takes a local slot, then asks the
+ * backfill target for a remote one.  If either is full it gives up and
+ * tries again after osd_backfill_retry_interval.  The slots are released
+ * when backfill finishes or the pg changes interval.  The target frees its
+ * slot when it finishes backfilling; otherwise the primary tells it to,
+ * since the target's own interval may not change.
+ */
+
+/// return true once both slots are held
+bool PG::reserve_backfill()
+{
+  assert(is_primary());
+  assert(backfill_target >= 0);
+  switch (backfill_reserve_state) {
+  case BACKFILL_RESERVED:
+    return true;
+  case BACKFILL_WAIT_REMOTE:
+    return false;
+  case BACKFILL_UNRESERVED:
+    break;
+  }
+
+  if (!osd->reserve_local_backfill(info.pgid, backfill_target)) {
+    osd->retry_backfill_reserve(info.pgid);
+    return false;
+  }
+  dout(10) << "backfill requesting reserve from osd." << backfill_target << dendl;
+  backfill_reserve_state = BACKFILL_WAIT_REMOTE;
+  backfill_reserve_peer = backfill_target;
+  _send_backfill_reserve_op(CEPH_OSD_OP_BACKFILL_RESERVE, backfill_target);
+  return false;
+}
+
+/**
+ * Give up our backfill slots.  With notify_peer, also tell the osd we
+ * asked for a remote slot to free it, in case it granted one.
+ */
+void PG::release_backfill_reservation(bool notify_peer)
+{
+  if (backfill_reserve_state == BACKFILL_UNRESERVED)
+    return;
+  dout(10) << "release_backfill_reservation" << dendl;
+  if (notify_peer && backfill_reserve_peer >= 0 &&
+      get_osdmap()->is_up(backfill_reserve_peer)) {
+    dout(10) << " unreserving osd." << backfill_reserve_peer << dendl;
+    _send_backfill_reserve_op(CEPH_OSD_OP_BACKFILL_UNRESERVE,
+			      backfill_reserve_peer);
+  }
+  backfill_reserve_state = BACKFILL_UNRESERVED;
+  backfill_reserve_peer = -1;
+  osd->release_local_backfill(info.pgid);
+}
+
+void PG::_send_backfill_reserve_op(int op, int peer)
+{
+  vector<OSDOp> ops(1);
+  ops[0].op.op = op;
+  hobject_t poid;
+  eversion_t v;
+  osd_reqid_t reqid;
+  MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
+				   get_osdmap()->get_epoch(), osd->get_tid(), v);
+  subop->ops = ops;
+  subop->set_priority(g_conf->osd_recovery_op_priority);
+  osd->send_message_osd_cluster(subop, get_osdmap()->get_cluster_inst(peer));
+}
+
+void PG::sub_op_backfill_reserve(OpRequestRef op)
+{
+  MOSDSubOp *m = (MOSDSubOp*)op->request;
+  assert(m->get_header().type == MSG_OSD_SUBOP);
+  dout(7) << "sub_op_backfill_reserve" << dendl;
+
+  op->mark_started();
+
+  bool reserved = osd->reserve_remote_backfill(info.pgid, m->get_source().num());
+
+  MOSDSubOpReply *reply = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+  ::encode(reserved, reply->get_data());
+  reply->set_priority(g_conf->osd_recovery_op_priority);
+  osd->send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
+}
+
+void PG::sub_op_backfill_reserve_reply(OpRequestRef op)
+{
+  MOSDSubOpReply *reply = (MOSDSubOpReply*)op->request;
+  assert(reply->get_header().type == MSG_OSD_SUBOPREPLY);
+  dout(7) << "sub_op_backfill_reserve_reply" << dendl;
+
+  op->mark_started();
+
+  int from = reply->get_source().num();
+  bufferlist::iterator p = reply->get_data().begin();
+  bool reserved;
+  ::decode(reserved, p);
+
+  if (backfill_reserve_state != BACKFILL_WAIT_REMOTE ||
+      from != backfill_target) {
+    dout(10) << "ignoring obsolete backfill reserve reply from osd." << from << dendl;
+    if (reserved) {
+      // we do not want it any more
+      vector<OSDOp> ops(1);
+      ops[0].op.op = CEPH_OSD_OP_BACKFILL_UNRESERVE;
+      hobject_t poid;
+      eversion_t v;
+      osd_reqid_t reqid;
+      MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
+				       get_osdmap()->get_epoch(), osd->get_tid(), v);
+      subop->ops = ops;
+      osd->send_message_osd_cluster(reply->get_source().num(), subop, reply->get_connection());
+    }
+    return;
+  }
+
+  if (reserved) {
+    dout(10) << " osd." << from << " backfill reserve = success" << dendl;
+    backfill_reserve_state = BACKFILL_RESERVED;
+    osd->queue_for_recovery(this);
+  } else {
+    dout(10) << " osd." << from << " backfill reserve = fail, retrying later" << dendl;
+    release_backfill_reservation(false);
+    osd->retry_backfill_reserve(info.pgid);
+  }
+}
+
+void PG::sub_op_backfill_unreserve(OpRequestRef op)
+{
+  assert(op->request->get_header().type == MSG_OSD_SUBOP);
+  dout(7) << "sub_op_backfill_unreserve" << dendl;
+
+  op->mark_started();
+
+  osd->release_remote_backfill(info.pgid, op->request->get_source().num());
+}
+
 void PG::sub_op_scrub_unreserve(OpRequestRef op)
 {
   assert(op->request->get_header().type == MSG_OSD_SUBOP);
@@ -2955,7 +3300,7 @@ void PG::sub_op_scrub_stop(OpRequestRef op)
   scrubber.reserved = false;
 
   MOSDSubOpReply *reply = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  osd->send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
 }
 
 void PG::clear_scrub_reserved()
@@ -2982,7 +3327,7 @@ void PG::scrub_reserve_replicas()
     MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
                                      get_osdmap()->get_epoch(), osd->get_tid(), v);
     subop->ops = scrub;
-    osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(acting[i]));
+    osd->send_message_osd_cluster(subop, get_osdmap()->get_cluster_inst(acting[i]));
   }
 }
 
@@ -2998,7 +3343,7 @@ void PG::scrub_unreserve_replicas()
     MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
                                      get_osdmap()->get_epoch(), osd->get_tid(), v);
     subop->ops = scrub;
-    osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(acting[i]));
+    osd->send_message_osd_cluster(subop, get_osdmap()->get_cluster_inst(acting[i]));
   }
 }
 
@@ -3027,13 +3372,103 @@ int PG::build_scrub_map_chunk(ScrubMap &map,
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
-  // log
-  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl);
-  dout(10) << " done.  pg log is " << map.logbl.length() << " bytes" << dendl;
+  // chunky scrub does not compare the log, so do not read (and send) it
+  // with every chunk
+  dout(10) << " done.  " << map.objects.size() << " objects" << dendl;
 
   return 0;
 }
 
+/*
+ * the end of the chunk starting at start: the first object after at least
+ * osd_scrub_chunk_min objects that begins a new hash, so that all objects
+ * of a hash are scrubbed together.
+ */
+hobject_t PG::_scrub_chunk_end(const hobject_t &start)
+{
+  // start and end need to lie on a hash boundary. We test for this by
+  // requesting a list and searching backward from the end looking for a
+  // boundary. If there's no boundary, we request a list after the first
+  // list, and so forth.
+  hobject_t end;
+  hobject_t cur = start;
+  while (true) {
+    vector<hobject_t> objects;
+    int ret = osd->store->collection_list_partial(coll, cur,
+						  g_conf->osd_scrub_chunk_min,
+						  g_conf->osd_scrub_chunk_max,
+						  0, &objects, &end);
+    assert(ret >= 0);
+
+    // in case we don't find a boundary: start again at the end
+    cur = end;
+
+    // special case: reached end of file store, implicitly a boundary
+    if (objects.size() == 0)
+      return end;
+
+    // search backward from the end looking for a boundary
+    objects.push_back(end);
+    while (objects.size() > 1) {
+      hobject_t back = objects.back();
+      objects.pop_back();
+
+      if (objects.back().get_filestore_key() != back.get_filestore_key())
+	return back;
+    }
+  }
+}
+
+/// the latest logged update to an object in [start,end)
+eversion_t PG::_scrub_chunk_last_update(const hobject_t &start,
+					const hobject_t &end)
+{
+  eversion_t v;
+  for (list<pg_log_entry_t>::iterator p = log.log.begin();
+       p != log.log.end();
+       ++p) {
+    if (p->soid >= start && p->soid < end)
+      v = p->version;
+  }
+  return v;
+}
+
+/*
+ * build our map of the chunk after the current one, while the replicas
+ * build theirs of the current one.  writes to the next chunk are not
+ * blocked; if one is logged before we get there, the map is rebuilt.
+ */
+void PG::_scrub_prefetch()
+{
+  if (!g_conf->osd_scrub_prefetch ||
+      scrubber.prefetched ||
+      !(scrubber.end < hobject_t::get_max()) ||
+      active_pushes > 0)
+    return;
+
+  hobject_t start = scrubber.end;
+  hobject_t end = _scrub_chunk_end(start);
+  eversion_t last_update = _scrub_chunk_last_update(start, end);
+  if (last_update_applied < last_update) {
+    dout(15) << "scrub not prefetching [" << start << "," << end << "), "
+	     << last_update << " not applied yet" << dendl;
+    return;
+  }
+
+  dout(15) << "scrub prefetching [" << start << "," << end << ")" << dendl;
+  scrubber.prefetch_map = ScrubMap();
+  int ret = build_scrub_map_chunk(scrubber.prefetch_map, start, end,
+				  scrubber.deep);
+  if (ret < 0) {
+    scrubber.clear_prefetch();
+    return;
+  }
+  scrubber.prefetched = true;
+  scrubber.prefetch_start = start;
+  scrubber.prefetch_end = end;
+  scrubber.prefetch_last_update = last_update;
+}
+
 /*
  * build a (sorted) summary of pg content for purposes of scrubbing
  * called while holding pg lock
@@ -3222,7 +3657,7 @@ void PG::replica_scrub(MOSDRepScrub *msg)
   ::encode(map, subop->get_data());
   subop->ops = scrub;
 
-  osd->cluster_messenger->send_message(subop, msg->get_connection());
+  osd->send_message_osd_cluster(msg->get_source().num(), subop, msg->get_connection());
 }
 
 /* Scrub:
@@ -3506,6 +3941,7 @@ void PG::chunky_scrub() {
         update_stats();
         scrubber.epoch_start = info.history.same_interval_since;
         scrubber.active = true;
+        scrubber.started = ceph_clock_now(g_ceph_context);
 
         osd->sched_scrub_lock.Lock();
         if (scrubber.reserved) {
@@ -3526,56 +3962,14 @@ void PG::chunky_scrub() {
         scrubber.primary_scrubmap = ScrubMap();
         scrubber.received_maps.clear();
 
-        {
-
-          // get the start and end of our scrub chunk
-          //
-          // start and end need to lie on a hash boundary. We test for this by
-          // requesting a list and searching backward from the end looking for a
-          // boundary. If there's no boundary, we request a list after the first
-          // list, and so forth.
-
-          bool boundary_found = false;
-          hobject_t start = scrubber.start;
-          while (!boundary_found) {
-            vector<hobject_t> objects;
-            ret = osd->store->collection_list_partial(coll, start,
-                                                      5, 5, 0,
-                                                      &objects, &scrubber.end);
-            assert(ret >= 0);
-
-            // in case we don't find a boundary: start again at the end
-            start = scrubber.end;
-
-            // special case: reached end of file store, implicitly a boundary
-            if (objects.size() == 0) {
-              break;
-            }
-
-            // search backward from the end looking for a boundary
-            objects.push_back(scrubber.end);
-            while (!boundary_found && objects.size() > 1) {
-              hobject_t end = objects.back();
-              objects.pop_back();
-
-              if (objects.back().get_filestore_key() != end.get_filestore_key()) {
-                scrubber.end = end;
-                boundary_found = true;
-              }
-            }
-          }
-        }
+        // get the start and end of our scrub chunk
+        scrubber.end = _scrub_chunk_end(scrubber.start);
 
         scrubber.block_writes = true;
 
         // walk the log to find the latest update that affects our chunk
-        scrubber.subset_last_update = eversion_t();
-        for (list<pg_log_entry_t>::iterator p = log.log.begin();
-             p != log.log.end();
-             ++p) {
-          if (p->soid >= scrubber.start && p->soid < scrubber.end)
-            scrubber.subset_last_update = p->version;
-        }
+        scrubber.subset_last_update =
+          _scrub_chunk_last_update(scrubber.start, scrubber.end);
 
         // ask replicas to wait until last_update_applied >= scrubber.subset_last_update and then scan
         scrubber.waiting_on_whom.insert(osd->whoami);
@@ -3615,15 +4009,35 @@ void PG::chunky_scrub() {
       case PG::Scrubber::BUILD_MAP:
         assert(last_update_applied >= scrubber.subset_last_update);
 
-        // build my own scrub map
-        ret = build_scrub_map_chunk(scrubber.primary_scrubmap,
-                                    scrubber.start, scrubber.end,
-                                    scrubber.deep);
-        if (ret < 0) {
-          dout(5) << "error building scrub map: " << ret << ", aborting" << dendl;
-          scrub_clear_state();
-          scrub_unreserve_replicas();
-          return;
+        // build my own scrub map, unless we prefetched it and nothing
+        // has been logged to the chunk since
+        if (scrubber.prefetched &&
+            scrubber.prefetch_start == scrubber.start &&
+            scrubber.prefetch_end == scrubber.end &&
+            scrubber.prefetch_last_update == scrubber.subset_last_update) {
+          dout(15) << "scrub using prefetched map" << dendl;
+          scrubber.primary_scrubmap = scrubber.prefetch_map;
+          scrubber.primary_scrubmap.valid_through = info.last_update;
+        } else {
+          ret = build_scrub_map_chunk(scrubber.primary_scrubmap,
+                                      scrubber.start, scrubber.end,
+                                      scrubber.deep);
+          if (ret < 0) {
+            dout(5) << "error building scrub map: " << ret << ", aborting" << dendl;
+            scrub_clear_state();
+            scrub_unreserve_replicas();
+            return;
+          }
+        }
+        scrubber.clear_prefetch();
+
+        scrubber.objects_scrubbed += scrubber.primary_scrubmap.objects.size();
+        if (scrubber.deep) {
+          for (map<hobject_t,ScrubMap::object>::iterator p =
+                 scrubber.primary_scrubmap.objects.begin();
+               p != scrubber.primary_scrubmap.objects.end();
+               ++p)
+            scrubber.bytes_scrubbed += p->second.size;
         }
 
         --scrubber.waiting_on;
@@ -3634,6 +4048,9 @@ void PG::chunky_scrub() {
 
       case PG::Scrubber::WAIT_REPLICAS:
         if (scrubber.waiting_on > 0) {
+          // get ahead on the next chunk while we wait
+          _scrub_prefetch();
+
           // will be requeued by sub_op_scrub_map
           dout(10) << "wait for replicas to build scrub map" << dendl;
           done = true;
@@ -3666,6 +4083,12 @@ void PG::chunky_scrub() {
         break;
 
       case PG::Scrubber::FINISH:
+        {
+          double elapsed = ceph_clock_now(g_ceph_context) - scrubber.started;
+          dout(5) << "scrub " << scrubber.objects_scrubbed << " objects, "
+                  << prettybyte_t(scrubber.bytes_scrubbed) << " read in "
+                  << elapsed << "s" << dendl;
+        }
         scrub_finish();
         scrubber.state = PG::Scrubber::INACTIVE;
         done = true;
@@ -4000,7 +4423,7 @@ void PG::share_pg_info()
 	  get_osdmap()->get_epoch(),
 	  info),
 	pg_interval_map_t()));
-    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(peer));
+    osd->send_message_osd_cluster(m, get_osdmap()->get_cluster_inst(peer));
   }
 }
 
@@ -4032,7 +4455,7 @@ void PG::share_pg_log()
     }
     pinfo.last_update = m->log.head;
 
-    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(peer));
+    osd->send_message_osd_cluster(m, get_osdmap()->get_cluster_inst(peer));
   }
 }
 
@@ -4086,7 +4509,7 @@ void PG::fulfill_log(int from, const pg_query_t &query, epoch_t query_epoch)
 
   osd->osd->_share_map_outgoing(get_osdmap()->get_cluster_inst(from),
 				get_osdmap());
-  osd->cluster_messenger->send_message(mlog, 
+  osd->send_message_osd_cluster(mlog, 
 				       get_osdmap()->get_cluster_inst(from));
 }
 
@@ -4179,6 +4602,83 @@ bool PG::acting_up_affected(const vector<int>& newup, const vector<int>& newacti
   }
 }
 
+bool PG::osd_changed(const OSDMap &lastmap, const OSDMap &osdmap, int o)
+{
+  if (lastmap.exists(o) != osdmap.exists(o))
+    return true;
+  if (!osdmap.exists(o))
+    return false;
+  return lastmap.is_up(o) != osdmap.is_up(o) ||
+    lastmap.get_up_from(o) != osdmap.get_up_from(o) ||
+    lastmap.get_info(o).lost_at != osdmap.get_info(o).lost_at;
+}
+
+/*
+ * Returns false if handing osdmap to the recovery state machine would
+ * have no effect, so that it can be skipped with skip_map().  That is
+ * only the case for an active pg whose up/acting sets and pool did not
+ * change, and none of whose peers changed state.  Peering and stray
+ * states react to most map changes, so we never skip for them.
+ */
+bool PG::affected_by_map(const OSDMapRef osdmap,
+			 const vector<int>& newup,
+			 const vector<int>& newacting) const
+{
+  if (!is_active() || is_peering())
+    return true;
+  if (up != newup || acting != newacting)
+    return true;
+
+  OSDMapRef lastmap = get_osdmap();
+  const pg_pool_t *pi = osdmap->get_pg_pool(info.pgid.pool());
+  if (!pi ||
+      pi->get_last_change() > lastmap->get_epoch() ||
+      pi->get_snap_epoch() > lastmap->get_epoch())
+    return true;
+
+  set<int> peers;
+  peers.insert(up.begin(), up.end());
+  peers.insert(acting.begin(), acting.end());
+  peers.insert(want_acting.begin(), want_acting.end());
+  for (map<int,pg_info_t>::const_iterator p = peer_info.begin();
+       p != peer_info.end();
+       ++p)
+    peers.insert(p->first);
+  peers.insert(missing_loc_sources.begin(), missing_loc_sources.end());
+  peers.insert(might_have_unfound.begin(), might_have_unfound.end());
+  if (backfill_target >= 0)
+    peers.insert(backfill_target);
+  for (set<int>::iterator p = peers.begin(); p != peers.end(); ++p) {
+    if (osd_changed(*lastmap, *osdmap, *p)) {
+      dout(20) << "affected_by_map osd." << *p << " changed in e"
+	       << osdmap->get_epoch() << dendl;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PG::skip_map(OSDMapRef osdmap)
+{
+  assert(osdmap->get_epoch() == get_osdmap()->get_epoch() + 1);
+  osdmap_ref = osdmap;
+  pool.update(osdmap);
+  // what Active does with every map, event or not
+  if (is_primary())
+    on_active_advmap();
+}
+
+/// per-map upkeep of an active primary; see Active::react(AdvMap)
+void PG::on_active_advmap()
+{
+  if (!pool.newly_removed_snaps.empty()) {
+    snap_trimq.union_of(pool.newly_removed_snaps);
+    dout(10) << *this << " snap_trimq now " << snap_trimq << dendl;
+    dirty_info = true;
+  }
+  check_recovery_sources(get_osdmap());
+}
+
 bool PG::old_peering_msg(epoch_t reply_epoch, epoch_t query_epoch)
 {
   if (last_peering_reset > reply_epoch ||
@@ -4588,8 +5088,7 @@ void PG::queue_op(OpRequestRef op)
       can_discard_request(op)) {
     return;
   }
-  op_queue.push_back(op);
-  osd->queue_for_op(this);
+  osd->queue_for_op(this, op);
 }
 
 void PG::take_waiters()
@@ -5091,12 +5590,7 @@ boost::statechart::result PG::RecoveryState::Active::react(const AdvMap& advmap)
 {
   PG *pg = context< RecoveryMachine >().pg;
   dout(10) << "Active advmap" << dendl;
-  if (!pg->pool.newly_removed_snaps.empty()) {
-    pg->snap_trimq.union_of(pg->pool.newly_removed_snaps);
-    dout(10) << *pg << " snap_trimq now " << pg->snap_trimq << dendl;
-    pg->dirty_info = true;
-  }
-  pg->check_recovery_sources(pg->get_osdmap());
+  pg->on_active_advmap();
 
   for (vector<int>::iterator p = pg->want_acting.begin();
        p != pg->want_acting.end(); ++p) {
@@ -5279,6 +5773,15 @@ boost::statechart::result PG::RecoveryState::Active::react(const QueryState& q)
     q.f->dump_int("scrubber.block_writes", pg->scrubber.block_writes);
     q.f->dump_int("scrubber.finalizing", pg->scrubber.finalizing);
     q.f->dump_int("scrubber.waiting_on", pg->scrubber.waiting_on);
+    if (pg->scrubber.is_chunky_scrub_active()) {
+      double elapsed = ceph_clock_now(g_ceph_context) - pg->scrubber.started;
+      q.f->dump_stream("scrubber.start") << pg->scrubber.start;
+      q.f->dump_unsigned("scrubber.objects_scrubbed", pg->scrubber.objects_scrubbed);
+      q.f->dump_unsigned("scrubber.bytes_scrubbed", pg->scrubber.bytes_scrubbed);
+      q.f->dump_float("scrubber.bytes_per_sec",
+		      elapsed > 0 ? (double)pg->scrubber.bytes_scrubbed / elapsed : 0);
+      q.f->dump_int("scrubber.prefetched", pg->scrubber.prefetched);
+    }
     {
       q.f->open_array_section("scrubber.waiting_on_whom");
       for (set<int>::iterator p = pg->scrubber.waiting_on_whom.begin();
@@ -165,6 +165,7 @@ public:
   struct IndexedLog : public pg_log_t {
     hash_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
     hash_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
+    hash_map<eversion_t,list<pg_log_entry_t>::iterator> versions;
 
     // recovery pointers
     list<pg_log_entry_t>::iterator complete_to;  // not inclusive of referenced item
@@ -203,9 +204,19 @@ public:
       return p->second->version;    
     }
 
+    /// entry for v, or the nearest one if v is not in the log
+    list<pg_log_entry_t>::iterator find_entry(eversion_t v) {
+      hash_map<eversion_t,list<pg_log_entry_t>::iterator>::iterator p =
+	versions.find(v);
+      if (p != versions.end())
+	return p->second;
+      return pg_log_t::find_entry(v);
+    }
+
     void index() {
       objects.clear();
       caller_ops.clear();
+      versions.clear();
       for (list<pg_log_entry_t>::iterator i = log.begin();
            i != log.end();
            i++) {
@@ -214,42 +225,105 @@ public:
 	  //assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	  caller_ops[i->reqid] = &(*i);
 	}
+	versions[i->version] = i;
       }
     }
 
-    void index(pg_log_entry_t& e) {
-      if (objects.count(e.soid) == 0 || 
-          objects[e.soid]->version < e.version)
-        objects[e.soid] = &e;
+    void index(list<pg_log_entry_t>::iterator i) {
+      pg_log_entry_t &e = *i;
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(e.soid);
+      if (p == objects.end())
+	objects[e.soid] = &e;
+      else if (p->second->version < e.version)
+	p->second = &e;
       if (e.reqid_is_indexed()) {
 	//assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	caller_ops[e.reqid] = &e;
       }
+      versions[e.version] = i;
     }
     void unindex() {
       objects.clear();
       caller_ops.clear();
+      versions.clear();
     }
     void unindex(pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
-      if (objects.count(e.soid) && objects[e.soid]->version == e.version)
-        objects.erase(e.soid);
-      if (e.reqid_is_indexed() &&
-	  caller_ops.count(e.reqid) &&  // divergent merge_log indexes new before unindexing old
-	  caller_ops[e.reqid] == &e)
-	caller_ops.erase(e.reqid);
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(e.soid);
+      if (p != objects.end() && p->second->version == e.version)
+        objects.erase(p);
+      if (e.reqid_is_indexed()) {
+	hash_map<osd_reqid_t,pg_log_entry_t*>::iterator q = caller_ops.find(e.reqid);
+	if (q != caller_ops.end() &&  // divergent merge_log indexes new before unindexing old
+	    q->second == &e)
+	  caller_ops.erase(q);
+      }
+      hash_map<eversion_t,list<pg_log_entry_t>::iterator>::iterator v =
+	versions.find(e.version);
+      if (v != versions.end() && &*v->second == &e)
+	versions.erase(v);
+    }
+    /**
+     * unindex an entry popped off the head of the log
+     *
+     * Unlike unindex(), the object keeps its index entry if the log still
+     * has an older entry for it (the one at e.prior_version).
+     */
+    void unindex_head(pg_log_entry_t& e) {
+      bool was_indexed = objects.count(e.soid) &&
+	objects[e.soid]->version == e.version;
+      unindex(e);
+      if (!was_indexed)
+	return;
+      hash_map<eversion_t,list<pg_log_entry_t>::iterator>::iterator prior =
+	versions.find(e.prior_version);
+      if (prior != versions.end() && prior->second->soid == e.soid)
+	objects[e.soid] = &*prior->second;
     }
 
 
     // accessors
     pg_log_entry_t *is_updated(const hobject_t& oid) {
-      if (objects.count(oid) && objects[oid]->is_update()) return objects[oid];
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(oid);
+      if (p != objects.end() && p->second->is_update())
+	return p->second;
       return 0;
     }
     pg_log_entry_t *is_deleted(const hobject_t& oid) {
-      if (objects.count(oid) && objects[oid]->is_delete()) return objects[oid];
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(oid);
+      if (p != objects.end() && p->second->is_delete())
+	return p->second;
       return 0;
     }
+
+    /**
+     * data of oid modified since version have
+     *
+     * Follows the log entries for oid back to have.  Returns false if
+     * that is not possible (the log was trimmed, or an entry did not
+     * record its extents), in which case the whole object must be copied.
+     */
+    bool get_modified_extents(const hobject_t& oid, eversion_t have,
+			      interval_set<uint64_t> *extents) {
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(oid);
+      if (p == objects.end() || have == eversion_t())
+	return false;
+      pg_log_entry_t *e = p->second;
+      while (true) {
+	if (!e->is_modify() || !e->extents_valid)
+	  return false;
+	extents->union_of(e->modified_extents);
+	if (e->prior_version == have)
+	  return true;
+	if (e->prior_version < have)
+	  return false;
+	hash_map<eversion_t,list<pg_log_entry_t>::iterator>::iterator q =
+	  versions.find(e->prior_version);
+	if (q == versions.end() || q->second->soid != oid)
+	  return false;
+	e = &*q->second;
+      }
+    }
     
     // actors
     void add(pg_log_entry_t& e) {
@@ -262,6 +336,7 @@ public:
       // to our index
       objects[e.soid] = &(log.back());
       caller_ops[e.reqid] = &(log.back());
+      versions[e.version] = --log.end();
     }
 
     void trim(ObjectStore::Transaction &t, eversion_t s);
@@ -272,6 +347,11 @@ public:
 
   /**
    * OndiskLog - some info about how we store the log on disk.
+   *
+   * The log is either a byte stream of entries in the log object, with
+   * tail/head/zero_to bounding it, or (omap) one omap key per entry on the
+   * log object, keyed by eversion_t::get_key_name(), in which case the
+   * byte bounds are unused.
    */
   class OndiskLog {
   public:
@@ -280,9 +360,10 @@ public:
     uint64_t head;                     // byte following end of log.
     uint64_t zero_to;                // first non-zeroed byte of log.
     bool has_checksums;
+    bool omap;                       // entries are omap keys
 
     OndiskLog() : tail(0), head(0), zero_to(0),
-		  has_checksums(true) {}
+		  has_checksums(true), omap(false) {}
 
     uint64_t length() { return head - tail; }
     bool trim_to(eversion_t v, ObjectStore::Transaction& t);
@@ -294,10 +375,12 @@ public:
     }
 
     void encode(bufferlist& bl) const {
-      ENCODE_START(4, 3, bl);
+      // older code would misread an omap log as an empty byte log
+      ENCODE_START(5, omap ? 5 : 3, bl);
       ::encode(tail, bl);
       ::encode(head, bl);
       ::encode(zero_to, bl);
+      ::encode(omap, bl);
       ENCODE_FINISH(bl);
     }
     void decode(bufferlist::iterator& bl) {
@@ -309,12 +392,17 @@ public:
 	::decode(zero_to, bl);
       else
 	zero_to = 0;
+      if (struct_v >= 5)
+	::decode(omap, bl);
+      else
+	omap = false;
       DECODE_FINISH(bl);
     }
     void dump(Formatter *f) const {
       f->dump_unsigned("head", head);
       f->dump_unsigned("tail", tail);
       f->dump_unsigned("zero_to", zero_to);
+      f->dump_int("omap", omap);
     }
     static void generate_test_instances(list<OndiskLog*>& o) {
       o.push_back(new OndiskLog);
@@ -322,6 +410,8 @@ public:
       o.back()->tail = 2;
       o.back()->head = 3;
       o.back()->zero_to = 1;
+      o.push_back(new OndiskLog);
+      o.back()->omap = true;
     }
   };
   WRITE_CLASS_ENCODER(OndiskLog)
@@ -396,9 +486,11 @@ public:
   }
 
 
-  list<OpRequestRef> op_queue;  // op queue
 
   bool dirty_info, dirty_log;
+  /// versions of entries added to or removed from an omap log since it
+  /// was last written; write_if_dirty() updates just their keys
+  set<eversion_t> dirty_log_entries;
 
 public:
   // pg state
@@ -613,6 +705,14 @@ protected:
   BackfillInterval peer_backfill_info;
   int backfill_target;
 
+  /// slots held for backfill, on the primary; see OSDService
+  enum {
+    BACKFILL_UNRESERVED,
+    BACKFILL_WAIT_REMOTE,  ///< local slot held, asked the target for one
+    BACKFILL_RESERVED,     ///< both held
+  } backfill_reserve_state;
+  int backfill_reserve_peer;  ///< osd asked for the remote slot, or -1
+
   friend class OSD;
 
 public:
@@ -779,7 +879,8 @@ public:
       block_writes(false), active(false), waiting_on(0),
       errors(0), fixed(0), active_rep_scrub(0),
       finalizing(false), is_chunky(false), state(INACTIVE),
-      deep(false)
+      deep(false), objects_scrubbed(0), bytes_scrubbed(0),
+      prefetched(false)
     {
     }
 
@@ -822,6 +923,18 @@ public:
     // deep scrub
     bool deep;
 
+    // progress of a chunky scrub, on the primary
+    utime_t started;
+    uint64_t objects_scrubbed, bytes_scrubbed;
+
+    // our map of the chunk after [start,end), built while the replicas
+    // build theirs of [start,end).  it stands in for BUILD_MAP if the chunk
+    // has the same bounds and no newer log entries by then.
+    bool prefetched;
+    hobject_t prefetch_start, prefetch_end;
+    eversion_t prefetch_last_update;
+    ScrubMap prefetch_map;
+
     static const char *state_string(const PG::Scrubber::State& state) {
       const char *ret = NULL;
       switch( state )
@@ -860,6 +973,18 @@ public:
       errors = 0;
       fixed = 0;
       deep = false;
+      started = utime_t();
+      objects_scrubbed = 0;
+      bytes_scrubbed = 0;
+      clear_prefetch();
+    }
+
+    void clear_prefetch() {
+      prefetched = false;
+      prefetch_start = hobject_t();
+      prefetch_end = hobject_t();
+      prefetch_last_update = eversion_t();
+      prefetch_map = ScrubMap();
     }
 
   } scrubber;
@@ -887,6 +1012,10 @@ public:
   void _request_scrub_map_classic(int replica, eversion_t version);
   void _request_scrub_map(int replica, eversion_t version,
                           hobject_t start, hobject_t end, bool deep);
+  hobject_t _scrub_chunk_end(const hobject_t &start);
+  eversion_t _scrub_chunk_last_update(const hobject_t &start,
+				      const hobject_t &end);
+  void _scrub_prefetch();
   int build_scrub_map_chunk(ScrubMap &map,
                             hobject_t start, hobject_t end, bool deep);
   void build_scrub_map(ScrubMap &map);
@@ -906,6 +1035,13 @@ public:
   void sub_op_scrub_map(OpRequestRef op);
   void sub_op_scrub_reserve(OpRequestRef op);
   void sub_op_scrub_reserve_reply(OpRequestRef op);
+
+  bool reserve_backfill();
+  void release_backfill_reservation(bool notify_peer);
+  void _send_backfill_reserve_op(int op, int peer);
+  void sub_op_backfill_reserve(OpRequestRef op);
+  void sub_op_backfill_reserve_reply(OpRequestRef op);
+  void sub_op_backfill_unreserve(OpRequestRef op);
   void sub_op_scrub_unreserve(OpRequestRef op);
   void sub_op_scrub_stop(OpRequestRef op);
 
@@ -1537,10 +1673,12 @@ public:
 
   void write_info(ObjectStore::Transaction& t);
   void write_log(ObjectStore::Transaction& t);
+  void write_log_entries(ObjectStore::Transaction& t);
 
   void write_if_dirty(ObjectStore::Transaction& t);
 
   void add_log_entry(pg_log_entry_t& e, bufferlist& log_bl);
+  void add_log_entry_bl(const pg_log_entry_t& e, bufferlist& log_bl);
   void append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStore::Transaction &t);
 
   void read_log(ObjectStore *store);
@@ -1580,6 +1718,12 @@ public:
 		    pair<int, pg_info_t> &notify_info);
   void fulfill_log(int from, const pg_query_t &query, epoch_t query_epoch);
   bool acting_up_affected(const vector<int>& newup, const vector<int>& newacting);
+  static bool osd_changed(const OSDMap &lastmap, const OSDMap &osdmap, int o);
+  bool affected_by_map(const OSDMapRef osdmap,
+		       const vector<int>& newup, const vector<int>& newacting) const;
+  /// advance to osdmap without a state machine event; see affected_by_map()
+  void skip_map(OSDMapRef osdmap);
+  void on_active_advmap();
 
   // OpRequest queueing
   bool can_discard_op(OpRequestRef op);
@@ -1103,6 +1103,15 @@ void ReplicatedPG::do_sub_op(OpRequestRef op)
       else
 	sub_op_scrub_unreserve(op);
       return;
+    case CEPH_OSD_OP_BACKFILL_RESERVE:
+      if (!is_active())
+	waiting_for_active.push_back(op);
+      else
+	sub_op_backfill_reserve(op);
+      return;
+    case CEPH_OSD_OP_BACKFILL_UNRESERVE:
+      sub_op_backfill_unreserve(op);
+      return;
     case CEPH_OSD_OP_SCRUB_STOP:
       if (!is_active())
 	waiting_for_active.push_back(op);
@@ -1139,6 +1148,10 @@ void ReplicatedPG::do_sub_op_reply(OpRequestRef op)
     case CEPH_OSD_OP_SCRUB_RESERVE:
       sub_op_scrub_reserve_reply(op);
       return;
+
+    case CEPH_OSD_OP_BACKFILL_RESERVE:
+      sub_op_backfill_reserve_reply(op);
+      return;
     }
   }
 
@@ -1163,7 +1176,8 @@ void ReplicatedPG::do_scan(OpRequestRef op)
 					 get_osdmap()->get_epoch(), m->query_epoch,
 					 info.pgid, bi.begin, bi.end);
       ::encode(bi.objects, reply->get_data());
-      osd->cluster_messenger->send_message(reply, m->get_connection());
+      reply->set_priority(g_conf->osd_recovery_op_priority);
+      osd->send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
     }
     break;
 
@@ -1217,10 +1231,13 @@ void ReplicatedPG::do_backfill(OpRequestRef op)
       assert(is_replica());
       assert(g_conf->osd_kill_backfill_at != 1);
 
+      osd->release_remote_backfill(info.pgid, m->get_source().num());
+
       MOSDPGBackfill *reply = new MOSDPGBackfill(MOSDPGBackfill::OP_BACKFILL_FINISH_ACK,
 						 get_osdmap()->get_epoch(), m->query_epoch,
 						 info.pgid);
-      osd->cluster_messenger->send_message(reply, m->get_connection());
+      reply->set_priority(g_conf->osd_recovery_op_priority);
+      osd->send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
     }
     // fall-thru
 
@@ -1243,6 +1260,7 @@ void ReplicatedPG::do_backfill(OpRequestRef op)
     {
       assert(is_primary());
       assert(g_conf->osd_kill_backfill_at != 3);
+      release_backfill_reservation(false);  // the target released its slot
       finish_recovery_op(hobject_t::get_max());
     }
     break;
@@ -2057,6 +2075,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    dout(10) << " truncate_seq " << op.extent.truncate_seq << " > current " << seq
 		     << ", truncating to " << op.extent.truncate_size << dendl;
 	    t.truncate(coll, soid, op.extent.truncate_size);
+	    ctx->modified_unknown = true;
 	    oi.truncate_seq = op.extent.truncate_seq;
 	    oi.truncate_size = op.extent.truncate_size;
 	    if (op.extent.truncate_size != oi.size) {
@@ -2098,6 +2117,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	if (oi.size > 0)
 	  ch.insert(0, oi.size);
 	ctx->modified_ranges.union_of(ch);
+	ctx->modified_unknown = true;
 	if (op.extent.length + op.extent.offset != oi.size) {
 	  ctx->delta_stats.num_bytes -= oi.size;
 	  oi.size = op.extent.length + op.extent.offset;
@@ -2110,6 +2130,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 
     case CEPH_OSD_OP_ROLLBACK :
       result = _rollback_to(ctx, op);
+      ctx->modified_unknown = true;
       break;
 
     case CEPH_OSD_OP_ZERO:
@@ -2856,6 +2877,7 @@ inline int ReplicatedPG::_delete_head(OpContext *ctx)
     return -ENOENT;
   
   t.remove(coll, soid);
+  ctx->modified_unknown = true;
 
   if (oi.size > 0) {
     interval_set<uint64_t> ch;
@@ -3308,6 +3330,8 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     return result;
   }
 
+  // make_writeable trims modified_ranges to the clone overlap
+  interval_set<uint64_t> modified_extents = ctx->modified_ranges;
 
   // clone, if necessary
   make_writeable(ctx);
@@ -3396,6 +3420,12 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     logopcode = pg_log_entry_t::DELETE;
   ctx->log.push_back(pg_log_entry_t(logopcode, soid, ctx->at_version, old_version,
 				ctx->reqid, ctx->mtime));
+  if (logopcode == pg_log_entry_t::MODIFY && !ctx->modified_unknown &&
+      modified_extents.num_intervals() <= g_conf->osd_pg_log_max_extents) {
+    // lets recovery push only what changed
+    ctx->log.back().extents_valid = true;
+    ctx->log.back().modified_extents.swap(modified_extents);
+  }
 
   // apply new object state.
   ctx->obc->obs = ctx->new_obs;
@@ -3780,7 +3810,9 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
     }
     
     wr->pg_trim_to = pg_trim_to;
-    osd->cluster_messenger->send_message(wr, get_osdmap()->get_cluster_inst(peer));
+    // more writes are likely to follow while the op queue is busy
+    osd->send_subop(wr, get_osdmap()->get_cluster_inst(peer),
+		    !osd->op_queue_empty());
 
     // keep peer_info up to date
     if (pinfo.last_complete == pinfo.last_update)
@@ -4331,6 +4363,7 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   RepModify *rm = new RepModify;
   rm->pg = this;
   get();
+  osd->rep_replies_pending.add(2);  // applied, committed
   rm->op = op;
   rm->ctx = 0;
   rm->ackerosd = ackerosd;
@@ -4418,6 +4451,9 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 {
   lock();
   rm->op->mark_event("sub_op_applied");
+  // batch the reply if other replica writes will reply shortly
+  bool more = osd->rep_replies_pending.dec() > 0;
+  bool sent = false;
 
   if (rm->epoch_started >= last_peering_reset) {
     dout(10) << "sub_op_modify_applied on " << rm << " op " << *rm->op->request << dendl;
@@ -4428,7 +4464,8 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
       // send ack to acker only if we haven't sent a commit already
       MOSDSubOpReply *ack = new MOSDSubOpReply(m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
       ack->set_priority(CEPH_MSG_PRIO_HIGH); // this better match commit priority!
-      osd->cluster_messenger->send_message(ack, get_osdmap()->get_cluster_inst(rm->ackerosd));
+      osd->send_subop(ack, get_osdmap()->get_cluster_inst(rm->ackerosd), more);
+      sent = true;
     }
     
     rm->applied = true;
@@ -4447,6 +4484,8 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 	     << " from epoch " << rm->epoch_started << " < last_peering_reset "
 	     << last_peering_reset << dendl;
   }
+  if (!sent && !more)
+    osd->flush_subop_batches();
 
   bool done = rm->applied && rm->committed;
   unlock();
@@ -4461,6 +4500,8 @@ void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
 {
   lock();
   rm->op->mark_event("sub_op_commit");
+  bool more = osd->rep_replies_pending.dec() > 0;
+  bool sent = false;
 
 
   if (rm->epoch_started >= last_peering_reset) {
@@ -4474,7 +4515,9 @@ void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
       MOSDSubOpReply *commit = new MOSDSubOpReply((MOSDSubOp*)rm->op->request, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ONDISK);
       commit->set_last_complete_ondisk(rm->last_complete);
       commit->set_priority(CEPH_MSG_PRIO_HIGH); // this better match ack priority!
-      osd->cluster_messenger->send_message(commit, get_osdmap()->get_cluster_inst(rm->ackerosd));
+      osd->send_subop(commit, get_osdmap()->get_cluster_inst(rm->ackerosd),
+		      more);
+      sent = true;
     }
     
     rm->committed = true;
@@ -4483,6 +4526,8 @@ void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
 	     << " from epoch " << rm->epoch_started << " < last_peering_reset "
 	     << last_peering_reset << dendl;
   }
+  if (!sent && !more)
+    osd->flush_subop_batches();
   
   log_subop_stats(rm->op, l_osd_sop_w_inb, l_osd_sop_w_lat);
   bool done = rm->applied && rm->committed;
@@ -4764,7 +4809,7 @@ void ReplicatedPG::send_remove_op(const hobject_t& oid, eversion_t v, int peer)
   subop->ops = vector<OSDOp>(1);
   subop->ops[0].op.op = CEPH_OSD_OP_DELETE;
 
-  osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  osd->send_message_osd_cluster(subop, get_osdmap()->get_cluster_inst(peer));
 }
 
 /*
@@ -4826,11 +4871,78 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
 		      peer_info[peer].last_backfill,
 		      data_subset, clone_subsets);
     put_snapset_context(ssc);
+
+    // or only what changed since the replica's copy?
+    eversion_t base;
+    interval_set<uint64_t> delta;
+    if (calc_delta_subset(obc, soid, peer, &base, &delta) &&
+	delta.size() < data_subset.size()) {
+      dout(10) << "push_to_replica osd." << peer << " has " << soid << " v" << base
+	       << ", pushing delta " << delta << dendl;
+      clone_subsets.clear();
+      osd->logger->inc(l_osd_push_delta);
+      push_start(obc, soid, peer, oi.version, delta, clone_subsets, base);
+      return;
+    }
   }
 
   push_start(obc, soid, peer, oi.version, data_subset, clone_subsets);
 }
 
+/**
+ * If peer has an older copy of soid and the log still describes what
+ * changed since, the extents to write over that copy.
+ */
+bool ReplicatedPG::calc_delta_subset(ObjectContext *obc, const hobject_t& soid,
+				     int peer, eversion_t *base,
+				     interval_set<uint64_t> *delta)
+{
+  if (!g_conf->osd_recovery_delta)
+    return false;
+
+  map<hobject_t, pg_missing_t::item>::iterator p =
+    peer_missing[peer].missing.find(soid);
+  if (p == peer_missing[peer].missing.end() ||
+      p->second.have == eversion_t())
+    return false;
+
+  Connection *con = osd->cluster_messenger->get_connection(
+    get_osdmap()->get_cluster_inst(peer));
+  bool supported = con->features & CEPH_FEATURE_OSD_DELTA_RECOVERY;
+  con->put();
+  if (!supported)
+    return false;
+
+  interval_set<uint64_t> modified;
+  if (!log.get_modified_extents(soid, p->second.have, &modified)) {
+    dout(15) << "calc_delta_subset " << soid << " changes since " << p->second.have
+	     << " not in log" << dendl;
+    return false;
+  }
+  delta->clear();
+  if (obc->obs.oi.size) {
+    delta->insert(0, obc->obs.oi.size);
+    delta->intersection_of(modified);
+  }
+  *base = p->second.have;
+  return true;
+}
+
+/**
+ * Whether a push can be applied here: a delta push only if our copy
+ * of the object is still the one the primary computed the delta
+ * against.
+ */
+bool ReplicatedPG::can_push_delta(const ObjectRecoveryInfo &recovery_info)
+{
+  if (recovery_info.delta_base == eversion_t())
+    return true;
+  map<hobject_t, pg_missing_t::item>::iterator p =
+    missing.missing.find(recovery_info.soid);
+  return p != missing.missing.end() &&
+    p->second.have == recovery_info.delta_base;
+}
+
 void ReplicatedPG::push_start(ObjectContext *obc,
 			      const hobject_t& soid, int peer)
 {
@@ -4847,7 +4959,8 @@ void ReplicatedPG::push_start(
   const hobject_t& soid, int peer,
   eversion_t version,
   interval_set<uint64_t> &data_subset,
-  map<hobject_t, interval_set<uint64_t> >& clone_subsets)
+  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+  eversion_t delta_base)
 {
   peer_missing[peer].revise_have(soid, eversion_t());
   // take note.
@@ -4855,6 +4968,7 @@ void ReplicatedPG::push_start(
   pi.recovery_info.size = obc->obs.oi.size;
   pi.recovery_info.copy_subset = data_subset;
   pi.recovery_info.clone_subset = clone_subsets;
+  pi.recovery_info.delta_base = delta_base;
   pi.recovery_info.soid = soid;
   pi.recovery_info.oi = obc->obs.oi;
   pi.recovery_info.version = version;
@@ -4891,8 +5005,9 @@ int ReplicatedPG::send_pull(int peer,
   subop->ops[0].op.op = CEPH_OSD_OP_PULL;
   subop->recovery_info = recovery_info;
   subop->recovery_progress = progress;
+  subop->set_priority(g_conf->osd_recovery_op_priority);
 
-  osd->cluster_messenger->send_message(subop,
+  osd->send_message_osd_cluster(subop,
 				       get_osdmap()->get_cluster_inst(peer));
 
   osd->logger->inc(l_osd_pull);
@@ -4910,10 +5025,21 @@ void ReplicatedPG::submit_push_data(
   ObjectStore::Transaction *t)
 {
   if (first) {
+    if (recovery_info.delta_base != eversion_t()) {
+      // start from our old copy; only the changed extents follow.  the
+      // attrs and omap are sent whole.  handle_push checked (with
+      // can_push_delta) that our copy is the one the delta is against.
+      t->remove(get_temp_coll(t), recovery_info.soid);
+      t->collection_move(get_temp_coll(t), coll, recovery_info.soid);
+      t->truncate(get_temp_coll(t), recovery_info.soid, recovery_info.size);
+      t->rmattrs(get_temp_coll(t), recovery_info.soid);
+      t->omap_clear(get_temp_coll(t), recovery_info.soid);
+    } else {
+      remove_object_with_snap_hardlinks(*t, recovery_info.soid);
+      t->remove(get_temp_coll(t), recovery_info.soid);
+      t->touch(get_temp_coll(t), recovery_info.soid);
+    }
     missing.revise_have(recovery_info.soid, eversion_t());
-    remove_object_with_snap_hardlinks(*t, recovery_info.soid);
-    t->remove(get_temp_coll(t), recovery_info.soid);
-    t->touch(get_temp_coll(t), recovery_info.soid);
     t->omap_setheader(get_temp_coll(t), recovery_info.soid, omap_header);
   }
   uint64_t off = 0;
@@ -5155,17 +5281,31 @@ void ReplicatedPG::handle_push(OpRequestRef op)
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   Context *onreadable = new C_OSD_AppliedRecoveredObjectReplica(this, t);
   Context *onreadable_sync = 0;
-  submit_push_data(m->recovery_info,
-		   first,
-		   m->data_included,
-		   data,
-		   m->omap_header,
-		   m->attrset,
-		   m->omap_entries,
-		   t);
-  if (complete)
-    submit_push_complete(m->recovery_info,
-			 t);
+  int result = 0;
+  if (first && !can_push_delta(m->recovery_info)) {
+    // our copy moved on since the primary planned the delta; have it
+    // push the whole object instead.  the (empty) transaction still
+    // goes through the store so the push is accounted for as usual.
+    dout(10) << "handle_push " << m->recovery_info.soid
+	     << " delta against " << m->recovery_info.delta_base
+	     << " but we have " << (missing.is_missing(m->recovery_info.soid) ?
+				    missing.missing[m->recovery_info.soid].have :
+				    eversion_t())
+	     << ", rejecting" << dendl;
+    result = -ESTALE;
+  } else {
+    submit_push_data(m->recovery_info,
+		     first,
+		     m->data_included,
+		     data,
+		     m->omap_header,
+		     m->attrset,
+		     m->omap_entries,
+		     t);
+    if (complete)
+      submit_push_complete(m->recovery_info,
+			   t);
+  }
 
   int r = osd->store->
     queue_transaction(osr.get(), t,
@@ -5178,9 +5318,10 @@ void ReplicatedPG::handle_push(OpRequestRef op)
   assert(r == 0);
 
   MOSDSubOpReply *reply = new MOSDSubOpReply(
-    m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+    m, result, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+  reply->set_priority(g_conf->osd_recovery_op_priority);
   assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  osd->send_message_osd_cluster(m->get_source().num(), reply, m->get_connection());
 }
 
 int ReplicatedPG::send_push(int peer,
@@ -5195,6 +5336,7 @@ int ReplicatedPG::send_push(int peer,
   MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, recovery_info.soid,
 				   false, 0, get_osdmap()->get_epoch(),
 				   tid, recovery_info.version);
+  subop->set_priority(g_conf->osd_recovery_op_priority);
 
   dout(7) << "send_push_op " << recovery_info.soid
 	  << " v " << recovery_info.version
@@ -5229,6 +5371,7 @@ int ReplicatedPG::send_push(int peer,
   }
 
   uint64_t available = g_conf->osd_recovery_max_chunk;
+  uint64_t omap_bytes = 0;
   if (!progress.omap_complete) {
     ObjectMap::ObjectMapIterator iter =
       osd->store->get_omap_iterator(coll,
@@ -5240,6 +5383,7 @@ int ReplicatedPG::send_push(int peer,
 	break;
       subop->omap_entries.insert(make_pair(iter->key(), iter->value()));
       available -= (iter->key().size() + iter->value().length());
+      omap_bytes += iter->key().size() + iter->value().length();
     }
     if (!iter->valid())
       new_progress.omap_complete = true;
@@ -5256,7 +5400,9 @@ int ReplicatedPG::send_push(int peer,
        ++p) {
     bufferlist bit;
     osd->store->read(coll, recovery_info.soid,
-		     p.get_start(), p.get_len(), bit);
+		     p.get_start(), p.get_len(), bit,
+		     g_conf->osd_recovery_read_nocache ?
+		       ObjectStore::READ_NOCACHE : 0);
     if (p.get_len() != bit.length()) {
       dout(10) << " extent " << p.get_start() << "~" << p.get_len()
 	       << " is actually " << p.get_start() << "~" << bit.length()
@@ -5275,13 +5421,13 @@ int ReplicatedPG::send_push(int peer,
 
   osd->logger->inc(l_osd_push);
   osd->logger->inc(l_osd_push_outb, subop->ops[0].indata.length());
+  osd->recovery_push_account(subop->ops[0].indata.length() + omap_bytes);
   
   // send
   subop->recovery_info = recovery_info;
   subop->recovery_progress = new_progress;
   subop->current_progress = progress;
-  osd->cluster_messenger->
-    send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  osd->send_message_osd_cluster(subop, get_osdmap()->get_cluster_inst(peer));
   if (out_progress)
     *out_progress = new_progress;
   return 0;
@@ -5298,7 +5444,8 @@ void ReplicatedPG::send_push_op_blank(const hobject_t& soid, int peer)
   subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
   subop->first = false;
   subop->complete = false;
-  osd->cluster_messenger->send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  subop->set_priority(g_conf->osd_recovery_op_priority);
+  osd->send_message_osd_cluster(subop, get_osdmap()->get_cluster_inst(peer));
 }
 
 void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
@@ -5322,7 +5469,22 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
   } else {
     PushInfo *pi = &pushing[soid][peer];
 
-    if (!pi->recovery_progress.data_complete) {
+    if (reply->get_result() == -ESTALE &&
+	pi->recovery_info.delta_base != eversion_t()) {
+      dout(10) << " osd." << peer << " rejected delta against "
+	       << pi->recovery_info.delta_base << ", pushing all of "
+	       << soid << dendl;
+      pi->recovery_info.delta_base = eversion_t();
+      pi->recovery_info.copy_subset.clear();
+      if (pi->recovery_info.size)
+	pi->recovery_info.copy_subset.insert(0, pi->recovery_info.size);
+      pi->recovery_info.clone_subset.clear();
+      pi->recovery_progress = ObjectRecoveryProgress();
+      ObjectRecoveryProgress new_progress;
+      send_push(
+	peer, pi->recovery_info, pi->recovery_progress, &new_progress);
+      pi->recovery_progress = new_progress;
+    } else if (!pi->recovery_progress.data_complete) {
       dout(10) << " pushing more from, "
 	       << pi->recovery_progress.data_recovered_to
 	       << " of " << pi->recovery_info.copy_subset << dendl;
@@ -5433,8 +5595,7 @@ void ReplicatedPG::_committed_pushed_object(OpRequestRef op, epoch_t same_since,
     if (last_complete_ondisk == info.last_update) {
       if (is_replica()) {
 	// we are fully up to date.  tell the primary!
-	osd->cluster_messenger->
-	  send_message(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
+	osd->send_message_osd_cluster(new MOSDPGTrim(get_osdmap()->get_epoch(), info.pgid,
 				      last_complete_ondisk),
 		       get_osdmap()->get_cluster_inst(get_primary()));
 
@@ -5866,6 +6027,8 @@ void ReplicatedPG::apply_and_flush_repops(bool requeue)
 void ReplicatedPG::on_removal()
 {
   dout(10) << "on_removal" << dendl;
+  release_backfill_reservation(true);
+  osd->release_remote_backfill(info.pgid);
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
 }
@@ -5901,6 +6064,10 @@ void ReplicatedPG::on_change()
   clear_scrub_reserved();
   scrub_clear_state();
 
+  // the backfill target may have changed; start over
+  release_backfill_reservation(true);
+  osd->release_remote_backfill(info.pgid);
+
   context_registry_on_change();
 
   // requeue object waiters
@@ -6067,6 +6234,9 @@ int ReplicatedPG::start_recovery_ops(int max, RecoveryCtx *prctx)
     if (get_osdmap()->test_flag(CEPH_OSDMAP_NOBACKFILL)) {
       dout(10) << "deferring backfill due to NOBACKFILL" << dendl;
       deferred_backfill = true;
+    } else if (!reserve_backfill()) {
+      dout(10) << "deferring backfill until reserved" << dendl;
+      deferred_backfill = true;
     } else {
       started += recover_backfill(max - started);
     }
@@ -6427,7 +6597,8 @@ int ReplicatedPG::recover_backfill(int max)
       epoch_t e = get_osdmap()->get_epoch();
       MOSDPGScan *m = new MOSDPGScan(MOSDPGScan::OP_SCAN_GET_DIGEST, e, e, info.pgid,
 				     pbi.end, hobject_t());
-      osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(backfill_target));
+      m->set_priority(g_conf->osd_recovery_op_priority);
+      osd->send_message_osd_cluster(m, get_osdmap()->get_cluster_inst(backfill_target));
       waiting_on_backfill = true;
       start_recovery_op(pbi.end);
       ops++;
@@ -6539,7 +6710,8 @@ int ReplicatedPG::recover_backfill(int max)
     }
     m->last_backfill = bound;
     m->stats = pinfo.stats.stats;
-    osd->cluster_messenger->send_message(m, get_osdmap()->get_cluster_inst(backfill_target));
+    m->set_priority(g_conf->osd_recovery_op_priority);
+    osd->send_message_osd_cluster(m, get_osdmap()->get_cluster_inst(backfill_target));
   }
 
   dout(10) << " peer num_objects now " << pinfo.stats.stats.sum.num_objects
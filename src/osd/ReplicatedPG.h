@@ -332,7 +332,7 @@ public:
   /*
    * Capture all object state associated with an in-progress read or write.
    */
-  struct OpContext {
+  struct OpContext : public PooledObject<OpContext> {
     OpRequestRef op;
     osd_reqid_t reqid;
     vector<OSDOp>& ops;
@@ -365,6 +365,7 @@ public:
     vector<pg_log_entry_t> log;
 
     interval_set<uint64_t> modified_ranges;
+    bool modified_unknown;       // data changed in ways modified_ranges misses
     ObjectContext *obc;          // For ref counting purposes
     map<hobject_t,ObjectContext*> src_obc;
     ObjectContext *clone_obc;    // if we created a clone
@@ -387,7 +388,7 @@ public:
       new_obs(_obs->oi, _obs->exists),
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
-      bytes_written(0), bytes_read(0),
+      bytes_written(0), bytes_read(0), modified_unknown(false),
       obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
       if (_ssc) {
 	new_snapset = _ssc->snapset;
@@ -404,7 +405,7 @@ public:
   /*
    * State on the PG primary associated with the replicated mutation
    */
-  class RepGather {
+  class RepGather : public PooledObject<RepGather> {
   public:
     xlist<RepGather*>::item queue_item;
     int nref;
@@ -758,7 +759,11 @@ protected:
 		  const hobject_t& soid, int peer,
 		  eversion_t version,
 		  interval_set<uint64_t> &data_subset,
-		  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+		  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+		  eversion_t delta_base = eversion_t());
+  bool calc_delta_subset(ObjectContext *obc, const hobject_t& soid, int peer,
+			 eversion_t *base, interval_set<uint64_t> *delta);
+  bool can_push_delta(const ObjectRecoveryInfo &recovery_info);
   void send_push_op_blank(const hobject_t& soid, int peer);
 
   void finish_degraded_object(const hobject_t& oid);
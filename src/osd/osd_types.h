@@ -448,6 +448,14 @@ public:
     version++;
   }
 
+  /// a key that sorts in version order, e.g. for omap
+  string get_key_name() const {
+    char key[40];
+    snprintf(key, sizeof(key), "%010u.%020llu", epoch,
+	     (long long unsigned)version);
+    return string(key);
+  }
+
   void encode(bufferlist &bl) const {
     ::encode(version, bl);
     ::encode(epoch, bl);
@@ -485,6 +493,15 @@ inline ostream& operator<<(ostream& out, const eversion_t e) {
   return out << e.epoch << "'" << e.version;
 }
 
+namespace __gnu_cxx {
+  template<> struct hash<eversion_t> {
+    size_t operator()(const eversion_t &e) const {
+      static hash<uint64_t> H;
+      return H(e.version ^ ((uint64_t)e.epoch << 32));
+    }
+  };
+}
+
 
 
 /** osd_stat
@@ -1246,17 +1263,22 @@ struct pg_log_entry_t {
   bool invalid_hash; // only when decoding sobject_t based entries
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
+  /// data this update wrote, zeroed or truncated away, if extents_valid
+  bool extents_valid;
+  interval_set<uint64_t> modified_extents;
+
   uint64_t offset;   // [soft state] my offset on disk
       
   pg_log_entry_t()
-    : op(0), invalid_hash(false), invalid_pool(false), offset(0) {}
+    : op(0), invalid_hash(false), invalid_pool(false), extents_valid(false),
+      offset(0) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
       reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
-      offset(0) {}
+      extents_valid(false), offset(0) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -1741,6 +1763,8 @@ struct ObjectRecoveryInfo {
   SnapSet ss;
   interval_set<uint64_t> copy_subset;
   map<hobject_t, interval_set<uint64_t> > clone_subset;
+  /// if set, the target has this version and copy_subset is what changed since
+  eversion_t delta_base;
 
   ObjectRecoveryInfo() : size(0) { }
 
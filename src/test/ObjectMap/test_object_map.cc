@@ -710,6 +710,115 @@ TEST_F(ObjectMapTest, OddEvenClone) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, Batch) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  string result;
+
+  // several mutations to the same new object in one batch
+  db->start_batch();
+  tester.set_key(hoid, "foo", "bar");
+  tester.set_key(hoid, "foo2", "bar2");
+  tester.set_header(hoid, "header");
+  tester.set_xattr(hoid, "attr", "val");
+  tester.set_key(hoid2, "foo", "baz");
+  tester.remove_key(hoid, "foo2");
+  ASSERT_EQ(0, db->end_batch());
+
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ("bar", result);
+  ASSERT_EQ(0, tester.get_key(hoid, "foo2", &result));
+  ASSERT_EQ(0, tester.get_header(hoid, &result));
+  ASSERT_EQ("header", result);
+  ASSERT_EQ(1, tester.get_xattr(hoid, "attr", &result));
+  ASSERT_EQ("val", result);
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+  ASSERT_EQ("baz", result);
+
+  // reads and unbatched ops within a batch see earlier batched writes
+  db->start_batch();
+  tester.set_key(hoid, "foo3", "bar3");
+  ASSERT_EQ(1, tester.get_key(hoid, "foo3", &result));
+  ASSERT_EQ("bar3", result);
+  tester.set_key(hoid, "foo4", "bar4");
+  tester.clone(hoid, hoid2);
+  tester.remove_key(hoid2, "foo3");
+  tester.set_key(hoid2, "foo5", "bar5");
+  ASSERT_EQ(0, db->end_batch());
+
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo4", &result));
+  ASSERT_EQ("bar4", result);
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo5", &result));
+  ASSERT_EQ(0, tester.get_key(hoid2, "foo3", &result));
+  ASSERT_EQ(1, tester.get_key(hoid, "foo3", &result));
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
+TEST_F(ObjectMapTest, HeaderCache) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  string result;
+
+  // cached "no header" must not survive creation
+  ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+  tester.set_key(hoid, "foo", "bar");
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ("bar", result);
+
+  // clone gives both objects new headers; writes to one must not
+  // land in the shared parent
+  tester.clone(hoid, hoid2);
+  tester.set_key(hoid, "foo", "baz");
+  tester.set_key(hoid2, "foo2", "bar2");
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+  ASSERT_EQ("bar", result);
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ("baz", result);
+  ASSERT_EQ(0, tester.get_key(hoid, "foo2", &result));
+
+  // clear drops the cached header
+  tester.clear(hoid2);
+  ASSERT_EQ(0, tester.get_key(hoid2, "foo", &result));
+  tester.set_key(hoid2, "foo3", "bar3");
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo3", &result));
+  ASSERT_EQ(0, tester.get_key(hoid2, "foo", &result));
+
+  // clone onto an existing target
+  tester.clone(hoid, hoid2);
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+  ASSERT_EQ("baz", result);
+  ASSERT_EQ(0, tester.get_key(hoid2, "foo3", &result));
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
+TEST_F(ObjectMapTest, Compact) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  string result;
+  DBObjectMap *dbom = static_cast<DBObjectMap*>(db.get());
+
+  db->compact();
+  ASSERT_EQ(0u, dbom->removed_seq_max);
+
+  tester.set_key(hoid, "foo", "bar");
+  tester.set_key(hoid2, "foo2", "bar2");
+  tester.clear(hoid);
+  ASSERT_NE(0u, dbom->removed_seq_max);
+  ASSERT_LE(dbom->removed_seq_min, dbom->removed_seq_max);
+
+  db->compact();
+  ASSERT_EQ(0u, dbom->removed_seq_max);
+  ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo2", &result));
+  ASSERT_EQ("bar2", result);
+
+  db->clear(hoid2);
+}
+
 TEST_F(ObjectMapTest, RandomTest) {
   tester.def_init();
   for (unsigned i = 0; i < 5000; ++i) {
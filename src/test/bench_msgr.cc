@@ -0,0 +1,329 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Compare the messengers: for each ms_type, start a server in a child
+ * process and have many clients ping it over loopback, then report the
+ * throughput, the round trip latency and the number of threads the
+ * server needed for its connections.
+ *
+ * The clients always use the simple messenger, so that only the server
+ * differs between runs.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "include/types.h"
+#include "include/page.h"
+#include "include/stringify.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "global/global_init.h"
+#include "messages/MPing.h"
+#include "msg/Messenger.h"
+
+#define dout_subsys ceph_subsys_ms
+
+static int count_threads()
+{
+  ifstream in("/proc/self/status");
+  string line;
+  while (getline(in, line))
+    if (line.compare(0, 8, "Threads:") == 0)
+      return atoi(line.c_str() + 8);
+  return -1;
+}
+
+/// answers each ping with an empty one
+class Server : public Dispatcher {
+public:
+  Messenger *msgr;
+  Server(CephContext *cct) : Dispatcher(cct), msgr(NULL) {}
+
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    msgr->send_message(new MPing, m->get_connection());
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+};
+
+/**
+ * Run a server with the given ms_type. Write its address to out, and
+ * once a byte comes in on in, the number of threads it has; exit when
+ * in is closed.
+ */
+static int run_server(vector<const char*> args, const string &type,
+		      int in, int out)
+{
+  global_init(NULL, args, CEPH_ENTITY_TYPE_OSD, CODE_ENVIRONMENT_UTILITY, 0);
+  // a string option can't be changed once threads are running
+  g_ceph_context->_conf->set_val("ms_type", type.c_str());
+  g_ceph_context->_conf->apply_changes(NULL);
+  common_init_finish(g_ceph_context);
+
+  Server server(g_ceph_context);
+  Messenger *msgr = Messenger::create(g_ceph_context, entity_name_t::OSD(0),
+				      "server", getpid());
+  server.msgr = msgr;
+  msgr->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  entity_addr_t addr;
+  addr.parse("127.0.0.1");
+  int r = msgr->bind(addr);
+  if (r < 0) {
+    cerr << "server couldn't bind: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  msgr->add_dispatcher_head(&server);
+  msgr->start();
+
+  string a = stringify(msgr->get_myaddr());
+  a.resize(127);
+  if (::write(out, a.c_str(), 128) != 128)
+    return 1;
+
+  char c;
+  while (::read(in, &c, 1) == 1) {
+    int n = count_threads();
+    if (::write(out, &n, sizeof(n)) != sizeof(n))
+      return 1;
+  }
+
+  msgr->shutdown();
+  msgr->wait();
+  delete msgr;
+  return 0;
+}
+
+/// keeps depth pings in flight until it has sent ops of them
+class Client : public Dispatcher {
+  Mutex lock;
+  Cond cond;
+  entity_inst_t dest;
+  bufferlist data;
+  int depth, ops;
+  int sent, received;
+  list<utime_t> in_flight;
+
+  void send_one() {
+    MPing *m = new MPing;
+    m->set_data(data);
+    in_flight.push_back(ceph_clock_now(cct));
+    ++sent;
+    msgr->send_message(m, dest);
+  }
+
+public:
+  Messenger *msgr;
+  utime_t total_latency;
+
+  Client(CephContext *cct, const entity_inst_t &d, int size, int segments,
+	 int depth, int ops)
+    : Dispatcher(cct), lock("Client::lock"), dest(d),
+      depth(depth), ops(ops), sent(0), received(0), msgr(NULL) {
+    // the payload as segments separate buffers: one like an object read,
+    // or many tiny ones like an omap reply
+    for (int i = 0; i < segments; ++i) {
+      int len = size / segments + (i < size % segments ? 1 : 0);
+      bufferptr bp = len >= (int)CEPH_PAGE_SIZE ?
+	buffer::create_page_aligned(len) : buffer::create(len);
+      bp.zero();
+      data.push_back(bp);
+    }
+  }
+
+  void start() {
+    Mutex::Locker l(lock);
+    while (sent < depth && sent < ops)
+      send_one();
+  }
+  void wait() {
+    Mutex::Locker l(lock);
+    while (received < ops)
+      cond.Wait(lock);
+  }
+
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    Mutex::Locker l(lock);
+    total_latency += ceph_clock_now(cct) - in_flight.front();
+    in_flight.pop_front();
+    ++received;
+    if (sent < ops)
+      send_one();
+    else if (received == ops)
+      cond.Signal();
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+};
+
+static void usage()
+{
+  cout << "usage: bench_msgr [--clients n] [--ops n] [--size bytes] [--segments n]\n"
+       << "                  [--depth n]\n"
+       << "  for each ms_type, n clients each send ops pings of size bytes, in\n"
+       << "  segments buffers, depth at a time, to a server with that ms_type\n"
+       << std::endl;
+  generic_client_usage();
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  // start the servers before anything else has threads to lose in fork()
+  const char *types[] = { "simple", "event" };
+  const int num_types = sizeof(types) / sizeof(types[0]);
+  int to_server[num_types], from_server[num_types];
+  pid_t pids[num_types];
+  for (int i = 0; i < num_types; ++i) {
+    int tp[2], fp[2];
+    if (::pipe(tp) < 0 || ::pipe(fp) < 0) {
+      cerr << "pipe: " << cpp_strerror(errno) << std::endl;
+      return 1;
+    }
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      ::close(tp[1]);
+      ::close(fp[0]);
+      for (int j = 0; j < i; ++j) {
+	::close(to_server[j]);
+	::close(from_server[j]);
+      }
+      exit(run_server(args, types[i], tp[0], fp[1]));
+    }
+    ::close(tp[0]);
+    ::close(fp[1]);
+    to_server[i] = tp[1];
+    from_server[i] = fp[0];
+  }
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  g_ceph_context->_conf->set_val("ms_type", "simple");
+  g_ceph_context->_conf->apply_changes(NULL);
+  common_init_finish(g_ceph_context);
+
+  int num_clients = 100, ops = 1000, size = 4096, segments = 1, depth = 4;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    std::ostringstream err;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      return 0;
+    } else if (ceph_argparse_withint(args, i, &num_clients, &err, "--clients", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &ops, &err, "--ops", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &size, &err, "--size", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &segments, &err, "--segments", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &depth, &err, "--depth", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	return 1;
+      }
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  if (segments < 1 || segments > size) {
+    cerr << "--segments must be between 1 and --size" << std::endl;
+    return 1;
+  }
+
+  cout << num_clients << " clients, " << ops << " ops of " << size
+       << " bytes each in " << segments << " segments, " << depth
+       << " in flight per client" << std::endl;
+  cout << "type\tops/s\tMB/s\tlat(ms)\tserver threads" << std::endl;
+
+  for (int i = 0; i < num_types; ++i) {
+    char buf[128];
+    if (::read(from_server[i], buf, sizeof(buf)) != sizeof(buf)) {
+      cerr << types[i] << " server didn't start" << std::endl;
+      continue;
+    }
+    entity_inst_t server;
+    server.name = entity_name_t::OSD(0);
+    server.addr.parse(buf);
+
+    vector<Client*> clients;
+    for (int c = 0; c < num_clients; ++c) {
+      Client *client = new Client(g_ceph_context, server, size, segments,
+				  depth, ops);
+      client->msgr = Messenger::create(g_ceph_context, entity_name_t::CLIENT(-1),
+				       "client", ((uint64_t)getpid() << 16) + c);
+      client->msgr->set_default_policy(Messenger::Policy::lossy_client(0, 0));
+      client->msgr->add_dispatcher_head(client);
+      client->msgr->start();
+      clients.push_back(client);
+    }
+
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (vector<Client*>::iterator p = clients.begin(); p != clients.end(); ++p)
+      (*p)->start();
+    utime_t latency;
+    for (vector<Client*>::iterator p = clients.begin(); p != clients.end(); ++p) {
+      (*p)->wait();
+      latency += (*p)->total_latency;
+    }
+    double elapsed = ceph_clock_now(g_ceph_context) - start;
+
+    // ask while the connections are still up
+    int threads = -1;
+    char c = 0;
+    if (::write(to_server[i], &c, 1) != 1 ||
+	::read(from_server[i], &threads, sizeof(threads)) != sizeof(threads))
+      threads = -1;
+
+    double total = (double)num_clients * ops;
+    cout << types[i] << "\t"
+	 << (int)(total / elapsed) << "\t"
+	 << (int)(total * size / elapsed / (1 << 20)) << "\t"
+	 << (double)latency / total * 1000.0 << "\t"
+	 << threads << std::endl;
+
+    for (vector<Client*>::iterator p = clients.begin(); p != clients.end(); ++p) {
+      (*p)->msgr->shutdown();
+      (*p)->msgr->wait();
+      delete (*p)->msgr;
+      delete *p;
+    }
+    ::close(to_server[i]);
+    ::close(from_server[i]);
+    int status;
+    waitpid(pids[i], &status, 0);
+  }
+  return 0;
+}
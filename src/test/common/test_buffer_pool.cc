@@ -0,0 +1,77 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/BufferPool.h"
+#include "test/unit.h"
+
+TEST(BufferPool, Recycle) {
+  BufferPool *pool = new BufferPool(g_ceph_context, "recycle", 1 << 20, 1 << 20);
+  const char *data;
+  {
+    bufferptr bp = pool->create(3 * CEPH_PAGE_SIZE);
+    ASSERT_EQ(3 * CEPH_PAGE_SIZE, bp.length());
+    ASSERT_EQ(0u, (unsigned long)bp.c_str() & ~CEPH_PAGE_MASK);
+    ASSERT_EQ(4 * CEPH_PAGE_SIZE, pool->get_in_use_bytes());
+    data = bp.c_str();
+  }
+  ASSERT_EQ(0u, pool->get_in_use_bytes());
+  ASSERT_EQ(4 * CEPH_PAGE_SIZE, pool->get_cached_bytes());
+
+  // same size class
+  bufferptr bp = pool->create(4 * CEPH_PAGE_SIZE - 1);
+  ASSERT_EQ(data, bp.c_str());
+  ASSERT_EQ(0u, pool->get_cached_bytes());
+  bp = bufferptr();
+
+  pool->shutdown();
+  pool->put();
+}
+
+TEST(BufferPool, Limit) {
+  BufferPool *pool = new BufferPool(g_ceph_context, "limit", 1 << 20,
+				    2 * CEPH_PAGE_SIZE);
+  {
+    bufferptr a = pool->create(CEPH_PAGE_SIZE);
+    bufferptr b = pool->create(CEPH_PAGE_SIZE);
+    bufferptr c = pool->create(CEPH_PAGE_SIZE);
+    ASSERT_EQ(3 * CEPH_PAGE_SIZE, pool->get_in_use_bytes());
+  }
+  // the third one is freed
+  ASSERT_EQ(2 * CEPH_PAGE_SIZE, pool->get_cached_bytes());
+  pool->shutdown();
+  ASSERT_EQ(0u, pool->get_cached_bytes());
+  pool->put();
+}
+
+TEST(BufferPool, Bypass) {
+  BufferPool *pool = new BufferPool(g_ceph_context, "bypass", 4 * CEPH_PAGE_SIZE,
+				    1 << 20);
+  bufferptr small = pool->create(100);
+  bufferptr big = pool->create(4 * CEPH_PAGE_SIZE + 1);
+  ASSERT_EQ(0u, (unsigned long)big.c_str() & ~CEPH_PAGE_MASK);
+  ASSERT_EQ(0u, pool->get_in_use_bytes());
+  pool->shutdown();
+  pool->put();
+}
+
+TEST(BufferPool, OutlivesOwner) {
+  BufferPool *pool = new BufferPool(g_ceph_context, "outlive", 1 << 20, 1 << 20);
+  bufferlist bl;
+  bl.append(pool->create(CEPH_PAGE_SIZE));
+  bl.zero();
+  pool->shutdown();
+  pool->put();
+  // the buffer holds the last ref, and frees its memory and the pool
+  bl.clear();
+}
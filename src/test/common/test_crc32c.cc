@@ -0,0 +1,84 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "include/crc32c.h"
+#include "include/utime.h"
+#include "common/Clock.h"
+#include "test/unit.h"
+
+TEST(Crc32c, Small) {
+  const char *a = "foo bar baz";
+  const char *b = "whiz bang boom";
+  ASSERT_EQ(4119623852u, ceph_crc32c_le(0, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(881700046u, ceph_crc32c_le(1234, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(2360230088u, ceph_crc32c_le(0, (unsigned char *)b, strlen(b)));
+  ASSERT_EQ(3743019208u, ceph_crc32c_le(5678, (unsigned char *)b, strlen(b)));
+}
+
+TEST(Crc32c, CheckValue) {
+  // the standard crc32c check value, with pre- and post-inversion
+  const char *s = "123456789";
+  ASSERT_EQ(0xe3069283u, ~ceph_crc32c_le(~0u, (unsigned char *)s, strlen(s)));
+}
+
+TEST(Crc32c, IntelFast) {
+  if (!ceph_crc32c_intel_fast_exists()) {
+    std::cout << "no sse4.2, skipping" << std::endl;
+    return;
+  }
+  ASSERT_EQ((void *)ceph_crc32c_intel_fast, (void *)ceph_choose_crc32());
+
+  // compare against the table implementation for every length and
+  // alignment we care about
+  unsigned char buf[4096 + 8];
+  for (unsigned i = 0; i < sizeof(buf); ++i)
+    buf[i] = rand();
+  for (unsigned off = 0; off < 8; ++off) {
+    for (unsigned len = 0; len < 300; ++len) {
+      ASSERT_EQ(ceph_crc32c_sctp(len, buf + off, len),
+		ceph_crc32c_intel_fast(len, buf + off, len));
+    }
+    ASSERT_EQ(ceph_crc32c_sctp(-1, buf + off, 4096),
+	      ceph_crc32c_intel_fast(-1, buf + off, 4096));
+  }
+}
+
+TEST(Crc32c, Performance) {
+  int len = 1000 * 1024 * 1024;
+  char *a = (char *)malloc(len);
+  memset(a, 1, len);
+  std::cout << "calculating crc" << std::endl;
+
+  {
+    utime_t start = ceph_clock_now(NULL);
+    unsigned val = ceph_crc32c_le(0, (unsigned char *)a, len);
+    utime_t end = ceph_clock_now(NULL);
+    float rate = (float)len / (float)(1024*1024) / (float)(end - start);
+    std::cout << "best choice = " << rate << " MB/sec" << std::endl;
+    ASSERT_EQ(2151341719u, val);
+  }
+  {
+    utime_t start = ceph_clock_now(NULL);
+    unsigned val = ceph_crc32c_sctp(0, (unsigned char *)a, len);
+    utime_t end = ceph_clock_now(NULL);
+    float rate = (float)len / (float)(1024*1024) / (float)(end - start);
+    std::cout << "sctp = " << rate << " MB/sec" << std::endl;
+    ASSERT_EQ(2151341719u, val);
+  }
+  free(a);
+}
@@ -0,0 +1,91 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <pthread.h>
+#include <set>
+#include <vector>
+
+#include "common/ObjectPool.h"
+#include "gtest/gtest.h"
+
+struct Pooled : public PooledObject<Pooled> {
+  char data[40];
+};
+
+struct Derived : public Pooled {
+  char more[40];
+};
+
+TEST(ObjectPool, Recycle) {
+  ObjectPool pool(64);
+  void *a = pool.alloc(64);
+  pool.free(a, 64);
+  ASSERT_EQ(a, pool.alloc(64));
+  pool.free(a, 64);
+
+  // other sizes bypass the pool
+  void *b = pool.alloc(128);
+  pool.free(b, 128);
+  ASSERT_EQ(a, pool.alloc(64));
+  pool.free(a, 64);
+}
+
+TEST(ObjectPool, Overflow) {
+  ObjectPool pool(64);
+  std::vector<void*> v;
+  for (int i = 0; i < 1000; ++i)
+    v.push_back(pool.alloc(64));
+  for (int i = 0; i < 1000; ++i)
+    pool.free(v[i], 64);
+  std::set<void*> seen;
+  for (int i = 0; i < 1000; ++i) {
+    v[i] = pool.alloc(64);
+    ASSERT_TRUE(seen.insert(v[i]).second);
+  }
+  for (int i = 0; i < 1000; ++i)
+    pool.free(v[i], 64);
+}
+
+static void *free_all(void *arg)
+{
+  std::vector<Pooled*> *v = (std::vector<Pooled*> *)arg;
+  for (unsigned i = 0; i < v->size(); ++i)
+    delete (*v)[i];
+  return NULL;
+}
+
+TEST(ObjectPool, CrossThread) {
+  // objects freed by another thread come back through the depot
+  std::vector<Pooled*> v;
+  for (int i = 0; i < 100; ++i)
+    v.push_back(new Pooled);
+  std::set<Pooled*> ours(v.begin(), v.end());
+
+  pthread_t t;
+  ASSERT_EQ(0, pthread_create(&t, NULL, free_all, &v));
+  ASSERT_EQ(0, pthread_join(t, NULL));
+
+  Pooled *p = new Pooled;
+  ASSERT_TRUE(ours.count(p));
+  delete p;
+}
+
+TEST(ObjectPool, Derived) {
+  Pooled *p = new Derived;
+  delete static_cast<Derived*>(p);
+  Pooled *q = new Pooled;
+  delete q;
+  ASSERT_EQ(q, new Pooled);
+  delete q;
+}
@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <list>
+#include <map>
+#include "common/PrioritizedQueue.h"
+#include "gtest/gtest.h"
+
+typedef PrioritizedQueue<int, int> queue_t;
+
+struct IsOdd {
+  bool operator()(int i) const {
+    return i % 2;
+  }
+};
+
+TEST(PrioritizedQueue, StrictFirst) {
+  queue_t q(1000);
+  q.enqueue(0, 100, 10, 1);
+  q.enqueue_strict(0, 10, 2);
+  q.enqueue_strict(0, 20, 3);
+  q.enqueue(0, 200, 10, 4);
+  ASSERT_EQ(4u, q.length());
+  ASSERT_EQ(3, q.dequeue());
+  ASSERT_EQ(2, q.dequeue());
+  ASSERT_EQ(4, q.dequeue());
+  ASSERT_EQ(1, q.dequeue());
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(PrioritizedQueue, FifoPerClass) {
+  queue_t q(1000);
+  for (int i = 0; i < 10; ++i)
+    q.enqueue(0, 100, 10, i);
+  q.enqueue_front(0, 100, 10, -1);
+  for (int i = -1; i < 10; ++i)
+    ASSERT_EQ(i, q.dequeue());
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(PrioritizedQueue, RoundRobinClasses) {
+  queue_t q(1000);
+  // a noisy class queues everything before the quiet one shows up
+  for (int i = 0; i < 100; ++i)
+    q.enqueue(1, 100, 10, 1000 + i);
+  q.enqueue(2, 100, 10, 2000);
+  int pos = 0;
+  while (q.dequeue() != 2000)
+    ++pos;
+  ASSERT_LE(pos, 1);
+  ASSERT_EQ(99u, q.length());
+}
+
+TEST(PrioritizedQueue, WeightedShare) {
+  queue_t q(1 << 20);
+  for (int i = 0; i < 1000; ++i) {
+    q.enqueue(0, 100, 1000, 0);
+    q.enqueue(0, 10, 1000, 1);
+  }
+  // the low priority is not starved, but gets about its share
+  int low = 0;
+  for (int i = 0; i < 110; ++i)
+    low += q.dequeue();
+  ASSERT_GE(low, 5);
+  ASSERT_LE(low, 20);
+}
+
+TEST(PrioritizedQueue, RemoveByFilter) {
+  queue_t q(1000);
+  for (int i = 0; i < 20; ++i) {
+    q.enqueue(i % 3, 100 + (i % 2), 10, i);
+    q.enqueue_strict(i % 3, 200, 100 + i);
+  }
+  std::list<int> removed;
+  q.remove_by_filter(IsOdd(), &removed);
+  ASSERT_EQ(20u, removed.size());
+  ASSERT_EQ(20u, q.length());
+  std::map<int, int> last;
+  while (!q.empty()) {
+    int i = q.dequeue();
+    ASSERT_EQ(0, i % 2);
+    // still in order within a class
+    int cl = (i >= 100 ? 100 + (i % 3) : i % 3);
+    if (last.count(cl)) {
+      ASSERT_LT(last[cl], i);
+    }
+    last[cl] = i;
+  }
+}
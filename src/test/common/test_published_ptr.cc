@@ -0,0 +1,91 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <pthread.h>
+#include <vector>
+#include "common/published_ptr.hpp"
+#include "gtest/gtest.h"
+
+typedef PublishedPtr<int> ptr_t;
+typedef ptr_t::TPtr IntRef;
+
+TEST(PublishedPtr, GetPublish) {
+  ptr_t p;
+  ASSERT_FALSE(p.get());
+  IntRef one(new int(1));
+  p.publish(one);
+  ASSERT_EQ(one, p.get());
+  p.publish(IntRef(new int(2)));
+  ASSERT_EQ(2, *p.get());
+  // readers keep what they got
+  ASSERT_EQ(1, *one);
+}
+
+TEST(PublishedPtr, Release) {
+  ptr_t p;
+  IntRef one(new int(1));
+  std::tr1::weak_ptr<int> weak(one);
+  p.publish(one);
+  one.reset();
+  p.publish(IntRef(new int(2)));
+  p.publish(IntRef(new int(3)));
+  // two publications later nothing holds the first value
+  ASSERT_TRUE(weak.expired());
+  p.reset();
+  ASSERT_FALSE(p.get());
+}
+
+struct Reader {
+  ptr_t *p;
+  int last;
+  bool ok;
+  int stop_at;
+};
+
+static void *read_until(void *arg)
+{
+  Reader *r = static_cast<Reader*>(arg);
+  while (r->last < r->stop_at) {
+    IntRef v = r->p->get();
+    // values only ever go forward, and are never torn
+    if (!v || *v < r->last) {
+      r->ok = false;
+      break;
+    }
+    r->last = *v;
+  }
+  return NULL;
+}
+
+TEST(PublishedPtr, ConcurrentReaders) {
+  const int num_readers = 4, num_values = 20000;
+  ptr_t p;
+  p.publish(IntRef(new int(0)));
+  std::vector<Reader> readers(num_readers);
+  std::vector<pthread_t> threads(num_readers);
+  for (int i = 0; i < num_readers; ++i) {
+    readers[i].p = &p;
+    readers[i].last = 0;
+    readers[i].ok = true;
+    readers[i].stop_at = num_values;
+    pthread_create(&threads[i], NULL, read_until, &readers[i]);
+  }
+  for (int v = 1; v <= num_values; ++v)
+    p.publish(IntRef(new int(v)));
+  for (int i = 0; i < num_readers; ++i) {
+    pthread_join(threads[i], NULL);
+    ASSERT_TRUE(readers[i].ok);
+    ASSERT_EQ(num_values, readers[i].last);
+  }
+}
@@ -0,0 +1,136 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include "common/WorkQueue.h"
+#include "global/global_context.h"
+#include "test/unit.h"
+
+struct Item {
+  uint32_t key;
+  int seq;
+  Item(uint32_t k, int s) : key(k), seq(s) {}
+};
+
+class TestWQ : public ShardedWorkQueue<Item> {
+  vector< list<Item*> > queues;
+
+  uint32_t _shard_of(Item *item) {
+    return item->key;
+  }
+  void _enqueue(uint32_t shard, Item *item) {
+    queues[shard].push_back(item);
+  }
+  void _dequeue(uint32_t shard, Item *item) {
+    queues[shard].remove(item);
+  }
+  Item *_dequeue(uint32_t shard) {
+    if (queues[shard].empty())
+      return NULL;
+    Item *item = queues[shard].front();
+    queues[shard].pop_front();
+    return item;
+  }
+  bool _empty(uint32_t shard) {
+    return queues[shard].empty();
+  }
+  void _clear(uint32_t shard) {
+    queues[shard].clear();
+  }
+  void _process(Item *item) {
+    Mutex::Locker l(lock);
+    seen[item->key].push_back(item->seq);
+    shards_of_thread[pthread_self()].insert(item->key % get_num_shards());
+    processed++;
+  }
+
+public:
+  Mutex lock;
+  map<uint32_t, vector<int> > seen;
+  map<pthread_t, set<uint32_t> > shards_of_thread;
+  int processed;
+
+  TestWQ(uint32_t num_shards, uint32_t threads_per_shard)
+    : ShardedWorkQueue<Item>(g_ceph_context, "TestWQ", num_shards,
+			     threads_per_shard, 60, 0),
+      queues(num_shards), lock("TestWQ::lock"), processed(0) {}
+};
+
+TEST(ShardedWorkQueue, InOrderPerShard) {
+  TestWQ wq(4, 1);
+  vector<Item*> items;
+  for (int seq = 0; seq < 100; ++seq)
+    for (uint32_t key = 0; key < 8; ++key)
+      items.push_back(new Item(key, seq));
+  wq.start();
+  for (unsigned i = 0; i < items.size(); ++i)
+    wq.queue(items[i]);
+  wq.drain();
+  ASSERT_EQ((int)items.size(), wq.processed);
+  for (uint32_t key = 0; key < 8; ++key) {
+    ASSERT_EQ(100u, wq.seen[key].size());
+    for (int seq = 0; seq < 100; ++seq)
+      ASSERT_EQ(seq, wq.seen[key][seq]);
+  }
+  wq.stop();
+  for (unsigned i = 0; i < items.size(); ++i)
+    delete items[i];
+}
+
+TEST(ShardedWorkQueue, ThreadAffinity) {
+  TestWQ wq(3, 2);
+  vector<Item*> items;
+  for (int seq = 0; seq < 200; ++seq)
+    for (uint32_t key = 0; key < 6; ++key)
+      items.push_back(new Item(key, seq));
+  wq.start();
+  for (unsigned i = 0; i < items.size(); ++i)
+    wq.queue(items[i]);
+  wq.drain();
+  ASSERT_EQ((int)items.size(), wq.processed);
+  ASSERT_GE(wq.shards_of_thread.size(), 3u);
+  ASSERT_LE(wq.shards_of_thread.size(), 6u);
+  for (map<pthread_t, set<uint32_t> >::iterator p = wq.shards_of_thread.begin();
+       p != wq.shards_of_thread.end();
+       ++p)
+    ASSERT_EQ(1u, p->second.size());
+  wq.stop();
+  for (unsigned i = 0; i < items.size(); ++i)
+    delete items[i];
+}
+
+TEST(ShardedWorkQueue, PauseDequeue) {
+  TestWQ wq(2, 1);
+  Item a(0, 0), b(1, 0), c(1, 1);
+  wq.start();
+  wq.pause();
+  wq.queue(&a);
+  wq.queue(&b);
+  wq.queue(&c);
+  wq.dequeue(&b);
+  usleep(100000);
+  ASSERT_EQ(0, wq.processed);
+  wq.unpause();
+  wq.drain();
+  ASSERT_EQ(2, wq.processed);
+  ASSERT_EQ(1u, wq.seen[0].size());
+  ASSERT_EQ(1u, wq.seen[1].size());
+  ASSERT_EQ(1, wq.seen[1][0]);
+  wq.stop();
+}
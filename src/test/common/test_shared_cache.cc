@@ -0,0 +1,104 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "common/shared_cache.hpp"
+#include "os/FDCache.h"
+#include "test/unit.h"
+
+typedef SharedLRU<int, int> cache_t;
+typedef std::tr1::shared_ptr<int> IntRef;
+
+struct IsOdd {
+  bool operator()(int k) const {
+    return k % 2;
+  }
+};
+
+TEST(SharedLRU, LookupAdd) {
+  cache_t cache(2);
+  ASSERT_FALSE(cache.lookup(1));
+  IntRef one = cache.add(1, new int(1));
+  ASSERT_EQ(1, *cache.lookup(1));
+  ASSERT_EQ(one, cache.lookup(1));
+}
+
+TEST(SharedLRU, AddExisting) {
+  cache_t cache(2);
+  IntRef one = cache.add(1, new int(1));
+  // a second add of a live key keeps the first value
+  IntRef dup = cache.add(1, new int(100));
+  ASSERT_EQ(one, dup);
+  ASSERT_EQ(1, *cache.lookup(1));
+}
+
+TEST(SharedLRU, Clear) {
+  cache_t cache(2);
+  IntRef one = cache.add(1, new int(1));
+  cache.clear(1);
+  ASSERT_FALSE(cache.lookup(1));
+  // outstanding refs are unaffected
+  ASSERT_EQ(1, *one);
+
+  // re-adding the key must not be undone when the old value goes away
+  IntRef other = cache.add(1, new int(11));
+  one.reset();
+  ASSERT_EQ(11, *cache.lookup(1));
+}
+
+TEST(SharedLRU, ClearIf) {
+  cache_t cache(10);
+  for (int i = 0; i < 6; ++i)
+    cache.add(i, new int(i));
+  cache.clear_if(IsOdd());
+  for (int i = 0; i < 6; ++i) {
+    if (i % 2)
+      ASSERT_FALSE(cache.lookup(i));
+    else
+      ASSERT_EQ(i, *cache.lookup(i));
+  }
+}
+
+TEST(SharedLRU, Trim) {
+  cache_t cache(1);
+  cache.add(1, new int(1));
+  cache.add(2, new int(2));
+  // 1 was pushed out of the lru and nobody else holds it
+  ASSERT_FALSE(cache.lookup(1));
+  ASSERT_EQ(2, *cache.lookup(2));
+}
+
+TEST(FDCache, Basic) {
+  FDCache fdcache(16, 4);
+  coll_t a("a"), b("b");
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+
+  ASSERT_FALSE(fdcache.lookup(a, hoid));
+  int fd = ::open("/dev/null", O_RDONLY);
+  ASSERT_GE(fd, 0);
+  FDCache::FDRef ref = fdcache.add(a, hoid, fd);
+  ASSERT_EQ(fd, **fdcache.lookup(a, hoid));
+  ASSERT_FALSE(fdcache.lookup(b, hoid));
+
+  fdcache.clear(a, hoid);
+  ASSERT_FALSE(fdcache.lookup(a, hoid));
+  // still open for the holder of the ref
+  ASSERT_EQ(0, ::fcntl(**ref, F_GETFD));
+
+  fdcache.add(b, hoid, ::open("/dev/null", O_RDONLY));
+  ASSERT_TRUE(fdcache.lookup(b, hoid));
+  fdcache.clear(b);
+  ASSERT_FALSE(fdcache.lookup(b, hoid));
+}
@@ -0,0 +1,52 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/Throttle.h"
+#include "gtest/gtest.h"
+
+TEST(TokenBucket, Unlimited) {
+  TokenBucket b("b");
+  utime_t now(100, 0);
+  b.take(now, 0, 1 << 30);
+  ASSERT_TRUE(b.ready(now));
+}
+
+TEST(TokenBucket, Debt) {
+  TokenBucket b("b");
+  utime_t now(100, 0);
+  b.take(now, 1000, 500);
+  b.take(now, 1000, 1500);
+  ASSERT_FALSE(b.ready(now));
+  ASSERT_EQ(utime_t(2, 0), b.get_wait(now));
+  ASSERT_EQ(utime_t(1, 0), b.get_wait(utime_t(101, 0)));
+  ASSERT_TRUE(b.ready(utime_t(102, 0)));
+}
+
+TEST(TokenBucket, IdleDoesNotAccumulate) {
+  TokenBucket b("b");
+  b.take(utime_t(100, 0), 1000, 1000);
+  // an hour idle buys nothing without a burst
+  utime_t now(3700, 0);
+  b.take(now, 1000, 1000);
+  ASSERT_EQ(utime_t(1, 0), b.get_wait(now));
+}
+
+TEST(TokenBucket, Burst) {
+  TokenBucket b("b", 1.0);
+  utime_t now(100, 0);
+  b.take(now, 1000, 500);
+  ASSERT_TRUE(b.ready(now));
+  b.take(now, 1000, 1000);
+  ASSERT_EQ(utime_t(0, 500000000), b.get_wait(now));
+}
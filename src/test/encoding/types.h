@@ -324,6 +324,8 @@ MESSAGE(MOSDScrub)
 MESSAGE(MOSDSubOp)
 #include "messages/MOSDSubOpReply.h"
 MESSAGE(MOSDSubOpReply)
+#include "messages/MOSDSubOpBatch.h"
+MESSAGE(MOSDSubOpBatch)
 #include "messages/MPGStats.h"
 MESSAGE(MPGStats)
 #include "messages/MPGStatsAck.h"
@@ -0,0 +1,150 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Measures collection_list_partial the way backfill and scrub use it:
+ * a collection is walked start to end in fixed size chunks.  Each pass
+ * starts from a freshly mounted store.  Compare runs with
+ * --filestore_index_list_cache_size 0 to see the cost without the
+ * HashIndex listing cache.
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <boost/scoped_ptr.hpp>
+#include "os/FileStore.h"
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "include/ceph_hash.h"
+
+void usage(const string &name) {
+  std::cerr << "Usage: " << name << " [new|existing] store_path store_journal"
+	    << " [num_objects [chunk_size [passes]]]" << std::endl;
+}
+
+int populate(ObjectStore *store, coll_t cid, int num_objects) {
+  const int per_transaction = 1000;
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  t->create_collection(cid);
+  for (int i = 0; i < num_objects; ++i) {
+    stringstream name;
+    name << "object_" << i;
+    // spread objects over the hash space the way the osd does
+    uint32_t hash = ceph_str_hash_rjenkins(name.str().c_str(),
+					   name.str().length());
+    t->touch(cid, hobject_t(sobject_t(name.str(), CEPH_NOSNAP), "", hash, 0));
+    if ((i + 1) % per_transaction == 0 || i + 1 == num_objects) {
+      int r = store->apply_transaction(*t);
+      delete t;
+      if (r < 0)
+	return r;
+      t = new ObjectStore::Transaction;
+      if ((i + 1) % (100 * per_transaction) == 0)
+	std::cerr << "created " << (i + 1) << " objects" << std::endl;
+    }
+  }
+  delete t;
+  return 0;
+}
+
+int list_pass(ObjectStore *store, coll_t cid, int chunk_size,
+	      int *listed, int *chunks) {
+  hobject_t start, next;
+  *listed = *chunks = 0;
+  while (1) {
+    vector<hobject_t> objects;
+    int r = store->collection_list_partial(cid, start, chunk_size, chunk_size,
+					   0, &objects, &next);
+    if (r < 0)
+      return r;
+    ++*chunks;
+    *listed += objects.size();
+    if (next.is_max())
+      break;
+    start = next;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->set_val("osd_journal_size", "400");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  if (args.size() < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  bool start_new = string(args[0]) == string("new");
+  string store_path(args[1]);
+  string store_journal(args[2]);
+  int num_objects = args.size() > 3 ? atoi(args[3]) : 1000000;
+  int chunk_size = args.size() > 4 ? atoi(args[4]) : 512;
+  int passes = args.size() > 5 ? atoi(args[5]) : 2;
+  coll_t cid("list_bench");
+
+  boost::scoped_ptr<ObjectStore> store(new FileStore(store_path, store_journal));
+  if (start_new) {
+    int r = store->mkfs();
+    if (r < 0) {
+      std::cerr << "mkfs failed: " << cpp_strerror(r) << std::endl;
+      return 1;
+    }
+    r = store->mount();
+    if (r < 0) {
+      std::cerr << "mount failed: " << cpp_strerror(r) << std::endl;
+      return 1;
+    }
+    utime_t begin = ceph_clock_now(g_ceph_context);
+    r = populate(store.get(), cid, num_objects);
+    if (r < 0) {
+      std::cerr << "populate failed: " << cpp_strerror(r) << std::endl;
+      return 1;
+    }
+    std::cout << "created " << num_objects << " objects in "
+	      << (ceph_clock_now(g_ceph_context) - begin) << "s" << std::endl;
+    store->umount();
+  }
+
+  for (int pass = 0; pass < passes; ++pass) {
+    // start every pass from a cold index
+    int r = store->mount();
+    if (r < 0) {
+      std::cerr << "mount failed: " << cpp_strerror(r) << std::endl;
+      return 1;
+    }
+    int listed, chunks;
+    utime_t begin = ceph_clock_now(g_ceph_context);
+    r = list_pass(store.get(), cid, chunk_size, &listed, &chunks);
+    utime_t elapsed = ceph_clock_now(g_ceph_context) - begin;
+    store->umount();
+    if (r < 0) {
+      std::cerr << "listing failed: " << cpp_strerror(r) << std::endl;
+      return 1;
+    }
+    std::cout << "pass " << pass << ": listed " << listed << " objects in "
+	      << chunks << " chunks of " << chunk_size << " in " << elapsed
+	      << "s, " << ((double)elapsed * 1000000 / chunks)
+	      << "us per chunk" << std::endl;
+  }
+  return 0;
+}
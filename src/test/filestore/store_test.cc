@@ -16,6 +16,8 @@
 #include <string.h>
 #include <iostream>
 #include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "os/FileStore.h"
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
@@ -122,6 +124,46 @@ TEST_F(StoreTest, SimpleObjectTest) {
   }
 }
 
+TEST_F(StoreTest, SequentialReadTest) {
+  int r;
+  coll_t cid = coll_t("coll");
+  hobject_t hoid(sobject_t("Object 1", CEPH_NOSNAP));
+  bufferlist data;
+  for (unsigned i = 0; i < (4 << 20); ++i)
+    data.append((char)(i % 251));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    bufferlist all;
+    for (uint64_t off = 0; off < data.length(); off += 65536) {
+      bufferlist bl;
+      r = store->read(cid, hoid, off, 65536, bl);
+      ASSERT_EQ(r, 65536);
+      all.claim_append(bl);
+    }
+    ASSERT_TRUE(all.contents_equal(data));
+  }
+  {
+    bufferlist bl;
+    r = store->read(cid, hoid, 0, data.length(), bl,
+		    ObjectStore::READ_NOCACHE);
+    ASSERT_EQ(r, (int)data.length());
+    ASSERT_TRUE(bl.contents_equal(data));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_F(StoreTest, SimpleObjectLongnameTest) {
   int r;
   coll_t cid = coll_t("coll");
@@ -556,6 +598,209 @@ TEST_F(StoreTest, HashCollisionTest) {
   store->apply_transaction(t);
 }
 
+int list_partial(ObjectStore *store, coll_t cid, set<hobject_t> *listed) {
+  hobject_t start, next;
+  while (1) {
+    vector<hobject_t> objects;
+    int r = store->collection_list_partial(cid, start, 50, 60, 0,
+					   &objects, &next);
+    if (r < 0)
+      return r;
+    listed->insert(objects.begin(), objects.end());
+    if (next.is_max())
+      return 0;
+    start = next;
+  }
+}
+
+TEST_F(StoreTest, ListAfterUpdateTest) {
+  coll_t cid("blah");
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  set<hobject_t> created;
+  for (int i = 0; i < 800; ++i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "update_%d", i);
+    hobject_t hoid(sobject_t(buf, CEPH_NOSNAP));
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    created.insert(hoid);
+    if (i % 200 == 199) {
+      // listings cached along the way must pick up the new objects
+      set<hobject_t> listed;
+      ASSERT_EQ(0, list_partial(store.get(), cid, &listed));
+      ASSERT_EQ(created, listed);
+    }
+  }
+
+  int n = 0;
+  for (set<hobject_t>::iterator i = created.begin(); i != created.end(); ++n) {
+    if (n % 2) {
+      ++i;
+      continue;
+    }
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    created.erase(i++);
+  }
+  {
+    set<hobject_t> listed;
+    ASSERT_EQ(0, list_partial(store.get(), cid, &listed));
+    ASSERT_EQ(created, listed);
+  }
+
+  for (set<hobject_t>::iterator i = created.begin(); i != created.end(); ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  ObjectStore::Transaction t;
+  t.remove_collection(cid);
+  r = store->apply_transaction(t);
+  ASSERT_EQ(r, 0);
+}
+
+TEST_F(StoreTest, PresplitTest) {
+  coll_t cid("blah");
+  int r;
+  g_ceph_context->_conf->set_val("filestore_index_presplit_levels", "2");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("filestore_index_presplit_levels", "0");
+  set<hobject_t> created;
+  for (int i = 0; i < 500; ++i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "presplit_%d", i);
+    hobject_t hoid(sobject_t(buf, CEPH_NOSNAP));
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    created.insert(hoid);
+  }
+  vector<hobject_t> objects;
+  r = store->collection_list(cid, objects);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(created, set<hobject_t>(objects.begin(), objects.end()));
+
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  // the collection keeps the presplit level it was created with, so
+  // emptying its leaf directories did not merge them away
+  string leaf = "store_test_temp_dir/current/" + cid.to_str() + "/DIR_0/DIR_0";
+  struct stat st;
+  ASSERT_EQ(0, ::stat(leaf.c_str(), &st));
+
+  // the presplit directories must not keep the collection around
+  ObjectStore::Transaction t;
+  t.remove_collection(cid);
+  r = store->apply_transaction(t);
+  ASSERT_EQ(r, 0);
+  ASSERT_FALSE(store->collection_exists(cid));
+}
+
+TEST_F(StoreTest, UnlinkDuringSplitTest) {
+  coll_t cid("blah");
+  int r;
+  // split the collection once it holds more than 16 objects, and leave
+  // the split pending after its first step
+  g_ceph_context->_conf->set_val("filestore_merge_threshold", "1");
+  g_ceph_context->_conf->set_val("filestore_split_multiple", "1");
+  g_ceph_context->_conf->set_val("filestore_debug_hold_splits", "true");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  set<hobject_t> created;
+  for (int i = 0; i < 64; ++i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "split_%d", i);
+    hobject_t hoid(sobject_t(buf, CEPH_NOSNAP));
+    map<string, bufferlist> keys;
+    keys["key"].append(buf);
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid);
+    t.omap_setkeys(cid, hoid, keys);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    created.insert(hoid);
+  }
+
+  // wait for the first step to create a subdirectory
+  string dir = "store_test_temp_dir/current/" + cid.to_str();
+  bool stepped = false;
+  for (int i = 0; i < 100 && !stepped; ++i) {
+    DIR *d = ::opendir(dir.c_str());
+    ASSERT_TRUE(d != NULL);
+    struct dirent *de;
+    while ((de = ::readdir(d)) != NULL)
+      if (strncmp(de->d_name, "DIR_", 4) == 0)
+	stepped = true;
+    ::closedir(d);
+    if (!stepped)
+      usleep(100000);
+  }
+  ASSERT_TRUE(stepped);
+
+  // the objects of that subdirectory still have a link in the collection
+  // root; removing them must still remove their omap
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    ObjectStore::Transaction t;
+    t.touch(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    bufferlist header;
+    map<string, bufferlist> keys;
+    r = store->omap_get(cid, *i, &header, &keys);
+    ASSERT_EQ(r, 0);
+    ASSERT_TRUE(keys.empty());
+  }
+
+  g_ceph_context->_conf->set_val("filestore_debug_hold_splits", "false");
+  g_ceph_context->_conf->set_val("filestore_split_multiple", "2");
+  g_ceph_context->_conf->set_val("filestore_merge_threshold", "10");
+  ObjectStore::Transaction t;
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i)
+    t.remove(cid, *i);
+  t.remove_collection(cid);
+  r = store->apply_transaction(t);
+  ASSERT_EQ(r, 0);
+}
+
 TEST_F(StoreTest, OMapTest) {
   coll_t cid("blah");
   hobject_t hoid("tesomap", "", CEPH_NOSNAP, 0, 0);
@@ -732,6 +977,115 @@ TEST_F(StoreTest, XattrTest) {
   ASSERT_TRUE(bl2 == attrs["attr3"]);
 }
 
+int remount(boost::scoped_ptr<ObjectStore> &store) {
+  store->umount();
+  store.reset(new FileStore(string("store_test_temp_dir"), string("store_test_temp_journal")));
+  return store->mount();
+}
+
+void check_attrs(ObjectStore *store, coll_t cid, const hobject_t &hoid,
+		 map<string, bufferlist> &attrs) {
+  map<string, bufferptr> aset;
+  int r = store->getattrs(cid, hoid, aset);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(aset.size(), attrs.size());
+  for (map<string, bufferptr>::iterator i = aset.begin();
+       i != aset.end();
+       ++i) {
+    bufferlist bl;
+    bl.push_back(i->second);
+    ASSERT_TRUE(attrs[i->first] == bl);
+
+    bufferptr bp;
+    r = store->getattr(cid, hoid, i->first.c_str(), bp);
+    ASSERT_GE(r, 0);
+    bufferlist bl2;
+    bl2.push_back(bp);
+    ASSERT_TRUE(attrs[i->first] == bl2);
+  }
+}
+
+TEST_F(StoreTest, PackedXattrTest) {
+  coll_t cid("packed_xattr");
+  hobject_t hoid("packed", "", CEPH_NOSNAP, 0, 0);
+  hobject_t hoid2("packed_clone", "", CEPH_NOSNAP, 0, 0);
+  bufferlist big;
+  for (unsigned i = 0; i < 1000; ++i) {
+    big.append('b');
+  }
+  bufferlist small;
+  for (unsigned i = 0; i < 10; ++i) {
+    small.append('s');
+  }
+  int r;
+  map<string, bufferlist> attrs;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    t.setattr(cid, hoid, "attr1", small);
+    attrs["attr1"] = small;
+    t.setattr(cid, hoid, "attr2", big);
+    attrs["attr2"] = big;
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // objects written the old way stay readable once packing is enabled
+  g_ceph_context->_conf->set_val("filestore_xattr_pack", "true");
+  r = remount(store);
+  ASSERT_EQ(r, 0);
+  check_attrs(store.get(), cid, hoid, attrs);
+
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "attr3", small);
+    attrs["attr3"] = small;
+    t.setattr(cid, hoid, "attr4", big);
+    attrs["attr4"] = big;
+    t.rmattr(cid, hoid, "attr2");
+    attrs.erase("attr2");
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  check_attrs(store.get(), cid, hoid, attrs);
+  bufferptr bp;
+  r = store->getattr(cid, hoid, "attr2", bp);
+  ASSERT_EQ(r, -ENODATA);
+
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, hoid, hoid2);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  check_attrs(store.get(), cid, hoid2, attrs);
+
+  // packed objects must be unpacked before packing is disabled
+  g_ceph_context->_conf->set_val("filestore_xattr_pack", "false");
+  r = remount(store);
+  ASSERT_EQ(r, -EINVAL);
+  g_ceph_context->_conf->set_val("filestore_xattr_pack_convert", "true");
+  store.reset(new FileStore(string("store_test_temp_dir"), string("store_test_temp_journal")));
+  r = store->mount();
+  ASSERT_EQ(r, 0);
+  check_attrs(store.get(), cid, hoid, attrs);
+  check_attrs(store.get(), cid, hoid2, attrs);
+
+  // and packed again, all at once
+  g_ceph_context->_conf->set_val("filestore_xattr_pack", "true");
+  r = remount(store);
+  ASSERT_EQ(r, 0);
+  check_attrs(store.get(), cid, hoid, attrs);
+  check_attrs(store.get(), cid, hoid2, attrs);
+
+  g_ceph_context->_conf->set_val("filestore_xattr_pack", "false");
+  r = remount(store);
+  g_ceph_context->_conf->set_val("filestore_xattr_pack_convert", "false");
+  ASSERT_EQ(r, 0);
+  check_attrs(store.get(), cid, hoid, attrs);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
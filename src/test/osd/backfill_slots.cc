@@ -0,0 +1,63 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "osd/BackfillSlots.h"
+#include "gtest/gtest.h"
+
+TEST(BackfillSlots, Max) {
+  BackfillSlots s;
+  ASSERT_TRUE(s.reserve(pg_t(1, 0, -1), 1, 2));
+  ASSERT_TRUE(s.reserve(pg_t(2, 0, -1), 1, 2));
+  ASSERT_FALSE(s.reserve(pg_t(3, 0, -1), 1, 2));
+  // a pg holding a slot keeps it even at the limit
+  ASSERT_TRUE(s.reserve(pg_t(2, 0, -1), 1, 2));
+  ASSERT_EQ(2u, s.size());
+
+  ASSERT_TRUE(s.release(pg_t(1, 0, -1)));
+  ASSERT_FALSE(s.release(pg_t(1, 0, -1)));
+  ASSERT_TRUE(s.reserve(pg_t(3, 0, -1), 1, 2));
+  ASSERT_EQ(2u, s.size());
+}
+
+TEST(BackfillSlots, ReleaseByOtherPeer) {
+  BackfillSlots s;
+  pg_t pgid(1, 0, -1);
+  ASSERT_TRUE(s.reserve(pgid, 1, 1));
+  ASSERT_FALSE(s.release(pgid, 2));
+  ASSERT_EQ(1u, s.size());
+  ASSERT_TRUE(s.release(pgid, 1));
+  ASSERT_EQ(0u, s.size());
+}
+
+TEST(BackfillSlots, PrimaryChange) {
+  BackfillSlots s;
+  pg_t pgid(1, 0, -1);
+  int prev;
+  ASSERT_TRUE(s.reserve(pgid, 1, 1, &prev));
+  ASSERT_EQ(-1, prev);
+
+  // the pg's primary moves to osd.2, which reserves again
+  ASSERT_TRUE(s.reserve(pgid, 2, 1, &prev));
+  ASSERT_EQ(1, prev);
+  ASSERT_EQ(1u, s.size());
+  ASSERT_EQ(2, s.get_slots().find(pgid)->second);
+
+  // the old primary's late unreserve must not drop osd.2's slot...
+  ASSERT_FALSE(s.release(pgid, 1));
+  ASSERT_EQ(1u, s.size());
+
+  // ...and the new primary's frees it
+  ASSERT_TRUE(s.release(pgid, 2, &prev));
+  ASSERT_EQ(2, prev);
+  ASSERT_EQ(0u, s.size());
+  ASSERT_TRUE(s.reserve(pg_t(2, 0, -1), 3, 1));
+}
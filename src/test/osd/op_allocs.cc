@@ -0,0 +1,89 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sstream>
+
+#include "osd/OpRequest.h"
+#include "messages/MPing.h"
+#include "common/Thread.h"
+#include "test/unit.h"
+
+// does n allocations that the compiler cannot optimize away
+static void alloc(int n)
+{
+  for (int i = 0; i < n; ++i) {
+    int * volatile p = new int(i);
+    delete p;
+  }
+}
+
+class AllocThread : public Thread {
+public:
+  uint64_t allocs;
+  AllocThread() : allocs(0) {}
+  void *entry() {
+    uint64_t start = get_thread_allocs();
+    alloc(100);
+    allocs = get_thread_allocs() - start;
+    return 0;
+  }
+};
+
+TEST(OpAllocs, CountsThisThread) {
+  uint64_t start = get_thread_allocs();
+  alloc(1);
+  ASSERT_EQ(start + 1, get_thread_allocs());
+
+  // other threads' allocations are theirs
+  AllocThread t;
+  t.create();
+  t.join();
+  ASSERT_EQ(100u, t.allocs);
+  ASSERT_EQ(start + 1, get_thread_allocs());
+}
+
+TEST(OpAllocs, ChargedToOp) {
+  OpTracker tracker;
+  {
+    OpRequestRef op = tracker.create_request(new MPing);
+    ASSERT_EQ(0u, op->get_allocs());
+    {
+      OpRequest::AllocCharge charge(op.get());
+      alloc(10);
+    }
+    ASSERT_EQ(10u, op->get_allocs());
+
+    // a second turn adds to the first
+    {
+      OpRequest::AllocCharge charge(op.get());
+      alloc(1);
+    }
+    ASSERT_EQ(11u, op->get_allocs());
+
+    std::stringstream ss;
+    tracker.dump_ops_in_flight(ss);
+    ASSERT_NE(std::string::npos, ss.str().find("\"allocs\": 11"));
+  }
+
+  // the op is done; it counts toward the average
+  std::stringstream ss;
+  tracker.dump_ops_in_flight(ss);
+  ASSERT_NE(std::string::npos, ss.str().find("\"num_ops_done\": 1"));
+  ASSERT_NE(std::string::npos, ss.str().find("\"allocs_per_op_done\": 11"));
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ; make unittest_osd_op_allocs &&
+ *   ./unittest_osd_op_allocs"
+ * End:
+ */
@@ -33,6 +33,7 @@
 #include <inttypes.h>
 #include <map>
 #include <poll.h>
+#include <pthread.h>
 #include <sstream>
 #include <stdint.h>
 #include <string.h>
@@ -165,3 +166,73 @@ TEST(PerfCounters, MultiplePerfCounters) {
   ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
   ASSERT_EQ("{}", msg);
 }
+
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_COUNT,
+  TEST_PERFCOUNTERS3_ELEMENT_LAT,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+static PerfCounters* setup_test_perfcounter3(CephContext *cct)
+{
+  PerfCountersBuilder bld(cct, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_COUNT, "count");
+  bld.add_fl_hist(TEST_PERFCOUNTERS3_ELEMENT_LAT, "lat");
+  return bld.create_perf_counters();
+}
+
+TEST(PerfCounters, Histogram) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCounters* fake_pf = setup_test_perfcounter3(g_ceph_context);
+  coll->add(fake_pf);
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+  ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'count':0,'lat':{'avgcount':0,"
+	    "'sum':0,'p50':0,'p99':0,'p999':0,'buckets':[]}}}"), msg);
+
+  // 0.5us, 3us and 100 x 12us: buckets 0, 2 and 4
+  fake_pf->finc(TEST_PERFCOUNTERS3_ELEMENT_LAT, 0.0000005);
+  fake_pf->finc(TEST_PERFCOUNTERS3_ELEMENT_LAT, 0.000003);
+  for (int i = 0; i < 100; ++i)
+    fake_pf->finc(TEST_PERFCOUNTERS3_ELEMENT_LAT, 0.000012);
+  ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'count':0,'lat':{'avgcount':102,"
+	    "'sum':0.0012035,'p50':1.6e-05,'p99':1.6e-05,'p999':1.6e-05,"
+	    "'buckets':[1,0,1,0,100]}}}"), msg);
+  ASSERT_EQ("", client.do_request("perfcounters_schema", &msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'count':{'type':10},"
+	    "'lat':{'type':21}}}"), msg);
+  coll->clear();
+}
+
+static void *inc_count(void *arg)
+{
+  PerfCounters *pf = (PerfCounters *)arg;
+  for (int i = 0; i < 1000; ++i) {
+    pf->inc(TEST_PERFCOUNTERS3_ELEMENT_COUNT);
+    pf->finc(TEST_PERFCOUNTERS3_ELEMENT_LAT, 1.0);
+  }
+  return NULL;
+}
+
+TEST(PerfCounters, Shards) {
+  PerfCounters* fake_pf = setup_test_perfcounter3(g_ceph_context);
+  pthread_t threads[10];
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, inc_count, fake_pf));
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+  ASSERT_EQ(10000u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNT));
+  ASSERT_EQ(10000.0, fake_pf->fget(TEST_PERFCOUNTERS3_ELEMENT_LAT));
+
+  // a set replaces the counts in every shard
+  fake_pf->set(TEST_PERFCOUNTERS3_ELEMENT_COUNT, 5);
+  ASSERT_EQ(5u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNT));
+  inc_count(fake_pf);
+  ASSERT_EQ(1005u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_COUNT));
+  delete fake_pf;
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include "common/ceph_argparse.h"
 #include "common/common_init.h"
@@ -348,3 +349,67 @@ TEST(TestFileJournal, WriteTrimSmall) {
 
   j.close();
 }
+
+/// record the commit latency of a journal entry, then pass it on
+class C_Latency : public Context {
+  utime_t start;
+  double *out;
+  Context *next;
+public:
+  C_Latency(double *o, Context *n)
+    : start(ceph_clock_now(g_ceph_context)), out(o), next(n) {}
+  void finish(int r) {
+    *out = (double)(ceph_clock_now(g_ceph_context) - start);
+    next->complete(r);
+  }
+};
+
+TEST(TestFileJournal, WriteQueueDepthBench) {
+  if (!aio) {
+    cout << "queue depth benchmark only applies with aio, skipping" << std::endl;
+    return;
+  }
+
+  const unsigned num = 2000;
+  const unsigned entry_size = 4096;
+  int depths[] = { 0, 1, 2, 4, 8, 16, 32 };
+
+  char foo[entry_size];
+  memset(foo, 1, sizeof(foo));
+
+  for (unsigned d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+    char val[10];
+    sprintf(val, "%d", depths[d]);
+    g_ceph_context->_conf->set_val("journal_aio_max_in_flight", val);
+    g_ceph_context->_conf->apply_changes(NULL);
+
+    fsid.generate_random();
+    FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+    ASSERT_EQ(0, j.create());
+    j.make_writeable();
+
+    vector<double> lat(num);
+    C_Sync *s = new C_Sync;
+    C_GatherBuilder gb(g_ceph_context, s->c);
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (unsigned i = 0; i < num; ++i) {
+      bufferlist bl;
+      bl.append(foo, sizeof(foo));
+      j.submit_entry(i + 1, bl, 0, new C_Latency(&lat[i], gb.new_sub()));
+    }
+    gb.activate();
+    delete s;  // waits for all commits
+    double elapsed = (double)(ceph_clock_now(g_ceph_context) - start);
+    j.close();
+
+    sort(lat.begin(), lat.end());
+    cout << "queue depth " << depths[d] << (depths[d] ? "" : " (adaptive)")
+	 << ": " << (double)(num * entry_size) / elapsed / (1024*1024) << " MB/s"
+	 << ", p50 commit " << lat[num / 2] * 1000.0 << " ms"
+	 << ", p99 commit " << lat[num * 99 / 100] * 1000.0 << " ms"
+	 << std::endl;
+  }
+
+  g_ceph_context->_conf->set_val("journal_aio_max_in_flight", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
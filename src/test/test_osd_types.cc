@@ -14,6 +14,7 @@
 
 #include "include/types.h"
 #include "osd/osd_types.h"
+#include "osd/PG.h"
 #include "gtest/gtest.h"
 
 #include <sstream>
@@ -122,3 +123,111 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(pg_log_entry_t, extents)
+{
+  hobject_t oid(object_t("objname"), "key", 123, 456, 0);
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, eversion_t(1,3), eversion_t(1,2),
+		   osd_reqid_t(entity_name_t::CLIENT(777), 8, 999), utime_t(8,9));
+  e.extents_valid = true;
+  e.modified_extents.insert(0, 4096);
+  e.modified_extents.insert(1 << 20, 512);
+
+  bufferlist bl;
+  ::encode(e, bl);
+  pg_log_entry_t d;
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_TRUE(d.extents_valid);
+  ASSERT_EQ(e.modified_extents, d.modified_extents);
+
+  e.extents_valid = false;
+  bl.clear();
+  ::encode(e, bl);
+  p = bl.begin();
+  ::decode(d, p);
+  ASSERT_FALSE(d.extents_valid);
+}
+
+static void add_modify(PG::IndexedLog& log, const hobject_t& oid,
+		       eversion_t v, eversion_t prior,
+		       uint64_t off, uint64_t len)
+{
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, v, prior,
+		   osd_reqid_t(entity_name_t::CLIENT(777), 8, v.version),
+		   utime_t(8,9));
+  if (len) {
+    e.extents_valid = true;
+    e.modified_extents.insert(off, len);
+  }
+  log.add(e);
+}
+
+TEST(pg_log_t, get_modified_extents)
+{
+  hobject_t a(object_t("a"), "", CEPH_NOSNAP, 1, 0);
+  hobject_t b(object_t("b"), "", CEPH_NOSNAP, 2, 0);
+  PG::IndexedLog log;
+  log.tail = eversion_t(1,1);
+  add_modify(log, a, eversion_t(1,2), eversion_t(1,1), 0, 4096);
+  add_modify(log, b, eversion_t(1,3), eversion_t(), 0, 100);
+  add_modify(log, a, eversion_t(1,4), eversion_t(1,2), 8192, 512);
+  add_modify(log, a, eversion_t(1,5), eversion_t(1,4), 1024, 1024);
+
+  // walk a's chain back to have, past b's entry
+  interval_set<uint64_t> s, expected;
+  ASSERT_TRUE(log.get_modified_extents(a, eversion_t(1,1), &s));
+  expected.insert(0, 4096);
+  expected.insert(8192, 512);
+  ASSERT_EQ(expected, s);
+
+  s.clear();
+  expected.clear();
+  ASSERT_TRUE(log.get_modified_extents(a, eversion_t(1,4), &s));
+  expected.insert(1024, 1024);
+  ASSERT_EQ(expected, s);
+
+  // a replica with no copy gets the whole object
+  s.clear();
+  ASSERT_FALSE(log.get_modified_extents(b, eversion_t(), &s));
+  s.clear();
+  ASSERT_FALSE(log.get_modified_extents(hobject_t(object_t("c"), "", CEPH_NOSNAP, 3, 0),
+					eversion_t(1,1), &s));
+}
+
+TEST(pg_log_t, get_modified_extents_trimmed)
+{
+  hobject_t a(object_t("a"), "", CEPH_NOSNAP, 1, 0);
+  PG::IndexedLog log;
+  // (1,2), the entry that wrote a over have, was trimmed
+  log.tail = eversion_t(1,3);
+  add_modify(log, a, eversion_t(1,4), eversion_t(1,2), 0, 4096);
+  add_modify(log, a, eversion_t(1,5), eversion_t(1,4), 8192, 512);
+
+  interval_set<uint64_t> s;
+  ASSERT_FALSE(log.get_modified_extents(a, eversion_t(1,1), &s));
+
+  // from (1,2) on the chain is all in the log
+  s.clear();
+  ASSERT_TRUE(log.get_modified_extents(a, eversion_t(1,2), &s));
+  ASSERT_EQ(4096 + 512, s.size());
+}
+
+TEST(pg_log_t, get_modified_extents_unrecorded)
+{
+  hobject_t a(object_t("a"), "", CEPH_NOSNAP, 1, 0);
+  PG::IndexedLog log;
+  log.tail = eversion_t(1,1);
+  add_modify(log, a, eversion_t(1,2), eversion_t(1,1), 0, 4096);
+  // e.g. a clone or a write from an osd that did not record extents
+  add_modify(log, a, eversion_t(1,3), eversion_t(1,2), 0, 0);
+  add_modify(log, a, eversion_t(1,4), eversion_t(1,3), 8192, 512);
+
+  interval_set<uint64_t> s;
+  ASSERT_FALSE(log.get_modified_extents(a, eversion_t(1,1), &s));
+
+  // a replica already past the unrecorded entry can still take a delta
+  s.clear();
+  ASSERT_TRUE(log.get_modified_extents(a, eversion_t(1,3), &s));
+  ASSERT_EQ(512, s.size());
+}
@@ -24,6 +24,7 @@
 #include "global/global_init.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Clock.h"
 #include <boost/scoped_ptr.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int.hpp>
@@ -33,7 +34,7 @@
 #include <ext/hash_map>
 
 void usage(const string &name) {
-  std::cerr << "Usage: " << name << " [xattr|omap] store_path store_journal"
+  std::cerr << "Usage: " << name << " [xattr|omap|packed] store_path store_journal"
 	    << std::endl;
 }
 
@@ -75,9 +76,8 @@ public:
 };
 
 uint64_t get_time() {
-  time_t start;
-  time(&start);
-  return start * 1000;
+  utime_t now = ceph_clock_now(g_ceph_context);
+  return now.sec() * 1000 + now.usec() / 1000;
 }
 
 double print_time(uint64_t ms) {
@@ -87,6 +87,7 @@ double print_time(uint64_t ms) {
 uint64_t do_run(ObjectStore *store, int attrsize, int numattrs,
 		int run,
 		int transsize, int ops,
+		uint64_t *read_time,
 		ostream &out) {
   Mutex lock("lock");
   Cond cond;
@@ -128,8 +129,9 @@ uint64_t do_run(ObjectStore *store, int attrsize, int numattrs,
 	 obj != iter->second.first.end();
 	 ++obj) {
       for (int j = 0; j < numattrs; ++j) {
+	// rewrite the same attrs, the way the osd updates object metadata
 	stringstream ss;
-	ss << i << ", " << j << ", " << *obj;
+	ss << "attr_" << j;
 	t->setattr(coll_t(iter->first),
 		   hobject_t(sobject_t(*obj, CEPH_NOSNAP)),
 		   ss.str().c_str(),
@@ -145,7 +147,24 @@ uint64_t do_run(ObjectStore *store, int attrsize, int numattrs,
     while (in_flight)
       cond.Wait(lock);
   }
-  return get_time() - start;
+  uint64_t write_time = get_time() - start;
+
+  // read every object's attrs back, as the osd does when it loads an object
+  start = get_time();
+  for (int i = 0; i < ops; ++i) {
+    map<string, pair<set<string>, ObjectStore::Sequencer*> >::iterator iter =
+      rand_choose(collections);
+    for (set<string>::iterator obj = iter->second.first.begin();
+	 obj != iter->second.first.end();
+	 ++obj) {
+      map<string,bufferptr> aset;
+      store->getattrs(coll_t(iter->first),
+		      hobject_t(sobject_t(*obj, CEPH_NOSNAP)),
+		      aset);
+    }
+  }
+  *read_time = get_time() - start;
+  return write_time;
 }
 
 int main(int argc, char **argv) {
@@ -157,6 +176,10 @@ int main(int argc, char **argv) {
   if (args[0] == string("omap")) {
     std::cerr << "using omap xattrs" << std::endl;
     g_ceph_context->_conf->set_val("filestore_xattr_use_omap", "true");
+  } else if (args[0] == string("packed")) {
+    std::cerr << "using packed xattrs" << std::endl;
+    g_ceph_context->_conf->set_val("filestore_xattr_use_omap", "false");
+    g_ceph_context->_conf->set_val("filestore_xattr_pack", "true");
   } else {
     std::cerr << "not using omap xattrs" << std::endl;
     g_ceph_context->_conf->set_val("filestore_xattr_use_omap", "false");
@@ -179,21 +202,23 @@ int main(int argc, char **argv) {
   assert(!store->mount());
   std::cerr << "mounted" << std::endl;
 
-  std::cerr << "attrsize\tnumattrs\ttranssize\tops\ttime" << std::endl;
+  std::cerr << "attrsize\tnumattrs\ttranssize\tops\ttime\treadtime" << std::endl;
   int runs = 0;
   int total_size = 11;
   for (int i = 6; i < total_size; ++i) {
     for (int j = (total_size - i); j >= 0; --j) {
       std::cerr << "starting run " << runs << std::endl;
       ++runs;
+      uint64_t read_time;
       uint64_t time = do_run(store.get(), (1 << i), (1 << j), runs,
 			     10,
-			     1000, std::cout);
+			     1000, &read_time, std::cout);
       std::cout << (1 << i) << "\t"
 		<< (1 << j) << "\t"
 		<< 10 << "\t"
 		<< 1000 << "\t"
-		<< print_time(time) << std::endl;
+		<< print_time(time) << "\t"
+		<< print_time(read_time) << std::endl;
     }
   }
   store->umount();